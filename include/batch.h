@@ -0,0 +1,103 @@
+/**
+ * batch.h
+ *
+ * Declares argument batching, which runs a command several times with as many
+ * arguments at a time as the kernel accepts.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct stage_attrs;
+
+/**
+ * BATCH_HEADROOM - Bytes of ARG_MAX left unused
+ *
+ * Same margin as POSIX requires of xargs, for what exec adds to the new
+ * program's stack besides arguments and environment.
+ */
+#define BATCH_HEADROOM 2048
+
+/**
+ * batch_command - A command to run in batches
+ * @command: Command line, for the job table
+ * @path: Resolved program, NULL to search $PATH
+ * @prefix: Words every batch starts with, prefix[0] is the program
+ * @prefix_count: Number of entries in prefix
+ * @items: Arguments to spread over batches
+ * @items_count: Number of entries in items
+ * @max_items: Most items per batch, 0 for no limit other than ARG_MAX
+ * @in_fd: Descriptor to use as stdin of every batch, -1 for the shell's
+ * @out_fd: Descriptor to use as stdout of every batch, -1 for the shell's
+ * @attrs: Attributes of every batch, NULL for none
+ */
+struct batch_command {
+  const char *command;
+  const char *path;
+  char **prefix;
+  unsigned int prefix_count;
+  char **items;
+  unsigned int items_count;
+  unsigned int max_items;
+  int in_fd;
+  int out_fd;
+  const struct stage_attrs *attrs;
+};
+
+/**
+ * arg_space - Bytes exec can take for the arguments of a new program
+ *
+ * ARG_MAX covers arguments and environment together, strings and pointer
+ * arrays alike, so the shell's current environment is subtracted.
+ *
+ * Return: Bytes available for arguments
+ */
+long arg_space(void);
+
+/**
+ * arg_footprint - Bytes an argument takes up in ARG_MAX
+ * @arg: Argument
+ *
+ * Return: Length including the terminator, plus the argv pointer
+ */
+size_t arg_footprint(const char *arg);
+
+/**
+ * argv_too_long - Check whether exec would fail with E2BIG
+ * @argv: NULL-terminated argument array
+ *
+ * Applies the same accounting as the kernel, so a command that would only
+ * fail after the child has been created is caught before.
+ *
+ * Return: true if argv doesn't fit, false otherwise
+ */
+bool argv_too_long(char **argv);
+
+/**
+ * batch_prefix_count - Pick the words every batch of a command repeats
+ * @argv: NULL-terminated argument array of a command that is too long
+ *
+ * The program and the options right after it are repeated, everything from
+ * the first operand on is spread over batches. A "--" ends the options and is
+ * repeated too.
+ *
+ * Return: Number of words in the prefix
+ */
+unsigned int batch_prefix_count(char **argv);
+
+/**
+ * batch_run - Run a command in batches, one after another
+ * @cmd: Command and items
+ *
+ * Each batch is a foreground job of its own, so Ctrl+C and Ctrl+Z work as for
+ * any command. Ctrl+C or a stopped batch ends the run early.
+ *
+ * Return: 0 if every batch succeeded, 1 if any failed, -1 on error or if the
+ * run ended early
+ */
+int batch_run(const struct batch_command *cmd);
+
+#endif
@@ -0,0 +1,35 @@
+/**
+ * bench.h
+ *
+ * Declares the bench keyword, which runs pipelines repeatedly and summarizes
+ * how long they took.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "context.h"
+
+/* Measured runs per pipeline without -n */
+#define BENCH_RUNS_DEFAULT 10
+
+/* Word separating the pipelines to compare */
+#define BENCH_SEPARATOR "--vs"
+
+/**
+ * bench_run - Benchmark the pipelines of a bench command line
+ * @current_ctx: Shell context, with the bench keyword parsed from input
+ *
+ * Usage: bench [-n RUNS] [-w WARMUPS] [-s] [-j] [-o FILE] PIPELINE
+ * [--vs PIPELINE]...
+ *
+ * Each pipeline is parsed like typed input and run through exec() WARMUPS
+ * times, then RUNS times measured. The context is left holding the last
+ * pipeline, for cleanup_ctx(), and $? holding its last status. A usage error
+ * sets $? to SKIPPED_EXIT_CODE.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int bench_run(struct repl_ctx *current_ctx);
+
+#endif
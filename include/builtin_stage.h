@@ -0,0 +1,129 @@
+/**
+ * builtin_stage.h
+ *
+ * Declares how builtins run as stages of a pipeline: in the shell, on a thread
+ * of the shell or in a forked child.
+ */
+
+#ifndef BUILTIN_STAGE_H
+#define BUILTIN_STAGE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "context.h"
+#include "exec.h"
+#include "jobs.h"
+#include "launch.h"
+
+/**
+ * builtin_stage - A builtin running on a thread of the shell
+ * @builtin: Table entry of the builtin
+ * @ctx: Context in which the stage is the whole command
+ * @out_fd: Descriptor the stage writes to, owned by the thread
+ * @slot: Position of the stage in the job's procs
+ * @exit_code: Exit status, set when the thread finishes
+ * @usage: Resources the thread used, set when it finishes
+ * @started: Whether the thread was started
+ * @thread: Thread running the stage
+ */
+struct builtin_stage {
+  const struct command_associations *builtin;
+  struct repl_ctx ctx;
+  int out_fd;
+  unsigned int slot;
+  int exit_code;
+  struct rusage usage;
+  bool started;
+  pthread_t thread;
+};
+
+/**
+ * stage_ctx - Make a context in which one stage is the whole command
+ * @current_ctx: Shell context with the pipeline
+ * @index: Stage of the pipeline
+ * @stage: Output parameter - context for the stage
+ *
+ * Builtins only look at the first command of the context they are given, and
+ * at its redirections. Those were opened for the whole pipeline already, so
+ * the stage's context has none.
+ */
+void stage_ctx(struct repl_ctx *current_ctx, unsigned int index,
+               struct repl_ctx *stage);
+
+/**
+ * redirect_shell - Point the shell's own stdin and stdout elsewhere
+ * @in_fd: Descriptor to use as stdin, -1 to leave stdin alone
+ * @out_fd: Descriptor to use as stdout, -1 to leave stdout alone
+ * @saved: Output parameter - copies of the original stdin and stdout, for
+ * restore_shell()
+ *
+ * Return: 0 on success, -1 on error (nothing is left redirected)
+ */
+int redirect_shell(int in_fd, int out_fd, int saved[2]);
+
+/**
+ * restore_shell - Undo redirect_shell()
+ * @saved: Copies saved by redirect_shell()
+ */
+void restore_shell(int saved[2]);
+
+/**
+ * run_builtin_here - Run a builtin stage in the shell itself
+ * @builtin: Table entry of the builtin
+ * @current_ctx: Shell context with the pipeline
+ * @index: Stage of the pipeline
+ * @in_fd: Descriptor to use as stdin, -1 for the shell's
+ * @out_fd: Descriptor to use as stdout, -1 for the shell's
+ *
+ * Whatever the builtin changes about the shell sticks, the shell exits after
+ * an exit stage just as after a plain exit.
+ *
+ * Return: Return value of the builtin (1 on success, -1 on error)
+ */
+int run_builtin_here(const struct command_associations *builtin,
+                     struct repl_ctx *current_ctx, unsigned int index,
+                     int in_fd, int out_fd);
+
+/**
+ * start_builtin_thread - Run a pure builtin stage on a thread of the shell
+ * @stage: Stage with builtin, ctx, out_fd and slot filled in
+ *
+ * The thread owns out_fd and closes it as soon as the builtin returns, which
+ * is what the next stage sees EOF on. Signals are blocked on the thread, so
+ * they keep being handled by the shell's main thread.
+ *
+ * Return: 0 on success, -1 on error (out_fd is still the caller's)
+ */
+int start_builtin_thread(struct builtin_stage *stage);
+
+/**
+ * fork_builtin - Run a builtin stage in a child process
+ * @builtin: Table entry of the builtin
+ * @ctx: Context in which the stage is the whole command
+ * @stage: Descriptors, process group, terminal and attributes of the child
+ * (path and argv are unused)
+ * @job: Job the stage belongs to
+ *
+ * The child is a copy of the shell that runs the builtin and exits with its
+ * status. Changes the builtin makes to the shell's state are lost with it, as
+ * in a subshell. It has no jobs, unless the builtin only looks at them.
+ *
+ * Return: PID of the child on success, -1 on error
+ */
+pid_t fork_builtin(const struct command_associations *builtin,
+                   struct repl_ctx *ctx, const struct stage_spawn *stage,
+                   struct job *job);
+
+/**
+ * builtin_exit_code - Exit status of a builtin stage
+ * @result: Return value of the builtin
+ *
+ * Return: NOT_FOUND_EXIT_CODE if the builtin failed to find a program, 1 if it
+ * failed otherwise, 0 if it succeeded
+ */
+int builtin_exit_code(int result);
+
+#endif
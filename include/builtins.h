@@ -9,7 +9,28 @@
 #ifndef BUILTINS_H
 #define BUILTINS_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
 #include "context.h"
+#include "jobs.h"
+#include "relay.h"
+
+/**
+ * builtin_stdout - Stream pure builtins print to on a thread of their own
+ *
+ * A builtin stage running on a thread can't have the shell's stdout
+ * redirected, so it gets a stream on its pipe instead. NULL on every other
+ * thread.
+ */
+extern _Thread_local FILE *builtin_stdout;
+
+/**
+ * builtin_output - Stream a builtin prints to
+ *
+ * Return: builtin_stdout on a builtin stage's thread, stdout otherwise
+ */
+FILE *builtin_output(void);
 
 /**
  * cat - Joke version of cat command
@@ -18,10 +39,63 @@
  * 10% of the time, an ASCII cat will be printed when users try to run the cat
  * command from GNU Coreutils.
  *
- * Return: 0 if normal cat should run instead, 1 otherwise
+ * Return: 0 if the cat stage should run instead, 1 otherwise
  */
 int cat(struct repl_ctx *current_ctx);
 
+/**
+ * cat_in_process - Check whether a cat stage can run inside the shell
+ * @args: Arguments of the stage, args[0] is "cat"
+ * @stdin_is_terminal: Whether the stage would read from the terminal
+ *
+ * Options aren't implemented, so "cat -n" and friends still launch the real
+ * cat. Neither does reading the terminal: the terminal belongs to the job
+ * while it runs, and the shell isn't part of it.
+ *
+ * Return: true if cat_stage() can handle the stage, false otherwise
+ */
+bool cat_in_process(char **args, bool stdin_is_terminal);
+
+/**
+ * cat_relay - Copy one file of a cat stage, which a stop of its job may move
+ * to a child
+ * @fd: File to copy
+ * @in_fd: Descriptor the stage uses as stdin
+ * @out_fd: Descriptor to write to
+ * @failed_side: Output parameter - side that failed on error
+ *
+ * Under job control, the shell can't stop along with the job, so it forks a
+ * child that carries on with the copy and stops in its place (see
+ * job_stage_detachable()). The shell is then done with the stage.
+ *
+ * Return: Same as relay_fd(), 0 in the shell once a child took over
+ */
+ssize_t cat_relay(int fd, int in_fd, int out_fd,
+                  enum relay_side *failed_side);
+
+/**
+ * cat_stage - Concatenate files to a descriptor without launching a process
+ * @args: Arguments of the stage, args[0] is "cat"
+ * @in_fd: Descriptor to use as stdin, -1 for the shell's
+ * @out_fd: Descriptor to write to, -1 for the shell's stdout
+ *
+ * Each file (or stdin for "-" or no arguments) is moved with relay_fd(), which
+ * uses copy_file_range(), splice() or sendfile() depending on what the source
+ * and destination are. A file that can't be opened or read is reported and
+ * skipped, like cat does.
+ *
+ * Return: Exit status, 0 on success, 1 if any file failed
+ */
+int cat_stage(char **args, int in_fd, int out_fd);
+
+/**
+ * bg - Resume stopped jobs in the background
+ * @current_ctx: Shell context with command arguments
+ *
+ * Return: 1 on success, -1 on error
+ */
+int bg(struct repl_ctx *current_ctx);
+
 /**
  * cd - Change directory builtin
  * @current_ctx: Shell context with command arguments
@@ -46,17 +120,85 @@ int cd(struct repl_ctx *current_ctx);
  */
 int cler(struct repl_ctx *current_ctx);
 
+/**
+ * coproc - Start a program connected to the shell by two pipes
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: coproc [-n NAME] COMMAND [ARGS...]. $NAME[0] is the descriptor to
+ * read COMMAND's output from, $NAME[1] the one to write its input to, and
+ * $NAME_PID its PID. NAME is COPROC by default, and only one coprocess can
+ * have a given name at a time.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int coproc(struct repl_ctx *current_ctx);
+
+/**
+ * coproc_close_all - End every coprocess before the shell exits
+ *
+ * The input of every coprocess is closed first. Those still running after
+ * COPROC_EXIT_GRACE_MS are sent SIGTERM. Either way, their jobs are removed,
+ * which closes the rest of the pipes and unsets their variables.
+ */
+void coproc_close_all(void);
+
+/**
+ * disown - Stop tracking jobs without signalling them
+ * @current_ctx: Shell context with command arguments
+ *
+ * Disowned jobs keep running but are no longer listed, can't be resumed with
+ * fg and bg, and are left alone when the shell exits.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int disown(struct repl_ctx *current_ctx);
+
+/**
+ * exec_command - Replace the shell with a command, or redirect the shell
+ * @current_ctx: Shell context with command arguments
+ *
+ * "exec COMMAND [ARGS...]" runs COMMAND in place of the shell, without forking,
+ * with any "<", ">" or ">>" redirection applied. Without a command, the
+ * redirections are applied to the shell itself and stay in effect for every
+ * command that follows.
+ *
+ * Return: 1 on success, -1 on error (only returns with a command on error)
+ */
+int exec_command(struct repl_ctx *current_ctx);
+
 /**
  * exit_builtin - Exit the shell
  * @current_ctx: Shell context
  *
  * Stops the REPL loop by setting receiving to 0. If we simply called exit(), we
- * would be skipping cleanup.
+ * would be skipping cleanup. Coprocesses are ended here, so they don't outlive
+ * the shell waiting for input that will never come.
  *
  * Return: 1 always
  */
 int exit_builtin(struct repl_ctx *current_ctx);
 
+/**
+ * fg - Resume a job in the foreground
+ * @current_ctx: Shell context with command arguments
+ *
+ * Return: 1 on success, -1 on error
+ */
+int fg(struct repl_ctx *current_ctx);
+
+/**
+ * hash - Inspect or reset the command lookup cache
+ * @current_ctx: Shell context with command arguments
+ *
+ * With no arguments, lists every cached command with its hit count. "hash -r"
+ * forgets every cached command, "hash NAME..." looks up and remembers each
+ * NAME.
+ *
+ * Return: 1 on success, -1 if a NAME couldn't be found, which makes $?
+ * NOT_FOUND_EXIT_CODE
+ */
+int hash(struct repl_ctx *current_ctx);
+
 /**
  * help - Display builtins (maybe)
  *
@@ -64,4 +206,214 @@ int exit_builtin(struct repl_ctx *current_ctx);
  */
 int help(struct repl_ctx *current_ctx);
 
+/**
+ * jobs_builtin - List jobs
+ * @current_ctx: Shell context with command arguments
+ *
+ * "jobs -l" also lists the PID of every stage, "jobs -p" lists only the process
+ * group ID of each job, and "jobs top" shows what their processes cost.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int jobs_builtin(struct repl_ctx *current_ctx);
+
+/**
+ * jobs_top - Show the CPU, memory and I/O use of every job's processes
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: jobs top [-d INTERVAL] [-n COUNT]. Refreshes every INTERVAL until
+ * Ctrl+C, COUNT refreshes or no job has a process left.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int jobs_top(struct repl_ctx *current_ctx);
+
+/**
+ * kill_builtin - Send a signal to jobs or processes
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: kill [-s SIGNAL | -SIGNAL] TARGET..., where each TARGET is a job spec
+ * or a PID. Job specs signal the whole job. "kill -l" lists signal names.
+ *
+ * kill has to be a builtin to understand job specs.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int kill_builtin(struct repl_ctx *current_ctx);
+
+/**
+ * memo - Run a command, or replay its output from an earlier run
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: memo [-r] [-i FILE]... [-e NAME]... COMMAND [ARGS...]. -i declares a
+ * file the output depends on, -e a variable. "memo -r" empties the cache.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int memo(struct repl_ctx *current_ctx);
+
+/**
+ * parallel - Run a command once per input across several workers
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: parallel [-j N] [-k] COMMAND... [::: INPUT...]. Inputs are the
+ * arguments after ":::", or the lines of stdin without it. Every "{}" in
+ * COMMAND is replaced with the input, or the input is appended if there is
+ * none.
+ *
+ * N defaults to the number of online CPUs. Output is printed one run at a
+ * time as runs finish, or in input order with -k (--keep-order).
+ *
+ * Return: 1 if every run succeeded, -1 otherwise
+ */
+int parallel(struct repl_ctx *current_ctx);
+
+/**
+ * queue_builtin - List, cancel or reorder deferred pipelines
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: queue [-c ID | -m ID POS]. Without arguments, lists the entries
+ * along with the load and pressure readings they wait on. -c cancels a
+ * waiting entry, -m moves one to position POS among the waiting entries.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int queue_builtin(struct repl_ctx *current_ctx);
+
+/**
+ * queue_add - Add the pipeline being evaluated to the queue
+ * @current_ctx: Shell context with the defer keyword parsed
+ *
+ * Sets $? to 0 once the pipeline is queued, to SKIPPED_EXIT_CODE if defer is
+ * used the wrong way, and to 1 on other errors.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int queue_add(struct repl_ctx *current_ctx);
+
+/**
+ * queue_next - Take the next pipeline to start, if there is headroom
+ * @current_ctx: Shell context (for configuration)
+ * @id: Output parameter - ID of the entry, for queue_started()
+ *
+ * Return: The pipeline as a background command line, to be freed by the
+ * caller, NULL if nothing should start now
+ */
+char *queue_next(struct repl_ctx *current_ctx, unsigned int *id);
+
+/**
+ * queue_started - Record the job a queued pipeline started as
+ * @id: ID returned by queue_next()
+ * @job: Job created for the pipeline, NULL if it didn't start
+ *
+ * A pipeline that didn't start (a typo in the command, say) leaves the queue,
+ * it would fail the same way every time.
+ */
+void queue_started(unsigned int id, struct job *job);
+
+/**
+ * queue_waiting - Check whether any pipeline waits for headroom
+ *
+ * Return: true if a queued pipeline hasn't started yet, false otherwise
+ */
+bool queue_waiting(void);
+
+/**
+ * queue_event_hook - readline event hook, ends an idle prompt when a queued
+ * pipeline can start
+ *
+ * Return: 0 always
+ */
+int queue_event_hook(void);
+
+/**
+ * queue_drain - Ask for the deferred pipelines to be started and waited for
+ * @drain: Whether to, false to stop
+ *
+ * For wait, which can't start them itself in the middle of a command.
+ */
+void queue_drain(bool drain);
+
+/**
+ * queue_draining - Check whether the deferred pipelines are to be drained
+ *
+ * Return: true if queue_drain() asked for it and it isn't over yet
+ */
+bool queue_draining(void);
+
+/**
+ * queue_drain_wait - Wait while the queue is drained
+ *
+ * While pipelines are still queued, waits until a job changes state or
+ * QUEUE_POLL_MS passed, either of which may leave headroom for the next one.
+ * Once none are, waits for every background job and ends the draining.
+ *
+ * Return: 0 on success, -1 if interrupted by Ctrl+C, which ends the draining
+ */
+int queue_drain_wait(void);
+
+/**
+ * queue_drop_all - Forget the deferred pipelines before the shell exits
+ *
+ * Waiting entries are dropped with a warning. Running ones are left to the
+ * job table like any other background job.
+ */
+void queue_drop_all(void);
+
+/**
+ * set_builtin - List or change shell options
+ * @current_ctx: Shell context with command arguments
+ *
+ * "set -o" lists every option, "set -o NAME" enables NAME and "set +o NAME"
+ * disables it.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int set_builtin(struct repl_ctx *current_ctx);
+
+/**
+ * wait_all_jobs - Wait for every background job to finish
+ * @deadline: When to give up (CLOCK_MONOTONIC), NULL to wait indefinitely
+ *
+ * Jobs that finished are removed, so they aren't reported again.
+ *
+ * Return: 0 once every job finished, 1 if the deadline passed, -1 if
+ * interrupted by Ctrl+C
+ */
+int wait_all_jobs(const struct timespec *deadline);
+
+/**
+ * wait_builtin - Wait for background jobs to finish
+ * @current_ctx: Shell context with command arguments
+ *
+ * Without arguments, waits for every background job, then for the pipelines
+ * still deferred with defer: the shell starts them as headroom allows once
+ * wait returns, see drain_queue(), and waits for them too. Otherwise, waits
+ * for each job spec or PID given. Jobs that were waited for are not reported
+ * again before the next prompt. Ctrl+C stops waiting.
+ *
+ * "wait -t DURATION" gives up once DURATION has passed, leaving the jobs that
+ * are still running alone, and says so. It doesn't wait for deferred
+ * pipelines.
+ *
+ * Return: 1 on success, -1 on error, interruption or if the deadline passed
+ */
+int wait_builtin(struct repl_ctx *current_ctx);
+
+/**
+ * xargs - Run a command with arguments read from stdin, in batches
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: xargs [-0] [-n MAX] [COMMAND [ARGS...]]. Items are the words of
+ * stdin, or NUL-separated with -0. COMMAND (echo by default) runs with ARGS
+ * followed by as many items as exec accepts, or at most MAX with -n, as many
+ * times as it takes. Nothing runs without items.
+ *
+ * Batches are sized to ARG_MAX minus the environment, so none fails with
+ * E2BIG, and launched without going through /usr/bin/xargs.
+ *
+ * Return: 1 if every batch succeeded, -1 otherwise
+ */
+int xargs(struct repl_ctx *current_ctx);
+
 #endif
@@ -34,6 +34,30 @@ extern bool debug_mode;
 char *get_user_env(const char *var_name, struct user_env *user_envs,
                    unsigned int user_envs_count);
 
+/**
+ * set_user_env - Set a shell variable
+ * @current_ctx: Shell context
+ * @var_name: Variable name
+ * @value: New value, copied
+ *
+ * Shell variables live alongside the ones from ~/.clownrc, so they are
+ * expanded the same way. This is how $? and $PIPESTATUS are kept up to date.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int set_user_env(struct repl_ctx *current_ctx, const char *var_name,
+                 const char *value);
+
+/**
+ * unset_user_env - Remove a shell variable
+ * @current_ctx: Shell context
+ * @var_name: Variable name
+ *
+ * The last variable takes the place of the removed one, order doesn't matter
+ * to lookups. Removing a variable that isn't set does nothing.
+ */
+void unset_user_env(struct repl_ctx *current_ctx, const char *var_name);
+
 /**
  * load_config - Main config file loading function
  * @current_ctx: Shell context
@@ -7,6 +7,9 @@
 #ifndef CONTEXT_H
 #define CONTEXT_H
 
+struct out_fanout;
+struct stage_attrs;
+
 /**
  * user_env - User-defined environment variable
  *
@@ -35,6 +38,8 @@ struct user_env {
  * @user_envs_count: Number of user variables
  * @user: Username
  * @receiving: Loop control flag (1=running, 0=exit)
+ * @is_last_command: Whether no input follows the current command, so the
+ * shell can exec it in place of itself
  *
  * TEMPORARY (allocated/freed each command):
  * @input: Raw input string from readline
@@ -47,9 +52,30 @@ struct user_env {
  * @in_stream_name: Input file names (< filename)
  * @out_stream_name: Output file names (> or >> filename)
  * @out_stream_type: Output modes (O_WRONLY or O_APPEND)
+ * @out_fanout: Further output files of each stage, NULL for stages with at
+ * most one
+ * @stage_attrs: Scheduling and resource attributes from the sched keyword,
+ * NULL for stages without any
  *
  * PROCESS CONTROL:
  * @is_background_process: Whether command ends with & (background process)
+ * @is_timed: Whether the pipeline is prefixed with the time keyword
+ * @pipe_size: Pipe capacity set with the pipesize keyword, 0 if not set
+ * @timeout_ms: Time limit set with the timeout keyword, 0 if not set
+ * @timeout_signal: Signal sent when the time limit runs out
+ * @kill_after_ms: Grace period before SIGKILL follows, 0 to never send it
+ * @is_profiled: Whether the pipeline is prefixed with the profile keyword
+ * @profile_json: Whether the profile report is JSON rather than a table
+ * @profile_output: File the profile report is appended to, NULL for stderr
+ * @watch_paths: Paths given to the on-change keyword, NULL-terminated, NULL
+ * if the pipeline only runs once
+ * @watch_debounce_ms: Quiet period after a change before on-change reruns
+ * @watch_cancel: Whether a change cancels the run in progress (on-change -c)
+ * @is_benched: Whether the pipeline is prefixed with the bench keyword, so it
+ * is run repeatedly and measured
+ * @is_deferred: Whether the pipeline is prefixed with the defer keyword, so
+ * it is queued rather than run
+ * @syntax_error: Whether parsing found an error that prevents execution
  */
 struct repl_ctx {
   /* Persistent user information */
@@ -59,6 +85,7 @@ struct repl_ctx {
   unsigned int user_envs_count;
   char *user;
   int receiving;
+  int is_last_command;
   /* Current command data*/
   char *input;
   char ***commands;
@@ -67,9 +94,25 @@ struct repl_ctx {
   unsigned int *args_count;
   /* I/O Redirection */
   int is_background_process;
+  int is_timed;
+  long pipe_size;
+  long timeout_ms;
+  int timeout_signal;
+  long kill_after_ms;
+  int is_profiled;
+  int profile_json;
+  char *profile_output;
+  char **watch_paths;
+  long watch_debounce_ms;
+  int watch_cancel;
+  int is_deferred;
+  int is_benched;
+  int syntax_error;
   char **in_stream_name;
   char **out_stream_name;
   int *out_stream_type;
+  struct out_fanout **out_fanout;
+  struct stage_attrs **stage_attrs;
 };
 
 /**
@@ -7,6 +7,9 @@
 #ifndef EXEC_H
 #define EXEC_H
 
+#include <sys/resource.h>
+#include <time.h>
+
 #include "context.h"
 
 /**
@@ -14,33 +17,132 @@
  * 
  * Used to size the builtins array and loop through it during execution.
  */
-#define NUM_OF_BUILTINS 5
+#define NUM_OF_BUILTINS 19
+
+/**
+ * SKIPPED_EXIT_CODE - Exit status ($?) of a command that wasn't run, because
+ * of a syntax error, a keyword used the wrong way or the blacklist
+ *
+ * Same as sh gives syntax errors, so "clownish -c" fails on them.
+ */
+#define SKIPPED_EXIT_CODE 2
+
+/**
+ * builtin_kind - How a builtin runs as a stage of a pipeline
+ * @BUILTIN_PURE: Only prints (to builtin_output()), so it can run on a thread
+ * of the shell anywhere in a pipeline
+ * @BUILTIN_STATEFUL: Reads or changes shell state. Runs in the shell as the
+ * last stage, so changes stick, and in a forked child anywhere else, where
+ * they are lost as in a subshell
+ * @BUILTIN_SEES_JOBS: Stateful builtin that uses the job table without
+ * changing it. A forked child keeps a copy of the table, so "jobs | cat"
+ * lists the shell's jobs
+ * @BUILTIN_OVERRIDE: Stands in for the program of the same name when run on
+ * its own, and is left to that program inside a pipeline
+ * @BUILTIN_ALONE: Can only be run on its own
+ */
+enum builtin_kind {
+  BUILTIN_PURE,
+  BUILTIN_STATEFUL,
+  BUILTIN_SEES_JOBS,
+  BUILTIN_OVERRIDE,
+  BUILTIN_ALONE
+};
 
 /**
  * command_associations - Builtin command lookup table
  *
- * Maps command names to their implementation functions.
+ * Maps command names to their implementation functions, and how they run in a
+ * pipeline.
  */
 struct command_associations {
   char command_name[255];
   int (*command_function)(struct repl_ctx *);
+  enum builtin_kind kind;
 };
 
+/**
+ * find_builtin - Look up a builtin by name
+ * @name: Command name
+ *
+ * Return: Table entry, NULL if name isn't a builtin
+ */
+const struct command_associations *find_builtin(const char *name);
+
+/**
+ * create_pipe - Create the pipe between a stage and the next one
+ * @pipe_fds: Output parameter - read and write ends
+ * @pipe_size: Capacity in bytes, PIPE_SIZE_DEFAULT or PIPE_SIZE_ADAPTIVE to
+ * leave it alone
+ *
+ * Both ends are close-on-exec, only the copies dup2'd onto a stage's stdin or
+ * stdout survive into the program.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int create_pipe(int pipe_fds[2], long pipe_size);
+
+/**
+ * close_fd - Close a descriptor the shell no longer needs
+ * @fd: Descriptor to close, -1 to do nothing
+ */
+void close_fd(int fd);
+
+/**
+ * exec_in_place - Replace the shell with a program
+ * @path: Resolved program
+ * @argv: NULL-terminated argument array
+ * @in_fd: Descriptor to use as stdin, -1 for the shell's
+ * @out_fd: Descriptor to use as stdout, -1 for the shell's
+ *
+ * Nothing is forked, the program takes over the shell's process ID, process
+ * group and terminal. The signal dispositions the shell changed are reset
+ * first, as ignored signals would stay ignored in the program.
+ *
+ * Return: Only returns on error, with -1
+ */
+int exec_in_place(const char *path, char **argv, int in_fd, int out_fd);
+
 /**
  * exec - Execute command pipeline
  * @current_ctx: Shell context
  *
  * This does quite a bit: 
- * - Checks if first command is a builtin and executes it if so
- * - Create pipes if there are multiple commands
- * - Fork child process for each command
- * - Set up pipes and I/O redirection in child
- * - Close all pipe file descriptors in parent and child
- * - Execute program in child with execvp
- * - Wait for all children to finish in parent (unless background process)
+ * - Runs builtins in the shell, or as stages of the pipeline
+ * - Resolve programs and open redirection targets in the shell so typos and
+ *   bad paths fail early
+ * - Create the pipe to the next command as each one is launched
+ * - Spawn a child process for each command with posix_spawn, as one job
+ * - Close pipe file descriptors in parent as soon as they are handed over
+ * - Wait for the job in the foreground (unless background process)
+ * - Record exit statuses and, for the time keyword, report resource usage
  * 
  * Return: 0 on success, -1 on error
  */
 int exec(struct repl_ctx *current_ctx);
 
+/**
+ * exec_measured - Execute command pipeline and measure it
+ * @current_ctx: Shell context
+ * @real: Output parameter - wall time the pipeline took
+ * @usage: Output parameter - resource usage of every stage, as reported by
+ * wait4(), plus that of the shell while it ran
+ *
+ * Same as exec(), for the bench keyword.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int exec_measured(struct repl_ctx *current_ctx, struct timespec *real,
+                  struct rusage *usage);
+
+/**
+ * set_exit_status - Set $? and $PIPESTATUS for a command without a job
+ * @current_ctx: Shell context
+ * @code: Exit status
+ *
+ * For commands the shell handles on its own instead of running a pipeline,
+ * such as one it skipped or a keyword used the wrong way.
+ */
+void set_exit_status(struct repl_ctx *current_ctx, int code);
+
 #endif
@@ -0,0 +1,88 @@
+/**
+ * fanout.h
+ *
+ * Declares output fan-out, which copies what a stage writes to several files
+ * and to the next stage.
+ */
+
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "context.h"
+
+/**
+ * out_fanout - Output files of a stage after the first
+ * @names: File names, from the second ">" or ">>" of the stage on
+ * @types: O_WRONLY or O_APPEND per file
+ * @fds: Descriptor per file while the pipeline runs, -1 when closed
+ * @count: Number of files
+ */
+struct out_fanout {
+  char **names;
+  int *types;
+  int *fds;
+  unsigned int count;
+};
+
+/**
+ * fanout_add - Add an output file to a stage
+ * @fanout: Stage's fan-out, allocated on the first call
+ * @name: File name, copied
+ * @type: O_WRONLY for ">", O_APPEND for ">>"
+ *
+ * Return: 0 on success, -1 on error
+ */
+int fanout_add(struct out_fanout **fanout, const char *name, int type);
+
+/**
+ * fanout_free - Free a stage's fan-out
+ * @fanout: Fan-out to free, NULL to do nothing
+ */
+void fanout_free(struct out_fanout *fanout);
+
+/**
+ * stage_fans_out - Check whether a stage's output goes to several places
+ * @current_ctx: Shell context with parsed redirections
+ * @index: Stage of the pipeline
+ *
+ * With the multios option, a stage fans out if it has several output files,
+ * or an output file and a next stage: as in zsh, "A > FILE | B" then writes
+ * to both. Otherwise the last file takes the output and the next stage gets
+ * nothing, as in POSIX shells.
+ *
+ * Return: true if the stage needs a relay, false otherwise
+ */
+bool stage_fans_out(const struct repl_ctx *current_ctx, unsigned int index);
+
+/**
+ * pipeline_fans_out - Check whether any stage of the pipeline fans out
+ * @current_ctx: Shell context with parsed redirections
+ *
+ * Such a pipeline has to run as a job, which its relays belong to.
+ *
+ * Return: true if a stage needs a relay, false otherwise
+ */
+bool pipeline_fans_out(const struct repl_ctx *current_ctx);
+
+/**
+ * fanout_spawn - Start the relay copying a stage's output everywhere
+ * @in_fd: Read end of the pipe the stage writes to
+ * @out_fds: Destinations, in the order the output is handed to them
+ * @count: Number of entries in out_fds
+ * @pgid: Process group to join, 0 for a new group, -1 to stay in the shell's
+ *
+ * The relay is a forked copy of the shell that keeps only in_fd and out_fds.
+ * It duplicates the pipe's contents with tee(2) and moves them with splice(),
+ * so the data stays in the kernel. A destination that goes away (EPIPE) is
+ * dropped and the others keep getting the output. The relay exits at EOF or
+ * once no destination is left.
+ *
+ * Return: PID of the relay, -1 on error
+ */
+pid_t fanout_spawn(int in_fd, const int *out_fds, unsigned int count,
+                   pid_t pgid);
+
+#endif
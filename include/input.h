@@ -39,8 +39,8 @@ int take_input(struct repl_ctx *current_ctx);
  * - Splits input on pipes to get individual commands
  * - Initialize arrays for command data
  * - Tokenize each command into arguments
- * - Parse special operators (&, <, >, >>)
- * - Expand environment variables and tilde (~)
+ * - Parse the time keyword and special operators (&, <, >, >>)
+ * - Expand environment variables and tilde (~), outside process substitutions
  *
  * Return: 0 on success, -1 on error
  */
@@ -68,6 +68,7 @@ char *construct_prompt(char *home_dir, char *user);
  * - in_stream_name[i]: input file for command i (or NULL)
  * - out_stream_name[i]: output file for command i (or NULL)
  * - out_stream_type[i]: O_WRONLY or O_APPEND
+ * - out_fanout[i]: output files after the first (or NULL)
  *
  * All arrays are sized by commands_count, which was set by split_on_pipes, so
  * that we only allocate as much memory as we need.
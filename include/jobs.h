@@ -0,0 +1,511 @@
+/**
+ * jobs.h
+ *
+ * Declares the job table, which keeps track of every pipeline the shell has
+ * launched until its processes have been reaped.
+ */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <termios.h>
+#include <time.h>
+
+/**
+ * JOB_MONITOR_INTERVAL_MS - How often a job's monitor runs while the shell
+ * waits for it
+ */
+#define JOB_MONITOR_INTERVAL_MS 100
+
+/**
+ * TEARDOWN_DELAY_MS - How long stages left running after the last stage exited
+ * get to finish on their own before teardown sends them SIGPIPE
+ */
+#define TEARDOWN_DELAY_MS 20
+
+/**
+ * TIMEOUT_KILL_AFTER_MS - Default grace period between the timeout keyword's
+ * signal and SIGKILL
+ */
+#define TIMEOUT_KILL_AFTER_MS 5000
+
+/**
+ * TIMEOUT_EXIT_CODE - Exit status ($?) of a job stopped by the timeout keyword
+ *
+ * Same as coreutils timeout, so scripts can tell a timeout from a failure.
+ */
+#define TIMEOUT_EXIT_CODE 124
+
+/**
+ * STAGE_KEEP_FDS_MAX - Most descriptors a stage handed over to a child keeps,
+ * see job_stage_detachable()
+ */
+#define STAGE_KEEP_FDS_MAX 4
+
+/**
+ * job_proc - One process (pipeline stage) of a job
+ * @pid: Process ID
+ * @pidfd: Descriptor from pidfd_open(), -1 once reaped or if unavailable
+ * @status: Last status reported by waitpid()
+ * @finished: Whether the process exited or was killed
+ * @stopped: Whether the process is currently stopped
+ * @job: Job the process belongs to
+ * @usage: Resource usage reported by wait4() once the process finished
+ * @start_time: When the process was launched (CLOCK_MONOTONIC)
+ * @end_time: When the process was reaped (CLOCK_MONOTONIC)
+ * @full_samples: Consecutive monitor samples that found the process's output
+ * pipe full, for adaptive pipe sizing
+ */
+struct job_proc {
+  pid_t pid;
+  int pidfd;
+  int status;
+  bool finished;
+  bool stopped;
+  struct job *job;
+  struct rusage usage;
+  struct timespec start_time;
+  struct timespec end_time;
+  unsigned int full_samples;
+};
+
+/**
+ * stage_result - Outcome of one stage of a foreground job
+ * @exit_code: Exit status, or 128 + signal number if killed or stopped
+ * @stopped: Whether the stage was stopped rather than finished
+ * @in_shell: Whether the stage ran inside the shell rather than as a process
+ * @usage: Resource usage of the stage, zeroed if it was stopped
+ * @elapsed: Wall time from launch until the stage was reaped
+ */
+struct stage_result {
+  int exit_code;
+  bool stopped;
+  bool in_shell;
+  struct rusage usage;
+  struct timespec elapsed;
+};
+
+/**
+ * job_result - Outcome of the last foreground job
+ * @stages: One entry per stage, in pipeline order
+ * @stages_count: Number of entries in stages
+ * @timed_out: Whether the job was signalled by the timeout keyword
+ */
+struct job_result {
+  struct stage_result *stages;
+  unsigned int stages_count;
+  bool timed_out;
+};
+
+/**
+ * job - A pipeline launched by the shell
+ * @id: Job number, as used in %n job specs
+ * @pgid: Process group shared by every stage, 0 until the first stage starts
+ * @command: Command line, for display
+ * @procs: One entry per stage that was launched
+ * @procs_count: Number of entries in procs
+ * @procs_capacity: Number of stages the job was created for
+ * @running_count: Processes that are neither finished nor stopped
+ * @finished_count: Processes that are finished
+ * @own_pgroup: Whether the job runs in its own process group
+ * @launched_by_stage: Whether a stage the shell runs launched the job, which
+ * then shares the stage's process group if it still exists, and can't stop
+ * @background: Whether the shell is not waiting for the job
+ * @notified: Whether the user has been told the job stopped
+ * @tmodes: Terminal modes saved when the job was stopped, restored by fg
+ * @has_tmodes: Whether tmodes holds anything
+ * @monitor: Called every JOB_MONITOR_INTERVAL_MS while the job is waited for
+ * in the foreground, can be NULL
+ * @deadline: When the job is signalled next (CLOCK_MONOTONIC), zero if never
+ * @deadline_signal: Signal sent at the deadline
+ * @kill_after_ms: Grace period before SIGKILL follows deadline_signal, 0 for
+ * none
+ * @timed_out: Whether the deadline has passed at least once
+ * @teardown: Whether to send SIGPIPE to the other stages once the last stage
+ * exits
+ * @teardown_kill_after_ms: Grace period before SIGKILL follows teardown's
+ * SIGPIPE, 0 for none
+ * @tearing_down: Whether the last stage exited and teardown has started
+ * @io_fd: Descriptor watched while the job is waited for in the foreground,
+ * -1 for none
+ * @io_ready: Called when io_fd is ready
+ * @io_release: Called when the job is removed, to report on and free io_data
+ * @io_data: State used by io_ready and io_release
+ * @helpers: Processes started for the job that aren't stages of it, such as
+ * the relays copying a stage's output to several places
+ * @helpers_count: Number of entries in helpers
+ * @helpers_capacity: Number of helpers room was reserved for
+ */
+struct job {
+  unsigned int id;
+  pid_t pgid;
+  char *command;
+  struct job_proc *procs;
+  unsigned int procs_count;
+  unsigned int procs_capacity;
+  unsigned int running_count;
+  unsigned int finished_count;
+  bool own_pgroup;
+  bool launched_by_stage;
+  bool background;
+  bool notified;
+  struct termios tmodes;
+  bool has_tmodes;
+  void (*monitor)(struct job *job);
+  struct timespec deadline;
+  int deadline_signal;
+  long kill_after_ms;
+  bool timed_out;
+  bool teardown;
+  long teardown_kill_after_ms;
+  bool tearing_down;
+  int io_fd;
+  void (*io_ready)(struct job *job);
+  void (*io_release)(struct job *job);
+  void *io_data;
+  struct job_proc *helpers;
+  unsigned int helpers_count;
+  unsigned int helpers_capacity;
+};
+
+/**
+ * job_control - Whether the shell manages the terminal's foreground job
+ *
+ * Only true for interactive sessions, where the shell owns the terminal.
+ */
+extern bool job_control;
+
+/**
+ * shell_terminal - Descriptor of the controlling terminal, -1 without job
+ * control
+ */
+extern int shell_terminal;
+
+/**
+ * jobs_init - Set up job control at startup
+ * @interactive: Whether commands are read from the user rather than given
+ * with -c
+ *
+ * Creates the epoll instance children are watched with. If the session is
+ * interactive and stdin is a terminal, also puts the shell in its own process
+ * group, takes ownership of the terminal and ignores the job control signals
+ * that would otherwise stop the shell itself.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int jobs_init(bool interactive);
+
+/**
+ * jobs_close - Release every job at shell exit
+ *
+ * Stopped jobs would otherwise stay stopped forever, so they are sent SIGHUP
+ * followed by SIGCONT before the table is freed.
+ */
+void jobs_close(void);
+
+/**
+ * job_create - Add a new job to the table
+ * @command: Command line, for display
+ * @procs_capacity: Number of stages in the pipeline
+ * @background: Whether the job is launched in the background
+ *
+ * Background jobs always get their own process group so that Ctrl+C doesn't
+ * reach them. Foreground jobs only do when job control is enabled.
+ *
+ * Return: New job, NULL on error
+ */
+struct job *job_create(const char *command, unsigned int procs_capacity,
+                       bool background);
+
+/**
+ * job_add_process - Record a stage that was launched for a job
+ * @job: Job the stage belongs to
+ * @pid: Process ID of the stage, 0 for a stage that runs inside the shell
+ *
+ * If the job has its own process group, the first launched stage's PID becomes
+ * the job's process group ID. A stage running inside the shell counts as
+ * running until it is completed with job_finish_process().
+ *
+ * Return: 0 on success, -1 on error
+ */
+int job_add_process(struct job *job, pid_t pid);
+
+/**
+ * job_reserve_helpers - Make room for the helper processes of a job
+ * @job: Job, without any helpers yet
+ * @count: Number of helpers that may be added
+ *
+ * Helpers are stored apart from the stages, so they don't show up in the
+ * job's result, but are signalled, waited for and reaped with it: the job
+ * isn't done until its helpers are.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int job_reserve_helpers(struct job *job, unsigned int count);
+
+/**
+ * job_add_helper - Record a helper process launched for a job
+ * @job: Job the helper belongs to, with room reserved by
+ * job_reserve_helpers()
+ * @pid: Process ID of the helper
+ *
+ * Like a stage, a helper launched before any stage leads the job's process
+ * group.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int job_add_helper(struct job *job, pid_t pid);
+
+/**
+ * job_finish_process - Record the outcome of a stage that ran inside the shell
+ * @job: Job the stage belongs to
+ * @index: Position of the stage in the job's procs
+ * @exit_code: Exit status of the stage
+ * @usage: Resources the shell used running the stage
+ */
+void job_finish_process(struct job *job, unsigned int index, int exit_code,
+                        const struct rusage *usage);
+
+/**
+ * job_set_timeout - Give a job a time limit
+ * @job: Job to limit
+ * @timeout_ms: Time from now until the job is signalled
+ * @signal_num: Signal to send first
+ * @kill_after_ms: Grace period before SIGKILL follows, 0 to never send it
+ *
+ * Deadlines are enforced whenever the shell reaps children, and the shell
+ * wakes up for them while it waits for jobs. A background job that runs out of
+ * time while the shell sits at the prompt is signalled before the next one.
+ */
+void job_set_timeout(struct job *job, long timeout_ms, int signal_num,
+                     long kill_after_ms);
+
+/**
+ * deadline_in - Compute a deadline some time from now
+ * @deadline: Output parameter - deadline on the CLOCK_MONOTONIC clock
+ * @duration_ms: Time from now
+ */
+void deadline_in(struct timespec *deadline, long duration_ms);
+
+/**
+ * job_remove - Remove a job from the table and free it
+ * @job: Job to remove
+ *
+ * Processes that are still running are not signalled, they simply stop being
+ * tracked (this is how disown works).
+ */
+void job_remove(struct job *job);
+
+/**
+ * job_wait - Wait for a job in the foreground
+ * @job: Job to wait for
+ *
+ * Hands the terminal to the job when job control is enabled, and takes it back
+ * once every process has finished or the job was stopped (Ctrl-Z). Finished
+ * jobs are removed from the table, stopped ones are kept and reported.
+ *
+ * The exit status and resource usage of every stage are saved for
+ * job_take_result().
+ *
+ * Return: 0 on success, -1 on error
+ */
+int job_wait(struct job *job);
+
+/**
+ * job_take_result - Get the result saved by the last job_wait()
+ *
+ * Each result is only handed out once, so callers can tell whether a command
+ * (e.g. fg) waited for a job at all.
+ *
+ * Return: Result, valid until the next job_wait(), NULL if there is none
+ */
+const struct job_result *job_take_result(void);
+
+/**
+ * job_peek_result - Look at the result saved by the last job_wait()
+ *
+ * Unlike job_take_result(), the result is left for the next caller, so a
+ * builtin can act on the status of a job it waited for and still leave it
+ * for $?.
+ *
+ * Return: Result, valid until the next job_wait(), NULL if there is none
+ */
+const struct job_result *job_peek_result(void);
+
+/**
+ * exit_code_of - Convert a wait status to a shell exit status
+ * @status: Status from waitpid() or wait4()
+ *
+ * Return: Exit status, or 128 + signal number for killed or stopped processes
+ */
+int exit_code_of(int status);
+
+/**
+ * job_stage_begin - Note that the shell is about to run stages of a job
+ * @job: Job whose stage runs in the shell or on its threads
+ * @hands_over: Whether the stage the shell runs can be handed to a child, see
+ * job_stage_detachable()
+ *
+ * Under job control, the shell can't be stopped along with the job by Ctrl-Z,
+ * and wouldn't wait for the job while busy with its stage. Until
+ * job_stage_end(), a stop of the job is undone with SIGCONT and reported,
+ * unless the stage is handed over. Jobs launched in the meantime join the
+ * job's process group and leave it the terminal, so Ctrl+C and Ctrl-Z reach
+ * them along with the pipeline.
+ *
+ * Return: Job the shell ran a stage of before, for job_stage_end()
+ */
+struct job *job_stage_begin(struct job *job, bool hands_over);
+
+/**
+ * job_stage_end - Note that the shell is done running stages of a job
+ * @previous: Return value of the matching job_stage_begin()
+ */
+void job_stage_end(struct job *previous);
+
+/**
+ * job_stage_check - Keep the job whose stage the shell runs from stopping
+ *
+ * Called by the SIGCHLD handler. The stop is only looked at (WNOWAIT), so the
+ * job table still reaps it, as a stop followed by a continue. A stage that is
+ * handed over instead waits for job_stage_detachable() if it is busy.
+ */
+void job_stage_check(void);
+
+/**
+ * job_stage_detachable - Let a stop of the job hand the stage to a child
+ * @point: Where the shell goes on once a child took the stage over, NULL while
+ * the stage runs code that isn't async-signal-safe
+ * @fds: Descriptors the stage uses, the child closes every other one
+ * @count: Number of entries in fds, at most STAGE_KEEP_FDS_MAX
+ *
+ * Only for a stage job_stage_begin() was told can be handed over. A stop that
+ * came while the stage was busy is acted on right away.
+ */
+void job_stage_detachable(sigjmp_buf *point, const int *fds,
+                          unsigned int count);
+
+/**
+ * job_stage_taken_over - Get the child that took over the stage the shell ran
+ *
+ * Return: PID of the child in the shell, -1 in the child itself, 0 if the
+ * stage wasn't handed over
+ */
+pid_t job_stage_taken_over(void);
+
+/**
+ * job_adopt_process - Track the child that took over a stage of the shell
+ * @job: Job the stage belongs to
+ * @index: Position of the stage in the job's procs
+ * @pid: Child, from job_stage_taken_over()
+ *
+ * Return: 0 on success, -1 on error
+ */
+int job_adopt_process(struct job *job, unsigned int index, pid_t pid);
+
+/**
+ * job_continue - Resume a job with SIGCONT
+ * @job: Job to resume
+ * @foreground: Whether to wait for it in the foreground (fg) or not (bg)
+ *
+ * Return: 0 on success, -1 on error
+ */
+int job_continue(struct job *job, bool foreground);
+
+/**
+ * signal_job - Send a signal to every process of a job
+ * @job: Job to signal
+ * @signal_num: Signal to send
+ *
+ * Return: 0 on success, -1 on error
+ */
+int signal_job(struct job *job, int signal_num);
+
+/**
+ * job_find - Look up a job from a job spec
+ * @spec: "%n" for job n, "%%" or "%+" for the current job, or a PID
+ *
+ * Return: Matching job, NULL if there is none
+ */
+struct job *job_find(const char *spec);
+
+/**
+ * job_current - Get the job that fg and bg act on without arguments
+ *
+ * Return: Most recently launched or stopped job, NULL if there are no jobs
+ */
+struct job *job_current(void);
+
+/**
+ * job_is_done - Check whether every process of a job has finished
+ * @job: Job to check
+ *
+ * Return: true if done, false otherwise
+ */
+bool job_is_done(const struct job *job);
+
+/**
+ * job_print - Print a job in the format used by the jobs builtin
+ * @job: Job to print
+ * @show_pids: Whether to list the PID of every stage
+ */
+void job_print(const struct job *job, bool show_pids);
+
+/**
+ * jobs_detach - Give a forked child of the shell a job table of its own
+ *
+ * For a forked child whose descriptors above stderr were closed. The jobs
+ * belong to the shell, and the epoll instance was shared with the shell: a
+ * pidfd the child added to it would wake up the shell. The child starts over
+ * with an empty table, a new epoll instance and no job control, as a subshell
+ * would.
+ */
+void jobs_detach(void);
+
+/**
+ * jobs_snapshot - Give a forked child of the shell a copy of the job table
+ * @own_job: Job the child belongs to, which is left out
+ *
+ * Like jobs_detach(), except that the shell's other jobs stay in the table,
+ * for builtins that use it without changing it. The child doesn't reap the
+ * jobs or enforce their deadlines, that is still up to the shell.
+ */
+void jobs_snapshot(struct job *own_job);
+
+/**
+ * jobs_for_each - Call a function for every job in job number order
+ * @fn: Function to call
+ * @arg: Passed through to fn
+ */
+void jobs_for_each(void (*fn)(struct job *, void *), void *arg);
+
+/**
+ * jobs_reap - Collect status changes of child processes without blocking
+ *
+ * Only does any work if SIGCHLD was received since the last call, or if a
+ * job's deadline has passed.
+ */
+void jobs_reap(void);
+
+/**
+ * jobs_notify - Report and remove background jobs that have finished
+ *
+ * Called before each prompt, so finished jobs are reported at a point where the
+ * output doesn't garble what the user is typing.
+ */
+void jobs_notify(void);
+
+/**
+ * jobs_wait_any - Block until a child process changes status
+ * @deadline: When to give up (CLOCK_MONOTONIC), NULL to wait indefinitely
+ *
+ * Return: 0 when a status change was collected or a job deadline was
+ * enforced, 1 if the deadline passed, -1 if interrupted by SIGINT
+ */
+int jobs_wait_any(const struct timespec *deadline);
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ * launch.h
+ *
+ * Declares the process launching interface used by the execution engine.
+ */
+
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <sys/types.h>
+
+struct stage_attrs;
+
+/**
+ * stage_spawn - Everything needed to launch one pipeline stage
+ *
+ * @path: Resolved path of the program, NULL to search $PATH for argv[0]
+ * @argv: NULL-terminated argument array, argv[0] is the program
+ * @in_fd: Descriptor to install as stdin, -1 to inherit the shell's
+ * @out_fd: Descriptor to install as stdout, -1 to inherit the shell's
+ * @err_fd: Descriptor to install as stderr, -1 to inherit the shell's
+ *
+ * Any other descriptor the shell holds is expected to be close-on-exec.
+ * @pgid: Process group to join, 0 for a new group led by the child, -1 to stay
+ * in the shell's group
+ * @tty_fd: Terminal to make the child's process group the foreground of, -1 to
+ * leave the terminal alone
+ * @attrs: Scheduling and resource attributes to apply before exec, NULL for
+ * none
+ * @keep_fds: Descriptors the program inherits under the same number, such as
+ * those named by /dev/fd paths in argv. NULL if none. Forked builtins close
+ * them like any other descriptor
+ * @keep_fds_count: Number of entries in keep_fds
+ */
+struct stage_spawn {
+  const char *path;
+  char **argv;
+  int in_fd;
+  int out_fd;
+  int err_fd;
+  pid_t pgid;
+  int tty_fd;
+  const struct stage_attrs *attrs;
+  const int *keep_fds;
+  unsigned int keep_fds_count;
+};
+
+/**
+ * launch_init - Make inherited descriptors close-on-exec
+ *
+ * Descriptors the shell opens itself are close-on-exec, but whatever started
+ * the shell may have left others open. Marking everything above stderr once at
+ * startup keeps them out of every stage without per-stage close actions.
+ */
+void launch_init(void);
+
+/**
+ * spawn_stage - Launch a single pipeline stage
+ * @stage: Description of the stage to launch
+ *
+ * Uses posix_spawn(), which glibc implements with clone(CLONE_VM |
+ * CLONE_VFORK). The child shares the shell's memory until it calls exec, so no
+ * page tables are copied no matter how large the shell grows. All descriptor
+ * setup is expressed as spawn file actions instead of code running in a forked
+ * child. A stage with attributes, which posix_spawn() can't express, is
+ * launched with vfork() instead. With -z, the zygote launches the others,
+ * unless they keep descriptors the zygote doesn't have.
+ *
+ * Return: PID of the child on success, -1 on error
+ */
+pid_t spawn_stage(const struct stage_spawn *stage);
+
+#endif
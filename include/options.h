@@ -0,0 +1,76 @@
+/**
+ * options.h
+ *
+ * Declares shell options, which change how the shell runs pipelines and are
+ * toggled with the set builtin.
+ */
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdbool.h>
+
+#include "context.h"
+
+/**
+ * shell_option - Options that can be toggled with "set -o NAME"
+ * @OPTION_PIPEFAIL: $? is the status of the last stage that failed rather
+ * than that of the last stage
+ * @OPTION_TEARDOWN: Once the last stage of a pipeline exits, the stages still
+ * running are sent SIGPIPE instead of being left to notice on their next write
+ * @OPTION_AUTOBATCH: A command whose arguments don't fit in ARG_MAX is run
+ * several times with as many arguments as fit, like xargs would
+ * @OPTION_REWRITE: Pipelines are rewritten to leave out cat stages that only
+ * pass data on
+ * @OPTION_MULTIOS: Every ">" and ">>" of a stage gets the whole output, and so
+ * does the next stage, as with zsh's multios
+ * @OPTIONS_COUNT: Number of options
+ */
+enum shell_option {
+  OPTION_PIPEFAIL,
+  OPTION_TEARDOWN,
+  OPTION_AUTOBATCH,
+  OPTION_REWRITE,
+  OPTION_MULTIOS,
+  OPTIONS_COUNT
+};
+
+/**
+ * options_init - Load option settings from the configuration file
+ * @current_ctx: Shell context (for configuration)
+ *
+ * TEARDOWN_KILL_AFTER=DURATION in ~/.clownrc makes the teardown option follow
+ * SIGPIPE with SIGKILL for stages still around after DURATION.
+ */
+void options_init(struct repl_ctx *current_ctx);
+
+/**
+ * option_is_set - Check whether an option is enabled
+ * @option: Option to check
+ *
+ * Return: true if enabled, false otherwise
+ */
+bool option_is_set(enum shell_option option);
+
+/**
+ * option_set - Enable or disable an option by name
+ * @name: Option name, as listed by "set -o"
+ * @value: Whether to enable it
+ *
+ * Return: 0 on success, -1 if there is no such option
+ */
+int option_set(const char *name, bool value);
+
+/**
+ * options_print - List every option and whether it is enabled
+ */
+void options_print(void);
+
+/**
+ * teardown_kill_after_ms - Get the grace period before teardown sends SIGKILL
+ *
+ * Return: Grace period in milliseconds, 0 if teardown never sends SIGKILL
+ */
+long teardown_kill_after_ms(void);
+
+#endif
@@ -17,9 +17,6 @@
  */
 #define NULL_TERMINATOR_LENGTH 1
 
-/* COMMANDS_MAX - Maximum number of commands in pipeline */
-#define COMMANDS_MAX 64
-
 /**
  * ENV_MAX - Maximum environment variable name length
  *
@@ -27,14 +24,6 @@
  */
 #define ENV_MAX 4096
 
-/**
- * PIPES_MAX - Maximum number of pipes (commands - 1)
- *
- * Each pipe consumes 2 file descriptors, so the number of pipes is limited to
- * prevent resource exhaustion.
- */
-#define PIPES_MAX 64
-
 /**
  * PROMPT_MAX - Maximum prompt length
  *
@@ -46,7 +35,7 @@
  * TOKENS_MAX - Initial token buffer size
  *
  * Starting size for argument array during tokenization.
- * If command has more arguments, buffer is reallocated (grows by TOKENS_MAX)
+ * If command has more arguments, buffer is reallocated to twice its size
  */
 #define TOKENS_MAX 64
 
@@ -73,6 +62,25 @@ void remove_arg(char **args, unsigned int *args_count, unsigned int arg_index);
 void replace(char **original_str, const char *original_substr,
              const char *new_substr);
 
+/**
+ * parse_duration - Parse a duration such as "30", "1.5s", "2m", "1h" or "1d"
+ * @spec: Number of seconds, fractions allowed, with an optional s, m, h or d
+ * suffix
+ * @duration_ms: Output parameter - duration in milliseconds
+ *
+ * Return: 0 on success, -1 if spec isn't a valid duration
+ */
+int parse_duration(const char *spec, long *duration_ms);
+
+/**
+ * parse_size - Parse a size such as "4096", "512K", "64M" or "2G"
+ * @spec: Number of bytes with an optional K, M or G suffix (powers of 1024)
+ * @bytes: Output parameter - size in bytes
+ *
+ * Return: 0 on success, -1 if spec isn't a valid size
+ */
+int parse_size(const char *spec, long long *bytes);
+
 /**
  * determine_if_background - Check for background operator
  * @current_ctx: Shell context with parsed commands
@@ -82,9 +90,9 @@ void replace(char **original_str, const char *original_substr,
  * is the last in the pipeline, removes & from arguments since it is not a
  * program argument and sets is_background_process to true.
  *
- * When exec.c sees that is_background_process is true, it calls setpgid(0, 0)
- * to create a new process group. This prevents SIGINT (Ctrl+C) from killing the
- * background job.
+ * When exec.c sees that is_background_process is true, it launches the
+ * pipeline as a background job in its own process group. This prevents SIGINT
+ * (Ctrl+C) from killing the background job.
  */
 void determine_if_background(struct repl_ctx *current_ctx,
                              unsigned int command_index);
@@ -103,13 +111,15 @@ void determine_in_stream(struct repl_ctx *current_ctx,
                          unsigned int command_index);
 
 /**
- * determine_out_stream - Parse input redirection operator
+ * determine_out_stream - Parse output redirection operators
  * @current_ctx: Shell context
  * @command_index: Which command in the pipeline to check
  *
- * Searches for the '>' and ">>" operators in the command's arguments. If found:
+ * Searches for the '>' and ">>" operators in the command's arguments. For
+ * each one:
  * - Extracts the filename that follows it
- * - Stores filename in in_stream_name[command_index]
+ * - Stores the first filename in out_stream_name[command_index], later ones
+ *   in out_fanout[command_index], as the output goes to every one of them
  * - Removes operator and filename from arguments
  */
 void determine_out_stream(struct repl_ctx *current_ctx,
@@ -123,11 +133,68 @@ void determine_out_stream(struct repl_ctx *current_ctx,
  *
  * Searches for "$VARNAME" pattern in the argument and replaces it with the
  * variable's value. The replacement is done in-place by modifying what arg
- * points to.
+ * points to. "$?" expands to the exit status of the last command and
+ * "$VARNAME[n]" to the nth element of an array variable such as PIPESTATUS.
  */
 void parse_envs(char **arg, struct user_env *user_envs,
                 unsigned int user_envs_count);
 
+/**
+ * determine_keywords - Check for pipeline keywords
+ * @current_ctx: Shell context with the first command parsed
+ *
+ * Removes the keywords at the start of the first command's arguments and
+ * records their effect on the whole pipeline:
+ * - time: exec reports the resource usage of every stage once it finishes
+ * - pipesize SIZE: pipes between stages get SIZE bytes of capacity (K, M and G
+ *   suffixes are accepted) or grow as needed with "adaptive"
+ * - timeout DURATION: the job is sent SIGTERM (or the signal given with -s)
+ *   once DURATION has passed, and SIGKILL if it is still around after the
+ *   grace period given with -k
+ * - profile: pipes between stages go through relays in the shell, which count
+ *   the bytes moved and how long each side waited, reported once the pipeline
+ *   finishes (as JSON with -j, appended to FILE with -o FILE)
+ *
+ * Return: 0 on success, -1 on a malformed keyword
+ */
+int determine_keywords(struct repl_ctx *current_ctx);
+
+/**
+ * rewrite_pipeline - Leave out stages of the pipeline that only pass data on
+ * @current_ctx: Shell context with parsed commands
+ *
+ * Rewrites are applied until none applies anymore, so "cat FILE | cat | wc"
+ * ends up as "wc < FILE".
+ */
+void rewrite_pipeline(struct repl_ctx *current_ctx);
+
+/**
+ * determine_stage_attrs - Parse the sched keyword of a stage
+ * @current_ctx: Shell context with the stage parsed
+ * @command_index: Which command in the pipeline to check
+ *
+ * Usage: sched [-a CPUS] [-n NICE] [-i CLASS[:LEVEL]] [-p POLICY]
+ * [-l RESOURCE=SOFT[:HARD]]... COMMAND...
+ *
+ * The attributes are applied by the stage's child before it execs, so
+ * builtins, which don't get a child of their own, can't have any.
+ *
+ * Return: 0 on success, -1 on a malformed keyword
+ */
+int determine_stage_attrs(struct repl_ctx *current_ctx,
+                          unsigned int command_index);
+
+/**
+ * apply_background_attrs - Give the stages of a background job the
+ * attributes from BACKGROUND_SCHED
+ * @current_ctx: Shell context with every stage parsed
+ *
+ * Attributes a stage sets with the sched keyword take precedence.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int apply_background_attrs(struct repl_ctx *current_ctx);
+
 /**
  * split_on_pipes - Split command line into individual commands
  * @line: Full command string
@@ -139,15 +206,37 @@ char **split_on_pipes(const char *line, unsigned int *commands_count);
 
 /**
  * lex_input - Tokenize a single command into arguments
- * @line: Command string to tokenize (modified by strtok)
+ * @line: Command string to tokenize (modified by next_token)
  * @args_count: Output parameter - number of arguments found
  *
- * Uses strtok() to split on whitespace (spaces, tabs, newlines). Each token is
- * duplicated with strdup so it persists after strtok modifies the original
- * string.
+ * Uses next_token() to split on whitespace (spaces, tabs, newlines). Each token
+ * is duplicated with strdup so it persists after next_token modifies the
+ * original string.
  *
  * Return: Array of strings (NULL-terminated), NULL on error
  */
 char **lex_input(char *line, unsigned int *args_count);
 
+/**
+ * substitution_end - Find the end of a process substitution
+ * @start: Start of a word
+ *
+ * Parentheses nest, so "<(diff <(a) <(b))" ends at the last one.
+ *
+ * Return: Character after the closing parenthesis, NULL if the word doesn't
+ * start a process substitution or it is never closed
+ */
+const char *substitution_end(const char *start);
+
+/**
+ * unclosed_substitution - Check a command for an unclosed process substitution
+ * @args: NULL-terminated arguments of the command
+ *
+ * next_token() splits an unclosed "<(" like any other word, which is reported
+ * rather than taken for a file name.
+ *
+ * Return: true if an argument opens a substitution it never closes
+ */
+bool unclosed_substitution(char **args);
+
 #endif
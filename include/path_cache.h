@@ -0,0 +1,129 @@
+/**
+ * path_cache.h
+ *
+ * Declares the executable lookup cache, which remembers where each command was
+ * found in $PATH so that launching it doesn't require walking every directory.
+ */
+
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "context.h"
+
+/* PATH_CACHE_FILE - Name of the persisted cache inside $XDG_RUNTIME_DIR */
+#define PATH_CACHE_FILE "clownish_hash"
+
+/* FNV1A_SEED - Starting value of a fresh fnv1a() hash */
+#define FNV1A_SEED 0xcbf29ce484222325ULL
+
+/**
+ * NOT_FOUND_EXIT_CODE - Exit status ($?) of a command that isn't in $PATH
+ *
+ * Same as sh, so scripts can tell a missing program from a failing one.
+ */
+#define NOT_FOUND_EXIT_CODE 127
+
+/**
+ * fnv1a - Hash a buffer
+ * @data: Bytes to hash
+ * @len: Number of bytes
+ * @hash: Starting value, chain calls by passing the previous result
+ *
+ * FNV-1a is tiny and good enough for short keys like command names.
+ *
+ * Return: 64-bit hash
+ */
+uint64_t fnv1a(const void *data, size_t len, uint64_t hash);
+
+/**
+ * path_cache_init - Set up the cache at startup
+ * @current_ctx: Shell context (for configuration)
+ *
+ * Watches the $PATH directories for changes and, if HASH_PERSIST=1 is set in
+ * ~/.clownrc, loads the entries saved by a previous session so that the first
+ * commands of a new session don't have to search $PATH.
+ *
+ * Failing to set up the cache is non-fatal, lookups still work without it.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int path_cache_init(struct repl_ctx *current_ctx);
+
+/**
+ * path_cache_sync - Drop entries invalidated since the last sync
+ *
+ * Processes pending change notifications for the $PATH directories. Pointers
+ * returned by path_cache_lookup() stay valid until the next call to this
+ * function or to path_cache_reset().
+ */
+void path_cache_sync(void);
+
+/**
+ * path_cache_lookup - Resolve a command name to an executable path
+ * @name: Command name as typed by the user
+ *
+ * Names containing a slash are returned unchanged, as the shell doesn't search
+ * $PATH for them.
+ *
+ * Return: Path to the executable, NULL if it wasn't found
+ */
+const char *path_cache_lookup(const char *name);
+
+/**
+ * path_cache_not_found - Report a command name that couldn't be resolved
+ * @name: Command name as typed by the user
+ *
+ * The command that failed because of it exits with NOT_FOUND_EXIT_CODE rather
+ * than 1, see path_cache_take_miss().
+ */
+void path_cache_not_found(const char *name);
+
+/**
+ * path_cache_take_miss - Check whether a command name wasn't found
+ *
+ * The report is cleared, so it only counts for the command that made it.
+ *
+ * Return: true if path_cache_not_found() was called since the last check
+ */
+bool path_cache_take_miss(void);
+
+/**
+ * path_cache_forget - Remove a single entry
+ * @name: Command name to forget
+ *
+ * Used when a cached path turns out to be stale, so the next lookup searches
+ * $PATH again.
+ */
+void path_cache_forget(const char *name);
+
+/**
+ * path_cache_reset - Remove every entry
+ */
+void path_cache_reset(void);
+
+/**
+ * path_cache_print - Print every entry with its hit count
+ *
+ * Return: Number of entries printed
+ */
+unsigned int path_cache_print(void);
+
+/**
+ * path_cache_detach - Stop sharing the inotify instance with the shell
+ *
+ * For a forked child of the shell whose descriptors above stderr were closed.
+ * Reading the shell's inotify instance would take events the shell needs, so
+ * the child checks the modification times of the $PATH directories instead.
+ */
+void path_cache_detach(void);
+
+/**
+ * path_cache_close - Persist (if enabled) and free the cache at shell exit
+ */
+void path_cache_close(void);
+
+#endif
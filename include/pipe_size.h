@@ -0,0 +1,71 @@
+/**
+ * pipe_size.h
+ *
+ * Declares pipe capacity tuning for pipelines that move a lot of data between
+ * stages.
+ */
+
+#ifndef PIPE_SIZE_H
+#define PIPE_SIZE_H
+
+#include "context.h"
+#include "jobs.h"
+
+/* PIPE_SIZE_DEFAULT - Leave pipes at the kernel's default capacity */
+#define PIPE_SIZE_DEFAULT 0
+
+/**
+ * PIPE_SIZE_ADAPTIVE - Start at the default capacity and grow pipes that keep
+ * filling up
+ */
+#define PIPE_SIZE_ADAPTIVE -1
+
+/**
+ * PIPE_SIZE_FULL_SAMPLES - Consecutive samples a pipe has to be found full
+ * before adaptive mode doubles it
+ */
+#define PIPE_SIZE_FULL_SAMPLES 3
+
+/**
+ * parse_pipe_size - Parse a pipe capacity setting
+ * @spec: Size in bytes with an optional K, M or G suffix, or "adaptive"
+ * @pipe_size: Output parameter - size in bytes or PIPE_SIZE_ADAPTIVE
+ *
+ * Return: 0 on success, -1 if spec is invalid
+ */
+int parse_pipe_size(const char *spec, long *pipe_size);
+
+/**
+ * pipe_size_for - Get the pipe capacity a pipeline should use
+ * @current_ctx: Shell context
+ *
+ * The pipesize keyword takes precedence over PIPE_SIZE from ~/.clownrc.
+ *
+ * Return: Size in bytes, PIPE_SIZE_DEFAULT or PIPE_SIZE_ADAPTIVE
+ */
+long pipe_size_for(struct repl_ctx *current_ctx);
+
+/**
+ * pipe_size_apply - Set the capacity of a pipe
+ * @fd: Either end of the pipe
+ * @pipe_size: Requested size in bytes
+ *
+ * The size is clamped to /proc/sys/fs/pipe-max-size, which is as far as an
+ * unprivileged process may go. The kernel rounds it up to a power of two
+ * number of pages.
+ *
+ * Return: New capacity on success, -1 on error
+ */
+int pipe_size_apply(int fd, long pipe_size);
+
+/**
+ * pipe_size_adapt - Job monitor that grows pipes which keep filling up
+ * @job: Foreground job being waited for
+ *
+ * Called periodically while the job runs. Every stage whose stdout is a pipe
+ * that is found full PIPE_SIZE_FULL_SAMPLES times in a row, meaning the stage
+ * keeps blocking on its consumer, gets that pipe doubled.
+ */
+void pipe_size_adapt(struct job *job);
+
+#endif
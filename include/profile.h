@@ -0,0 +1,60 @@
+/**
+ * profile.h
+ *
+ * Declares pipeline profiling for the profile keyword, which measures how much
+ * data flows between the stages of a pipeline and which stage holds the
+ * others up.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+#include "context.h"
+#include "jobs.h"
+
+/**
+ * profile_start - Prepare a job for profiling
+ * @job: Foreground job about to be launched
+ * @current_ctx: Shell context with the pipeline's commands and report options
+ *
+ * The job's I/O hooks are pointed at the profile, so relays run while the
+ * shell waits for the job and the report is printed once the job is removed.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int profile_start(struct job *job, struct repl_ctx *current_ctx);
+
+/**
+ * profile_relay - Put a relay between a stage and the next one
+ * @job: Job being profiled
+ * @stage: Position of the upstream stage in the pipeline
+ * @read_end: Read end of the upstream stage's pipe, replaced with the read end
+ * the downstream stage should use
+ * @pipe_size: Capacity for the new pipe, as for the upstream one
+ *
+ * The shell keeps the original read end and a second pipe's write end, and
+ * moves data from one to the other with splice().
+ *
+ * Return: 0 on success, -1 on error (read_end is left alone)
+ */
+int profile_relay(struct job *job, unsigned int stage, int *read_end,
+                  long pipe_size);
+
+/**
+ * print_json_string - Print a string as a JSON string literal
+ * @stream: Stream to print to
+ * @str: String to print
+ */
+void print_json_string(FILE *stream, const char *str);
+
+/**
+ * format_bytes - Format a byte count for the report table
+ * @buffer: Output buffer
+ * @size: Size of buffer
+ * @bytes: Byte count
+ */
+void format_bytes(char *buffer, size_t size, double bytes);
+
+#endif
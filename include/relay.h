@@ -0,0 +1,63 @@
+/**
+ * relay.h
+ *
+ * Declares the in-kernel data mover used by builtins that pass data between
+ * descriptors without a userspace copy.
+ */
+
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <sys/types.h>
+
+/**
+ * RELAY_CHUNK - Most bytes moved by a single system call
+ *
+ * Keeps each call short enough for Ctrl+C to be noticed promptly.
+ */
+#define RELAY_CHUNK (1024 * 1024)
+
+/**
+ * relay_side - Descriptor of a copy that an error came from
+ * @RELAY_READ: The source
+ * @RELAY_WRITE: The destination
+ */
+enum relay_side { RELAY_READ, RELAY_WRITE };
+
+/**
+ * relay_fd - Copy everything from one descriptor to another
+ * @in_fd: Descriptor to read from until EOF
+ * @out_fd: Descriptor to write to
+ * @failed_side: Output parameter - side that failed on error, may be NULL
+ *
+ * Picks the cheapest mechanism the pair of descriptors supports:
+ * - copy_file_range() between regular files, which may share extents or be
+ *   done by the storage without passing through memory
+ * - splice() when either side is a pipe
+ * - sendfile() from a regular file to anything else (sockets, terminals)
+ * - read()/write() through a buffer when none of the above apply
+ *
+ * Stops early without an error if the reader of out_fd went away (EPIPE), and
+ * with an error if SIGINT was received. The in-kernel calls don't tell which
+ * descriptor an error came from, so a failed chunk is retried through the
+ * buffer, which does.
+ *
+ * Return: Number of bytes copied, -1 on error
+ */
+ssize_t relay_fd(int in_fd, int out_fd, enum relay_side *failed_side);
+
+/**
+ * relay_range - Copy part of a regular file to a descriptor
+ * @in_fd: Regular file (or memfd) to read from, its offset is left alone
+ * @offset: Where the part starts in in_fd
+ * @length: Size of the part in bytes
+ * @out_fd: Descriptor to write to
+ *
+ * Uses sendfile() with an explicit offset, which works for any destination,
+ * and falls back to pread()/write() through a buffer if the kernel refuses.
+ *
+ * Return: Number of bytes copied, -1 on error
+ */
+ssize_t relay_range(int in_fd, off_t offset, size_t length, int out_fd);
+
+#endif
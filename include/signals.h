@@ -7,6 +7,34 @@
 #ifndef SIGNALS_H
 #define SIGNALS_H
 
+#include <signal.h>
+
+/**
+ * child_status_changed - Set by the SIGCHLD handler
+ *
+ * Tells the job table that at least one child exited, stopped or continued
+ * since it last reaped.
+ */
+extern volatile sig_atomic_t child_status_changed;
+
+/**
+ * sigint_received - Set by the SIGINT handler
+ *
+ * Lets builtins that block (such as wait) notice Ctrl+C. Whoever starts
+ * blocking is responsible for clearing it first.
+ */
+extern volatile sig_atomic_t sigint_received;
+
+/**
+ * child_handler - SIGCHLD signal handler
+ * @signal_num: Signal number (unused, but required by API)
+ *
+ * Only records that a child changed status, the reaping is done outside of the
+ * handler by the job table. A stop of a job whose stage the shell runs is
+ * undone right away (see job_stage_check()).
+ */
+void child_handler(int signal_num);
+
 /**
  * handler - SIGINT (Ctrl+C) signal handler
  * @signal_num: Signal number (unused, but required by API)
@@ -23,4 +51,43 @@ void handler(int signal_num);
  */
 int init_sig_handler(void);
 
+/**
+ * SHELL_SIGNALS_COUNT - Number of signals whose disposition the shell changes
+ */
+#define SHELL_SIGNALS_COUNT 7
+
+/**
+ * saved_signals - Signal setup of the shell, to put back after a failed exec
+ * @actions: Disposition of each signal the shell changes
+ * @mask: Signal mask
+ */
+struct saved_signals {
+  struct sigaction actions[SHELL_SIGNALS_COUNT];
+  sigset_t mask;
+};
+
+/**
+ * restore_default_signals - Undo the shell's signal setup before exec
+ * @saved: Output parameter - the shell's setup, for reinstate_signals()
+ *
+ * Ignored signals stay ignored across exec and the signal mask is inherited,
+ * so a program that replaces the shell would otherwise start with the shell's
+ * dispositions instead of the defaults.
+ */
+void restore_default_signals(struct saved_signals *saved);
+
+/**
+ * reinstate_signals - Put back the setup restore_default_signals() undid
+ * @saved: Setup saved by restore_default_signals()
+ */
+void reinstate_signals(const struct saved_signals *saved);
+
+/**
+ * parse_signal - Convert a signal name or number to a signal number
+ * @name: "9", "KILL" or "SIGKILL" (case insensitive)
+ *
+ * Return: Signal number, -1 if unknown
+ */
+int parse_signal(const char *name);
+
 #endif
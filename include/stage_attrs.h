@@ -0,0 +1,117 @@
+/**
+ * stage_attrs.h
+ *
+ * Declares scheduling and resource attributes applied to a pipeline stage
+ * before it execs: CPU affinity, nice level, I/O priority, scheduling policy
+ * and resource limits.
+ */
+
+#ifndef STAGE_ATTRS_H
+#define STAGE_ATTRS_H
+
+#include <sched.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+
+#include "context.h"
+
+/**
+ * STAGE_LIMITS_MAX - Most resource limits a single stage can set
+ */
+#define STAGE_LIMITS_MAX 16
+
+/**
+ * stage_limit - A resource limit to set
+ * @resource: RLIMIT_* constant
+ * @limit: Soft and hard limit
+ * @set_hard: Whether the hard limit is set too, otherwise it is left as is
+ */
+struct stage_limit {
+  int resource;
+  struct rlimit limit;
+  bool set_hard;
+};
+
+/**
+ * stage_attrs - Attributes of a stage, each only applied if its has_* is set
+ * @has_affinity: Whether affinity is set
+ * @affinity: CPUs the stage may run on
+ * @has_nice: Whether nice is set
+ * @nice: Nice level, -20 to 19
+ * @has_ioprio: Whether ioprio is set
+ * @ioprio: I/O scheduling class and level, as ioprio_set() takes them
+ * @has_policy: Whether policy is set
+ * @policy: SCHED_OTHER, SCHED_BATCH or SCHED_IDLE
+ * @limits: Resource limits, applied last
+ * @limits_count: Number of entries in limits
+ */
+struct stage_attrs {
+  bool has_affinity;
+  cpu_set_t affinity;
+  bool has_nice;
+  int nice;
+  bool has_ioprio;
+  int ioprio;
+  bool has_policy;
+  int policy;
+  struct stage_limit limits[STAGE_LIMITS_MAX];
+  unsigned int limits_count;
+};
+
+/**
+ * parse_stage_attrs - Parse the options of the sched keyword
+ * @args: Words following the keyword, NULL-terminated
+ * @attrs: Output parameter - attributes, cleared first
+ *
+ * Options:
+ * -a CPUS: run on the listed CPUs only ("0-3,6")
+ * -n NICE: nice level
+ * -i CLASS[:LEVEL]: I/O priority class (realtime, best-effort or idle) and
+ *  level within the class (0 to 7, 4 by default)
+ * -p POLICY: scheduling policy (other, batch or idle)
+ * -l RESOURCE=SOFT[:HARD]: resource limit, RESOURCE as in prlimit(1) without
+ *  the RLIMIT_ prefix, values with K, M or G suffixes or "unlimited"
+ *
+ * Parsing stops at the first word that isn't an option.
+ *
+ * Return: Number of words used, -1 on a malformed option
+ */
+int parse_stage_attrs(char **args, struct stage_attrs *attrs);
+
+/**
+ * merge_stage_attrs - Fill in attributes a stage doesn't set itself
+ * @attrs: Attributes of the stage, updated
+ * @defaults: Attributes to take the missing ones from
+ */
+void merge_stage_attrs(struct stage_attrs *attrs,
+                       const struct stage_attrs *defaults);
+
+/**
+ * apply_stage_attrs - Apply attributes to the calling process
+ * @attrs: Attributes to apply
+ *
+ * Meant for a child between fork (or vfork) and exec: only system calls are
+ * made, nothing is allocated or printed.
+ *
+ * Return: NULL on success, name of the attribute that failed otherwise (errno
+ * tells why)
+ */
+const char *apply_stage_attrs(const struct stage_attrs *attrs);
+
+/**
+ * stage_attrs_init - Load the attributes of background jobs
+ * @current_ctx: Shell context (for configuration)
+ *
+ * BACKGROUND_SCHED in ~/.clownrc takes the same options as the sched keyword
+ * and applies them to every stage of a background job that doesn't set them.
+ */
+void stage_attrs_init(struct repl_ctx *current_ctx);
+
+/**
+ * background_stage_attrs - Get the attributes of background jobs
+ *
+ * Return: Attributes from BACKGROUND_SCHED, NULL if it isn't set
+ */
+const struct stage_attrs *background_stage_attrs(void);
+
+#endif
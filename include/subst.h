@@ -0,0 +1,135 @@
+/**
+ * subst.h
+ *
+ * Declares process substitution, which hands a command the output or input of
+ * another pipeline as a /dev/fd path.
+ */
+
+#ifndef SUBST_H
+#define SUBST_H
+
+#include <stdbool.h>
+
+#include "context.h"
+#include "jobs.h"
+
+/**
+ * substitution - One "<(...)" or ">(...)" of the pipeline
+ * @word: Argument or redirection target the substitution was typed as, which
+ * holds its /dev/fd path while the pipeline runs
+ * @original: Word as typed, put back by subst_finish()
+ * @stage: Stage of the pipeline the word belongs to
+ * @in_argv: Whether the word is an argument, which the stage's program has to
+ * inherit the descriptor for, rather than a target the shell opens
+ * @fd: Shell's end of the pipe, which the path names. -1 once closed
+ * @inner_fd: Subshell's end of the pipe, -1 once handed over
+ */
+struct substitution {
+  char **word;
+  char *original;
+  unsigned int stage;
+  bool in_argv;
+  int fd;
+  int inner_fd;
+};
+
+/**
+ * substitutions - Every process substitution of the pipeline
+ * @items: One entry per substitution
+ * @count: Number of substitutions
+ * @stage_fds: Room for the descriptors subst_stage_fds() collects
+ */
+struct substitutions {
+  struct substitution *items;
+  unsigned int count;
+  int *stage_fds;
+};
+
+/**
+ * is_substitution - Check whether a word is a process substitution
+ * @word: Argument or redirection target
+ *
+ * Return: true for "<(COMMAND)" and ">(COMMAND)", false otherwise
+ */
+bool is_substitution(const char *word);
+
+/**
+ * pipeline_substitutes - Check whether the pipeline has process substitutions
+ * @current_ctx: Shell context with parsed commands and redirections
+ *
+ * Such a pipeline has to run as a job, which its subshells belong to.
+ *
+ * Return: true if any argument or redirection target is a substitution
+ */
+bool pipeline_substitutes(const struct repl_ctx *current_ctx);
+
+/**
+ * subst_prepare - Give every process substitution of the pipeline its pipe
+ * @current_ctx: Shell context with parsed commands and redirections
+ * @subs: Output parameter - the substitutions found
+ *
+ * Each word is replaced by the /dev/fd path of the shell's end of its pipe,
+ * so the redirections can be opened and the stages launched as usual. Nothing
+ * runs yet, subst_launch() starts the subshells once there is a job.
+ *
+ * Return: 0 on success, -1 on error (the words are left as typed)
+ */
+int subst_prepare(struct repl_ctx *current_ctx, struct substitutions *subs);
+
+/**
+ * subst_launch - Start the subshell of every process substitution
+ * @current_ctx: Shell context
+ * @subs: Substitutions from subst_prepare()
+ * @job: Job the subshells belong to, before any stage has started
+ *
+ * Each subshell is a forked copy of the shell that parses and runs the
+ * substitution's command with its end of the pipe as stdout ("<(...)") or
+ * stdin (">(...)"). The subshells join the job's process group and are
+ * waited for with it, so Ctrl+C, job control and the exit of the job reach
+ * them too. A subshell that can't be started is reported, the command then
+ * sees an empty pipe.
+ */
+void subst_launch(struct repl_ctx *current_ctx, struct substitutions *subs,
+                  struct job *job);
+
+/**
+ * subst_stage_fds - Collect the descriptors a stage's arguments name
+ * @subs: Substitutions from subst_prepare()
+ * @stage: Stage of the pipeline
+ * @count: Output parameter - number of descriptors
+ *
+ * Return: The descriptors, valid until the next call
+ */
+const int *subst_stage_fds(struct substitutions *subs, unsigned int stage,
+                           unsigned int *count);
+
+/**
+ * subst_takes_output - Check whether a subshell reads what the pipeline writes
+ * @subs: Substitutions from subst_prepare()
+ *
+ * Such a subshell is still busy with the output when the last stage exits, so
+ * the job mustn't be torn down then.
+ *
+ * Return: true if any substitution is ">(...)", false otherwise
+ */
+bool subst_takes_output(const struct substitutions *subs);
+
+/**
+ * subst_close - Close the shell's ends of the pipes
+ * @subs: Substitutions from subst_prepare()
+ *
+ * Once every stage holds its own copy, the shell's would keep a subshell
+ * from seeing EOF, or from getting SIGPIPE when the command stops reading.
+ */
+void subst_close(struct substitutions *subs);
+
+/**
+ * subst_finish - Release the substitutions and put the words back
+ * @subs: Substitutions from subst_prepare(), emptied
+ *
+ * The words are restored as typed, so a pipeline run again (by on-change)
+ * starts new subshells.
+ */
+void subst_finish(struct substitutions *subs);
+
+#endif
@@ -0,0 +1,67 @@
+/**
+ * timing.h
+ *
+ * Declares the resource usage report printed for pipelines prefixed with the
+ * time keyword.
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <sys/resource.h>
+#include <time.h>
+
+#include "context.h"
+#include "jobs.h"
+
+/**
+ * timing_mark - Snapshot taken before a timed pipeline starts
+ * @wall: Start time (CLOCK_MONOTONIC)
+ * @self: Resource usage of the shell itself, which runs builtins
+ */
+struct timing_mark {
+  struct timespec wall;
+  struct rusage self;
+};
+
+/**
+ * timespec_seconds - Convert a timespec to seconds
+ * @ts: Time to convert
+ *
+ * Return: Seconds
+ */
+double timespec_seconds(const struct timespec *ts);
+
+/**
+ * timing_start - Take the snapshot a timed pipeline is measured against
+ * @mark: Output parameter - snapshot
+ */
+void timing_start(struct timing_mark *mark);
+
+/**
+ * timing_total - Work out the wall time and resource usage of a pipeline
+ * @mark: Snapshot taken by timing_start()
+ * @result: Result of the pipeline's job, NULL if only a builtin ran
+ * @real: Output parameter - wall time since the snapshot
+ * @total: Output parameter - the shell's own usage since the snapshot plus
+ * that of every stage, with the largest peak resident set size of any of them
+ */
+void timing_total(const struct timing_mark *mark,
+                  const struct job_result *result, struct timespec *real,
+                  struct rusage *total);
+
+/**
+ * timing_report - Print the resource usage of a timed pipeline to stderr
+ * @current_ctx: Shell context with the pipeline's commands
+ * @mark: Snapshot taken by timing_start()
+ * @result: Result of the pipeline's job, NULL if only a builtin ran
+ *
+ * Prints one line per stage with its wall, user and system time, peak resident
+ * set size, voluntary and involuntary context switches and exit status,
+ * followed by a total line. Time the shell spent running builtins counts
+ * towards the total.
+ */
+void timing_report(struct repl_ctx *current_ctx, const struct timing_mark *mark,
+                   const struct job_result *result);
+
+#endif
@@ -0,0 +1,45 @@
+/**
+ * watch.h
+ *
+ * Declares the on-change keyword's loop, which reruns a pipeline whenever
+ * watched files or directories change.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "context.h"
+#include "jobs.h"
+
+/**
+ * WATCH_DEBOUNCE_MS - Default quiet period after a change before the pipeline
+ * reruns
+ *
+ * Saving a file or checking out a branch comes as a burst of events, which
+ * should trigger one run rather than one per event.
+ */
+#define WATCH_DEBOUNCE_MS 100
+
+/**
+ * watch_run - Run a pipeline, then again every time a watched path changes
+ * @current_ctx: Shell context with the pipeline and the on-change settings
+ *
+ * Every run goes through exec(), so it is an ordinary foreground job with
+ * $? and $PIPESTATUS set. Between runs, the shell sleeps on an inotify
+ * descriptor, nothing is polled. Ctrl+C stops watching.
+ *
+ * Return: Result of the last exec(), 0 on success, -1 on error
+ */
+int watch_run(struct repl_ctx *current_ctx);
+
+/**
+ * watch_attach - Let a change cancel a job launched by watch_run()
+ * @job: Foreground job just created by exec
+ *
+ * Does nothing unless on-change runs with -c and the job has no other use for
+ * its io_fd. Otherwise, a change while the job runs sends it SIGTERM, and the
+ * pipeline reruns once the job is gone.
+ */
+void watch_attach(struct job *job);
+
+#endif
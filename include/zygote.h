@@ -0,0 +1,72 @@
+/**
+ * zygote.h
+ *
+ * Declares the zygote, a small helper process forked at startup that launches
+ * pipeline stages on the shell's behalf.
+ */
+
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "launch.h"
+
+/**
+ * ZYGOTE_MSG_MAX - Largest spawn request, in bytes
+ *
+ * Arguments and environment travel in a single message. Commands that don't
+ * fit are launched by the shell directly.
+ */
+#define ZYGOTE_MSG_MAX (128 * 1024)
+
+/**
+ * ZYGOTE_FALLBACK - Returned by zygote_spawn() for a stage the shell has to
+ * launch itself
+ */
+#define ZYGOTE_FALLBACK (-2)
+
+/**
+ * use_zygote - Global flag for launching commands through the zygote (-z)
+ */
+extern bool use_zygote;
+
+/**
+ * zygote_start - Fork the zygote
+ *
+ * Meant to be called first thing at startup, while the shell is still as small
+ * as it gets. If it fails, the shell launches everything itself.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int zygote_start(void);
+
+/**
+ * zygote_active - Check whether stages are launched through the zygote
+ *
+ * Return: true if the zygote is running, false otherwise
+ */
+bool zygote_active(void);
+
+/**
+ * zygote_spawn - Launch a pipeline stage through the zygote
+ * @stage: Description of the stage to launch
+ *
+ * The child is created with CLONE_PARENT, so it is the shell's child like any
+ * other stage: the shell gets its SIGCHLD, waits for it and opens its pidfd.
+ *
+ * Return: PID of the child on success, -1 on error, ZYGOTE_FALLBACK if the
+ * request doesn't fit in a message or the zygote is gone
+ */
+pid_t zygote_spawn(const struct stage_spawn *stage);
+
+/**
+ * zygote_detach - Stop using the zygote in a forked copy of the shell
+ *
+ * Children the zygote creates belong to the shell, not to the copy, which
+ * couldn't wait for them. The copy launches its stages itself instead.
+ */
+void zygote_detach(void);
+
+#endif
@@ -0,0 +1,251 @@
+/**
+ * batch.c
+ *
+ * Argument batching.
+ *
+ * OVERVIEW:
+ * exec fails with E2BIG when the arguments and environment of the new program
+ * don't fit in ARG_MAX (a quarter of the stack limit), and a single argument
+ * can't be longer than MAX_ARG_STRLEN. By then the child process already
+ * exists. The shell applies the same limits beforehand instead, which lets it
+ * report the error without creating a child, or split the arguments into
+ * batches that each fit and run the command once per batch, like xargs.
+ */
+
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "error.h"
+#include "jobs.h"
+#include "launch.h"
+
+extern char **environ;
+
+/* Longest single argument, in pages (MAX_ARG_STRLEN in the kernel) */
+#define ARG_STRLEN_PAGES 32
+
+/**
+ * arg_footprint - Bytes an argument takes up in ARG_MAX
+ * @arg: Argument
+ *
+ * Return: Length including the terminator, plus the argv pointer
+ */
+size_t arg_footprint(const char *arg) { return strlen(arg) + 1 + sizeof(arg); }
+
+/**
+ * arg_space - Bytes exec can take for the arguments of a new program
+ *
+ * ARG_MAX covers arguments and environment together, strings and pointer
+ * arrays alike, so the shell's current environment is subtracted.
+ *
+ * Return: Bytes available for arguments
+ */
+long arg_space(void) {
+  long space = sysconf(_SC_ARG_MAX);
+
+  /* POSIX guarantees at least this much */
+  if (space <= 0) {
+    space = _POSIX_ARG_MAX;
+  }
+
+  for (char **env = environ; *env; env++) {
+    space -= arg_footprint(*env);
+  }
+
+  /* The NULL pointers ending argv and envp */
+  space -= 2 * sizeof(char *);
+
+  return space - BATCH_HEADROOM;
+}
+
+/**
+ * arg_too_long - Check a single argument against MAX_ARG_STRLEN
+ * @arg: Argument
+ *
+ * Return: true if exec would refuse it no matter what else it gets
+ */
+bool arg_too_long(const char *arg) {
+  return strlen(arg) + 1 > (size_t)sysconf(_SC_PAGESIZE) * ARG_STRLEN_PAGES;
+}
+
+/**
+ * argv_too_long - Check whether exec would fail with E2BIG
+ * @argv: NULL-terminated argument array
+ *
+ * Applies the same accounting as the kernel, so a command that would only
+ * fail after the child has been created is caught before.
+ *
+ * Return: true if argv doesn't fit, false otherwise
+ */
+bool argv_too_long(char **argv) {
+  long space = arg_space();
+
+  for (unsigned int i = 0; argv[i]; i++) {
+    space -= arg_footprint(argv[i]);
+
+    if (space < 0 || arg_too_long(argv[i])) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * batch_prefix_count - Pick the words every batch of a command repeats
+ * @argv: NULL-terminated argument array of a command that is too long
+ *
+ * The program and the options right after it are repeated, everything from
+ * the first operand on is spread over batches. A "--" ends the options and is
+ * repeated too.
+ *
+ * Return: Number of words in the prefix
+ */
+unsigned int batch_prefix_count(char **argv) {
+  unsigned int count = 1;
+
+  while (argv[count] && argv[count][0] == '-' && argv[count][1]) {
+    if (strcmp(argv[count++], "--") == 0) {
+      break;
+    }
+  }
+
+  return count;
+}
+
+/**
+ * run_batch - Run one batch as a foreground job
+ * @cmd: Command being batched
+ * @argv: Arguments of the batch
+ *
+ * Return: Exit status of the batch, -1 if it couldn't be launched or was
+ * stopped
+ */
+int run_batch(const struct batch_command *cmd, char **argv) {
+  struct job *job = job_create(cmd->command, 1, false);
+  if (!job) {
+    return -1;
+  }
+
+  struct stage_spawn stage = {
+      .path = cmd->path,
+      .argv = argv,
+      .in_fd = cmd->in_fd,
+      .out_fd = cmd->out_fd,
+      .err_fd = -1,
+      .pgid = job->own_pgroup ? job->pgid : -1,
+      .tty_fd = job_control ? shell_terminal : -1,
+      .attrs = cmd->attrs,
+  };
+
+  pid_t pid = spawn_stage(&stage);
+
+  if (pid == -1 || job_add_process(job, pid) == -1) {
+    job_remove(job);
+    return -1;
+  }
+
+  if (stage.tty_fd != -1) {
+    tcsetpgrp(shell_terminal, job->pgid);
+  }
+
+  job_wait(job);
+
+  /* Consumed here, so $? reflects the whole run rather than the last batch */
+  const struct job_result *result = job_take_result();
+
+  if (!result || result->stages[0].stopped) {
+    return -1;
+  }
+
+  return result->stages[0].exit_code;
+}
+
+/**
+ * batch_run - Run a command in batches, one after another
+ * @cmd: Command and items
+ *
+ * Each batch is a foreground job of its own, so Ctrl+C and Ctrl+Z work as for
+ * any command. Ctrl+C or a stopped batch ends the run early.
+ *
+ * Return: 0 if every batch succeeded, 1 if any failed, -1 on error or if the
+ * run ended early
+ */
+int batch_run(const struct batch_command *cmd) {
+  long prefix_space = arg_space();
+
+  for (unsigned int i = 0; i < cmd->prefix_count; i++) {
+    prefix_space -= arg_footprint(cmd->prefix[i]);
+  }
+
+  if (prefix_space <= 0) {
+    error_msg("Argument list too long", false);
+    return -1;
+  }
+
+  char **argv =
+      malloc((cmd->prefix_count + cmd->items_count + 1) * sizeof(*argv));
+  if (!argv) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  memcpy(argv, cmd->prefix, cmd->prefix_count * sizeof(*argv));
+
+  int result = 0;
+  unsigned int next = 0;
+
+  while (next < cmd->items_count) {
+    long space = prefix_space;
+    unsigned int count = 0;
+
+    /* Greedily take items until the next one would not fit */
+    while (next + count < cmd->items_count &&
+           (!cmd->max_items || count < cmd->max_items)) {
+      const char *item = cmd->items[next + count];
+      long footprint = arg_footprint(item);
+
+      if (footprint > space || arg_too_long(item)) {
+        break;
+      }
+
+      argv[cmd->prefix_count + count] = (char *)item;
+      space -= footprint;
+      count++;
+    }
+
+    if (count == 0) {
+      char msg[ERR_MSG_MAX];
+      snprintf(msg, ERR_MSG_MAX, "Argument too long: %.64s...",
+               cmd->items[next]);
+      error_msg(msg, false);
+      result = -1;
+      break;
+    }
+
+    argv[cmd->prefix_count + count] = NULL;
+    next += count;
+
+    int status = run_batch(cmd, argv);
+
+    /* Interrupted or stopped, the user wants it to end */
+    if (status == -1 || status == 128 + SIGINT) {
+      result = -1;
+      break;
+    }
+
+    if (status != 0) {
+      result = 1;
+    }
+  }
+
+  free(argv);
+  return result;
+}
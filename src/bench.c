@@ -0,0 +1,731 @@
+/**
+ * bench.c
+ *
+ * Repeated, summarized timing of pipelines, for the bench keyword.
+ *
+ * OVERVIEW:
+ * "bench [-n RUNS] [-w WARMUPS] PIPELINE" runs PIPELINE WARMUPS times to warm
+ * caches, then RUNS times (BENCH_RUNS_DEFAULT without -n) while measuring
+ * each run, and reports the mean, standard deviation, minimum, maximum and
+ * 50th, 90th and 99th percentiles of the wall time, along with the mean user
+ * and system time and the peak resident set size.
+ *
+ * Runs go through exec() like any typed pipeline, so what is measured is the
+ * pipeline itself: no shell is started per run, as hyperfine has to, and its
+ * startup doesn't have to be estimated and subtracted. CPU time and memory
+ * come from the wait4() of every stage, as for the time keyword.
+ *
+ * COMPARING:
+ * Pipelines separated by "--vs" are benchmarked one after another, and the
+ * report ends with how many times slower each one is than the fastest. The
+ * command line is split on "--vs" before parsing, since the lexer has no
+ * quoting that could keep two pipelines apart.
+ *
+ * OUTPUT:
+ * The pipelines' stdout goes to /dev/null, unless -s is given, so the report
+ * isn't lost in it. The report goes to stderr like the time keyword's, or is
+ * appended to FILE with -o FILE, as a table or, with -j, a line of JSON.
+ * Ctrl+C stops the benchmark, and what was measured so far is reported.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "config.h"
+#include "error.h"
+#include "exec.h"
+#include "input.h"
+#include "parse.h"
+#include "profile.h"
+#include "signals.h"
+#include "timing.h"
+
+static const char bench_usage_msg[] =
+    "bench: usage: bench [-n RUNS] [-w WARMUPS] [-s] [-j] [-o FILE] PIPELINE "
+    "[--vs PIPELINE]...";
+
+/**
+ * bench_options - Options given to the bench keyword
+ * @runs: Measured runs per pipeline
+ * @warmups: Unmeasured runs before those
+ * @show_output: Whether the pipelines' stdout is kept (-s)
+ * @json: Whether the report is JSON rather than a table (-j)
+ * @output: File the report is appended to, NULL for stderr (-o)
+ */
+struct bench_options {
+  long runs;
+  long warmups;
+  bool show_output;
+  bool json;
+  char *output;
+};
+
+/**
+ * bench_result - Measurements of one pipeline
+ * @command: Pipeline as typed
+ * @wall: Wall time of each measured run, in seconds
+ * @count: Number of measured runs
+ * @failed: Runs that exited with a non-zero status
+ * @user: Total user time of the measured runs, in seconds
+ * @sys: Total system time of the measured runs, in seconds
+ * @maxrss: Largest peak resident set size of any run, in kilobytes
+ */
+struct bench_result {
+  char *command;
+  double *wall;
+  unsigned int count;
+  unsigned int failed;
+  double user;
+  double sys;
+  long maxrss;
+};
+
+/**
+ * bench_stats - Summary of the wall times of one pipeline
+ */
+struct bench_stats {
+  double mean;
+  double stddev;
+  double min;
+  double max;
+  double p50;
+  double p90;
+  double p99;
+};
+
+/**
+ * skip_blanks - Skip the blanks before the next word
+ * @str: Position in the command line
+ *
+ * Return: Start of the next word, or the end of the string
+ */
+const char *skip_blanks(const char *str) { return str + strspn(str, " \t"); }
+
+/**
+ * word_is - Check whether the word at a position is a given one
+ * @str: Start of the word
+ * @word: Word to compare with
+ *
+ * Return: true if the word at str is word, false otherwise
+ */
+bool word_is(const char *str, const char *word) {
+  const size_t len = strcspn(str, " \t");
+  return len == strlen(word) && strncmp(str, word, len) == 0;
+}
+
+/**
+ * next_word - Copy the word at a position and move past it
+ * @str: Position in the command line, moved past the word
+ *
+ * Return: Copy of the word, to be freed by the caller, NULL if there is none
+ * or on error
+ */
+char *next_word(const char **str) {
+  const char *start = skip_blanks(*str);
+  const size_t len = strcspn(start, " \t");
+
+  *str = start + len;
+
+  return len ? strndup(start, len) : NULL;
+}
+
+/**
+ * parse_bench_options - Parse the options after the bench keyword
+ * @str: Position after the keyword, moved to the first pipeline
+ * @options: Output parameter - options
+ *
+ * Return: 0 on success, -1 on a malformed option
+ */
+int parse_bench_options(const char **str, struct bench_options *options) {
+  for (;;) {
+    const char *word = skip_blanks(*str);
+
+    if (word[0] != '-' || word_is(word, BENCH_SEPARATOR)) {
+      return 0;
+    }
+
+    if (word_is(word, "-s") || word_is(word, "-j")) {
+      if (word[1] == 's') {
+        options->show_output = true;
+      } else {
+        options->json = true;
+      }
+      *str = word + 2;
+      continue;
+    }
+
+    char *flag = next_word(str);
+    char *value = next_word(str);
+    char *end = NULL;
+    int result = flag && value ? 0 : -1;
+
+    if (result == -1) {
+      /* Nothing to check */
+    } else if (strcmp(flag, "-n") == 0) {
+      options->runs = strtol(value, &end, 10);
+      result = *end == '\0' && options->runs > 0 ? 0 : -1;
+    } else if (strcmp(flag, "-w") == 0) {
+      options->warmups = strtol(value, &end, 10);
+      result = *end == '\0' && options->warmups >= 0 ? 0 : -1;
+    } else if (strcmp(flag, "-o") == 0) {
+      free(options->output);
+      options->output = value;
+      value = NULL;
+    } else {
+      result = -1;
+    }
+
+    free(flag);
+    free(value);
+
+    if (result == -1) {
+      return -1;
+    }
+  }
+}
+
+/**
+ * split_pipelines - Split the rest of the command line on BENCH_SEPARATOR
+ * @str: First pipeline
+ * @count: Output parameter - number of pipelines
+ *
+ * Return: NULL-terminated array of pipelines, NULL if one of them is empty or
+ * on error
+ */
+char **split_pipelines(const char *str, unsigned int *count) {
+  char **pipelines = calloc(strlen(str) / 2 + 2, sizeof(char *));
+  const char *start = skip_blanks(str);
+
+  if (!pipelines) {
+    error_msg(malloc_fail_msg, true);
+    return NULL;
+  }
+
+  *count = 0;
+
+  for (const char *word = start;; word = skip_blanks(word)) {
+    if (*word != '\0' && !word_is(word, BENCH_SEPARATOR)) {
+      word += strcspn(word, " \t");
+      continue;
+    }
+
+    /* The pipeline ends before the blanks leading up to the separator */
+    const char *end = word;
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+      end--;
+    }
+
+    if (end == start) {
+      break;
+    }
+
+    pipelines[*count] = strndup(start, end - start);
+    if (!pipelines[(*count)++]) {
+      error_msg(strdup_fail_msg, true);
+      break;
+    }
+
+    if (*word == '\0') {
+      return pipelines;
+    }
+
+    start = skip_blanks(word + strlen(BENCH_SEPARATOR));
+    word = start;
+  }
+
+  for (unsigned int i = 0; i < *count; i++) {
+    free(pipelines[i]);
+  }
+  free(pipelines);
+
+  return NULL;
+}
+
+/**
+ * prepare_pipeline - Parse a pipeline into the context, for exec()
+ * @current_ctx: Shell context, its previous command is freed
+ * @pipeline: Pipeline as typed
+ *
+ * Return: 0 on success, -1 on error
+ */
+int prepare_pipeline(struct repl_ctx *current_ctx, const char *pipeline) {
+  char *input = strdup(pipeline);
+  if (!input) {
+    error_msg(strdup_fail_msg, true);
+    set_exit_status(current_ctx, 1);
+    return -1;
+  }
+
+  cleanup_ctx(current_ctx);
+  current_ctx->input = input;
+
+  if (process_input(current_ctx) == -1) {
+    set_exit_status(current_ctx, 1);
+    return -1;
+  }
+
+  if (current_ctx->syntax_error) {
+    set_exit_status(current_ctx, SKIPPED_EXIT_CODE);
+    return -1;
+  }
+
+  if (current_ctx->is_background_process || current_ctx->is_deferred ||
+      current_ctx->is_benched || current_ctx->watch_paths) {
+    error_msg("bench: can't benchmark background, deferred, benchmarked or "
+              "watched pipelines",
+              false);
+    set_exit_status(current_ctx, SKIPPED_EXIT_CODE);
+    return -1;
+  }
+
+  rewrite_pipeline(current_ctx);
+
+  /* The shell has to stay around for the next run */
+  current_ctx->is_last_command = 0;
+
+  return 0;
+}
+
+/**
+ * measure_pipeline - Run the pipeline in the context repeatedly
+ * @current_ctx: Shell context, prepared by prepare_pipeline()
+ * @options: Options given to bench
+ * @result: Output parameter - measurements, its wall array allocated
+ *
+ * Return: 0 when every run was made, -1 if interrupted or on error
+ */
+int measure_pipeline(struct repl_ctx *current_ctx,
+                     const struct bench_options *options,
+                     struct bench_result *result) {
+  result->wall = calloc(options->runs, sizeof(double));
+  if (!result->wall) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  for (long i = 0; i < options->warmups + options->runs; i++) {
+    struct timespec real;
+    struct rusage usage;
+
+    if (exec_measured(current_ctx, &real, &usage) == -1) {
+      return -1;
+    }
+
+    const char *status = get_user_env("?", current_ctx->user_envs,
+                                      current_ctx->user_envs_count);
+    const int exit_code = status ? atoi(status) : 0;
+
+    /* Ctrl+C reaches the pipeline rather than the shell under job control */
+    if (sigint_received || exit_code == 128 + SIGINT) {
+      return -1;
+    }
+
+    if (i < options->warmups) {
+      continue;
+    }
+
+    result->wall[result->count++] = timespec_seconds(&real);
+    result->user += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    result->sys += usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+    if (usage.ru_maxrss > result->maxrss) {
+      result->maxrss = usage.ru_maxrss;
+    }
+
+    if (exit_code != 0) {
+      result->failed++;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * compare_doubles - qsort() comparison for ascending doubles
+ * @a: First value
+ * @b: Second value
+ *
+ * Return: Negative, zero or positive like strcmp()
+ */
+int compare_doubles(const void *a, const void *b) {
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * percentile - Nearest-rank percentile of sorted values
+ * @sorted: Values in ascending order
+ * @count: Number of values, at least 1
+ * @p: Percentile, from 0 to 100
+ *
+ * Return: Smallest value at least p percent of the values are at most
+ */
+double percentile(const double *sorted, unsigned int count, double p) {
+  unsigned int rank = (unsigned int)ceil(p / 100 * count);
+
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/**
+ * compute_stats - Summarize the wall times of a pipeline
+ * @result: Measurements, with at least one run
+ * @stats: Output parameter - summary
+ */
+void compute_stats(const struct bench_result *result,
+                   struct bench_stats *stats) {
+  const unsigned int n = result->count;
+  double sum = 0;
+  double squares = 0;
+
+  qsort(result->wall, n, sizeof(double), compare_doubles);
+
+  for (unsigned int i = 0; i < n; i++) {
+    sum += result->wall[i];
+  }
+
+  stats->mean = sum / n;
+
+  for (unsigned int i = 0; i < n; i++) {
+    const double deviation = result->wall[i] - stats->mean;
+    squares += deviation * deviation;
+  }
+
+  /* Sample standard deviation, the runs being a sample of all possible runs */
+  stats->stddev = n > 1 ? sqrt(squares / (n - 1)) : 0;
+  stats->min = result->wall[0];
+  stats->max = result->wall[n - 1];
+  stats->p50 = percentile(result->wall, n, 50);
+  stats->p90 = percentile(result->wall, n, 90);
+  stats->p99 = percentile(result->wall, n, 99);
+}
+
+/**
+ * find_fastest - Find the pipeline with the lowest mean wall time
+ * @stats: Summary of each pipeline
+ * @results: Measurements of each pipeline
+ * @count: Number of pipelines
+ *
+ * Return: Index of the fastest pipeline with runs, -1 if none has any
+ */
+int find_fastest(const struct bench_stats *stats,
+                 const struct bench_result *results, unsigned int count) {
+  int fastest = -1;
+
+  for (unsigned int i = 0; i < count; i++) {
+    if (results[i].count > 0 &&
+        (fastest == -1 || stats[i].mean < stats[fastest].mean)) {
+      fastest = (int)i;
+    }
+  }
+
+  return fastest;
+}
+
+/**
+ * slowdown - How many times slower a pipeline is than another
+ * @slow: Summary of the slower pipeline
+ * @fast: Summary of the faster pipeline
+ * @error: Output parameter - standard deviation of the ratio
+ *
+ * Return: Ratio of the mean wall times
+ */
+double slowdown(const struct bench_stats *slow, const struct bench_stats *fast,
+                double *error) {
+  const double ratio = slow->mean / fast->mean;
+
+  /* Relative errors add up in quadrature for a quotient */
+  *error = ratio * sqrt(pow(slow->stddev / slow->mean, 2) +
+                        pow(fast->stddev / fast->mean, 2));
+
+  return ratio;
+}
+
+/**
+ * bench_table - Print the report as a table
+ * @stream: Stream to print to
+ * @results: Measurements of each pipeline
+ * @stats: Summary of each pipeline
+ * @count: Number of pipelines
+ * @options: Options given to bench
+ */
+void bench_table(FILE *stream, const struct bench_result *results,
+                 const struct bench_stats *stats, unsigned int count,
+                 const struct bench_options *options) {
+  for (unsigned int i = 0; i < count; i++) {
+    const struct bench_result *result = &results[i];
+    const struct bench_stats *stat = &stats[i];
+
+    fprintf(stream, "%u: %s\n", i + 1, result->command);
+
+    if (result->count == 0) {
+      fprintf(stream, "  no runs\n");
+      continue;
+    }
+
+    fprintf(stream,
+            "  wall  mean %.4fs ± %.4fs  min %.4fs  max %.4fs\n"
+            "        p50 %.4fs  p90 %.4fs  p99 %.4fs\n"
+            "  cpu   user %.4fs  sys %.4fs  maxrss %ldK (means per run)\n"
+            "  runs  %u, %ld warmups, %u failed\n",
+            stat->mean, stat->stddev, stat->min, stat->max, stat->p50,
+            stat->p90, stat->p99, result->user / result->count,
+            result->sys / result->count, result->maxrss, result->count,
+            options->warmups, result->failed);
+  }
+
+  int fastest = find_fastest(stats, results, count);
+
+  if (count < 2 || fastest == -1) {
+    return;
+  }
+
+  fprintf(stream, "fastest: %d\n", fastest + 1);
+
+  for (unsigned int i = 0; i < count; i++) {
+    double error;
+
+    if ((int)i == fastest || results[i].count == 0) {
+      continue;
+    }
+
+    const double ratio = slowdown(&stats[i], &stats[fastest], &error);
+    fprintf(stream, "  %u is %.2f ± %.2f times slower\n", i + 1, ratio, error);
+  }
+}
+
+/**
+ * bench_json - Print the report as a single line of JSON
+ * @stream: Stream to print to
+ * @results: Measurements of each pipeline
+ * @stats: Summary of each pipeline
+ * @count: Number of pipelines
+ * @options: Options given to bench
+ *
+ * Times are in seconds, and summaries are null for pipelines without runs.
+ */
+void bench_json(FILE *stream, const struct bench_result *results,
+                const struct bench_stats *stats, unsigned int count,
+                const struct bench_options *options) {
+  fprintf(stream, "{\"benchmarks\":[");
+
+  for (unsigned int i = 0; i < count; i++) {
+    const struct bench_result *result = &results[i];
+    const struct bench_stats *stat = &stats[i];
+
+    fprintf(stream, "%s{\"command\":", i ? "," : "");
+    print_json_string(stream, result->command);
+    fprintf(stream, ",\"runs\":%u,\"warmups\":%ld,\"failed\":%u",
+            result->count, options->warmups, result->failed);
+
+    if (result->count == 0) {
+      fprintf(stream, ",\"wall\":null,\"user\":null,\"sys\":null,"
+                      "\"maxrss_kb\":null,\"times\":[]}");
+      continue;
+    }
+
+    fprintf(stream,
+            ",\"wall\":{\"mean\":%.6f,\"stddev\":%.6f,\"min\":%.6f,"
+            "\"max\":%.6f,\"p50\":%.6f,\"p90\":%.6f,\"p99\":%.6f}"
+            ",\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,\"times\":[",
+            stat->mean, stat->stddev, stat->min, stat->max, stat->p50,
+            stat->p90, stat->p99, result->user / result->count,
+            result->sys / result->count, result->maxrss);
+
+    for (unsigned int j = 0; j < result->count; j++) {
+      fprintf(stream, "%s%.6f", j ? "," : "", result->wall[j]);
+    }
+
+    fprintf(stream, "]}");
+  }
+
+  int fastest = find_fastest(stats, results, count);
+
+  if (fastest == -1) {
+    fprintf(stream, "],\"fastest\":null}\n");
+  } else {
+    fprintf(stream, "],\"fastest\":%d}\n", fastest + 1);
+  }
+}
+
+/**
+ * bench_report - Print the report where the options asked for it
+ * @results: Measurements of each pipeline
+ * @count: Number of pipelines
+ * @options: Options given to bench
+ */
+void bench_report(struct bench_result *results, unsigned int count,
+                  const struct bench_options *options) {
+  struct bench_stats *stats = calloc(count, sizeof(struct bench_stats));
+  FILE *stream = stderr;
+
+  if (!stats) {
+    error_msg(malloc_fail_msg, true);
+    return;
+  }
+
+  for (unsigned int i = 0; i < count; i++) {
+    if (results[i].count > 0) {
+      compute_stats(&results[i], &stats[i]);
+    }
+  }
+
+  if (options->output) {
+    stream = fopen(options->output, "ae");
+    if (!stream) {
+      error_msg(open_fail_msg, true);
+      free(stats);
+      return;
+    }
+  }
+
+  if (options->json) {
+    bench_json(stream, results, stats, count, options);
+  } else {
+    bench_table(stream, results, stats, count, options);
+  }
+
+  if (stream != stderr) {
+    fclose(stream);
+  }
+
+  free(stats);
+}
+
+/**
+ * silence_stdout - Point stdout at /dev/null for the duration of the runs
+ *
+ * Return: Copy of the original stdout to restore, -1 on error
+ */
+int silence_stdout(void) {
+  fflush(stdout);
+
+  int saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+  int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+  if (saved == -1 || null_fd == -1 || dup2(null_fd, STDOUT_FILENO) == -1) {
+    error_msg("bench: failed to redirect output to /dev/null", true);
+    if (saved != -1) {
+      close(saved);
+    }
+    if (null_fd != -1) {
+      close(null_fd);
+    }
+    return -1;
+  }
+
+  close(null_fd);
+
+  return saved;
+}
+
+/**
+ * restore_stdout - Undo silence_stdout()
+ * @saved: Descriptor returned by silence_stdout()
+ */
+void restore_stdout(int saved) {
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+}
+
+/**
+ * bench_run - Benchmark the pipelines of a bench command line
+ * @current_ctx: Shell context, with the bench keyword parsed from input
+ *
+ * Usage: bench [-n RUNS] [-w WARMUPS] [-s] [-j] [-o FILE] PIPELINE
+ * [--vs PIPELINE]...
+ *
+ * Each pipeline is parsed like typed input and run through exec() WARMUPS
+ * times, then RUNS times measured. The context is left holding the last
+ * pipeline, for cleanup_ctx(), and $? holding its last status. A usage error
+ * sets $? to SKIPPED_EXIT_CODE.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int bench_run(struct repl_ctx *current_ctx) {
+  struct bench_options options = {.runs = BENCH_RUNS_DEFAULT,
+                                  .warmups = 0,
+                                  .show_output = false,
+                                  .json = false,
+                                  .output = NULL};
+  const char *line = skip_blanks(current_ctx->input);
+  unsigned int count = 0;
+
+  /* The pipelines are split from the text, so bench has to be the first word */
+  if (!word_is(line, "bench")) {
+    error_msg("bench: has to come before the other keywords", false);
+    set_exit_status(current_ctx, SKIPPED_EXIT_CODE);
+    return -1;
+  }
+
+  line += strlen("bench");
+
+  char **pipelines = NULL;
+
+  if (parse_bench_options(&line, &options) == -1 ||
+      !(pipelines = split_pipelines(line, &count))) {
+    error_msg(bench_usage_msg, false);
+    set_exit_status(current_ctx, SKIPPED_EXIT_CODE);
+    free(options.output);
+    return -1;
+  }
+
+  struct bench_result *results = calloc(count, sizeof(struct bench_result));
+  int saved_stdout = -1;
+  int status = 0;
+
+  if (!results) {
+    error_msg(malloc_fail_msg, true);
+    status = -1;
+  } else if (!options.show_output && (saved_stdout = silence_stdout()) == -1) {
+    status = -1;
+  }
+
+  if (status == -1) {
+    set_exit_status(current_ctx, 1);
+  }
+
+  sigint_received = 0;
+
+  for (unsigned int i = 0; status == 0 && i < count; i++) {
+    results[i].command = pipelines[i];
+
+    if (prepare_pipeline(current_ctx, pipelines[i]) == -1 ||
+        measure_pipeline(current_ctx, &options, &results[i]) == -1) {
+      status = -1;
+    }
+  }
+
+  if (saved_stdout != -1) {
+    restore_stdout(saved_stdout);
+  }
+
+  /* Whatever was measured before an interruption is still worth seeing */
+  if (results) {
+    bench_report(results, count, &options);
+
+    for (unsigned int i = 0; i < count; i++) {
+      free(results[i].wall);
+    }
+  }
+
+  for (unsigned int i = 0; i < count; i++) {
+    free(pipelines[i]);
+  }
+
+  free(pipelines);
+  free(results);
+  free(options.output);
+
+  return status;
+}
@@ -0,0 +1,326 @@
+/**
+ * builtin_stage.c
+ *
+ * Builtins as pipeline stages.
+ *
+ * OVERVIEW:
+ * A builtin can appear anywhere in a pipeline, with its stdin and stdout
+ * connected like those of any other stage. Where it runs depends on what it
+ * does (see builtin_kind):
+ * - The last stage runs in the shell after every other stage was launched,
+ *   like the in-process cat stage, so "... | cd DIR" or "... | exit" act on
+ *   the shell itself
+ * - Pure builtins elsewhere run on a thread, writing straight into the pipe
+ * - Other builtins elsewhere run in a forked child, as in a subshell
+ *
+ * The shell's stdin and stdout are process-wide, so a builtin running on a
+ * thread can't have them redirected: pure builtins print to builtin_output()
+ * instead, which is the thread's end of the pipe.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "builtin_stage.h"
+#include "builtins.h"
+#include "error.h"
+#include "jobs.h"
+#include "path_cache.h"
+#include "stage_attrs.h"
+#include "zygote.h"
+
+/* Redirections of a stage context, which has none of its own */
+static char *no_stream_name[1];
+static int no_stream_type[1];
+static struct out_fanout *no_fanout[1];
+
+/**
+ * stage_ctx - Make a context in which one stage is the whole command
+ * @current_ctx: Shell context with the pipeline
+ * @index: Stage of the pipeline
+ * @stage: Output parameter - context for the stage
+ *
+ * Builtins only look at the first command of the context they are given, and
+ * at its redirections. Those were opened for the whole pipeline already, so
+ * the stage's context has none.
+ */
+void stage_ctx(struct repl_ctx *current_ctx, unsigned int index,
+               struct repl_ctx *stage) {
+  *stage = *current_ctx;
+
+  stage->commands = &current_ctx->commands[index];
+  stage->unparsed_commands = &current_ctx->unparsed_commands[index];
+  stage->args_count = &current_ctx->args_count[index];
+  stage->commands_count = 1;
+  stage->in_stream_name = no_stream_name;
+  stage->out_stream_name = no_stream_name;
+  stage->out_stream_type = no_stream_type;
+  stage->out_fanout = no_fanout;
+  stage->is_background_process = 0;
+  stage->is_last_command = 0;
+}
+
+/**
+ * redirect_shell - Point the shell's own stdin and stdout elsewhere
+ * @in_fd: Descriptor to use as stdin, -1 to leave stdin alone
+ * @out_fd: Descriptor to use as stdout, -1 to leave stdout alone
+ * @saved: Output parameter - copies of the original stdin and stdout, for
+ * restore_shell()
+ *
+ * Return: 0 on success, -1 on error (nothing is left redirected)
+ */
+int redirect_shell(int in_fd, int out_fd, int saved[2]) {
+  /* Output the shell buffered so far belongs to the old stdout */
+  fflush(stdout);
+
+  saved[0] = in_fd != -1 ? fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10) : -1;
+  saved[1] = out_fd != -1 ? fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10) : -1;
+
+  if ((in_fd != -1 && (saved[0] == -1 || dup2(in_fd, STDIN_FILENO) == -1)) ||
+      (out_fd != -1 && (saved[1] == -1 || dup2(out_fd, STDOUT_FILENO) == -1))) {
+    error_msg(dup2_fail_msg, true);
+    restore_shell(saved);
+    return -1;
+  }
+
+  /* Input buffered from the old stdin must not be read from the new one */
+  if (in_fd != -1) {
+    __fpurge(stdin);
+  }
+
+  return 0;
+}
+
+/**
+ * restore_shell - Undo redirect_shell()
+ * @saved: Copies saved by redirect_shell()
+ */
+void restore_shell(int saved[2]) {
+  fflush(stdout);
+
+  if (saved[0] != -1) {
+    __fpurge(stdin);
+    clearerr(stdin);
+    dup2(saved[0], STDIN_FILENO);
+    close(saved[0]);
+    saved[0] = -1;
+  }
+
+  if (saved[1] != -1) {
+    dup2(saved[1], STDOUT_FILENO);
+    close(saved[1]);
+    saved[1] = -1;
+  }
+}
+
+/**
+ * run_builtin_here - Run a builtin stage in the shell itself
+ * @builtin: Table entry of the builtin
+ * @current_ctx: Shell context with the pipeline
+ * @index: Stage of the pipeline
+ * @in_fd: Descriptor to use as stdin, -1 for the shell's
+ * @out_fd: Descriptor to use as stdout, -1 for the shell's
+ *
+ * Whatever the builtin changes about the shell sticks, the shell exits after
+ * an exit stage just as after a plain exit.
+ *
+ * Return: Return value of the builtin (1 on success, -1 on error)
+ */
+int run_builtin_here(const struct command_associations *builtin,
+                     struct repl_ctx *current_ctx, unsigned int index,
+                     int in_fd, int out_fd) {
+  struct repl_ctx stage;
+  int saved[2];
+
+  if (redirect_shell(in_fd, out_fd, saved) == -1) {
+    return -1;
+  }
+
+  stage_ctx(current_ctx, index, &stage);
+
+  int result = builtin->command_function(&stage);
+
+  /* The only part of the context a builtin changes for good */
+  current_ctx->receiving = stage.receiving;
+
+  restore_shell(saved);
+
+  return result;
+}
+
+/**
+ * builtin_exit_code - Exit status of a builtin stage
+ * @result: Return value of the builtin
+ *
+ * Return: NOT_FOUND_EXIT_CODE if the builtin failed to find a program, 1 if it
+ * failed otherwise, 0 if it succeeded
+ */
+int builtin_exit_code(int result) {
+  const bool not_found = path_cache_take_miss();
+
+  if (result != -1) {
+    return 0;
+  }
+
+  return not_found ? NOT_FOUND_EXIT_CODE : 1;
+}
+
+/**
+ * builtin_thread - Body of the thread started by start_builtin_thread()
+ * @arg: The builtin_stage
+ *
+ * Return: NULL always
+ */
+void *builtin_thread(void *arg) {
+  struct builtin_stage *stage = arg;
+
+  builtin_stdout = fdopen(stage->out_fd, "w");
+  if (!builtin_stdout) {
+    close(stage->out_fd);
+    stage->exit_code = 1;
+    return NULL;
+  }
+
+  stage->exit_code =
+      builtin_exit_code(stage->builtin->command_function(&stage->ctx));
+
+  getrusage(RUSAGE_THREAD, &stage->usage);
+
+  /* Also closes out_fd, the next stage sees EOF right away */
+  fclose(builtin_stdout);
+  builtin_stdout = NULL;
+
+  return NULL;
+}
+
+/**
+ * start_builtin_thread - Run a pure builtin stage on a thread of the shell
+ * @stage: Stage with builtin, ctx, out_fd and slot filled in
+ *
+ * The thread owns out_fd and closes it as soon as the builtin returns, which
+ * is what the next stage sees EOF on. Signals are blocked on the thread, so
+ * they keep being handled by the shell's main thread.
+ *
+ * Return: 0 on success, -1 on error (out_fd is still the caller's)
+ */
+int start_builtin_thread(struct builtin_stage *stage) {
+  sigset_t all_signals;
+  sigset_t old_mask;
+
+  /* The new thread inherits the mask it is created with */
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+  int err = pthread_create(&stage->thread, NULL, builtin_thread, stage);
+
+  pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+  return err == 0 ? 0 : -1;
+}
+
+/**
+ * fork_builtin - Run a builtin stage in a child process
+ * @builtin: Table entry of the builtin
+ * @ctx: Context in which the stage is the whole command
+ * @stage: Descriptors, process group, terminal and attributes of the child
+ * (path and argv are unused)
+ * @job: Job the stage belongs to
+ *
+ * The child is a copy of the shell that runs the builtin and exits with its
+ * status. Changes the builtin makes to the shell's state are lost with it, as
+ * in a subshell. It has no jobs, unless the builtin only looks at them.
+ *
+ * Return: PID of the child on success, -1 on error
+ */
+pid_t fork_builtin(const struct command_associations *builtin,
+                   struct repl_ctx *ctx, const struct stage_spawn *stage,
+                   struct job *job) {
+  static const int reset_signals[] = {SIGINT,  SIGPIPE, SIGQUIT,
+                                      SIGTSTP, SIGTTIN, SIGTTOU};
+
+  fflush(stdout);
+  fflush(stderr);
+
+  pid_t pid = fork();
+
+  if (pid == -1) {
+    error_msg("Failed to fork", true);
+    return -1;
+  }
+
+  if (pid > 0) {
+    return pid;
+  }
+
+  /* Same setup as spawn_stage() describes with file actions and attributes */
+  if (stage->pgid != -1) {
+    setpgid(0, stage->pgid);
+  }
+
+  /* Before SIGTTOU is reset, as the child isn't in the foreground yet */
+  if (stage->tty_fd != -1) {
+    tcsetpgrp(stage->tty_fd, getpgrp());
+  }
+
+  if ((stage->in_fd != -1 && dup2(stage->in_fd, STDIN_FILENO) == -1) ||
+      (stage->out_fd != -1 && dup2(stage->out_fd, STDOUT_FILENO) == -1) ||
+      (stage->err_fd != -1 && dup2(stage->err_fd, STDERR_FILENO) == -1)) {
+    error_msg(dup2_fail_msg, true);
+    _exit(EXIT_FAILURE);
+  }
+
+  __fpurge(stdin);
+
+  /*
+   * The shell's copies of pipe ends (its own, and those of thread stages)
+   * would keep the child's neighbours from ever seeing EOF.
+   */
+  if (close_range(STDERR_FILENO + 1, ~0U, 0) == -1) {
+    for (long fd = STDERR_FILENO + 1; fd < sysconf(_SC_OPEN_MAX); fd++) {
+      close(fd);
+    }
+  }
+
+  path_cache_detach();
+
+  if (builtin->kind == BUILTIN_SEES_JOBS) {
+    jobs_snapshot(job);
+  } else {
+    jobs_detach();
+  }
+  zygote_detach();
+
+  /* SIGCHLD stays handled, builtins such as xargs still wait for children */
+  for (size_t i = 0; i < sizeof(reset_signals) / sizeof(*reset_signals); i++) {
+    signal(reset_signals[i], SIG_DFL);
+  }
+
+  sigset_t empty_mask;
+  sigemptyset(&empty_mask);
+  sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+
+  const char *failed_attr =
+      stage->attrs ? apply_stage_attrs(stage->attrs) : NULL;
+
+  if (failed_attr) {
+    char msg[ERR_MSG_MAX];
+    snprintf(msg, ERR_MSG_MAX, "%s: Failed to set %s", ctx->commands[0][0],
+             failed_attr);
+    error_msg(msg, true);
+    _exit(EXIT_FAILURE);
+  }
+
+  int result = builtin->command_function(ctx);
+
+  fflush(stdout);
+  fflush(stderr);
+
+  /* Skips atexit handlers and stdio buffers that belong to the shell */
+  _exit(builtin_exit_code(result));
+}
@@ -10,16 +10,41 @@
  * Some of these built-ins are only used to randomly override expected output of
  * common commands. An example being cat, which prints an ASCII cat picture 10%
  * of the time that the user tries to run cat to concatenate files.
+ *
+ * The rest of the time, cat runs inside the shell as a pipeline stage (see
+ * cat_stage), moving data with in-kernel copies instead of launching a
+ * process.
  */
 
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "batch.h"
 #include "builtins.h"
 #include "error.h"
+#include "exec.h"
+#include "options.h"
+#include "parse.h"
+#include "path_cache.h"
+#include "relay.h"
+#include "signals.h"
 #include "tease.h"
 
+_Thread_local FILE *builtin_stdout;
+
+/**
+ * builtin_output - Stream a builtin prints to
+ *
+ * Return: builtin_stdout on a builtin stage's thread, stdout otherwise
+ */
+FILE *builtin_output(void) { return builtin_stdout ? builtin_stdout : stdout; }
+
 /**
  * cat - Joke version of cat command
  * @current_ctx: Shell context (for user name)
@@ -27,7 +52,7 @@
  * 10% of the time, an ASCII cat will be printed when users try to run the cat
  * command from GNU Coreutils.
  *
- * Return: 0 if normal cat should run instead, 1 otherwise
+ * Return: 0 if the cat stage should run instead, 1 otherwise
  */
 int cat(struct repl_ctx *current_ctx) {
   if (!teasing_enabled) {
@@ -47,6 +72,130 @@ int cat(struct repl_ctx *current_ctx) {
   return 0;
 }
 
+/**
+ * cat_in_process - Check whether a cat stage can run inside the shell
+ * @args: Arguments of the stage, args[0] is "cat"
+ * @stdin_is_terminal: Whether the stage would read from the terminal
+ *
+ * Options aren't implemented, so "cat -n" and friends still launch the real
+ * cat. Neither does reading the terminal: the terminal belongs to the job
+ * while it runs, and the shell isn't part of it.
+ *
+ * Return: true if cat_stage() can handle the stage, false otherwise
+ */
+bool cat_in_process(char **args, bool stdin_is_terminal) {
+  if (strcmp(args[0], "cat") != 0) {
+    return false;
+  }
+
+  bool reads_stdin = !args[1];
+
+  for (unsigned int i = 1; args[i]; i++) {
+    if (strcmp(args[i], "-") == 0) {
+      reads_stdin = true;
+    } else if (args[i][0] == '-') {
+      return false;
+    }
+  }
+
+  return !(reads_stdin && stdin_is_terminal);
+}
+
+/**
+ * cat_relay - Copy one file of a cat stage, which a stop of its job may move
+ * to a child
+ * @fd: File to copy
+ * @in_fd: Descriptor the stage uses as stdin
+ * @out_fd: Descriptor to write to
+ * @failed_side: Output parameter - side that failed on error
+ *
+ * Under job control, the shell can't stop along with the job, so it forks a
+ * child that carries on with the copy and stops in its place (see
+ * job_stage_detachable()). The shell is then done with the stage.
+ *
+ * Return: Same as relay_fd(), 0 in the shell once a child took over
+ */
+ssize_t cat_relay(int fd, int in_fd, int out_fd,
+                  enum relay_side *failed_side) {
+  const int keep[] = {fd, in_fd, out_fd};
+  sigjmp_buf detach_point;
+
+  if (sigsetjmp(detach_point, 1) != 0) {
+    return 0;
+  }
+
+  job_stage_detachable(&detach_point, keep, sizeof(keep) / sizeof(*keep));
+  const ssize_t copied = relay_fd(fd, out_fd, failed_side);
+  job_stage_detachable(NULL, NULL, 0);
+
+  return copied;
+}
+
+/**
+ * cat_stage - Concatenate files to a descriptor without launching a process
+ * @args: Arguments of the stage, args[0] is "cat"
+ * @in_fd: Descriptor to use as stdin, -1 for the shell's
+ * @out_fd: Descriptor to write to, -1 for the shell's stdout
+ *
+ * Each file (or stdin for "-" or no arguments) is moved with relay_fd(), which
+ * uses copy_file_range(), splice() or sendfile() depending on what the source
+ * and destination are. A file that can't be opened or read is reported and
+ * skipped, like cat does.
+ *
+ * Return: Exit status, 0 on success, 1 if any file failed
+ */
+int cat_stage(char **args, int in_fd, int out_fd) {
+  /* Without arguments, cat copies stdin */
+  static char *stdin_only[] = {"cat", "-", NULL};
+  int status = 0;
+
+  if (!args[1]) {
+    args = stdin_only;
+  }
+
+  if (in_fd == -1) {
+    in_fd = STDIN_FILENO;
+  }
+
+  if (out_fd == -1) {
+    /* Anything the shell printed must come out before the data */
+    fflush(stdout);
+    out_fd = STDOUT_FILENO;
+  }
+
+  /*
+   * Ctrl+C stops the whole command, not just the current file. Once a child
+   * took the stage over, the rest of the files are its to copy.
+   */
+  for (unsigned int i = 1;
+       args[i] && !sigint_received && job_stage_taken_over() <= 0; i++) {
+    const bool use_stdin = strcmp(args[i], "-") == 0;
+    int fd = use_stdin ? in_fd : open(args[i], O_RDONLY | O_CLOEXEC);
+    enum relay_side failed_side = RELAY_READ;
+
+    if (fd == -1 || cat_relay(fd, in_fd, out_fd, &failed_side) == -1) {
+      char msg[ERR_MSG_MAX];
+
+      if (failed_side == RELAY_WRITE) {
+        snprintf(msg, ERR_MSG_MAX, "cat: write error");
+      } else {
+        snprintf(msg, ERR_MSG_MAX, "cat: %s", args[i]);
+      }
+
+      if (!sigint_received) {
+        error_msg(msg, true);
+      }
+      status = 1;
+    }
+
+    if (fd != -1 && !use_stdin) {
+      close(fd);
+    }
+  }
+
+  return status;
+}
+
 /**
  * cd - Change directory builtin
  * @current_ctx: Shell context with command arguments
@@ -96,36 +245,407 @@ int cler(struct repl_ctx *current_ctx) {
   return 1;
 }
 
+/**
+ * exec_command - Replace the shell with a command, or redirect the shell
+ * @current_ctx: Shell context with command arguments
+ *
+ * "exec COMMAND [ARGS...]" runs COMMAND in place of the shell, without forking,
+ * with any "<", ">" or ">>" redirection applied. Without a command, the
+ * redirections are applied to the shell itself and stay in effect for every
+ * command that follows.
+ *
+ * Return: 1 on success, -1 on error (only returns with a command on error)
+ */
+int exec_command(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+  const char *path = NULL;
+
+  /* Nothing would be left to run the relay copying the output */
+  if (current_ctx->out_fanout[0]) {
+    error_msg("exec: output can only be redirected to one file", false);
+    return -1;
+  }
+
+  if (args[1]) {
+    path_cache_sync();
+    path = path_cache_lookup(args[1]);
+
+    if (!path) {
+      char msg[ERR_MSG_MAX];
+      snprintf(msg, ERR_MSG_MAX, "exec: %s: not found", args[1]);
+      error_msg(msg, false);
+      return -1;
+    }
+  }
+
+  const char *in_name = current_ctx->in_stream_name[0];
+  const char *out_name = current_ctx->out_stream_name[0];
+  int in_fd = -1;
+  int out_fd = -1;
+
+  if (in_name) {
+    in_fd = open(in_name, O_RDONLY | O_CLOEXEC);
+  }
+
+  if (out_name && (!in_name || in_fd != -1)) {
+    out_fd = open(out_name,
+                  O_WRONLY | current_ctx->out_stream_type[0] | O_CREAT |
+                      O_CLOEXEC,
+                  0644);
+  }
+
+  int result = -1;
+
+  if ((in_name && in_fd == -1) || (out_name && out_fd == -1)) {
+    error_msg(open_fail_msg, true);
+  } else if (path) {
+    result = exec_in_place(path, args + 1, in_fd, out_fd);
+  } else {
+    /* Output the shell buffered so far belongs to the old stdout */
+    fflush(stdout);
+
+    result = 1;
+
+    if ((in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1) ||
+        (out_fd != -1 && dup2(out_fd, STDOUT_FILENO) == -1)) {
+      error_msg(dup2_fail_msg, true);
+      result = -1;
+    }
+  }
+
+  if (in_fd != -1) {
+    close(in_fd);
+  }
+
+  if (out_fd != -1) {
+    close(out_fd);
+  }
+
+  return result;
+}
+
 /**
  * exit_builtin - Exit the shell
  * @current_ctx: Shell context
  *
  * Stops the REPL loop by setting receiving to 0. If we simply called exit(), we
- * would be skipping cleanup.
+ * would be skipping cleanup. Coprocesses are ended here, so they don't outlive
+ * the shell waiting for input that will never come, and deferred pipelines
+ * that never started are dropped.
  *
  * Return: 1 always
  */
 int exit_builtin(struct repl_ctx *current_ctx) {
+  coproc_close_all();
+  queue_drop_all();
   current_ctx->receiving = 0;
   printf("Finally giving up, %s?\n", current_ctx->user);
   return 1;
 }
 
+/**
+ * hash - Inspect or reset the command lookup cache
+ * @current_ctx: Shell context with command arguments
+ *
+ * With no arguments, lists every cached command with its hit count. "hash -r"
+ * forgets every cached command, "hash NAME..." looks up and remembers each
+ * NAME.
+ *
+ * Return: 1 on success, -1 if a NAME couldn't be found, which makes $?
+ * NOT_FOUND_EXIT_CODE
+ */
+int hash(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+
+  if (!args[1]) {
+    if (path_cache_print() == 0) {
+      printf("hash: table empty\n");
+    }
+    return 1;
+  }
+
+  if (strcmp(args[1], "-r") == 0) {
+    path_cache_reset();
+    return 1;
+  }
+
+  path_cache_sync();
+
+  int result = 1;
+
+  for (unsigned int i = 1; args[i]; i++) {
+    if (!path_cache_lookup(args[i])) {
+      path_cache_not_found(args[i]);
+      result = -1;
+    }
+  }
+
+  return result;
+}
+
+/**
+ * set_builtin - List or change shell options
+ * @current_ctx: Shell context with command arguments
+ *
+ * "set -o" lists every option, "set -o NAME" enables NAME and "set +o NAME"
+ * disables it.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int set_builtin(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+
+  if (!args[1] || (strcmp(args[1], "-o") != 0 && strcmp(args[1], "+o") != 0)) {
+    error_msg("set: usage: set -o | set -o NAME... | set +o NAME...", false);
+    return -1;
+  }
+
+  if (!args[2]) {
+    options_print();
+    return 1;
+  }
+
+  int result = 1;
+
+  for (unsigned int i = 2; args[i]; i++) {
+    if (option_set(args[i], args[1][0] == '-') == -1) {
+      char msg[ERR_MSG_MAX];
+      snprintf(msg, ERR_MSG_MAX, "set: %s: invalid option name", args[i]);
+      error_msg(msg, false);
+      result = -1;
+    }
+  }
+
+  return result;
+}
+
 /**
  * help - Display builtins (maybe)
  * 
  * Return: 1 always
  */
 int help(struct repl_ctx *current_ctx) {
+  FILE *out = builtin_output();
+
   if (!teasing_enabled) {
-    printf("cd - change directory\n");
-    printf("exit - exit shell\n");
-    printf("help - display this message\n");
+    fprintf(out, "cd - change directory\n");
+    fprintf(out, "bg [job...] - resume jobs in the background\n");
+    fprintf(out, "coproc [-n NAME] command... - "
+                 "start a command connected by two pipes\n");
+    fprintf(out, "disown [job...] - stop tracking jobs\n");
+    fprintf(out, "exec [command...] - replace the shell, or redirect it\n");
+    fprintf(out, "exit - exit shell\n");
+    fprintf(out, "fg [job] - resume a job in the foreground\n");
+    fprintf(out, "hash [-r] [name...] - "
+                 "show, reset or fill the command cache\n");
+    fprintf(out, "help - display this message\n");
+    fprintf(out, "jobs [-l|-p] - list jobs\n");
+    fprintf(out, "jobs top [-d INTERVAL] [-n COUNT] - "
+                 "show CPU, memory and I/O of jobs\n");
+    fprintf(out, "kill [-SIGNAL] target... - signal jobs (%%n) or processes\n");
+    fprintf(out, "memo [-r] [-i FILE]... [-e NAME]... command... - "
+                 "cache and replay output\n");
+    fprintf(out, "parallel [-j N] [-k] command... [::: input...] - "
+                 "run command once per input\n");
+    fprintf(out, "queue [-c ID | -m ID POS] - "
+                 "list, cancel or reorder deferred pipelines\n");
+    fprintf(out, "set -o|+o [option...] - list, enable or disable options\n");
+    fprintf(out, "wait [-t DURATION] [target...] - wait for background jobs\n");
+    fprintf(out, "xargs [-0] [-n max] [command...] - "
+                 "run command with stdin as arguments\n");
     return 1;
   }
 
-  printf("You aren't seriously asking me to hold your hand, are you %s?\n",
-         current_ctx->user);
+  fprintf(out,
+          "You aren't seriously asking me to hold your hand, are you %s?\n",
+          current_ctx->user);
 
   return 1;
 }
+
+/**
+ * read_stream - Read a whole stream into memory
+ * @stream: Stream to read until EOF
+ * @len: Output parameter - number of bytes read
+ *
+ * The buffer doubles as it fills, and is NUL-terminated.
+ *
+ * Return: Buffer, NULL on error
+ */
+char *read_stream(FILE *stream, size_t *len) {
+  size_t capacity = 4096;
+  char *buffer = malloc(capacity);
+  *len = 0;
+
+  while (buffer) {
+    *len += fread(buffer + *len, 1, capacity - *len - 1, stream);
+
+    if (*len < capacity - 1) {
+      break;
+    }
+
+    char *new_buffer = realloc(buffer, capacity * 2);
+    if (!new_buffer) {
+      free(buffer);
+      buffer = NULL;
+      break;
+    }
+
+    buffer = new_buffer;
+    capacity *= 2;
+  }
+
+  if (!buffer) {
+    error_msg(malloc_fail_msg, true);
+    return NULL;
+  }
+
+  /* A terminal can be read from again after Ctrl+D */
+  clearerr(stream);
+
+  buffer[*len] = '\0';
+  return buffer;
+}
+
+/**
+ * split_items - Split a buffer into items in place
+ * @buffer: Buffer to split, separators are overwritten with NUL
+ * @len: Size of the buffer
+ * @nul_separated: Whether items end with NUL rather than with whitespace
+ * @items_count: Output parameter - number of items
+ *
+ * Return: Array of pointers into buffer, NULL on error
+ */
+char **split_items(char *buffer, size_t len, bool nul_separated,
+                   unsigned int *items_count) {
+  unsigned int capacity = TOKENS_MAX;
+  char **items = malloc(capacity * sizeof(*items));
+  if (!items) {
+    error_msg(malloc_fail_msg, true);
+    return NULL;
+  }
+
+  *items_count = 0;
+
+  for (size_t i = 0; i < len;) {
+    if (nul_separated ? buffer[i] == '\0' : isspace((unsigned char)buffer[i])) {
+      buffer[i++] = '\0';
+      continue;
+    }
+
+    if (*items_count == capacity) {
+      char **new_items = realloc(items, capacity * 2 * sizeof(*items));
+      if (!new_items) {
+        error_msg(malloc_fail_msg, true);
+        free(items);
+        return NULL;
+      }
+      items = new_items;
+      capacity *= 2;
+    }
+
+    items[(*items_count)++] = buffer + i;
+
+    while (i < len &&
+           !(nul_separated ? buffer[i] == '\0'
+                           : isspace((unsigned char)buffer[i]))) {
+      i++;
+    }
+  }
+
+  return items;
+}
+
+/**
+ * xargs - Run a command with arguments read from stdin, in batches
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: xargs [-0] [-n MAX] [COMMAND [ARGS...]]. Items are the words of
+ * stdin, or NUL-separated with -0. COMMAND (echo by default) runs with ARGS
+ * followed by as many items as exec accepts, or at most MAX with -n, as many
+ * times as it takes. Nothing runs without items.
+ *
+ * Batches are sized to ARG_MAX minus the environment, so none fails with
+ * E2BIG, and launched without going through /usr/bin/xargs.
+ *
+ * Return: 1 if every batch succeeded, -1 otherwise
+ */
+int xargs(struct repl_ctx *current_ctx) {
+  static char *default_command[] = {"echo", NULL};
+  char **args = current_ctx->commands[0];
+  bool nul_separated = false;
+  unsigned int max_items = 0;
+  unsigned int i = 1;
+
+  for (; args[i] && args[i][0] == '-'; i++) {
+    if (strcmp(args[i], "-0") == 0) {
+      nul_separated = true;
+      continue;
+    }
+
+    char *end;
+    long count = args[i + 1] ? strtol(args[i + 1], &end, 10) : 0;
+
+    if (strcmp(args[i], "-n") != 0 || !args[i + 1] || *end != '\0' ||
+        count <= 0 || count > INT_MAX) {
+      error_msg("xargs: usage: xargs [-0] [-n MAX] [COMMAND [ARGS...]]",
+                false);
+      return -1;
+    }
+
+    max_items = count;
+    i++;
+  }
+
+  char **prefix = args[i] ? args + i : default_command;
+  unsigned int prefix_count = 0;
+
+  while (prefix[prefix_count]) {
+    prefix_count++;
+  }
+
+  path_cache_sync();
+  const char *path = path_cache_lookup(prefix[0]);
+  if (!path) {
+    path_cache_not_found(prefix[0]);
+    return -1;
+  }
+
+  size_t len;
+  char *buffer = read_stream(stdin, &len);
+
+  unsigned int items_count = 0;
+  char **items =
+      buffer ? split_items(buffer, len, nul_separated, &items_count) : NULL;
+
+  /* The items came from stdin, so the commands mustn't read it too */
+  int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  int result = -1;
+
+  if (null_fd == -1) {
+    error_msg(open_fail_msg, true);
+  } else if (items) {
+    const struct batch_command cmd = {
+        .command = current_ctx->input,
+        .path = path,
+        .prefix = prefix,
+        .prefix_count = prefix_count,
+        .items = items,
+        .items_count = items_count,
+        .max_items = max_items,
+        .in_fd = null_fd,
+        .out_fd = -1,
+    };
+
+    result = batch_run(&cmd) == 0 ? 1 : -1;
+  }
+
+  if (null_fd != -1) {
+    close(null_fd);
+  }
+
+  free(items);
+  free(buffer);
+
+  return result;
+}
@@ -0,0 +1,371 @@
+/**
+ * builtins_coproc.c
+ * The coproc builtin.
+ *
+ * OVERVIEW:
+ * A coprocess is a background job whose stdin and stdout are pipes to the
+ * shell, so a script can send it one request after another instead of
+ * launching a program per request:
+ *
+ *   coproc bc -q
+ *   echo 2+2 > /dev/fd/$COPROC[1]
+ *   head -n 1 < /dev/fd/$COPROC[0]
+ *
+ * The pipes are created with create_pipe() and the program is launched with
+ * spawn_stage(), like any pipeline stage. The shell keeps its ends open
+ * (close-on-exec, so no other command inherits them) and exposes them as
+ * variables: NAME holds the descriptor to read the coprocess's output from,
+ * followed by the one to write its input to, so $NAME[0] and $NAME[1] select
+ * them, and NAME_PID holds its PID. NAME is COPROC unless set with -n.
+ *
+ * Redirecting to /dev/fd/N opens the pipe again in the shell, and the
+ * command the redirection is for gets that copy. Reading has to stop at the
+ * end of the answer, as the coprocess doesn't close its output between
+ * requests: "head -n 1" does, "cat" would wait forever.
+ *
+ * CLEANUP:
+ * The coprocess is tracked in the job table, so jobs, kill and wait work on
+ * it. Once its job is removed (it finished and was reported, or was
+ * disowned), the shell's ends are closed and the variables unset, so output
+ * of a coprocess that quit on its own has to be read before the next prompt.
+ * exit closes the input of every coprocess, which is how most filters know to
+ * quit, gives them COPROC_EXIT_GRACE_MS to do so and sends SIGTERM to the rest.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins.h"
+#include "config.h"
+#include "error.h"
+#include "exec.h"
+#include "jobs.h"
+#include "launch.h"
+#include "path_cache.h"
+#include "pipe_size.h"
+#include "stage_attrs.h"
+
+/* How long exit waits for coprocesses to quit after closing their input */
+#define COPROC_EXIT_GRACE_MS 200
+
+/* Longest NAME, leaving room for the _PID suffix */
+#define COPROC_NAME_MAX 64
+
+#define COPROC_DEFAULT_NAME "COPROC"
+
+static const char coproc_usage_msg[] =
+    "coproc: usage: coproc [-n NAME] COMMAND [ARGS...]";
+
+enum { READ_END, WRITE_END };
+
+/**
+ * coproc - State of a running coprocess, the io_data of its job
+ * @name: Name of the variables holding the descriptors and PID
+ * @read_fd: Shell's end of the pipe from the coprocess's stdout
+ * @write_fd: Shell's end of the pipe to the coprocess's stdin, -1 once closed
+ * @ctx: Shell context the variables are set in
+ */
+struct coproc {
+  char name[COPROC_NAME_MAX];
+  int read_fd;
+  int write_fd;
+  struct repl_ctx *ctx;
+};
+
+/**
+ * coproc_release - io_release hook, closes the pipes and unsets the variables
+ * @job: Job of the coprocess, being removed
+ */
+void coproc_release(struct job *job) {
+  struct coproc *coproc = job->io_data;
+  char pid_name[COPROC_NAME_MAX + 4];
+
+  close_fd(coproc->read_fd);
+  close_fd(coproc->write_fd);
+
+  snprintf(pid_name, sizeof(pid_name), "%s_PID", coproc->name);
+  unset_user_env(coproc->ctx, coproc->name);
+  unset_user_env(coproc->ctx, pid_name);
+
+  free(coproc);
+  job->io_data = NULL;
+  job->io_release = NULL;
+}
+
+/**
+ * coproc_search - Lookup of a coprocess by name, see find_coproc()
+ * @name: Name to look for
+ * @job: Output parameter - job of the coprocess, NULL if there is none
+ */
+struct coproc_search {
+  const char *name;
+  struct job *job;
+};
+
+/**
+ * find_coproc - jobs_for_each() callback looking for a coprocess by name
+ * @job: Job to check
+ * @arg: struct coproc_search, its job is set if this one matches
+ */
+void find_coproc(struct job *job, void *arg) {
+  struct coproc_search *search = arg;
+
+  if (job->io_release == coproc_release &&
+      strcmp(((struct coproc *)job->io_data)->name, search->name) == 0) {
+    search->job = job;
+  }
+}
+
+/**
+ * valid_coproc_name - Check whether a name can be used for the variables
+ * @name: Name given with -n
+ *
+ * Return: true if name is a variable name that fits, false otherwise
+ */
+bool valid_coproc_name(const char *name) {
+  if (!isalpha(name[0]) && name[0] != '_') {
+    return false;
+  }
+
+  for (const char *c = name; *c; c++) {
+    if (!isalnum(*c) && *c != '_') {
+      return false;
+    }
+  }
+
+  return strlen(name) < COPROC_NAME_MAX;
+}
+
+/**
+ * set_coproc_vars - Expose the descriptors and PID of a coprocess
+ * @coproc: Coprocess, with its pipes open
+ * @pid: PID of the coprocess
+ *
+ * Return: 0 on success, -1 on error
+ */
+int set_coproc_vars(const struct coproc *coproc, pid_t pid) {
+  char pid_name[COPROC_NAME_MAX + 4];
+  char value[32];
+
+  snprintf(pid_name, sizeof(pid_name), "%s_PID", coproc->name);
+  snprintf(value, sizeof(value), "%d %d", coproc->read_fd, coproc->write_fd);
+
+  if (set_user_env(coproc->ctx, coproc->name, value) == -1) {
+    return -1;
+  }
+
+  snprintf(value, sizeof(value), "%d", pid);
+  return set_user_env(coproc->ctx, pid_name, value);
+}
+
+/**
+ * start_coproc - Launch a coprocess and track it as a background job
+ * @current_ctx: Shell context
+ * @coproc: Coprocess to start, with its name set, taken over by the job
+ * @path: Resolved program
+ * @argv: NULL-terminated argument array
+ *
+ * Return: 0 on success, -1 on error (coproc is freed)
+ */
+int start_coproc(struct repl_ctx *current_ctx, struct coproc *coproc,
+                 const char *path, char **argv) {
+  const long pipe_size = pipe_size_for(current_ctx);
+  int to_coproc[2] = {-1, -1};
+  int from_coproc[2] = {-1, -1};
+  struct job *job = NULL;
+
+  if (create_pipe(to_coproc, pipe_size) == -1 ||
+      create_pipe(from_coproc, pipe_size) == -1 ||
+      !(job = job_create(current_ctx->input, 1, true))) {
+    close_fd(to_coproc[READ_END]);
+    close_fd(to_coproc[WRITE_END]);
+    close_fd(from_coproc[READ_END]);
+    close_fd(from_coproc[WRITE_END]);
+    free(coproc);
+    return -1;
+  }
+
+  struct stage_spawn stage = {
+      .path = path,
+      .argv = argv,
+      .in_fd = to_coproc[READ_END],
+      .out_fd = from_coproc[WRITE_END],
+      .err_fd = -1,
+      .pgid = 0,
+      .tty_fd = -1,
+      .attrs = background_stage_attrs(),
+  };
+
+  pid_t pid = spawn_stage(&stage);
+
+  /* The coprocess has its own copies of these */
+  close_fd(to_coproc[READ_END]);
+  close_fd(from_coproc[WRITE_END]);
+
+  coproc->read_fd = from_coproc[READ_END];
+  coproc->write_fd = to_coproc[WRITE_END];
+  coproc->ctx = current_ctx;
+
+  /* From here on, removing the job closes the pipes and frees coproc */
+  job->io_release = coproc_release;
+  job->io_data = coproc;
+
+  if (pid == -1) {
+    /* The cached path may be stale, make the next lookup search again */
+    path_cache_forget(argv[0]);
+    job_remove(job);
+    return -1;
+  }
+
+  if (job_add_process(job, pid) == -1) {
+    error_msg("Failed to track process", false);
+    kill(pid, SIGTERM);
+    job_remove(job);
+    return -1;
+  }
+
+  if (set_coproc_vars(coproc, pid) == -1) {
+    signal_job(job, SIGTERM);
+    job_remove(job);
+    return -1;
+  }
+
+  printf("[%u] %d\n", job->id, job->pgid);
+  fflush(stdout);
+  return 0;
+}
+
+/**
+ * coproc - Start a program connected to the shell by two pipes
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: coproc [-n NAME] COMMAND [ARGS...]. $NAME[0] is the descriptor to
+ * read COMMAND's output from, $NAME[1] the one to write its input to, and
+ * $NAME_PID its PID. NAME is COPROC by default, and only one coprocess can
+ * have a given name at a time.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int coproc(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+  const char *name = COPROC_DEFAULT_NAME;
+  unsigned int i = 1;
+
+  if (args[i] && strcmp(args[i], "-n") == 0) {
+    name = args[i + 1];
+    i = name ? i + 2 : i + 1;
+  }
+
+  if (!name || !args[i] || args[i][0] == '-') {
+    error_msg(coproc_usage_msg, false);
+    return -1;
+  }
+
+  if (!valid_coproc_name(name)) {
+    char msg[ERR_MSG_MAX];
+    snprintf(msg, ERR_MSG_MAX, "coproc: %s: invalid name", name);
+    error_msg(msg, false);
+    return -1;
+  }
+
+  if (current_ctx->in_stream_name[0] || current_ctx->out_stream_name[0]) {
+    error_msg("coproc: can't redirect, stdin and stdout are the pipes", false);
+    return -1;
+  }
+
+  struct coproc_search search = {.name = name, .job = NULL};
+  jobs_for_each(find_coproc, &search);
+
+  if (search.job) {
+    char msg[ERR_MSG_MAX];
+    snprintf(msg, ERR_MSG_MAX, "coproc: %s: already in use by job %%%u", name,
+             search.job->id);
+    error_msg(msg, false);
+    return -1;
+  }
+
+  path_cache_sync();
+  const char *path = path_cache_lookup(args[i]);
+  if (!path) {
+    path_cache_not_found(args[i]);
+    return -1;
+  }
+
+  struct coproc *new_coproc = calloc(1, sizeof(*new_coproc));
+  if (!new_coproc) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  strcpy(new_coproc->name, name);
+
+  return start_coproc(current_ctx, new_coproc, path, args + i) == -1 ? -1 : 1;
+}
+
+/**
+ * close_coproc_input - jobs_for_each() callback closing a coprocess's stdin
+ * @job: Job to check
+ * @arg: Counter of coprocesses still running, incremented for this one
+ */
+void close_coproc_input(struct job *job, void *arg) {
+  if (job->io_release != coproc_release) {
+    return;
+  }
+
+  struct coproc *coproc = job->io_data;
+  close_fd(coproc->write_fd);
+  coproc->write_fd = -1;
+
+  if (!job_is_done(job)) {
+    (*(unsigned int *)arg)++;
+  }
+}
+
+/**
+ * stop_coproc - jobs_for_each() callback ending a coprocess for good
+ * @job: Job to check
+ * @arg: Unused
+ *
+ * A stopped coprocess wouldn't act on SIGTERM, so it is continued too.
+ */
+void stop_coproc(struct job *job, void *arg) {
+  (void)arg;
+
+  if (job->io_release != coproc_release) {
+    return;
+  }
+
+  if (!job_is_done(job)) {
+    signal_job(job, SIGTERM);
+    signal_job(job, SIGCONT);
+  }
+
+  job_remove(job);
+}
+
+/**
+ * coproc_close_all - End every coprocess before the shell exits
+ *
+ * The input of every coprocess is closed first. Those still running after
+ * COPROC_EXIT_GRACE_MS are sent SIGTERM. Either way, their jobs are removed,
+ * which closes the rest of the pipes and unsets their variables.
+ */
+void coproc_close_all(void) {
+  unsigned int running = 0;
+  jobs_for_each(close_coproc_input, &running);
+
+  struct timespec deadline;
+  deadline_in(&deadline, COPROC_EXIT_GRACE_MS);
+
+  while (running > 0 && jobs_wait_any(&deadline) == 0) {
+    running = 0;
+    jobs_for_each(close_coproc_input, &running);
+  }
+
+  jobs_for_each(stop_coproc, NULL);
+}
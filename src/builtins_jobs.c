@@ -0,0 +1,429 @@
+/**
+ * builtins_jobs.c
+ * Job control builtins.
+ *
+ * OVERVIEW:
+ * These operate on the job table, so they have to run inside the shell: a
+ * child process can't wait for, resume or hand the terminal to its siblings.
+ *
+ * Jobs are referred to with job specs: %n for job number n, %% or %+ for the
+ * current job, %name for the most recent job starting with name, or a PID.
+ */
+
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins.h"
+#include "error.h"
+#include "jobs.h"
+#include "parse.h"
+#include "signals.h"
+
+/**
+ * job_spec_error - Report a job spec that doesn't match any job
+ * @builtin_name: Builtin reporting the error
+ * @spec: Job spec given by the user, NULL for the current job
+ */
+void job_spec_error(const char *builtin_name, const char *spec) {
+  char msg[ERR_MSG_MAX];
+  snprintf(msg, ERR_MSG_MAX, "%s: %s: no such job", builtin_name,
+           spec ? spec : "current");
+  error_msg(msg, false);
+}
+
+/**
+ * lookup_job - Resolve an optional job spec argument
+ * @builtin_name: Builtin doing the lookup, for error messages
+ * @spec: Job spec, NULL for the current job
+ *
+ * Return: Matching job, NULL if there is none (already reported)
+ */
+struct job *lookup_job(const char *builtin_name, const char *spec) {
+  jobs_reap();
+
+  struct job *job = spec ? job_find(spec) : job_current();
+  if (!job) {
+    job_spec_error(builtin_name, spec);
+  }
+
+  return job;
+}
+
+/**
+ * print_job - jobs_for_each callback used by the jobs builtin
+ * @job: Job to print
+ * @arg: Pointer to a bool, whether to show PIDs
+ *
+ * Finished jobs are reported one last time and then removed, just like the
+ * notification before a prompt would have done.
+ */
+void print_job(struct job *job, void *arg) {
+  job_print(job, *(bool *)arg);
+
+  if (job->background && job_is_done(job)) {
+    job_remove(job);
+  }
+}
+
+/**
+ * print_job_pgid - jobs_for_each callback used by "jobs -p"
+ * @job: Job to print
+ * @arg: Unused
+ */
+void print_job_pgid(struct job *job, void *arg) {
+  (void)arg;
+  printf("%d\n", job->pgid ? job->pgid : job->procs[0].pid);
+}
+
+/**
+ * jobs_builtin - List jobs
+ * @current_ctx: Shell context with command arguments
+ *
+ * "jobs -l" also lists the PID of every stage, "jobs -p" lists only the process
+ * group ID of each job, and "jobs top" shows what their processes cost.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int jobs_builtin(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+  bool show_pids = args[1] && strcmp(args[1], "-l") == 0;
+
+  if (args[1] && strcmp(args[1], "top") == 0) {
+    return jobs_top(current_ctx);
+  }
+
+  jobs_reap();
+
+  if (args[1] && strcmp(args[1], "-p") == 0) {
+    jobs_for_each(print_job_pgid, NULL);
+    return 1;
+  }
+
+  jobs_for_each(print_job, &show_pids);
+
+  return 1;
+}
+
+/**
+ * fg - Resume a job in the foreground
+ * @current_ctx: Shell context with command arguments
+ *
+ * Return: 1 on success, -1 on error
+ */
+int fg(struct repl_ctx *current_ctx) {
+  struct job *job = lookup_job("fg", current_ctx->commands[0][1]);
+  if (!job) {
+    return -1;
+  }
+
+  printf("%s\n", job->command);
+
+  return job_continue(job, true) == -1 ? -1 : 1;
+}
+
+/**
+ * resume_in_background - Resume one job for bg
+ * @spec: Job spec, NULL for the current job
+ *
+ * Return: 0 on success, -1 on error
+ */
+int resume_in_background(const char *spec) {
+  struct job *job = lookup_job("bg", spec);
+  if (!job || job_continue(job, false) == -1) {
+    return -1;
+  }
+
+  printf("[%u]+ %s &\n", job->id, job->command);
+
+  return 0;
+}
+
+/**
+ * bg - Resume stopped jobs in the background
+ * @current_ctx: Shell context with command arguments
+ *
+ * Return: 1 on success, -1 on error
+ */
+int bg(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+
+  /* Without arguments, bg acts on the current job */
+  if (!args[1]) {
+    return resume_in_background(NULL) == -1 ? -1 : 1;
+  }
+
+  int result = 1;
+
+  for (unsigned int i = 1; args[i]; i++) {
+    if (resume_in_background(args[i]) == -1) {
+      result = -1;
+    }
+  }
+
+  return result;
+}
+
+/**
+ * wait_for_job - Block until a job has no running processes
+ * @job: Job to wait for
+ * @deadline: When to give up, NULL to wait indefinitely
+ *
+ * Return: 0 once the job finished or stopped, 1 if the deadline passed, -1 if
+ * interrupted by SIGINT
+ */
+int wait_for_job(struct job *job, const struct timespec *deadline) {
+  while (job->running_count > 0) {
+    int result = jobs_wait_any(deadline);
+    if (result != 0) {
+      return result;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * find_running_job - jobs_for_each callback used by "wait" without arguments
+ * @job: Job to check
+ * @arg: Pointer to a bool, set when a background job is still running
+ */
+void find_running_job(struct job *job, void *arg) {
+  if (job->background && job->running_count > 0) {
+    *(bool *)arg = true;
+  }
+}
+
+/**
+ * remove_done_job - jobs_for_each callback removing finished background jobs
+ * @job: Job to check
+ * @arg: Unused
+ */
+void remove_done_job(struct job *job, void *arg) {
+  (void)arg;
+
+  if (job->background && job_is_done(job)) {
+    job_remove(job);
+  }
+}
+
+/**
+ * wait_all_jobs - Wait for every background job to finish
+ * @deadline: When to give up (CLOCK_MONOTONIC), NULL to wait indefinitely
+ *
+ * Jobs that finished are removed, so they aren't reported again.
+ *
+ * Return: 0 once every job finished, 1 if the deadline passed, -1 if
+ * interrupted by Ctrl+C
+ */
+int wait_all_jobs(const struct timespec *deadline) {
+  int result = 0;
+
+  bool running = true;
+
+  while (running && result == 0) {
+    running = false;
+    jobs_reap();
+    jobs_for_each(find_running_job, &running);
+
+    if (running) {
+      result = jobs_wait_any(deadline);
+    }
+  }
+
+  jobs_for_each(remove_done_job, NULL);
+
+  return result;
+}
+
+/**
+ * wait_builtin - Wait for background jobs to finish
+ * @current_ctx: Shell context with command arguments
+ *
+ * Without arguments, waits for every background job, then for the pipelines
+ * still deferred with defer: the shell starts them as headroom allows once
+ * wait returns, see drain_queue(), and waits for them too. Otherwise, waits
+ * for each job spec or PID given. Jobs that were waited for are not reported
+ * again before the next prompt. Ctrl+C stops waiting.
+ *
+ * "wait -t DURATION" gives up once DURATION has passed, leaving the jobs that
+ * are still running alone, and says so. It doesn't wait for deferred
+ * pipelines.
+ *
+ * Return: 1 on success, -1 on error, interruption or if the deadline passed
+ */
+int wait_builtin(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+  struct timespec deadline;
+  const struct timespec *deadline_ptr = NULL;
+  unsigned int first = 1;
+
+  sigint_received = 0;
+
+  if (args[1] && strcmp(args[1], "-t") == 0) {
+    long timeout_ms;
+
+    if (!args[2] || parse_duration(args[2], &timeout_ms) == -1) {
+      error_msg("wait: usage: wait [-t DURATION] [target...]", false);
+      return -1;
+    }
+
+    deadline_in(&deadline, timeout_ms);
+    deadline_ptr = &deadline;
+    first = 3;
+  }
+
+  if (!args[first]) {
+    const int waited = wait_all_jobs(deadline_ptr);
+
+    queue_drain(waited == 0 && !deadline_ptr);
+
+    if (waited == 1) {
+      error_msg("wait: timed out", false);
+    }
+
+    return waited == 0 ? 1 : -1;
+  }
+
+  int result = 1;
+
+  for (unsigned int i = first; args[i]; i++) {
+    struct job *job = lookup_job("wait", args[i]);
+    if (!job) {
+      result = -1;
+      continue;
+    }
+
+    const int waited = wait_for_job(job, deadline_ptr);
+
+    if (waited == 1) {
+      error_msg("wait: timed out", false);
+    }
+
+    if (waited != 0) {
+      return -1;
+    }
+
+    if (job_is_done(job)) {
+      job_remove(job);
+    }
+  }
+
+  return result;
+}
+
+/**
+ * kill_builtin - Send a signal to jobs or processes
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: kill [-s SIGNAL | -SIGNAL] TARGET..., where each TARGET is a job spec
+ * or a PID. Job specs signal the whole job. "kill -l" lists signal names.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int kill_builtin(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+  int signal_num = SIGTERM;
+  unsigned int i = 1;
+
+  if (args[1] && strcmp(args[1], "-l") == 0) {
+    for (int sig = 1; sig < NSIG; sig++) {
+      if (sigabbrev_np(sig)) {
+        printf("%2d) SIG%s\n", sig, sigabbrev_np(sig));
+      }
+    }
+    return 1;
+  }
+
+  if (args[1] && strcmp(args[1], "-s") == 0 && args[2]) {
+    signal_num = parse_signal(args[2]);
+    i = 3;
+  } else if (args[1] && args[1][0] == '-' && args[1][1] != '\0') {
+    signal_num = parse_signal(args[1] + 1);
+    i = 2;
+  }
+
+  if (signal_num == -1) {
+    error_msg("kill: unknown signal", false);
+    return -1;
+  }
+
+  if (!args[i]) {
+    error_msg("kill: usage: kill [-s SIGNAL | -SIGNAL] TARGET...", false);
+    return -1;
+  }
+
+  jobs_reap();
+
+  int result = 1;
+
+  for (; args[i]; i++) {
+    if (args[i][0] == '%') {
+      struct job *job = job_find(args[i]);
+      if (!job) {
+        job_spec_error("kill", args[i]);
+        result = -1;
+        continue;
+      }
+
+      if (signal_job(job, signal_num) == -1) {
+        error_msg("kill: failed to signal job", true);
+        result = -1;
+      }
+
+      continue;
+    }
+
+    char *end;
+    long pid = strtol(args[i], &end, 10);
+
+    if (*end != '\0' || kill((pid_t)pid, signal_num) == -1) {
+      char msg[ERR_MSG_MAX];
+      snprintf(msg, ERR_MSG_MAX, "kill: %s", args[i]);
+      error_msg(msg, *end == '\0');
+      result = -1;
+    }
+  }
+
+  return result;
+}
+
+/**
+ * disown - Stop tracking jobs without signalling them
+ * @current_ctx: Shell context with command arguments
+ *
+ * Disowned jobs keep running but are no longer listed, can't be resumed with
+ * fg and bg, and are left alone when the shell exits.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int disown(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+
+  if (!args[1]) {
+    struct job *job = lookup_job("disown", NULL);
+    if (!job) {
+      return -1;
+    }
+
+    job_remove(job);
+    return 1;
+  }
+
+  int result = 1;
+
+  for (unsigned int i = 1; args[i]; i++) {
+    struct job *job = lookup_job("disown", args[i]);
+    if (!job) {
+      result = -1;
+      continue;
+    }
+
+    job_remove(job);
+  }
+
+  return result;
+}
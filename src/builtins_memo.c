@@ -0,0 +1,669 @@
+/**
+ * builtins_memo.c
+ * The memo builtin.
+ *
+ * OVERVIEW:
+ * "memo COMMAND [ARGS...]" runs COMMAND once and, as long as nothing it
+ * depends on changes, replays its output instead of running it again. Meant
+ * for slow, deterministic commands that get rerun while debugging: find over a
+ * large tree, report generators, dependency resolvers.
+ *
+ * KEYS:
+ * An entry is keyed on everything the output is assumed to depend on:
+ * - the arguments, and the path, size and modification time of the program
+ * - the working directory and $PATH
+ * - NAME=VALUE of every variable declared with -e NAME
+ * - the device, inode, size, modification time and offset of stdin when it is
+ *   a file (redirected with <), and the same for every file declared with
+ *   -i FILE, or the fact that it doesn't exist
+ * Files are identified by their metadata rather than their contents, as
+ * hashing a large input would cost about as much as running most commands.
+ * The output of a command reading a pipe or the terminal depends on data the
+ * shell never sees, so such a command just runs, uncached.
+ *
+ * The key is hashed with 64-bit FNV-1a to name the entry's file, and stored in
+ * full in the entry, so a hash collision is a miss rather than the output of
+ * another command.
+ *
+ * STORAGE:
+ * Entries live in ~/.cache/clownish/memo, one file per key: a header with the
+ * exit status, the key, then stdout. stderr isn't stored, it reaches the
+ * terminal on the first run only. On a miss, the command writes straight into
+ * a temporary file, which is renamed into place once it exits. Either way, the
+ * output is replayed with relay_range(), which uses sendfile() from the entry
+ * to stdout. Commands that were stopped or killed by a signal aren't cached.
+ *
+ * EVICTION:
+ * A hit touches the entry's modification time, so modification times order
+ * entries from least to most recently used. When a new entry brings the total
+ * above MEMO_MAX_SIZE (in ~/.clownrc, MEMO_MAX_SIZE_DEFAULT if unset), the
+ * least recently used entries are removed until it fits again. "memo -r"
+ * empties the cache.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "config.h"
+#include "error.h"
+#include "jobs.h"
+#include "launch.h"
+#include "parse.h"
+#include "path_cache.h"
+#include "relay.h"
+
+/* Cache size used when MEMO_MAX_SIZE isn't set */
+#define MEMO_MAX_SIZE_DEFAULT (64LL * 1024 * 1024)
+
+/* Cache directory, relative to $HOME */
+#define MEMO_DIR ".cache/clownish/memo"
+
+/* First bytes of every entry, changed whenever the format changes */
+#define MEMO_MAGIC "CLMEMO1"
+
+/* Length of an entry's file name, the key hash in hex */
+#define MEMO_NAME_LEN 16
+
+static const char memo_usage_msg[] =
+    "memo: usage: memo [-r] [-i FILE]... [-e NAME]... COMMAND [ARGS...]";
+
+/**
+ * memo_header - Start of an entry file, followed by the key and the output
+ * @magic: MEMO_MAGIC, NUL-padded
+ * @key_len: Length of the key in bytes
+ * @exit_code: Exit status of the command
+ * @output_len: Length of the output in bytes
+ */
+struct memo_header {
+  char magic[8];
+  uint32_t key_len;
+  int32_t exit_code;
+  uint64_t output_len;
+};
+
+/**
+ * memo_entry - An entry found while scanning the cache for eviction
+ * @name: File name
+ * @last_used: Modification time, touched by every hit
+ * @size: Size of the file in bytes
+ */
+struct memo_entry {
+  char name[MEMO_NAME_LEN + 1];
+  struct timespec last_used;
+  off_t size;
+};
+
+/**
+ * memo_dir - Build the path of the cache directory, creating it if needed
+ * @home_dir: User's home directory
+ * @path: Output buffer of PATH_MAX bytes
+ *
+ * Return: 0 on success, -1 on error (reported)
+ */
+int memo_dir(const char *home_dir, char *path) {
+  if (snprintf(path, PATH_MAX, "%s/%s", home_dir, MEMO_DIR) >= PATH_MAX) {
+    error_msg("memo: cache path too long", false);
+    return -1;
+  }
+
+  /* Create every missing component, like mkdir -p */
+  for (char *slash = strchr(path + strlen(home_dir) + 1, '/'); slash;
+       slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    int result = mkdir(path, 0700);
+    *slash = '/';
+
+    if (result == -1 && errno != EEXIST) {
+      error_msg("memo: failed to create cache directory", true);
+      return -1;
+    }
+  }
+
+  if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+    error_msg("memo: failed to create cache directory", true);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * memo_max_size - Get the cache size limit
+ * @current_ctx: Shell context (for configuration)
+ *
+ * Return: MEMO_MAX_SIZE from ~/.clownrc, MEMO_MAX_SIZE_DEFAULT if it isn't set
+ * or invalid
+ */
+long long memo_max_size(struct repl_ctx *current_ctx) {
+  const char *setting = get_user_env("MEMO_MAX_SIZE", current_ctx->user_envs,
+                                     current_ctx->user_envs_count);
+  long long max_size;
+
+  if (!setting) {
+    return MEMO_MAX_SIZE_DEFAULT;
+  }
+
+  if (parse_size(setting, &max_size) == -1) {
+    error_msg("memo: invalid MEMO_MAX_SIZE, using the default", false);
+    return MEMO_MAX_SIZE_DEFAULT;
+  }
+
+  return max_size;
+}
+
+/**
+ * key_end_field - Terminate a field of the key
+ * @key: Key being built
+ *
+ * Fields are NUL-separated, so no two different lists of fields make the same
+ * key.
+ */
+void key_end_field(FILE *key) { fputc('\0', key); }
+
+/**
+ * key_add_stat - Add the identity of a file to the key
+ * @key: Key being built
+ * @label: What the file is to the command
+ * @st: Status of the file
+ */
+void key_add_stat(FILE *key, const char *label, const struct stat *st) {
+  fprintf(key, "%s %llu %llu %lld %lld.%09ld", label,
+          (unsigned long long)st->st_dev, (unsigned long long)st->st_ino,
+          (long long)st->st_size, (long long)st->st_mtim.tv_sec,
+          st->st_mtim.tv_nsec);
+  key_end_field(key);
+}
+
+/**
+ * key_add_file - Add the identity of a named file to the key
+ * @key: Key being built
+ * @label: What the file is to the command
+ * @path: File to add
+ */
+void key_add_file(FILE *key, const char *label, const char *path) {
+  struct stat st;
+
+  fprintf(key, "%s %s", label, path);
+  key_end_field(key);
+
+  if (stat(path, &st) == -1) {
+    fprintf(key, "missing");
+    key_end_field(key);
+    return;
+  }
+
+  key_add_stat(key, "stat", &st);
+}
+
+/**
+ * key_add_stdin - Add stdin to the key
+ * @key: Key being built
+ *
+ * A regular file is identified like any input, along with the offset the
+ * command starts reading at. Another device, such as /dev/null, is assumed not
+ * to be read.
+ *
+ * Return: true if the command can be cached, false if stdin is a pipe, socket
+ * or terminal
+ */
+bool key_add_stdin(FILE *key) {
+  struct stat st;
+
+  if (fstat(STDIN_FILENO, &st) == -1 || S_ISFIFO(st.st_mode) ||
+      S_ISSOCK(st.st_mode) || isatty(STDIN_FILENO)) {
+    return false;
+  }
+
+  if (S_ISREG(st.st_mode)) {
+    key_add_stat(key, "stdin", &st);
+    fprintf(key, "offset %lld", (long long)lseek(STDIN_FILENO, 0, SEEK_CUR));
+    key_end_field(key);
+  }
+
+  return true;
+}
+
+/**
+ * build_key - Describe everything the output of a command depends on
+ * @current_ctx: Shell context (for variables)
+ * @args: Arguments of memo, with its options
+ * @command_index: Where the command starts in args
+ * @path: Resolved program
+ * @key_len: Output parameter - length of the key
+ *
+ * Return: Key on success (to free), NULL if the command can't be cached or on
+ * error
+ */
+char *build_key(struct repl_ctx *current_ctx, char **args,
+                unsigned int command_index, const char *path,
+                size_t *key_len) {
+  char *data = NULL;
+  FILE *key = open_memstream(&data, key_len);
+  if (!key) {
+    error_msg(malloc_fail_msg, true);
+    return NULL;
+  }
+
+  for (unsigned int i = command_index; args[i]; i++) {
+    fprintf(key, "arg %s", args[i]);
+    key_end_field(key);
+  }
+
+  key_add_file(key, "program", path);
+
+  char cwd[PATH_MAX];
+  fprintf(key, "cwd %s", getcwd(cwd, sizeof(cwd)) ? cwd : "?");
+  key_end_field(key);
+
+  const char *search_path = getenv("PATH");
+  fprintf(key, "PATH=%s", search_path ? search_path : "");
+  key_end_field(key);
+
+  for (unsigned int i = 1; i < command_index; i += 2) {
+    if (strcmp(args[i], "-i") == 0) {
+      key_add_file(key, "input", args[i + 1]);
+      continue;
+    }
+
+    const char *value = get_user_env(args[i + 1], current_ctx->user_envs,
+                                     current_ctx->user_envs_count);
+    if (!value) {
+      value = getenv(args[i + 1]);
+    }
+
+    /* Unset is different from set to "" */
+    if (value) {
+      fprintf(key, "env %s=%s", args[i + 1], value);
+    } else {
+      fprintf(key, "unset %s", args[i + 1]);
+    }
+    key_end_field(key);
+  }
+
+  const bool cacheable = key_add_stdin(key);
+
+  if (fclose(key) != 0) {
+    error_msg(malloc_fail_msg, true);
+    free(data);
+    return NULL;
+  }
+
+  if (!cacheable) {
+    free(data);
+    return NULL;
+  }
+
+  return data;
+}
+
+/**
+ * record_status - Make an exit status the result of the command for $?
+ * @command: Command line, for display
+ * @exit_code: Exit status to record
+ *
+ * A hit runs nothing, so it is recorded like a stage that ran inside the
+ * shell: as a job whose only stage finishes right away.
+ */
+void record_status(const char *command, int exit_code) {
+  struct job *job = job_create(command, 1, false);
+  struct rusage usage = {0};
+
+  if (!job) {
+    return;
+  }
+
+  if (job_add_process(job, 0) == -1) {
+    job_remove(job);
+    return;
+  }
+
+  job_finish_process(job, 0, exit_code, &usage);
+  job_wait(job);
+}
+
+/**
+ * replay - Copy the output of an entry to stdout
+ * @fd: Entry
+ * @header: Header of the entry
+ *
+ * Return: 0 on success, -1 on error
+ */
+int replay(int fd, const struct memo_header *header) {
+  fflush(stdout);
+
+  off_t offset = sizeof(*header) + header->key_len;
+
+  if (relay_range(fd, offset, header->output_len, STDOUT_FILENO) == -1) {
+    error_msg("memo: failed to replay output", true);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * try_hit - Replay an entry, if there is one for the key
+ * @current_ctx: Shell context
+ * @entry_path: Path of the entry for the key
+ * @key: Key
+ * @key_len: Length of the key
+ *
+ * Return: 1 if the entry was replayed, 0 if there is no (valid) entry, -1 on
+ * error
+ */
+int try_hit(struct repl_ctx *current_ctx, const char *entry_path,
+            const char *key, size_t key_len) {
+  int fd = open(entry_path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return 0;
+  }
+
+  struct memo_header header;
+  struct stat st;
+  char *stored_key = malloc(key_len);
+  int result = 0;
+
+  /* Anything that doesn't match exactly is a miss, and gets overwritten */
+  if (stored_key && fstat(fd, &st) == 0 &&
+      pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+      memcmp(header.magic, MEMO_MAGIC, sizeof(header.magic)) == 0 &&
+      header.key_len == key_len &&
+      (off_t)(sizeof(header) + key_len + header.output_len) == st.st_size &&
+      pread(fd, stored_key, key_len, sizeof(header)) == (ssize_t)key_len &&
+      memcmp(stored_key, key, key_len) == 0) {
+    /* Most recently used now, failing to mark it only affects eviction */
+    futimens(fd, NULL);
+
+    result = replay(fd, &header) == -1 ? -1 : 1;
+    record_status(current_ctx->input, header.exit_code);
+  }
+
+  free(stored_key);
+  close(fd);
+
+  return result;
+}
+
+/**
+ * run_command - Run the command as a foreground job
+ * @current_ctx: Shell context
+ * @path: Resolved program
+ * @argv: NULL-terminated argument array
+ * @out_fd: Descriptor to use as stdout, -1 for the shell's
+ *
+ * Return: Result of the job, NULL if it couldn't be launched
+ */
+const struct job_result *run_command(struct repl_ctx *current_ctx,
+                                     const char *path, char **argv,
+                                     int out_fd) {
+  struct job *job = job_create(current_ctx->input, 1, false);
+  if (!job) {
+    return NULL;
+  }
+
+  struct stage_spawn stage = {
+      .path = path,
+      .argv = argv,
+      .in_fd = -1,
+      .out_fd = out_fd,
+      .err_fd = -1,
+      .pgid = job->own_pgroup ? job->pgid : -1,
+      .tty_fd = job_control ? shell_terminal : -1,
+      .attrs = NULL,
+  };
+
+  pid_t pid = spawn_stage(&stage);
+
+  if (pid == -1 || job_add_process(job, pid) == -1) {
+    path_cache_forget(argv[0]);
+    job_remove(job);
+    return NULL;
+  }
+
+  if (stage.tty_fd != -1) {
+    tcsetpgrp(shell_terminal, job->pgid);
+  }
+
+  job_wait(job);
+
+  /* Left for $?, memo's status is the command's */
+  return job_peek_result();
+}
+
+/**
+ * entry_name_valid - Check whether a file in the cache directory is an entry
+ * @name: File name
+ *
+ * Return: true for an entry, false for anything else (temporary files)
+ */
+bool entry_name_valid(const char *name) {
+  return strlen(name) == MEMO_NAME_LEN &&
+         strspn(name, "0123456789abcdef") == MEMO_NAME_LEN;
+}
+
+/**
+ * compare_last_used - qsort() comparator, least recently used first
+ * @a: First entry
+ * @b: Second entry
+ *
+ * Return: Negative, zero or positive as a was used before, with or after b
+ */
+int compare_last_used(const void *a, const void *b) {
+  const struct timespec *ta = &((const struct memo_entry *)a)->last_used;
+  const struct timespec *tb = &((const struct memo_entry *)b)->last_used;
+
+  if (ta->tv_sec != tb->tv_sec) {
+    return ta->tv_sec < tb->tv_sec ? -1 : 1;
+  }
+
+  return (ta->tv_nsec > tb->tv_nsec) - (ta->tv_nsec < tb->tv_nsec);
+}
+
+/**
+ * evict - Remove least recently used entries until the cache fits
+ * @dir_path: Cache directory
+ * @max_size: Size limit in bytes, 0 to remove every entry
+ */
+void evict(const char *dir_path, long long max_size) {
+  DIR *dir = opendir(dir_path);
+  if (!dir) {
+    return;
+  }
+
+  struct memo_entry *entries = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  long long total = 0;
+  struct dirent *ent;
+  struct stat st;
+
+  while ((ent = readdir(dir))) {
+    if (!entry_name_valid(ent->d_name) ||
+        fstatat(dirfd(dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+      continue;
+    }
+
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      struct memo_entry *grown = realloc(entries, capacity * sizeof(*entries));
+      if (!grown) {
+        error_msg(malloc_fail_msg, true);
+        break;
+      }
+      entries = grown;
+    }
+
+    strcpy(entries[count].name, ent->d_name);
+    entries[count].last_used = st.st_mtim;
+    entries[count].size = st.st_size;
+    total += st.st_size;
+    count++;
+  }
+
+  if (total > max_size) {
+    qsort(entries, count, sizeof(*entries), compare_last_used);
+
+    for (size_t i = 0; i < count && total > max_size; i++) {
+      if (unlinkat(dirfd(dir), entries[i].name, 0) == 0) {
+        total -= entries[i].size;
+      }
+    }
+  }
+
+  free(entries);
+  closedir(dir);
+}
+
+/**
+ * run_and_store - Run the command and add its output to the cache
+ * @current_ctx: Shell context
+ * @dir_path: Cache directory
+ * @entry_path: Path of the entry for the key
+ * @key: Key
+ * @key_len: Length of the key
+ * @path: Resolved program
+ * @argv: NULL-terminated argument array
+ *
+ * Return: 0 on success, -1 on error
+ */
+int run_and_store(struct repl_ctx *current_ctx, const char *dir_path,
+                  const char *entry_path, const char *key, size_t key_len,
+                  const char *path, char **argv) {
+  char tmp_path[PATH_MAX + MEMO_NAME_LEN + 1];
+  snprintf(tmp_path, sizeof(tmp_path), "%s/tmp.XXXXXX", dir_path);
+
+  int fd = mkostemp(tmp_path, O_CLOEXEC);
+  if (fd == -1) {
+    error_msg("memo: failed to create cache entry", true);
+    return -1;
+  }
+
+  struct memo_header header = {.magic = MEMO_MAGIC, .key_len = key_len};
+
+  /* The command appends its output after the key */
+  if (write(fd, &header, sizeof(header)) != sizeof(header) ||
+      write(fd, key, key_len) != (ssize_t)key_len) {
+    error_msg("memo: failed to write cache entry", true);
+    unlink(tmp_path);
+    close(fd);
+    return -1;
+  }
+
+  const struct job_result *result = run_command(current_ctx, path, argv, fd);
+  struct stat st;
+  int status = result ? 0 : -1;
+
+  if (result && result->stages[0].stopped) {
+    error_msg("memo: command stopped, its output won't be shown or cached",
+              false);
+  } else if (result && fstat(fd, &st) == 0) {
+    header.exit_code = result->stages[0].exit_code;
+    header.output_len = st.st_size - sizeof(header) - key_len;
+
+    status = replay(fd, &header);
+
+    const long long max_size = memo_max_size(current_ctx);
+
+    /* Above 128 is how a signal (Ctrl+C) shows, the output may be partial */
+    if (header.exit_code <= 128 && st.st_size <= max_size &&
+        pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        rename(tmp_path, entry_path) == 0) {
+      close(fd);
+      evict(dir_path, max_size);
+      return status;
+    }
+  }
+
+  unlink(tmp_path);
+  close(fd);
+
+  return status;
+}
+
+/**
+ * memo - Run a command, or replay its output from an earlier run
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: memo [-r] [-i FILE]... [-e NAME]... COMMAND [ARGS...]. -i declares a
+ * file the output depends on, -e a variable. "memo -r" empties the cache.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int memo(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+  char dir_path[PATH_MAX];
+  unsigned int i = 1;
+
+  if (args[1] && strcmp(args[1], "-r") == 0 && !args[2]) {
+    if (memo_dir(current_ctx->home_dir, dir_path) == -1) {
+      return -1;
+    }
+
+    evict(dir_path, 0);
+    return 1;
+  }
+
+  while (args[i] && args[i + 1] &&
+         (strcmp(args[i], "-i") == 0 || strcmp(args[i], "-e") == 0)) {
+    i += 2;
+  }
+
+  if (!args[i] || args[i][0] == '-') {
+    error_msg(memo_usage_msg, false);
+    return -1;
+  }
+
+  path_cache_sync();
+  const char *path = path_cache_lookup(args[i]);
+  if (!path) {
+    path_cache_not_found(args[i]);
+    return -1;
+  }
+
+  size_t key_len = 0;
+  char *key = NULL;
+
+  if (memo_dir(current_ctx->home_dir, dir_path) == 0) {
+    key = build_key(current_ctx, args, i, path, &key_len);
+  }
+
+  /* Without a cache or a usable key, the command still runs */
+  if (!key) {
+    if (debug_mode) {
+      fprintf(stderr, "memo: %s: not cacheable, running it\n", args[i]);
+    }
+    return run_command(current_ctx, path, args + i, -1) ? 1 : -1;
+  }
+
+  char entry_path[PATH_MAX + MEMO_NAME_LEN + 1];
+  snprintf(entry_path, sizeof(entry_path), "%s/%016llx", dir_path,
+           (unsigned long long)fnv1a(key, key_len, FNV1A_SEED));
+
+  int result = try_hit(current_ctx, entry_path, key, key_len);
+
+  if (debug_mode) {
+    fprintf(stderr, "memo: %s: %s\n", entry_path, result == 1 ? "hit" : "miss");
+  }
+
+  if (result == 0) {
+    result = run_and_store(current_ctx, dir_path, entry_path, key, key_len,
+                           path, args + i) == -1
+                 ? -1
+                 : 1;
+  }
+
+  free(key);
+
+  return result;
+}
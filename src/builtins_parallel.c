@@ -0,0 +1,825 @@
+/**
+ * builtins_parallel.c
+ * The parallel builtin.
+ *
+ * OVERVIEW:
+ * parallel runs a command once per input, where inputs are the arguments
+ * after ":::" or the lines of stdin, on a fixed number of workers. Each run is
+ * launched with spawn_stage() like any pipeline stage and tracked in the job
+ * table, so no helper program (GNU parallel, xargs -P) is involved.
+ *
+ * SCHEDULING:
+ * Inputs are split into one contiguous range per worker up front. A worker
+ * that becomes idle takes the next input at the front of its own range, and
+ * once its range is empty it steals the back half of the largest range left.
+ * Uneven run times therefore don't leave workers idle while others still
+ * have a backlog, and steals are rare: a worker only steals when it runs out,
+ * and each steal hands over half of what is left. The shell does the
+ * scheduling for every worker from a single thread, between waits.
+ *
+ * OUTPUT:
+ * Each run writes its stdout and stderr to memfds of its own, which are copied
+ * to the shell's once it finishes, so lines of different runs never
+ * interleave. With -k, output also comes out in input order: the output of a
+ * run that finished before an earlier one is appended to a spill memfd until
+ * its turn comes, so only running commands hold descriptors of their own.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "error.h"
+#include "jobs.h"
+#include "launch.h"
+#include "path_cache.h"
+#include "relay.h"
+#include "signals.h"
+
+/* Placeholder replaced with the input, which is appended if there is none */
+#define PARALLEL_PLACEHOLDER "{}"
+
+/* Separates the command from inputs given as arguments */
+#define PARALLEL_INPUTS_MARK ":::"
+
+static const char parallel_usage_msg[] =
+    "parallel: usage: parallel [-j N] [-k] COMMAND... [::: INPUT...]";
+
+enum { CAPTURE_OUT, CAPTURE_ERR, CAPTURES_COUNT };
+
+/**
+ * parallel_worker - Slot running one command at a time
+ * @head: First input of the worker's range that hasn't been started
+ * @tail: End of the worker's range (exclusive)
+ * @job: Job of the running command, NULL while idle
+ * @input: Input the running command was launched for
+ * @capture: memfds receiving the running command's stdout and stderr
+ */
+struct parallel_worker {
+  unsigned int head;
+  unsigned int tail;
+  struct job *job;
+  unsigned int input;
+  int capture[CAPTURES_COUNT];
+};
+
+/**
+ * spilled_output - Output of a finished command waiting for its turn (-k)
+ * @done: Whether the command finished
+ * @offset: Where its stdout and stderr start in the spill memfds
+ * @length: Size of its stdout and stderr
+ */
+struct spilled_output {
+  bool done;
+  off_t offset[CAPTURES_COUNT];
+  size_t length[CAPTURES_COUNT];
+};
+
+/**
+ * parallel_run - State of one invocation of the parallel builtin
+ * @words: Command to run, with the placeholder where the input goes
+ * @words_count: Number of entries in words
+ * @path: Resolved program, NULL to search $PATH for every run
+ * @inputs: One entry per run
+ * @inputs_count: Number of entries in inputs
+ * @workers: Worker slots
+ * @workers_count: Number of entries in workers
+ * @running_count: Workers currently running a command
+ * @keep_order: Whether output comes out in input order
+ * @spilled: With keep_order, one entry per input
+ * @next_output: With keep_order, input whose output is printed next
+ * @spill: With keep_order, memfds holding output that has to wait
+ * @null_fd: /dev/null, stdin of every run
+ * @failed_count: Runs that failed or couldn't be launched
+ */
+struct parallel_run {
+  char **words;
+  unsigned int words_count;
+  const char *path;
+  char **inputs;
+  unsigned int inputs_count;
+  struct parallel_worker *workers;
+  unsigned int workers_count;
+  unsigned int running_count;
+  bool keep_order;
+  struct spilled_output *spilled;
+  unsigned int next_output;
+  int spill[CAPTURES_COUNT];
+  int null_fd;
+  unsigned int failed_count;
+};
+
+/**
+ * add_input - Append an input to the run list
+ * @run: Invocation to add to
+ * @input: Input, copied
+ * @capacity: Current capacity of run->inputs, updated when it grows
+ *
+ * Return: 0 on success, -1 on error
+ */
+int add_input(struct parallel_run *run, const char *input,
+              unsigned int *capacity) {
+  if (run->inputs_count == *capacity) {
+    unsigned int new_capacity = *capacity ? *capacity * 2 : 64;
+
+    char **new_inputs =
+        realloc(run->inputs, new_capacity * sizeof(*new_inputs));
+    if (!new_inputs) {
+      error_msg(malloc_fail_msg, true);
+      return -1;
+    }
+
+    run->inputs = new_inputs;
+    *capacity = new_capacity;
+  }
+
+  run->inputs[run->inputs_count] = strdup(input);
+  if (!run->inputs[run->inputs_count]) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  run->inputs_count++;
+  return 0;
+}
+
+/**
+ * read_inputs - Read one input per line
+ * @run: Invocation to add to
+ * @stream: Stream to read until EOF
+ *
+ * Empty lines are skipped.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int read_inputs(struct parallel_run *run, FILE *stream) {
+  unsigned int capacity = 0;
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  int result = 0;
+
+  while ((len = getline(&line, &line_size, stream)) != -1) {
+    if (len > 0 && line[len - 1] == '\n') {
+      line[--len] = '\0';
+    }
+
+    if (len > 0 && add_input(run, line, &capacity) == -1) {
+      result = -1;
+      break;
+    }
+  }
+
+  free(line);
+
+  /* A terminal can be read from again after Ctrl+D */
+  clearerr(stream);
+
+  return result;
+}
+
+/**
+ * parse_parallel_args - Parse options, the command and argument inputs
+ * @run: Invocation to fill
+ * @args: Arguments of the builtin, args[0] is "parallel"
+ * @read_stdin: Output parameter - whether inputs have to be read from stdin
+ *
+ * Return: 0 on success, -1 on error (already reported)
+ */
+int parse_parallel_args(struct parallel_run *run, char **args,
+                        bool *read_stdin) {
+  unsigned int i = 1;
+
+  for (; args[i] && args[i][0] == '-'; i++) {
+    if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    }
+
+    if (strcmp(args[i], "-k") == 0 || strcmp(args[i], "--keep-order") == 0) {
+      run->keep_order = true;
+      continue;
+    }
+
+    if (strncmp(args[i], "-j", 2) != 0) {
+      error_msg(parallel_usage_msg, false);
+      return -1;
+    }
+
+    /* Both "-j N" and "-jN" */
+    const char *spec = args[i][2] ? args[i] + 2 : args[++i];
+    char *end;
+    long count = spec ? strtol(spec, &end, 10) : 0;
+
+    if (!spec || *end != '\0' || count <= 0 || count > 4096) {
+      error_msg("parallel: -j takes a number of workers from 1 to 4096",
+                false);
+      return -1;
+    }
+
+    run->workers_count = count;
+  }
+
+  run->words = args + i;
+
+  while (args[i] && strcmp(args[i], PARALLEL_INPUTS_MARK) != 0) {
+    i++;
+  }
+
+  run->words_count = args + i - run->words;
+
+  if (run->words_count == 0) {
+    error_msg(parallel_usage_msg, false);
+    return -1;
+  }
+
+  *read_stdin = !args[i];
+  if (*read_stdin) {
+    return 0;
+  }
+
+  unsigned int capacity = 0;
+
+  for (i++; args[i]; i++) {
+    if (add_input(run, args[i], &capacity) == -1) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * expand_word - Substitute the input for every placeholder in a word
+ * @word: Word of the command
+ * @input: Input of the run
+ *
+ * Return: New string, NULL on error
+ */
+char *expand_word(const char *word, const char *input) {
+  const size_t placeholder_len = strlen(PARALLEL_PLACEHOLDER);
+  const size_t input_len = strlen(input);
+  size_t len = 0;
+
+  for (const char *p = word; *p;) {
+    if (strncmp(p, PARALLEL_PLACEHOLDER, placeholder_len) == 0) {
+      len += input_len;
+      p += placeholder_len;
+    } else {
+      len++;
+      p++;
+    }
+  }
+
+  char *expanded = malloc(len + 1);
+  if (!expanded) {
+    return NULL;
+  }
+
+  char *out = expanded;
+
+  for (const char *p = word; *p;) {
+    if (strncmp(p, PARALLEL_PLACEHOLDER, placeholder_len) == 0) {
+      memcpy(out, input, input_len);
+      out += input_len;
+      p += placeholder_len;
+    } else {
+      *out++ = *p++;
+    }
+  }
+
+  *out = '\0';
+  return expanded;
+}
+
+/**
+ * free_argv - Free an argument array built by build_argv()
+ * @argv: Array to free, can be NULL
+ */
+void free_argv(char **argv) {
+  if (!argv) {
+    return;
+  }
+
+  for (unsigned int i = 0; argv[i]; i++) {
+    free(argv[i]);
+  }
+
+  free(argv);
+}
+
+/**
+ * build_argv - Build the arguments of one run
+ * @run: Invocation with the command
+ * @input: Input of the run
+ *
+ * The input replaces every placeholder, or becomes the last argument if the
+ * command has none.
+ *
+ * Return: NULL-terminated array, NULL on error
+ */
+char **build_argv(const struct parallel_run *run, const char *input) {
+  char **argv = calloc(run->words_count + 2, sizeof(*argv));
+  if (!argv) {
+    error_msg(malloc_fail_msg, true);
+    return NULL;
+  }
+
+  bool substituted = false;
+  unsigned int i = 0;
+
+  for (; i < run->words_count; i++) {
+    substituted |= strstr(run->words[i], PARALLEL_PLACEHOLDER) != NULL;
+
+    argv[i] = expand_word(run->words[i], input);
+    if (!argv[i]) {
+      error_msg(malloc_fail_msg, true);
+      free_argv(argv);
+      return NULL;
+    }
+  }
+
+  if (!substituted) {
+    argv[i] = strdup(input);
+    if (!argv[i]) {
+      error_msg(malloc_fail_msg, true);
+      free_argv(argv);
+      return NULL;
+    }
+  }
+
+  return argv;
+}
+
+/**
+ * join_argv - Join arguments with spaces, for the job table
+ * @argv: NULL-terminated argument array
+ *
+ * Return: New string, NULL on error
+ */
+char *join_argv(char **argv) {
+  size_t len = 1;
+
+  for (unsigned int i = 0; argv[i]; i++) {
+    len += strlen(argv[i]) + 1;
+  }
+
+  char *joined = malloc(len);
+  if (!joined) {
+    return NULL;
+  }
+
+  joined[0] = '\0';
+
+  for (unsigned int i = 0; argv[i]; i++) {
+    if (i > 0) {
+      strcat(joined, " ");
+    }
+    strcat(joined, argv[i]);
+  }
+
+  return joined;
+}
+
+/**
+ * steal_inputs - Give an idle worker half of the largest range left
+ * @run: Invocation
+ * @thief: Worker whose own range is empty
+ *
+ * The back half is taken, so the victim keeps the inputs next to the ones it
+ * has been working through.
+ *
+ * Return: true if inputs were stolen, false if none are left anywhere
+ */
+bool steal_inputs(struct parallel_run *run, struct parallel_worker *thief) {
+  struct parallel_worker *victim = NULL;
+  unsigned int largest = 0;
+
+  for (unsigned int i = 0; i < run->workers_count; i++) {
+    struct parallel_worker *worker = &run->workers[i];
+    unsigned int left = worker->tail - worker->head;
+
+    if (left > largest) {
+      largest = left;
+      victim = worker;
+    }
+  }
+
+  if (!victim) {
+    return false;
+  }
+
+  /* Rounding up means the last input left is stolen too */
+  unsigned int split = victim->tail - (largest + 1) / 2;
+
+  thief->head = split;
+  thief->tail = victim->tail;
+  victim->tail = split;
+
+  return true;
+}
+
+/**
+ * close_capture - Close a worker's capture memfds
+ * @worker: Worker to clean up
+ */
+void close_capture(struct parallel_worker *worker) {
+  for (unsigned int i = 0; i < CAPTURES_COUNT; i++) {
+    if (worker->capture[i] != -1) {
+      close(worker->capture[i]);
+      worker->capture[i] = -1;
+    }
+  }
+}
+
+/**
+ * start_run - Launch the command for an input on an idle worker
+ * @run: Invocation
+ * @worker: Idle worker
+ * @input: Index of the input
+ *
+ * Each run gets its own process group, which keeps Ctrl+C from reaching it
+ * directly (the builtin forwards it), and can't read the terminal.
+ *
+ * Return: 0 if the command is running, -1 if it couldn't be launched
+ */
+int start_run(struct parallel_run *run, struct parallel_worker *worker,
+              unsigned int input) {
+  for (unsigned int i = 0; i < CAPTURES_COUNT; i++) {
+    worker->capture[i] = memfd_create("parallel", MFD_CLOEXEC);
+    if (worker->capture[i] == -1) {
+      error_msg("parallel: failed to create output buffer", true);
+      close_capture(worker);
+      return -1;
+    }
+  }
+
+  char **argv = build_argv(run, run->inputs[input]);
+  char *command = argv ? join_argv(argv) : NULL;
+  struct job *job = command ? job_create(command, 1, true) : NULL;
+
+  if (argv && !command) {
+    error_msg(malloc_fail_msg, true);
+  }
+
+  pid_t pid = -1;
+
+  if (job) {
+    struct stage_spawn stage = {
+        .path = run->path,
+        .argv = argv,
+        .in_fd = run->null_fd,
+        .out_fd = worker->capture[CAPTURE_OUT],
+        .err_fd = worker->capture[CAPTURE_ERR],
+        .pgid = 0,
+        .tty_fd = -1,
+    };
+
+    pid = spawn_stage(&stage);
+  }
+
+  free(command);
+  free_argv(argv);
+
+  if (pid == -1 || job_add_process(job, pid) == -1) {
+    if (job) {
+      job_remove(job);
+    }
+    close_capture(worker);
+    return -1;
+  }
+
+  worker->job = job;
+  worker->input = input;
+  run->running_count++;
+
+  return 0;
+}
+
+/**
+ * print_capture - Copy a finished run's captured output to the shell's
+ * @fd: memfd holding the output
+ * @out_fd: Descriptor to copy to
+ */
+void print_capture(int fd, int out_fd) {
+  if (lseek(fd, 0, SEEK_SET) == 0) {
+    relay_fd(fd, out_fd, NULL);
+  }
+}
+
+/**
+ * print_spilled - Print the output waiting in the spill memfds, in order
+ * @run: Invocation with keep_order
+ *
+ * Stops at the first input whose command hasn't finished yet.
+ */
+void print_spilled(struct parallel_run *run) {
+  while (run->next_output < run->inputs_count &&
+         run->spilled[run->next_output].done) {
+    const struct spilled_output *spilled = &run->spilled[run->next_output];
+
+    relay_range(run->spill[CAPTURE_OUT], spilled->offset[CAPTURE_OUT],
+                spilled->length[CAPTURE_OUT], STDOUT_FILENO);
+    relay_range(run->spill[CAPTURE_ERR], spilled->offset[CAPTURE_ERR],
+                spilled->length[CAPTURE_ERR], STDERR_FILENO);
+
+    run->next_output++;
+  }
+}
+
+/**
+ * emit_output - Print or set aside a finished run's output
+ * @run: Invocation
+ * @worker: Worker whose command finished
+ */
+void emit_output(struct parallel_run *run, struct parallel_worker *worker) {
+  const int out_fds[CAPTURES_COUNT] = {STDOUT_FILENO, STDERR_FILENO};
+
+  /* Anything the shell printed must come out first */
+  fflush(stdout);
+
+  if (!run->keep_order || worker->input == run->next_output) {
+    for (unsigned int i = 0; i < CAPTURES_COUNT; i++) {
+      print_capture(worker->capture[i], out_fds[i]);
+    }
+
+    if (run->keep_order) {
+      run->spilled[worker->input].done = true;
+      print_spilled(run);
+    }
+    return;
+  }
+
+  struct spilled_output *spilled = &run->spilled[worker->input];
+
+  for (unsigned int i = 0; i < CAPTURES_COUNT; i++) {
+    spilled->offset[i] = lseek(run->spill[i], 0, SEEK_END);
+
+    ssize_t length = -1;
+    if (spilled->offset[i] != -1 &&
+        lseek(worker->capture[i], 0, SEEK_SET) == 0) {
+      length = relay_fd(worker->capture[i], run->spill[i], NULL);
+    }
+
+    if (length == -1) {
+      error_msg("parallel: failed to buffer output", true);
+      length = 0;
+    }
+
+    spilled->length[i] = length;
+  }
+
+  spilled->done = true;
+}
+
+/**
+ * finish_run - Collect a worker's command once its job is done
+ * @run: Invocation
+ * @worker: Worker whose job is done
+ */
+void finish_run(struct parallel_run *run, struct parallel_worker *worker) {
+  if (exit_code_of(worker->job->procs[0].status) != 0) {
+    run->failed_count++;
+  }
+
+  emit_output(run, worker);
+  close_capture(worker);
+
+  job_remove(worker->job);
+  worker->job = NULL;
+  run->running_count--;
+}
+
+/**
+ * fill_workers - Launch a command on every idle worker that has input left
+ * @run: Invocation
+ */
+void fill_workers(struct parallel_run *run) {
+  for (unsigned int i = 0; i < run->workers_count; i++) {
+    struct parallel_worker *worker = &run->workers[i];
+
+    while (!worker->job &&
+           (worker->head < worker->tail || steal_inputs(run, worker))) {
+      unsigned int input = worker->head++;
+
+      /* Counted as a failure, the worker moves on to its next input */
+      if (start_run(run, worker, input) == -1) {
+        run->failed_count++;
+
+        if (run->keep_order) {
+          run->spilled[input].done = true;
+          print_spilled(run);
+        }
+      }
+    }
+  }
+}
+
+/**
+ * signal_runs - Send a signal to every running command
+ * @run: Invocation
+ * @signal_num: Signal to send
+ */
+void signal_runs(struct parallel_run *run, int signal_num) {
+  for (unsigned int i = 0; i < run->workers_count; i++) {
+    if (run->workers[i].job) {
+      signal_job(run->workers[i].job, signal_num);
+    }
+  }
+}
+
+/**
+ * run_all - Run every input across the workers
+ * @run: Invocation with inputs and workers set up
+ *
+ * Ctrl+C stops new commands from being launched and is forwarded to the ones
+ * running, whose output is still printed.
+ *
+ * Return: true if interrupted, false otherwise
+ */
+bool run_all(struct parallel_run *run) {
+  bool interrupted = false;
+
+  for (unsigned int i = 0; i < run->workers_count; i++) {
+    struct parallel_worker *worker = &run->workers[i];
+
+    worker->head = (unsigned long)run->inputs_count * i / run->workers_count;
+    worker->tail =
+        (unsigned long)run->inputs_count * (i + 1) / run->workers_count;
+    worker->job = NULL;
+    worker->capture[CAPTURE_OUT] = -1;
+    worker->capture[CAPTURE_ERR] = -1;
+  }
+
+  /* A Ctrl+C at the prompt must not cancel the run */
+  sigint_received = 0;
+
+  for (;;) {
+    if (!interrupted) {
+      fill_workers(run);
+    }
+
+    if (run->running_count == 0) {
+      break;
+    }
+
+    if (jobs_wait_any(NULL) == -1) {
+      interrupted = true;
+      sigint_received = 0;
+      signal_runs(run, SIGINT);
+    }
+
+    for (unsigned int i = 0; i < run->workers_count; i++) {
+      struct parallel_worker *worker = &run->workers[i];
+
+      if (worker->job && job_is_done(worker->job)) {
+        finish_run(run, worker);
+      }
+    }
+  }
+
+  return interrupted;
+}
+
+/**
+ * setup_output - Open what the workers and -k need besides capture memfds
+ * @run: Invocation
+ *
+ * Return: 0 on success, -1 on error
+ */
+int setup_output(struct parallel_run *run) {
+  run->null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (run->null_fd == -1) {
+    error_msg(open_fail_msg, true);
+    return -1;
+  }
+
+  if (!run->keep_order) {
+    return 0;
+  }
+
+  run->spilled = calloc(run->inputs_count, sizeof(*run->spilled));
+  if (!run->spilled) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  for (unsigned int i = 0; i < CAPTURES_COUNT; i++) {
+    run->spill[i] = memfd_create("parallel-spill", MFD_CLOEXEC);
+    if (run->spill[i] == -1) {
+      error_msg("parallel: failed to create output buffer", true);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * free_run - Release everything an invocation holds
+ * @run: Invocation
+ */
+void free_run(struct parallel_run *run) {
+  for (unsigned int i = 0; i < run->inputs_count; i++) {
+    free(run->inputs[i]);
+  }
+
+  for (unsigned int i = 0; i < CAPTURES_COUNT; i++) {
+    if (run->spill[i] != -1) {
+      close(run->spill[i]);
+    }
+  }
+
+  if (run->null_fd != -1) {
+    close(run->null_fd);
+  }
+
+  free(run->inputs);
+  free(run->workers);
+  free(run->spilled);
+}
+
+/**
+ * parallel - Run a command once per input across several workers
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: parallel [-j N] [-k] COMMAND... [::: INPUT...]. Inputs are the
+ * arguments after ":::", or the lines of stdin without it. Every "{}" in
+ * COMMAND is replaced with the input, or the input is appended if there is
+ * none.
+ *
+ * N defaults to the number of online CPUs. Output is printed one run at a
+ * time as runs finish, or in input order with -k (--keep-order).
+ *
+ * Return: 1 if every run succeeded, -1 otherwise
+ */
+int parallel(struct repl_ctx *current_ctx) {
+  struct parallel_run run = {
+      .spill = {-1, -1},
+      .null_fd = -1,
+  };
+  bool read_stdin = false;
+  int result = -1;
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  run.workers_count = cpus > 0 ? cpus : 1;
+
+  if (parse_parallel_args(&run, current_ctx->commands[0], &read_stdin) == -1 ||
+      (read_stdin &&
+       read_inputs(&run, stdin) == -1)) {
+    free_run(&run);
+    return -1;
+  }
+
+  if (run.inputs_count == 0) {
+    free_run(&run);
+    return 1;
+  }
+
+  /* Looked up once for every run, unless the input is part of the name */
+  if (!strstr(run.words[0], PARALLEL_PLACEHOLDER)) {
+    path_cache_sync();
+    run.path = path_cache_lookup(run.words[0]);
+
+    if (!run.path) {
+      path_cache_not_found(run.words[0]);
+      free_run(&run);
+      return -1;
+    }
+  }
+
+  if (run.workers_count > run.inputs_count) {
+    run.workers_count = run.inputs_count;
+  }
+
+  run.workers = calloc(run.workers_count, sizeof(*run.workers));
+  if (!run.workers) {
+    error_msg(malloc_fail_msg, true);
+    free_run(&run);
+    return -1;
+  }
+
+  if (setup_output(&run) == 0) {
+    bool interrupted = run_all(&run);
+
+    if (run.failed_count > 0) {
+      char msg[ERR_MSG_MAX];
+      snprintf(msg, ERR_MSG_MAX, "parallel: %u of %u runs failed",
+               run.failed_count, run.inputs_count);
+      error_msg(msg, false);
+    }
+
+    result = interrupted || run.failed_count > 0 ? -1 : 1;
+  }
+
+  free_run(&run);
+  return result;
+}
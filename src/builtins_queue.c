@@ -0,0 +1,650 @@
+/**
+ * builtins_queue.c
+ * The defer keyword's queue and the queue builtin.
+ *
+ * OVERVIEW:
+ * "defer PIPELINE" doesn't run the pipeline, it adds it to a queue kept by
+ * the shell. Queued pipelines start as background jobs, in queue order, once
+ * the machine has headroom, which makes it easy to put off heavy maintenance
+ * (rebuilding an index, compressing logs) without watching the load by hand.
+ *
+ * HEADROOM:
+ * The first queued pipeline starts when all of these hold:
+ * - fewer than QUEUE_MAX_JOBS (1 by default) queued pipelines are running
+ * - the 1 minute load average is at most QUEUE_MAX_LOAD (the number of
+ *   online CPUs by default)
+ * - the share of the last 10 seconds some task spent waiting for a CPU,
+ *   from /proc/pressure/cpu, is at most QUEUE_MAX_CPU_PRESSURE percent
+ * - the same for memory, from /proc/pressure/memory, is at most
+ *   QUEUE_MAX_MEMORY_PRESSURE percent
+ * The settings are read from ~/.clownrc. Kernels built without pressure stall
+ * information only have the load average checked.
+ *
+ * LAUNCHING:
+ * A queued pipeline is kept as text and goes through the same parsing and
+ * exec() as if it was typed, variables included, once it starts. The queue is
+ * checked before every prompt, and while the prompt waits for input, every
+ * QUEUE_POLL_MS from readline's event hook, which accepts the line to get back
+ * to the REPL loop when it is still empty. Nothing starts while a foreground
+ * command runs.
+ *
+ * "queue" lists the entries and the current readings, "queue -c ID" cancels a
+ * waiting entry and "queue -m ID POS" moves one to position POS among the
+ * waiting entries. A running entry is an ordinary job, for kill, fg and wait,
+ * and leaves the queue once its job is removed.
+ */
+
+#define _GNU_SOURCE
+
+#include <readline/readline.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "config.h"
+#include "error.h"
+#include "exec.h"
+#include "jobs.h"
+
+/* How often the idle prompt checks whether a queued pipeline can start */
+#define QUEUE_POLL_MS 1000
+
+/* Defaults for the settings in ~/.clownrc, QUEUE_MAX_LOAD is the CPU count */
+#define QUEUE_MAX_JOBS_DEFAULT 1
+#define QUEUE_MAX_CPU_PRESSURE_DEFAULT 10.0
+#define QUEUE_MAX_MEMORY_PRESSURE_DEFAULT 5.0
+
+#define CPU_PRESSURE_PATH "/proc/pressure/cpu"
+#define MEMORY_PRESSURE_PATH "/proc/pressure/memory"
+
+static const char queue_usage_msg[] =
+    "queue: usage: queue [-c ID | -m ID POS]";
+
+/**
+ * queue_entry - A deferred pipeline
+ * @id: Number shown by queue and used by -c and -m
+ * @command: Pipeline as typed, without the defer keyword
+ * @job: Job running the pipeline, NULL while it waits
+ */
+struct queue_entry {
+  unsigned int id;
+  char *command;
+  struct job *job;
+};
+
+/**
+ * queue_limits - Thresholds a queued pipeline has to wait for
+ * @max_jobs: Queued pipelines allowed to run at once
+ * @max_load: Highest 1 minute load average
+ * @max_cpu_pressure: Highest CPU pressure, in percent
+ * @max_memory_pressure: Highest memory pressure, in percent
+ */
+struct queue_limits {
+  long max_jobs;
+  double max_load;
+  double max_cpu_pressure;
+  double max_memory_pressure;
+};
+
+/**
+ * queue - The deferred pipelines, in the order they start
+ * @entries: Running entries, then waiting ones in order
+ * @count: Number of entries
+ * @next_id: ID of the next entry added
+ * @ctx: Shell context the entries were added from, for readline's event hook
+ * @last_poll: When readline's event hook last checked for headroom
+ */
+static struct {
+  struct queue_entry *entries;
+  unsigned int count;
+  unsigned int next_id;
+  struct repl_ctx *ctx;
+  struct timespec last_poll;
+  bool draining;
+} queue = {.next_id = 1};
+
+/**
+ * setting_number - Read a numeric setting from ~/.clownrc
+ * @current_ctx: Shell context (for configuration)
+ * @name: Name of the setting
+ * @fallback: Value used if the setting isn't set or invalid
+ * @report: Whether to report an invalid setting
+ *
+ * Return: Value of the setting, fallback if it isn't set or invalid
+ */
+double setting_number(struct repl_ctx *current_ctx, const char *name,
+                      double fallback, bool report) {
+  const char *setting =
+      get_user_env(name, current_ctx->user_envs, current_ctx->user_envs_count);
+  char *end;
+
+  if (!setting) {
+    return fallback;
+  }
+
+  double value = strtod(setting, &end);
+  if (end == setting || *end != '\0' || value < 0) {
+    if (report) {
+      char msg[ERR_MSG_MAX];
+      snprintf(msg, ERR_MSG_MAX, "queue: invalid %s, using the default", name);
+      error_msg(msg, false);
+    }
+    return fallback;
+  }
+
+  return value;
+}
+
+/**
+ * read_limits - Get the thresholds from ~/.clownrc
+ * @current_ctx: Shell context (for configuration)
+ * @limits: Output parameter
+ * @report: Whether to report invalid settings
+ */
+void read_limits(struct repl_ctx *current_ctx, struct queue_limits *limits,
+                 bool report) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  limits->max_jobs = (long)setting_number(current_ctx, "QUEUE_MAX_JOBS",
+                                          QUEUE_MAX_JOBS_DEFAULT, report);
+  limits->max_load = setting_number(current_ctx, "QUEUE_MAX_LOAD",
+                                    cpus > 0 ? cpus : 1, report);
+  limits->max_cpu_pressure =
+      setting_number(current_ctx, "QUEUE_MAX_CPU_PRESSURE",
+                     QUEUE_MAX_CPU_PRESSURE_DEFAULT, report);
+  limits->max_memory_pressure =
+      setting_number(current_ctx, "QUEUE_MAX_MEMORY_PRESSURE",
+                     QUEUE_MAX_MEMORY_PRESSURE_DEFAULT, report);
+}
+
+/**
+ * read_pressure - Read how much of the last 10 seconds some task stalled
+ * @path: File under /proc/pressure
+ *
+ * Return: The "some avg10" value in percent, -1 if it can't be read
+ */
+double read_pressure(const char *path) {
+  FILE *file = fopen(path, "re");
+  double avg10;
+
+  if (!file) {
+    return -1;
+  }
+
+  if (fscanf(file, "some avg10=%lf", &avg10) != 1) {
+    avg10 = -1;
+  }
+
+  fclose(file);
+
+  return avg10;
+}
+
+/**
+ * running_count - Count the queued pipelines that are still running
+ *
+ * Return: Entries whose job hasn't finished
+ */
+unsigned int running_count(void) {
+  unsigned int running = 0;
+
+  for (unsigned int i = 0; i < queue.count; i++) {
+    if (queue.entries[i].job && !job_is_done(queue.entries[i].job)) {
+      running++;
+    }
+  }
+
+  return running;
+}
+
+/**
+ * first_waiting - Find the entry that starts next
+ *
+ * Return: Index of the first waiting entry, queue.count if there is none
+ */
+unsigned int first_waiting(void) {
+  unsigned int i = 0;
+
+  while (i < queue.count && queue.entries[i].job) {
+    i++;
+  }
+
+  return i;
+}
+
+/**
+ * has_headroom - Check the machine against the thresholds
+ * @limits: Thresholds
+ *
+ * Return: true if a queued pipeline may start, false otherwise
+ */
+bool has_headroom(const struct queue_limits *limits) {
+  double load;
+
+  if ((long)running_count() >= limits->max_jobs) {
+    return false;
+  }
+
+  if (getloadavg(&load, 1) == 1 && load > limits->max_load) {
+    return false;
+  }
+
+  return read_pressure(CPU_PRESSURE_PATH) <= limits->max_cpu_pressure &&
+         read_pressure(MEMORY_PRESSURE_PATH) <= limits->max_memory_pressure;
+}
+
+/**
+ * remove_queue_entry - Drop an entry from the queue
+ * @index: Index of the entry
+ */
+void remove_queue_entry(unsigned int index) {
+  free(queue.entries[index].command);
+
+  memmove(&queue.entries[index], &queue.entries[index + 1],
+          (queue.count - index - 1) * sizeof(struct queue_entry));
+  queue.count--;
+}
+
+/**
+ * find_queue_entry - Look up an entry by ID
+ * @id: ID of the entry
+ *
+ * Return: Index of the entry, -1 if there is none
+ */
+int find_queue_entry(unsigned int id) {
+  for (unsigned int i = 0; i < queue.count; i++) {
+    if (queue.entries[i].id == id) {
+      return (int)i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * queue_release - io_release hook, takes a finished entry off the queue
+ * @job: Job of the entry, being removed
+ */
+void queue_release(struct job *job) {
+  int index = find_queue_entry((unsigned int)(uintptr_t)job->io_data);
+
+  if (index != -1) {
+    remove_queue_entry(index);
+  }
+
+  job->io_data = NULL;
+  job->io_release = NULL;
+}
+
+/**
+ * queue_add - Add the pipeline being evaluated to the queue
+ * @current_ctx: Shell context with the defer keyword parsed
+ *
+ * Sets $? to 0 once the pipeline is queued, to SKIPPED_EXIT_CODE if defer is
+ * used the wrong way, and to 1 on other errors.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int queue_add(struct repl_ctx *current_ctx) {
+  const char *command = current_ctx->input + strspn(current_ctx->input, " \t");
+
+  /* The rest is stored as typed, so defer has to be the first word */
+  if (strncmp(command, "defer", 5) != 0 || !strchr(" \t", command[5])) {
+    error_msg("defer: has to come before the other keywords", false);
+    set_exit_status(current_ctx, SKIPPED_EXIT_CODE);
+    return -1;
+  }
+
+  if (current_ctx->is_background_process) {
+    error_msg("defer: queued pipelines run in the background, leave out &",
+              false);
+    set_exit_status(current_ctx, SKIPPED_EXIT_CODE);
+    return -1;
+  }
+
+  command += 5 + strspn(command + 5, " \t");
+
+  struct queue_entry *entries =
+      realloc(queue.entries, (queue.count + 1) * sizeof(struct queue_entry));
+  if (!entries) {
+    error_msg(malloc_fail_msg, true);
+    set_exit_status(current_ctx, 1);
+    return -1;
+  }
+  queue.entries = entries;
+
+  struct queue_entry *entry = &queue.entries[queue.count];
+  entry->command = strdup(command);
+  if (!entry->command) {
+    error_msg(strdup_fail_msg, true);
+    set_exit_status(current_ctx, 1);
+    return -1;
+  }
+
+  entry->id = queue.next_id++;
+  entry->job = NULL;
+  queue.count++;
+  queue.ctx = current_ctx;
+
+  /* Report bad settings now rather than every time the queue is checked */
+  struct queue_limits limits;
+  read_limits(current_ctx, &limits, true);
+
+  printf("queued as %u\n", entry->id);
+  set_exit_status(current_ctx, 0);
+
+  return 0;
+}
+
+/**
+ * queue_next - Take the next pipeline to start, if there is headroom
+ * @current_ctx: Shell context (for configuration)
+ * @id: Output parameter - ID of the entry, for queue_started()
+ *
+ * Return: The pipeline as a background command line, to be freed by the
+ * caller, NULL if nothing should start now
+ */
+char *queue_next(struct repl_ctx *current_ctx, unsigned int *id) {
+  const unsigned int index = first_waiting();
+  struct queue_limits limits;
+  char *command;
+
+  if (index == queue.count) {
+    return NULL;
+  }
+
+  read_limits(current_ctx, &limits, false);
+  if (!has_headroom(&limits)) {
+    return NULL;
+  }
+
+  if (asprintf(&command, "%s &", queue.entries[index].command) == -1) {
+    error_msg(malloc_fail_msg, true);
+    return NULL;
+  }
+
+  *id = queue.entries[index].id;
+
+  return command;
+}
+
+/**
+ * queue_started - Record the job a queued pipeline started as
+ * @id: ID returned by queue_next()
+ * @job: Job created for the pipeline, NULL if it didn't start
+ *
+ * A pipeline that didn't start (a typo in the command, say) leaves the queue,
+ * it would fail the same way every time.
+ */
+void queue_started(unsigned int id, struct job *job) {
+  int index = find_queue_entry(id);
+
+  if (index == -1) {
+    return;
+  }
+
+  if (!job || job->io_release) {
+    remove_queue_entry(index);
+    return;
+  }
+
+  queue.entries[index].job = job;
+  job->io_release = queue_release;
+  job->io_data = (void *)(uintptr_t)id;
+}
+
+/**
+ * queue_waiting - Check whether any pipeline waits for headroom
+ *
+ * Return: true if a queued pipeline hasn't started yet, false otherwise
+ */
+bool queue_waiting(void) { return first_waiting() < queue.count; }
+
+/**
+ * queue_event_hook - readline event hook, ends an idle prompt when a queued
+ * pipeline can start
+ *
+ * Return: 0 always
+ */
+int queue_event_hook(void) {
+  struct timespec now;
+  struct queue_limits limits;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  const long elapsed_ms = (now.tv_sec - queue.last_poll.tv_sec) * 1000 +
+                          (now.tv_nsec - queue.last_poll.tv_nsec) / 1000000;
+
+  /* Never throw away what the user is typing */
+  if (elapsed_ms < QUEUE_POLL_MS || rl_end > 0 || !queue_waiting()) {
+    return 0;
+  }
+
+  queue.last_poll = now;
+
+  /* Running entries only count as done once their processes are reaped */
+  jobs_reap();
+
+  read_limits(queue.ctx, &limits, false);
+  if (has_headroom(&limits)) {
+    rl_done = 1;
+  }
+
+  return 0;
+}
+
+/**
+ * print_queue - List the entries and what they wait for
+ * @current_ctx: Shell context (for configuration)
+ */
+void print_queue(struct repl_ctx *current_ctx) {
+  struct queue_limits limits;
+  double load = -1;
+
+  read_limits(current_ctx, &limits, true);
+  getloadavg(&load, 1);
+  jobs_reap();
+
+  printf("load %.2f (max %.2f), cpu pressure ", load, limits.max_load);
+
+  const double cpu = read_pressure(CPU_PRESSURE_PATH);
+  const double memory = read_pressure(MEMORY_PRESSURE_PATH);
+
+  if (cpu < 0 || memory < 0) {
+    printf("n/a, memory pressure n/a");
+  } else {
+    printf("%.2f%% (max %.2f%%), memory pressure %.2f%% (max %.2f%%)", cpu,
+           limits.max_cpu_pressure, memory, limits.max_memory_pressure);
+  }
+
+  printf(", running %u (max %ld)\n", running_count(), limits.max_jobs);
+
+  for (unsigned int i = 0; i < queue.count; i++) {
+    const struct queue_entry *entry = &queue.entries[i];
+
+    if (entry->job) {
+      printf("%u\t%%%u\t%s\n", entry->id, entry->job->id, entry->command);
+    } else {
+      printf("%u\twaiting\t%s\n", entry->id, entry->command);
+    }
+  }
+}
+
+/**
+ * parse_queue_id - Resolve an ID argument to a waiting entry
+ * @arg: ID given by the user
+ *
+ * Return: Index of the entry, -1 if there is no such waiting entry (reported)
+ */
+int parse_queue_id(const char *arg) {
+  char msg[ERR_MSG_MAX];
+  char *end;
+  long id = strtol(arg, &end, 10);
+  int index = *end == '\0' && id > 0 ? find_queue_entry((unsigned int)id) : -1;
+
+  if (index == -1) {
+    snprintf(msg, ERR_MSG_MAX, "queue: %s: no such entry", arg);
+    error_msg(msg, false);
+    return -1;
+  }
+
+  if (queue.entries[index].job) {
+    snprintf(msg, ERR_MSG_MAX, "queue: %s: already running as job %%%u", arg,
+             queue.entries[index].job->id);
+    error_msg(msg, false);
+    return -1;
+  }
+
+  return index;
+}
+
+/**
+ * move_queue_entry - Move a waiting entry to another position
+ * @index: Index of the entry
+ * @position: Position among the waiting entries, 1 to start next
+ */
+void move_queue_entry(unsigned int index, unsigned long position) {
+  const unsigned int waiting_start = first_waiting();
+  struct queue_entry entry = queue.entries[index];
+  unsigned int target = waiting_start + position - 1;
+
+  if (position == 0 || target >= queue.count) {
+    target = queue.count - 1;
+  }
+
+  if (target < index) {
+    memmove(&queue.entries[target + 1], &queue.entries[target],
+            (index - target) * sizeof(struct queue_entry));
+  } else {
+    memmove(&queue.entries[index], &queue.entries[index + 1],
+            (target - index) * sizeof(struct queue_entry));
+  }
+
+  queue.entries[target] = entry;
+}
+
+/**
+ * queue_builtin - List, cancel or reorder deferred pipelines
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: queue [-c ID | -m ID POS]. Without arguments, lists the entries
+ * along with the load and pressure readings they wait on. -c cancels a
+ * waiting entry, -m moves one to position POS among the waiting entries.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int queue_builtin(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+  int index;
+
+  if (!args[1]) {
+    print_queue(current_ctx);
+    return 1;
+  }
+
+  if (strcmp(args[1], "-c") == 0 && args[2] && !args[3]) {
+    if ((index = parse_queue_id(args[2])) == -1) {
+      return -1;
+    }
+
+    remove_queue_entry(index);
+    return 1;
+  }
+
+  if (strcmp(args[1], "-m") == 0 && args[2] && args[3] && !args[4]) {
+    char *end;
+    unsigned long position = strtoul(args[3], &end, 10);
+
+    if (*end != '\0' || position == 0) {
+      error_msg(queue_usage_msg, false);
+      return -1;
+    }
+
+    if ((index = parse_queue_id(args[2])) == -1) {
+      return -1;
+    }
+
+    move_queue_entry(index, position);
+    return 1;
+  }
+
+  error_msg(queue_usage_msg, false);
+  return -1;
+}
+
+/**
+ * queue_drain - Ask for the deferred pipelines to be started and waited for
+ * @drain: Whether to, false to stop
+ *
+ * For wait, which can't start them itself in the middle of a command.
+ */
+void queue_drain(bool drain) { queue.draining = drain && queue_waiting(); }
+
+/**
+ * queue_draining - Check whether the deferred pipelines are to be drained
+ *
+ * Return: true if queue_drain() asked for it and it isn't over yet
+ */
+bool queue_draining(void) { return queue.draining; }
+
+/**
+ * queue_drain_wait - Wait while the queue is drained
+ *
+ * While pipelines are still queued, waits until a job changes state or
+ * QUEUE_POLL_MS passed, either of which may leave headroom for the next one.
+ * Once none are, waits for every background job and ends the draining.
+ *
+ * Return: 0 on success, -1 if interrupted by Ctrl+C, which ends the draining
+ */
+int queue_drain_wait(void) {
+  if (!queue_waiting()) {
+    queue.draining = false;
+    return wait_all_jobs(NULL) == 0 ? 0 : -1;
+  }
+
+  struct timespec poll;
+  deadline_in(&poll, QUEUE_POLL_MS);
+
+  if (jobs_wait_any(&poll) == -1) {
+    queue.draining = false;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * queue_drop_all - Forget the deferred pipelines before the shell exits
+ *
+ * Waiting entries are dropped with a warning. Running ones are left to the
+ * job table like any other background job.
+ */
+void queue_drop_all(void) {
+  unsigned int dropped = 0;
+
+  for (unsigned int i = 0; i < queue.count; i++) {
+    if (queue.entries[i].job) {
+      queue.entries[i].job->io_release = NULL;
+      queue.entries[i].job->io_data = NULL;
+    } else {
+      dropped++;
+    }
+    free(queue.entries[i].command);
+  }
+
+  if (dropped > 0) {
+    char msg[ERR_MSG_MAX];
+    snprintf(msg, ERR_MSG_MAX, "queue: dropping %u pipeline(s) that never "
+                               "started",
+             dropped);
+    error_msg(msg, false);
+  }
+
+  free(queue.entries);
+  queue.entries = NULL;
+  queue.count = 0;
+}
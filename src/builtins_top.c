@@ -0,0 +1,410 @@
+/**
+ * builtins_top.c
+ * The "jobs top" view.
+ *
+ * OVERVIEW:
+ * "jobs top [-d INTERVAL] [-n COUNT]" shows what every process of every job
+ * costs, refreshed every INTERVAL (1 second by default) until Ctrl+C, COUNT
+ * refreshes or the last job finishing: its state, the share of a CPU it used
+ * since the previous refresh, its resident memory, and how many bytes it read
+ * and wrote, pipes included.
+ *
+ * SAMPLING:
+ * The figures come from /proc/PID/stat (state, CPU time, resident pages) and
+ * /proc/PID/io (bytes read and written). Both are opened once per process
+ * and kept open across refreshes: reading them again with pread() at offset
+ * 0 gets fresh figures without the path lookup and permission checks of an
+ * open() per file per refresh. Every process is read in one pass, right after
+ * another, so the figures of a refresh describe the same moment. An open
+ * /proc/PID descriptor keeps referring to the process it was opened for, so a
+ * recycled PID can't be mistaken for the old process, reading just fails.
+ *
+ * Between refreshes, the shell waits in jobs_wait_any(), so finished stages
+ * are reaped and dropped from the view on time.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "error.h"
+#include "jobs.h"
+#include "parse.h"
+#include "profile.h"
+#include "signals.h"
+
+/* Refresh interval used without -d */
+#define TOP_INTERVAL_MS 1000
+
+/* Longest /proc/PID/stat or /proc/PID/io we read */
+#define TOP_READ_MAX 1024
+
+/* Clears the terminal and moves the cursor to the top left corner */
+#define TOP_CLEAR "\033[H\033[2J"
+
+static const char top_usage_msg[] =
+    "jobs: usage: jobs top [-d INTERVAL] [-n COUNT]";
+
+/**
+ * top_proc - A process shown by jobs top
+ * @pid: Process ID
+ * @job_id: Number of the job the process belongs to
+ * @stat_fd: Open /proc/PID/stat
+ * @io_fd: Open /proc/PID/io, -1 if it can't be read
+ * @seen: Whether the process was still in the job table this refresh
+ * @sampled: When cpu_ticks was sampled, the process's start before the first
+ * sample (CLOCK_MONOTONIC)
+ * @state: State letter from /proc/PID/stat
+ * @comm: Program name from /proc/PID/stat
+ * @cpu_ticks: User and system time at the last sample, in clock ticks
+ * @cpu_percent: Share of a CPU used since the previous sample, or since the
+ * process started for the first one
+ * @rss_bytes: Resident memory
+ * @read_bytes: Bytes read so far, -1 if unknown
+ * @write_bytes: Bytes written so far, -1 if unknown
+ */
+struct top_proc {
+  pid_t pid;
+  unsigned int job_id;
+  int stat_fd;
+  int io_fd;
+  bool seen;
+  struct timespec sampled;
+  char state;
+  char comm[32];
+  unsigned long long cpu_ticks;
+  double cpu_percent;
+  long long rss_bytes;
+  long long read_bytes;
+  long long write_bytes;
+};
+
+/**
+ * top_view - Processes shown by jobs top
+ * @procs: One entry per process
+ * @count: Number of entries in procs
+ * @capacity: Number of entries procs has room for
+ */
+struct top_view {
+  struct top_proc *procs;
+  unsigned int count;
+  unsigned int capacity;
+};
+
+/**
+ * open_proc_file - Open a file under /proc/PID
+ * @pid: Process ID
+ * @name: File name
+ *
+ * Return: Descriptor, -1 on error
+ */
+int open_proc_file(pid_t pid, const char *name) {
+  char path[64];
+
+  snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+
+  return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/**
+ * read_proc_file - Read an open /proc file from the start
+ * @fd: Descriptor from open_proc_file()
+ * @buffer: Output buffer, TOP_READ_MAX bytes
+ *
+ * Return: 0 on success, -1 on error (such as the process having exited)
+ */
+int read_proc_file(int fd, char *buffer) {
+  ssize_t len = pread(fd, buffer, TOP_READ_MAX - 1, 0);
+
+  if (len <= 0) {
+    return -1;
+  }
+
+  buffer[len] = '\0';
+
+  return 0;
+}
+
+/**
+ * track_proc - jobs_for_each() callback adding a job's processes to the view
+ * @job: Job to add
+ * @arg: struct top_view
+ *
+ * Processes already in the view are only marked as seen, so their
+ * descriptors and previous sample are kept.
+ */
+void track_proc(struct job *job, void *arg) {
+  struct top_view *view = arg;
+
+  for (unsigned int i = 0; i < job->procs_count; i++) {
+    const struct job_proc *proc = &job->procs[i];
+    unsigned int j = 0;
+
+    /* In-shell stages have no process of their own */
+    if (proc->pid <= 0 || proc->finished) {
+      continue;
+    }
+
+    while (j < view->count && view->procs[j].pid != proc->pid) {
+      j++;
+    }
+
+    if (j < view->count) {
+      view->procs[j].seen = true;
+      continue;
+    }
+
+    if (view->count == view->capacity) {
+      unsigned int capacity = view->capacity ? view->capacity * 2 : 16;
+      struct top_proc *procs =
+          realloc(view->procs, capacity * sizeof(struct top_proc));
+      if (!procs) {
+        error_msg(malloc_fail_msg, true);
+        return;
+      }
+      view->procs = procs;
+      view->capacity = capacity;
+    }
+
+    int stat_fd = open_proc_file(proc->pid, "stat");
+    if (stat_fd == -1) {
+      continue;
+    }
+
+    view->procs[view->count++] = (struct top_proc){
+        .pid = proc->pid,
+        .job_id = job->id,
+        .stat_fd = stat_fd,
+        .io_fd = open_proc_file(proc->pid, "io"),
+        .seen = true,
+        .sampled = proc->start_time,
+    };
+  }
+}
+
+/**
+ * untrack_procs - Drop the processes that are gone from the job table
+ * @view: View whose entries were marked by track_proc()
+ */
+void untrack_procs(struct top_view *view) {
+  unsigned int kept = 0;
+
+  for (unsigned int i = 0; i < view->count; i++) {
+    struct top_proc *proc = &view->procs[i];
+
+    if (!proc->seen) {
+      close(proc->stat_fd);
+      if (proc->io_fd != -1) {
+        close(proc->io_fd);
+      }
+      continue;
+    }
+
+    proc->seen = false;
+    view->procs[kept++] = *proc;
+  }
+
+  view->count = kept;
+}
+
+/**
+ * sample_proc - Take a new sample of a process
+ * @proc: Process, with its descriptors open
+ * @now: Time of the sample (CLOCK_MONOTONIC)
+ *
+ * Return: 0 on success, -1 if the process is gone
+ */
+int sample_proc(struct top_proc *proc, const struct timespec *now) {
+  char buffer[TOP_READ_MAX];
+  unsigned long long utime;
+  unsigned long long stime;
+  long rss_pages;
+
+  if (read_proc_file(proc->stat_fd, buffer) == -1) {
+    return -1;
+  }
+
+  /* The name is in parentheses and can contain anything, even ")" */
+  char *open_paren = strchr(buffer, '(');
+  char *close_paren = strrchr(buffer, ')');
+  if (!open_paren || !close_paren || close_paren < open_paren) {
+    return -1;
+  }
+
+  snprintf(proc->comm, sizeof(proc->comm), "%.*s",
+           (int)(close_paren - open_paren - 1), open_paren + 1);
+
+  /* Fields 3 (state), 14 and 15 (utime, stime) and 24 (rss) */
+  if (sscanf(close_paren + 2,
+             "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d "
+             "%*d %*d %*d %*d %*u %*u %ld",
+             &proc->state, &utime, &stime, &rss_pages) != 4) {
+    return -1;
+  }
+
+  const unsigned long long ticks = utime + stime;
+  const double elapsed_ticks =
+      ((now->tv_sec - proc->sampled.tv_sec) +
+       (now->tv_nsec - proc->sampled.tv_nsec) / 1e9) *
+      sysconf(_SC_CLK_TCK);
+
+  /* Before the first sample, cpu_ticks is 0 as of the process's start */
+  proc->cpu_percent =
+      elapsed_ticks > 0 ? (ticks - proc->cpu_ticks) * 100.0 / elapsed_ticks
+                        : 0;
+  proc->cpu_ticks = ticks;
+  proc->sampled = *now;
+  proc->rss_bytes = (long long)rss_pages * sysconf(_SC_PAGESIZE);
+
+  /* Every read() and write(), pipes included, not only storage */
+  proc->read_bytes = -1;
+  proc->write_bytes = -1;
+
+  if (proc->io_fd != -1 && read_proc_file(proc->io_fd, buffer) == 0) {
+    sscanf(buffer, "rchar: %lld wchar: %lld", &proc->read_bytes,
+           &proc->write_bytes);
+  }
+
+  return 0;
+}
+
+/**
+ * print_view - Print one refresh of the view
+ * @view: Sampled processes
+ * @clear: Whether to clear the terminal first
+ */
+void print_view(const struct top_view *view, bool clear) {
+  char rss[16];
+  char in[16];
+  char out[16];
+
+  printf("%s%-5s %-8s %-5s %6s %8s %8s %8s  %s\n", clear ? TOP_CLEAR : "",
+         "JOB", "PID", "STATE", "CPU%", "RSS", "READ", "WRITE", "COMMAND");
+
+  for (unsigned int i = 0; i < view->count; i++) {
+    const struct top_proc *proc = &view->procs[i];
+
+    format_bytes(rss, sizeof(rss), proc->rss_bytes);
+
+    if (proc->read_bytes == -1) {
+      strcpy(in, "-");
+      strcpy(out, "-");
+    } else {
+      format_bytes(in, sizeof(in), proc->read_bytes);
+      format_bytes(out, sizeof(out), proc->write_bytes);
+    }
+
+    printf("%%%-4u %-8d %-5c %6.1f %8s %8s %8s  %s\n", proc->job_id, proc->pid,
+           proc->state, proc->cpu_percent, rss, in, out, proc->comm);
+  }
+
+  fflush(stdout);
+}
+
+/**
+ * parse_top_args - Parse the options of jobs top
+ * @args: Arguments of jobs, "top" at index 1
+ * @interval_ms: Output parameter - refresh interval
+ * @count: Output parameter - refreshes to show, 0 for no limit
+ *
+ * Return: 0 on success, -1 on error
+ */
+int parse_top_args(char **args, long *interval_ms, long *count) {
+  *interval_ms = TOP_INTERVAL_MS;
+  *count = 0;
+
+  for (unsigned int i = 2; args[i]; i += 2) {
+    char *end;
+
+    if (!args[i + 1]) {
+      return -1;
+    }
+
+    if (strcmp(args[i], "-d") == 0) {
+      if (parse_duration(args[i + 1], interval_ms) == -1 || *interval_ms <= 0) {
+        return -1;
+      }
+    } else if (strcmp(args[i], "-n") == 0) {
+      *count = strtol(args[i + 1], &end, 10);
+      if (*end != '\0' || *count <= 0) {
+        return -1;
+      }
+    } else {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * jobs_top - Show the CPU, memory and I/O use of every job's processes
+ * @current_ctx: Shell context with command arguments
+ *
+ * Usage: jobs top [-d INTERVAL] [-n COUNT]. Refreshes every INTERVAL until
+ * Ctrl+C, COUNT refreshes or no job has a process left.
+ *
+ * Return: 1 on success, -1 on error
+ */
+int jobs_top(struct repl_ctx *current_ctx) {
+  struct top_view view = {.procs = NULL, .count = 0, .capacity = 0};
+  const bool clear = isatty(STDOUT_FILENO);
+  long interval_ms;
+  long count;
+
+  if (parse_top_args(current_ctx->commands[0], &interval_ms, &count) == -1) {
+    error_msg(top_usage_msg, false);
+    return -1;
+  }
+
+  sigint_received = 0;
+
+  for (long refresh = 1;; refresh++) {
+    struct timespec now;
+
+    jobs_reap();
+    jobs_for_each(track_proc, &view);
+    untrack_procs(&view);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    /* One pass over every process, so the figures describe the same moment */
+    for (unsigned int i = 0; i < view.count; i++) {
+      if (sample_proc(&view.procs[i], &now) == -1) {
+        view.procs[i].state = 'X';
+        view.procs[i].cpu_percent = 0;
+      }
+    }
+
+    print_view(&view, clear);
+
+    if (view.count == 0 || (count > 0 && refresh >= count)) {
+      break;
+    }
+
+    struct timespec deadline;
+    deadline_in(&deadline, interval_ms);
+
+    /* Finished stages are reaped meanwhile, Ctrl+C ends the view */
+    int result;
+    do {
+      result = jobs_wait_any(&deadline);
+    } while (result == 0);
+
+    if (result == -1) {
+      break;
+    }
+  }
+
+  /* Every entry is unseen now, so this closes all of them */
+  untrack_procs(&view);
+  free(view.procs);
+
+  return 1;
+}
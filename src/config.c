@@ -45,6 +45,79 @@ char *get_user_env(const char *var_name, struct user_env *user_envs,
   return NULL;
 }
 
+/**
+ * set_user_env - Set a shell variable
+ * @current_ctx: Shell context
+ * @var_name: Variable name
+ * @value: New value, copied
+ *
+ * Shell variables live alongside the ones from ~/.clownrc, so they are
+ * expanded the same way. This is how $? and $PIPESTATUS are kept up to date.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int set_user_env(struct repl_ctx *current_ctx, const char *var_name,
+                 const char *value) {
+  char *new_value = strdup(value);
+  if (!new_value) {
+    error_msg(strdup_fail_msg, true);
+    return -1;
+  }
+
+  for (unsigned int i = 0; i < current_ctx->user_envs_count; i++) {
+    if (strcmp(var_name, current_ctx->user_envs[i].name) == 0) {
+      free(current_ctx->user_envs[i].value);
+      current_ctx->user_envs[i].value = new_value;
+      return 0;
+    }
+  }
+
+  struct user_env *user_envs =
+      realloc(current_ctx->user_envs,
+              (current_ctx->user_envs_count + 1) * sizeof(struct user_env));
+  if (!user_envs) {
+    error_msg(malloc_fail_msg, true);
+    free(new_value);
+    return -1;
+  }
+
+  current_ctx->user_envs = user_envs;
+
+  char *new_name = strdup(var_name);
+  if (!new_name) {
+    error_msg(strdup_fail_msg, true);
+    free(new_value);
+    return -1;
+  }
+
+  current_ctx->user_envs[current_ctx->user_envs_count].name = new_name;
+  current_ctx->user_envs[current_ctx->user_envs_count].value = new_value;
+  current_ctx->user_envs_count++;
+
+  return 0;
+}
+
+/**
+ * unset_user_env - Remove a shell variable
+ * @current_ctx: Shell context
+ * @var_name: Variable name
+ *
+ * The last variable takes the place of the removed one, order doesn't matter
+ * to lookups. Removing a variable that isn't set does nothing.
+ */
+void unset_user_env(struct repl_ctx *current_ctx, const char *var_name) {
+  for (unsigned int i = 0; i < current_ctx->user_envs_count; i++) {
+    if (strcmp(var_name, current_ctx->user_envs[i].name) == 0) {
+      free(current_ctx->user_envs[i].name);
+      free(current_ctx->user_envs[i].value);
+      current_ctx->user_envs_count--;
+      current_ctx->user_envs[i] =
+          current_ctx->user_envs[current_ctx->user_envs_count];
+      return;
+    }
+  }
+}
+
 /**
  * construct_config_path - Build path to config file
  * @current_ctx: Shell context
@@ -189,6 +262,9 @@ int parse_user_envs(struct repl_ctx *current_ctx, char *config_file_contents) {
     current_line = strtok(NULL, "\n");
   }
 
+  /* '=' in a value is counted too, only keep the entries actually filled in */
+  current_ctx->user_envs_count = i;
+
   return 0;
 }
 
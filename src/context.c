@@ -16,6 +16,7 @@
 
 #include "config.h"
 #include "envs.h"
+#include "fanout.h"
 
 /**
  * clenaup_ctx - Free all dynamically allocated memory in context
@@ -50,6 +51,22 @@ void cleanup_ctx(struct repl_ctx *current_ctx) {
       if (current_ctx->out_stream_name[i]) {
         free(current_ctx->out_stream_name[i]);
       }
+
+      if (current_ctx->stage_attrs && current_ctx->stage_attrs[i]) {
+        free(current_ctx->stage_attrs[i]);
+      }
+
+      if (current_ctx->out_fanout) {
+        fanout_free(current_ctx->out_fanout[i]);
+      }
+    }
+
+    if (current_ctx->out_fanout) {
+      free(current_ctx->out_fanout);
+    }
+
+    if (current_ctx->stage_attrs) {
+      free(current_ctx->stage_attrs);
     }
 
     if (current_ctx->out_stream_name) {
@@ -80,6 +97,17 @@ void cleanup_ctx(struct repl_ctx *current_ctx) {
   if (current_ctx->input) {
     free(current_ctx->input);
   }
+
+  free(current_ctx->profile_output);
+  current_ctx->profile_output = NULL;
+
+  if (current_ctx->watch_paths) {
+    for (unsigned int i = 0; current_ctx->watch_paths[i]; i++) {
+      free(current_ctx->watch_paths[i]);
+    }
+    free(current_ctx->watch_paths);
+    current_ctx->watch_paths = NULL;
+  }
 }
 
 /**
@@ -96,6 +124,17 @@ void init_current_ctx(struct repl_ctx *current_ctx) {
     exit(EXIT_FAILURE);
   }
 
+  /* Stays empty if there is no config file to load */
+  current_ctx->user_envs = NULL;
+  current_ctx->user_envs_count = 0;
+
+  /* Only known in advance with -c, the REPL never knows what comes next */
+  current_ctx->is_last_command = 0;
+
+  /* Only allocated by pipeline keywords, freed after every command */
+  current_ctx->profile_output = NULL;
+  current_ctx->watch_paths = NULL;
+
   load_config(current_ctx);
 
   /* 
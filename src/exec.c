@@ -10,277 +10,1178 @@
  * - Pipes between commands
  * - I/O redirection
  * - Background processes
+ * - Stages that run inside the shell (cat, builtins)
+ * - Exit statuses ($? and $PIPESTATUS) and the time keyword
+ * - Time limits set with the timeout keyword
+ * - Relays between stages for the profile keyword
+ * - Relays copying a stage's output to several files and the next stage
+ * - Process substitutions, whose subshells run as part of the job
+ * - Argument lists too long for exec, which are reported or run in batches
+ * - Replacing the shell with the last command when no input follows
+ *
+ * Launching the processes themselves is left to launch.c, this file decides
+ * what each stage's stdin and stdout should be.
  */
 
+#define _GNU_SOURCE
+
 #include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <unistd.h>
 
+#include "batch.h"
+#include "builtin_stage.h"
 #include "builtins.h"
+#include "config.h"
 #include "error.h"
 #include "exec.h"
+#include "fanout.h"
+#include "jobs.h"
+#include "launch.h"
+#include "options.h"
+#include "path_cache.h"
+#include "pipe_size.h"
+#include "profile.h"
+#include "signals.h"
+#include "subst.h"
+#include "timing.h"
+#include "watch.h"
 
 enum { READ_END, WRITE_END };
 
 /**
- * exec_builtin - Execute built-in shell commands
+ * find_builtin - Look up a builtin by name
+ * @name: Command name
+ *
+ * Return: Table entry, NULL if name isn't a builtin
+ */
+const struct command_associations *find_builtin(const char *name) {
+  static const struct command_associations built_ins[NUM_OF_BUILTINS] = {
+      {"bg", bg, BUILTIN_STATEFUL},
+      {"cat", cat, BUILTIN_OVERRIDE},
+      {"cd", cd, BUILTIN_STATEFUL},
+      {"cler", cler, BUILTIN_OVERRIDE},
+      {"coproc", coproc, BUILTIN_ALONE},
+      {"disown", disown, BUILTIN_STATEFUL},
+      {"exec", exec_command, BUILTIN_ALONE},
+      {"exit", exit_builtin, BUILTIN_STATEFUL},
+      {"fg", fg, BUILTIN_STATEFUL},
+      {"hash", hash, BUILTIN_STATEFUL},
+      {"help", help, BUILTIN_PURE},
+      {"jobs", jobs_builtin, BUILTIN_SEES_JOBS},
+      {"kill", kill_builtin, BUILTIN_SEES_JOBS},
+      {"memo", memo, BUILTIN_STATEFUL},
+      {"parallel", parallel, BUILTIN_STATEFUL},
+      {"queue", queue_builtin, BUILTIN_STATEFUL},
+      {"set", set_builtin, BUILTIN_STATEFUL},
+      {"wait", wait_builtin, BUILTIN_STATEFUL},
+      {"xargs", xargs, BUILTIN_STATEFUL}};
+
+  for (int i = 0; i < NUM_OF_BUILTINS; i++) {
+    if (strcmp(name, built_ins[i].command_name) == 0) {
+      return &built_ins[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * exec_builtin - Execute a builtin that runs before anything is set up
  * @current_ctx: Shell context with parsed command
  *
- * Built-in commands are implemented into the shell itself rather than spawning
- * external programs. Only checks the first command (commands[0]), so built-ins
- * can't be piped from.
+ * Overrides (cat, cler) get to decide whether the program of the same name
+ * runs instead, and exec applies its redirections itself, so both run before
+ * the shell opens redirections or resolves programs. Either only runs as a
+ * command on its own.
  *
- * Return: 0 on match, 1 on match, -1 on error
+ * Return: 0 if there is no such builtin or it declined, 1 if it ran, -1 on
+ * error
  */
-// Returns -1 on error, 0 on no match, 1 on match
 int exec_builtin(struct repl_ctx *current_ctx) {
-  static const struct command_associations built_ins[NUM_OF_BUILTINS] = {
-      {"cat", cat},
-      {"cd", cd},
-      {"cler", cler},
-      {"exit", exit_builtin},
-      {"help", help}};
+  const struct command_associations *builtin =
+      find_builtin(current_ctx->commands[0][0]);
 
-  for (int i = 0; i < NUM_OF_BUILTINS; i++) {
-    if (strcmp(current_ctx->commands[0][0], built_ins[i].command_name) == 0) {
-      return built_ins[i].command_function(current_ctx);
+  if (!builtin || current_ctx->commands_count > 1 ||
+      (builtin->kind != BUILTIN_OVERRIDE && builtin->kind != BUILTIN_ALONE)) {
+    return 0;
+  }
+
+  if (builtin->kind == BUILTIN_ALONE && pipeline_substitutes(current_ctx)) {
+    char msg[ERR_MSG_MAX];
+    snprintf(msg, ERR_MSG_MAX, "%s: can't take process substitutions",
+             current_ctx->commands[0][0]);
+    error_msg(msg, false);
+    return -1;
+  }
+
+  return builtin->command_function(current_ctx);
+}
+
+/**
+ * find_stage_builtins - Find the stages of the pipeline that are builtins
+ * @current_ctx: Shell context with parsed commands
+ * @builtins: Output parameter - table entry per stage, NULL for programs
+ *
+ * Overrides are left to the program of the same name in a pipeline.
+ *
+ * Return: 0 on success, -1 if a builtin can't be part of a pipeline (already
+ * reported)
+ */
+int find_stage_builtins(struct repl_ctx *current_ctx,
+                        const struct command_associations **builtins) {
+  for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
+    builtins[i] = find_builtin(current_ctx->commands[i][0]);
+
+    if (builtins[i] && builtins[i]->kind == BUILTIN_OVERRIDE) {
+      builtins[i] = NULL;
+    }
+
+    if (builtins[i] && builtins[i]->kind == BUILTIN_ALONE) {
+      char msg[ERR_MSG_MAX];
+      snprintf(msg, ERR_MSG_MAX, "%s: can't be part of a pipeline",
+               current_ctx->commands[i][0]);
+      error_msg(msg, false);
+      return -1;
     }
   }
+
   return 0;
 }
 
 /**
- * create-pipes - Set up pipes for command pipeline
+ * create_pipe - Create the pipe between a stage and the next one
+ * @pipe_fds: Output parameter - read and write ends
+ * @pipe_size: Capacity in bytes, PIPE_SIZE_DEFAULT or PIPE_SIZE_ADAPTIVE to
+ * leave it alone
+ *
+ * Pipes are created one at a time while the pipeline is launched, so the shell
+ * holds at most two of them open no matter how long the pipeline is.
+ *
+ * Both ends are close-on-exec: posix_spawn dup2s the ends a stage needs onto
+ * its stdin and stdout, which clears the flag on the copies, and every other
+ * pipe descriptor disappears at exec without the child closing anything.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int create_pipe(int pipe_fds[2], long pipe_size) {
+  /**
+   * pipe2() creates a unidirectional data channel.
+   * pipe_fds[0] is the read end, pipe_fds[1] is the write end.
+   * Data written to [1] can be read from [0]
+   */
+  if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+    error_msg("Failed to create pipe", true);
+    return -1;
+  }
+
+  /* A pipe that can't be resized still works, just at the default capacity */
+  if (pipe_size > 0) {
+    pipe_size_apply(pipe_fds[WRITE_END], pipe_size);
+  }
+
+  return 0;
+}
+
+/**
+ * close_fd - Close a descriptor the shell no longer needs
+ * @fd: Descriptor to close, -1 to do nothing
+ */
+void close_fd(int fd) {
+  if (fd != -1 && close(fd) == -1) {
+    error_msg(close_fail_msg, true);
+  }
+}
+
+/**
+ * close_redirections - Close descriptors opened by open_redirections
  * @current_ctx: Shell context with command count
+ * @in_fds: Input descriptors, -1 for stages without input redirection. Set to
+ * -1 once closed
+ * @out_fds: Output descriptors, -1 for stages without output redirection. Set
+ * to -1 once closed
+ */
+void close_redirections(struct repl_ctx *current_ctx, int *in_fds,
+                        int *out_fds) {
+  for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
+    if (in_fds[i] != -1 && close(in_fds[i]) == -1) {
+      error_msg(close_fail_msg, true);
+    }
+
+    if (out_fds[i] != -1 && close(out_fds[i]) == -1) {
+      error_msg(close_fail_msg, true);
+    }
+
+    in_fds[i] = -1;
+    out_fds[i] = -1;
+
+    struct out_fanout *fanout = current_ctx->out_fanout[i];
+
+    for (unsigned int j = 0; fanout && j < fanout->count; j++) {
+      close_fd(fanout->fds[j]);
+      fanout->fds[j] = -1;
+    }
+  }
+}
+
+/**
+ * open_redirections - Open every redirection target of the pipeline
+ * @current_ctx: Shell context with parsed redirections
+ * @in_fds: Output parameter - input descriptor per stage, -1 if none
+ * @out_fds: Output parameter - output descriptor per stage, -1 if none
+ *
+ * We assume we are redirecting to and from a file as the POSIX specification
+ * does, though many shells (starting with ksh93) allow for redirecting to and
+ * from sockets.
  *
- * Return: Array of pipe file descriptor pairs, NULL on error
+ * The targets are opened in the shell rather than in the children, so a bad
+ * path is reported before any stage of the pipeline has been started. The
+ * descriptors are opened with O_CLOEXEC, only the dup2'd copies on
+ * stdin/stdout survive into the program.
+ *
+ * The output files after the first are opened into the stage's out_fanout,
+ * for its relay. Without the multios option every file is still created or
+ * truncated, but only the last one takes the output, as in POSIX shells.
+ *
+ * Return: 0 on success, -1 on error (nothing is left open)
  */
-int (*create_pipes(struct repl_ctx *current_ctx))[2] {
-  int(*pipe_fds)[2] =
-      malloc((current_ctx->commands_count - 1) * sizeof(int[2]));
-  if (!pipe_fds) {
-    error_msg(malloc_fail_msg, true);
-    return NULL;
+int open_redirections(struct repl_ctx *current_ctx, int *in_fds,
+                      int *out_fds) {
+  for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
+    in_fds[i] = -1;
+    out_fds[i] = -1;
   }
 
-  for (unsigned int i = 0; i < current_ctx->commands_count - 1; i++) {
-    /**
-     * pipe() creates a unidirectional data channel.
-     * pipe_fds[i][0] is the read end, pipe_fds[i][1] is the write end.
-     * Data written to [1] can be read from [0]
-     */
-    if (pipe(pipe_fds[i]) == -1) {
-      error_msg("Failed to create pipe", true);
+  for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
+    if (current_ctx->in_stream_name[i]) {
+      in_fds[i] = open(current_ctx->in_stream_name[i], O_RDONLY | O_CLOEXEC);
+      if (in_fds[i] == -1) {
+        error_msg(open_fail_msg, true);
+        close_redirections(current_ctx, in_fds, out_fds);
+        return -1;
+      }
+    }
 
-      /* Clean up any previously created pipes on error */
-      for (unsigned int j = 0; j < i; j++) {
-        close(pipe_fds[j][READ_END]);
-        close(pipe_fds[j][WRITE_END]);
+    if (current_ctx->out_stream_name[i]) {
+      /* The stream type is either write only (for >) or append (for >>) */
+      out_fds[i] = open(current_ctx->out_stream_name[i],
+                        O_WRONLY | current_ctx->out_stream_type[i] | O_CREAT |
+                            O_CLOEXEC,
+                        0644);
+      if (out_fds[i] == -1) {
+        error_msg(open_fail_msg, true);
+        close_redirections(current_ctx, in_fds, out_fds);
+        return -1;
       }
+    }
 
-      free(pipe_fds);
+    struct out_fanout *fanout = current_ctx->out_fanout[i];
 
-      return NULL;
+    for (unsigned int j = 0; fanout && j < fanout->count; j++) {
+      fanout->fds[j] =
+          open(fanout->names[j],
+               O_WRONLY | fanout->types[j] | O_CREAT | O_CLOEXEC, 0644);
+      if (fanout->fds[j] == -1) {
+        error_msg(open_fail_msg, true);
+        close_redirections(current_ctx, in_fds, out_fds);
+        return -1;
+      }
+    }
+
+    if (fanout && fanout->count > 0 && !option_is_set(OPTION_MULTIOS)) {
+      close_fd(out_fds[i]);
+      out_fds[i] = fanout->fds[fanout->count - 1];
+      fanout->fds[fanout->count - 1] = -1;
     }
   }
-  return pipe_fds;
+
+  return 0;
 }
 
 /**
- * exec - Execute command pipeline
- * @current_ctx: Shell context
+ * resolve_programs - Find the executable for every stage of the pipeline
+ * @current_ctx: Shell context with parsed commands
+ * @builtins: Builtin per stage, NULL for programs
+ * @paths: Output parameter - resolved path per stage, NULL for builtins
  *
- * This does quite a bit: 
- * - Checks if first command is a builtin and executes it if so
- * - Create pipes if there are multiple commands
- * - Fork child process for each command
- * - Set up pipes and I/O redirection in child
- * - Close all pipe file descriptors in parent and child
- * - Execute program in child with execvp
- * - Wait for all children to finish in parent (unless background process)
- * 
- * Return: 0 on success, -1 on error
+ * Looking the programs up in the shell means a typo is reported before any
+ * stage is launched, rather than by a child that has already been created.
+ *
+ * Return: 0 if every program was found, -1 otherwise
  */
-int exec(struct repl_ctx *current_ctx) {
-  /*
-   * We do not need to execute an external program for builtin commands and we
-   * do not support piping with builtin commands, so we can
-   * return early if running a builtin
-   */
-  const int is_builtin = exec_builtin(current_ctx);
+int resolve_programs(struct repl_ctx *current_ctx,
+                     const struct command_associations **builtins,
+                     const char **paths) {
+  /* Apply any changes to the $PATH directories since the last command */
+  path_cache_sync();
 
-  if (is_builtin == -1) {
+  for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
+    paths[i] = NULL;
+
+    if (builtins[i]) {
+      continue;
+    }
+
+    paths[i] = path_cache_lookup(current_ctx->commands[i][0]);
+
+    if (!paths[i]) {
+      path_cache_not_found(current_ctx->commands[i][0]);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * check_arg_sizes - Catch stages exec would refuse with E2BIG
+ * @current_ctx: Shell context with parsed commands
+ * @builtins: Builtin per stage, NULL for programs (which are the only ones
+ * exec'd)
+ *
+ * Without this, the error would only come from the child, after it has been
+ * created. With the autobatch option, a command on its own is run in batches
+ * instead. Pipelines, background jobs and jobs with a time limit, relays
+ * (profile or fan-out) or process substitutions are not: the batches run one
+ * after another, as foreground jobs of their own.
+ *
+ * Return: 0 if every stage fits, 1 to run the command in batches, -1 if a stage
+ * doesn't fit (already reported)
+ */
+int check_arg_sizes(struct repl_ctx *current_ctx,
+                    const struct command_associations **builtins) {
+  for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
+    if (builtins[i] || !argv_too_long(current_ctx->commands[i])) {
+      continue;
+    }
+
+    if (option_is_set(OPTION_AUTOBATCH) && current_ctx->commands_count == 1 &&
+        !current_ctx->is_background_process && current_ctx->timeout_ms == 0 &&
+        !current_ctx->is_profiled && !pipeline_fans_out(current_ctx) &&
+        !pipeline_substitutes(current_ctx)) {
+      return 1;
+    }
+
+    char msg[ERR_MSG_MAX];
+    snprintf(msg, ERR_MSG_MAX, "Argument list too long: %s",
+             current_ctx->commands[i][0]);
+    error_msg(msg, false);
     return -1;
   }
 
-  if (is_builtin) {
-    return 0;
+  return 0;
+}
+
+/**
+ * run_batched - Run a command on its own in batches of arguments that fit
+ * @current_ctx: Shell context with the command
+ * @path: Resolved program
+ * @in_fd: Input redirection, -1 if none
+ * @out_fd: Output redirection, -1 if none
+ *
+ * Return: 0 if every batch succeeded, -1 otherwise
+ */
+int run_batched(struct repl_ctx *current_ctx, const char *path, int in_fd,
+                int out_fd) {
+  char **argv = current_ctx->commands[0];
+  unsigned int argc = 0;
+
+  while (argv[argc]) {
+    argc++;
   }
 
-  int(*pipe_fds)[2] = NULL;
+  const unsigned int prefix_count = batch_prefix_count(argv);
 
-  if (current_ctx->commands_count > 1) {
-    pipe_fds = create_pipes(current_ctx);
-    if (!pipe_fds) {
-      return -1;
-    }
+  const struct batch_command cmd = {
+      .command = current_ctx->input,
+      .path = path,
+      .prefix = argv,
+      .prefix_count = prefix_count,
+      .items = argv + prefix_count,
+      .items_count = argc - prefix_count,
+      .max_items = 0,
+      .in_fd = in_fd,
+      .out_fd = out_fd,
+      .attrs = current_ctx->stage_attrs[0],
+  };
+
+  return batch_run(&cmd) == 0 ? 0 : -1;
+}
+
+/**
+ * exec_in_place - Replace the shell with a program
+ * @path: Resolved program
+ * @argv: NULL-terminated argument array
+ * @in_fd: Descriptor to use as stdin, -1 for the shell's
+ * @out_fd: Descriptor to use as stdout, -1 for the shell's
+ *
+ * Nothing is forked, the program takes over the shell's process ID, process
+ * group and terminal. The signal dispositions the shell changed are reset
+ * first, as ignored signals would stay ignored in the program.
+ *
+ * Return: Only returns on error, with -1
+ */
+int exec_in_place(const char *path, char **argv, int in_fd, int out_fd) {
+  struct saved_signals saved_signals;
+  int saved[2];
+
+  /* Whatever the shell printed must come out before the program's output */
+  fflush(stderr);
+
+  if (redirect_shell(in_fd, out_fd, saved) == -1) {
+    return -1;
+  }
+
+  restore_default_signals(&saved_signals);
+  execv(path, argv);
+  reinstate_signals(&saved_signals);
+
+  char msg[ERR_MSG_MAX];
+  snprintf(msg, ERR_MSG_MAX, "Failed to execute %s", argv[0]);
+  error_msg(msg, true);
+
+  /* The shell carries on as before */
+  restore_shell(saved);
+  return -1;
+}
+
+/**
+ * can_exec_in_place - Check whether the shell can exec the command itself
+ * @current_ctx: Shell context with parsed commands
+ *
+ * The last command of a -c string doesn't need a child: the shell would only
+ * wait for it and exit with its status, which is what exec gives for free. A
+ * pipeline still needs its other stages forked, and the time, timeout and
+ * profile keywords as well as background jobs need the shell to stay around,
+ * and so does a command whose output is copied to several files by a relay,
+ * so only a simple command qualifies. Attributes set with sched aren't applied
+ * to the shell, as the exec could still fail and leave the shell with them.
+ *
+ * Return: true if the command can replace the shell, false otherwise
+ */
+bool can_exec_in_place(struct repl_ctx *current_ctx) {
+  return current_ctx->is_last_command && current_ctx->commands_count == 1 &&
+         !current_ctx->is_background_process && !current_ctx->is_timed &&
+         current_ctx->timeout_ms == 0 && !current_ctx->is_profiled &&
+         !current_ctx->stage_attrs[0] && !pipeline_fans_out(current_ctx);
+}
+
+/**
+ * shell_runs_stages - Check whether stages of the job may run in the shell
+ * @current_ctx: Shell context with parsed commands
+ *
+ * Background jobs can't have any, as the shell would be busy until the stage
+ * finished. Neither can jobs with a time limit or relays, which the shell
+ * can't enforce or run while it is busy running the stage, and which can't
+ * stop or signal a thread. Under job control, Ctrl-Z can't stop a job while
+ * the shell runs one of its stages (see job_stage_begin()).
+ *
+ * Return: true if stages may run in the shell or on its threads
+ */
+bool shell_runs_stages(struct repl_ctx *current_ctx) {
+  return !current_ctx->is_background_process && current_ctx->timeout_ms == 0 &&
+         !current_ctx->is_profiled;
+}
+
+/**
+ * in_process_stage - Pick the stage of the pipeline that runs inside the shell
+ * @current_ctx: Shell context with parsed commands
+ * @builtins: Builtin per stage, NULL for programs
+ * @in_fds: Input redirection per stage, -1 if none
+ *
+ * cat is common at the head of pipelines and does nothing but move data, so
+ * the shell does it itself instead of launching a process. Under job control,
+ * a child takes the copy over if the job is stopped (see cat_relay()). A
+ * builtin as the last stage runs in the shell too, so whatever it changes
+ * sticks. Only one stage can run this way: the shell runs it after launching
+ * every other stage, and two of them in a row would have to run at the same
+ * time.
+ *
+ * Return: Index of the stage, -1 if every stage needs a process
+ */
+int in_process_stage(struct repl_ctx *current_ctx,
+                     const struct command_associations **builtins,
+                     int *in_fds) {
+  const unsigned int last = current_ctx->commands_count - 1;
+
+  if (!shell_runs_stages(current_ctx)) {
+    return -1;
   }
 
-  pid_t pids[current_ctx->commands_count];
-  int status = 0;
+  if (builtins[last]) {
+    return (int)last;
+  }
 
   for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
-    /* Create a new process by duplicating the current process */
-    pids[i] = fork();
+    bool stdin_is_terminal =
+        i == 0 && in_fds[0] == -1 && isatty(STDIN_FILENO);
+
+    /* Attributes only make sense for a process of its own */
+    if (!current_ctx->stage_attrs[i] &&
+        cat_in_process(current_ctx->commands[i], stdin_is_terminal)) {
+      return (int)i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * run_in_process_stage - Run the stage picked by in_process_stage()
+ * @current_ctx: Shell context
+ * @job: Job the stage belongs to
+ * @slot: Position of the stage in the job's procs
+ * @index: Position of the stage in the pipeline
+ * @builtin: Builtin of the stage, NULL for cat
+ * @in_fd: Descriptor to use as stdin, -1 for the shell's
+ * @out_fd: Descriptor to use as stdout, -1 for the shell's
+ *
+ * The shell's own resource usage while the stage runs is recorded as the
+ * stage's, so it shows up in the time report like any other stage. A child
+ * that took the stage over becomes the stage's process instead, and exits
+ * once done.
+ */
+void run_in_process_stage(struct repl_ctx *current_ctx, struct job *job,
+                          unsigned int slot, unsigned int index,
+                          const struct command_associations *builtin,
+                          int in_fd, int out_fd) {
+  struct rusage before;
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &before);
+
+  /* A Ctrl+C at the prompt must not cancel the stage */
+  sigint_received = 0;
+
+  int exit_code =
+      builtin ? builtin_exit_code(run_builtin_here(builtin, current_ctx, index,
+                                                   in_fd, out_fd))
+              : cat_stage(current_ctx->commands[index], in_fd, out_fd);
+
+  const pid_t taken_over = job_stage_taken_over();
+
+  if (taken_over == -1) {
+    _exit(exit_code);
+  }
+
+  if (taken_over > 0) {
+    if (job_adopt_process(job, slot, taken_over) == -1) {
+      kill(taken_over, SIGKILL);
+      job_finish_process(job, slot, 1, NULL);
+    }
+    return;
+  }
 
-    if (pids[i] == -1) {
-      error_msg("Failed to fork process", true);
+  getrusage(RUSAGE_SELF, &usage);
+
+  timersub(&usage.ru_utime, &before.ru_utime, &usage.ru_utime);
+  timersub(&usage.ru_stime, &before.ru_stime, &usage.ru_stime);
+  usage.ru_nvcsw -= before.ru_nvcsw;
+  usage.ru_nivcsw -= before.ru_nivcsw;
+
+  job_finish_process(job, slot, exit_code, &usage);
+}
+
+/**
+ * launch_builtin - Start a builtin stage that isn't run by the shell itself
+ * @current_ctx: Shell context
+ * @job: Job the stage belongs to
+ * @index: Position of the stage in the pipeline
+ * @builtin: Builtin of the stage
+ * @stage: Descriptors, process group and terminal of the stage
+ * @threads: Room for a thread stage, NULL if threads can't be used
+ *
+ * Pure builtins run on a thread when the job allows stages in the shell,
+ * every other builtin (and a pure one the thread couldn't be started for)
+ * runs in a forked child.
+ *
+ * Return: PID of the child, 0 if the stage runs on a thread (already added to
+ * the job), -1 on error
+ */
+pid_t launch_builtin(struct repl_ctx *current_ctx, struct job *job,
+                     unsigned int index,
+                     const struct command_associations *builtin,
+                     const struct stage_spawn *stage,
+                     struct builtin_stage *threads) {
+  if (threads && builtin->kind == BUILTIN_PURE && stage->out_fd != -1) {
+    struct builtin_stage *thread = &threads[index];
+
+    thread->builtin = builtin;
+    stage_ctx(current_ctx, index, &thread->ctx);
+
+    /* The thread closes its copy when done, the loop closes ours as usual */
+    thread->out_fd = fcntl(stage->out_fd, F_DUPFD_CLOEXEC, 0);
+    if (thread->out_fd == -1) {
+      error_msg(dup2_fail_msg, true);
       return -1;
     }
 
-    // Child process
-    if (pids[i] == 0) {
-      /**
-       * Create a new process group if this is going to be a background process.
-       * This prevents SIGINT from killing the background job.
-       */
-      if (current_ctx->is_background_process) {
-        setpgid(0, 0);
+    if (job_add_process(job, 0) == -1) {
+      close(thread->out_fd);
+      return -1;
+    }
+
+    thread->slot = job->procs_count - 1;
+
+    if (start_builtin_thread(thread) == -1) {
+      error_msg("Failed to start thread", false);
+      close(thread->out_fd);
+      job_finish_process(job, thread->slot, 1, &thread->usage);
+      return -1;
+    }
+
+    thread->started = true;
+    return 0;
+  }
+
+  struct repl_ctx ctx;
+  stage_ctx(current_ctx, index, &ctx);
+
+  return fork_builtin(builtin, &ctx, stage, job);
+}
+
+/**
+ * join_builtin_threads - Wait for the thread stages of a job to finish
+ * @job: Job the stages belong to
+ * @threads: One entry per stage, NULL if there are none
+ * @count: Number of stages
+ */
+void join_builtin_threads(struct job *job, struct builtin_stage *threads,
+                          unsigned int count) {
+  for (unsigned int i = 0; threads && i < count; i++) {
+    if (threads[i].started) {
+      pthread_join(threads[i].thread, NULL);
+      job_finish_process(job, threads[i].slot, threads[i].exit_code,
+                         &threads[i].usage);
+    }
+  }
+
+  free(threads);
+}
+
+/**
+ * start_fanout - Put a relay between a stage and everywhere its output goes
+ * @current_ctx: Shell context with opened redirections
+ * @job: Job the relay belongs to
+ * @index: Stage that fans out
+ * @out_fd: Stage's first output file, -1 if none
+ * @write_end: Write end of the pipe to the next stage, -1 if none. Replaced
+ * by the write end of the pipe to the relay, which the stage writes to instead
+ * @pipe_size: Capacity of the pipe to the relay, as for create_pipe()
+ *
+ * The files come first and the next stage last, the order the relay hands
+ * each chunk of output out in.
+ *
+ * Return: 0 on success, -1 on error (write_end is left alone)
+ */
+int start_fanout(struct repl_ctx *current_ctx, struct job *job,
+                 unsigned int index, int out_fd, int *write_end,
+                 long pipe_size) {
+  const struct out_fanout *fanout = current_ctx->out_fanout[index];
+  const unsigned int files = fanout ? fanout->count : 0;
+  int *dests = malloc((files + 2) * sizeof(*dests));
+  unsigned int count = 0;
+  int relay_pipe[2];
+
+  if (!dests) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  if (out_fd != -1) {
+    dests[count++] = out_fd;
+  }
+
+  for (unsigned int i = 0; i < files; i++) {
+    dests[count++] = fanout->fds[i];
+  }
+
+  if (*write_end != -1) {
+    dests[count++] = *write_end;
+  }
+
+  if (create_pipe(relay_pipe, pipe_size) == -1) {
+    free(dests);
+    return -1;
+  }
+
+  pid_t pid = fanout_spawn(relay_pipe[READ_END], dests, count,
+                           job->own_pgroup ? job->pgid : -1);
+
+  free(dests);
+  close_fd(relay_pipe[READ_END]);
+
+  if (pid == -1 || job_add_helper(job, pid) == -1) {
+    /* Without its input, a relay that did start sees EOF and exits */
+    close_fd(relay_pipe[WRITE_END]);
+    return -1;
+  }
+
+  /* The relay has its own copy, the stage writes to the relay instead */
+  close_fd(*write_end);
+  *write_end = relay_pipe[WRITE_END];
+
+  return 0;
+}
+
+/**
+ * launch_job - Launch every stage of the pipeline as one job
+ * @current_ctx: Shell context
+ * @builtins: Builtin per stage, NULL for programs
+ * @paths: Resolved program per stage
+ * @in_fds: Input redirection per stage, -1 if none
+ * @out_fds: Output redirection per stage, -1 if none
+ * @subs: Process substitutions of the pipeline, their subshells are started
+ * first and the shell's ends of their pipes are closed once the stages are
+ *
+ * Return: 0 on success, -1 on error
+ */
+int launch_job(struct repl_ctx *current_ctx,
+               const struct command_associations **builtins,
+               const char **paths, int *in_fds, int *out_fds,
+               struct substitutions *subs) {
+  struct job *job =
+      job_create(current_ctx->input, current_ctx->commands_count,
+                 current_ctx->is_background_process);
+  if (!job) {
+    return -1;
+  }
+
+  /* Thread stages are only possible where the shell may run stages itself */
+  struct builtin_stage *threads = NULL;
+
+  if (shell_runs_stages(current_ctx)) {
+    for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
+      if (builtins[i] && builtins[i]->kind == BUILTIN_PURE) {
+        threads = calloc(current_ctx->commands_count, sizeof(*threads));
+        break;
       }
+    }
+  }
 
-      if (pipe_fds) {
-        if (i > 0) {
-          /**
-           * The dup2 system call lets us overwrite one file descriptor to refer
-           * to another. Here, we make STDIN_FILENO refer to the read end of the
-           * pipe. After calling this, reading from STDIN_FILENO reads from the
-           * pipe.
-           */
-          if (dup2(pipe_fds[i - 1][READ_END], STDIN_FILENO) == -1) {
-            error_msg(dup2_fail_msg, true);
-
-            if (close(pipe_fds[i - 1][READ_END])) {
-              error_msg(close_fail_msg, true);
-            }
-          }
-        }
-
-        /**
-         * If not the last command, redirect stdout to next pipe.
-         * After calling this, writing to STDOUT_FILENO writes to the pipe.
-         */
-        if (i < current_ctx->commands_count - 1) {
-          if (dup2(pipe_fds[i][WRITE_END], STDOUT_FILENO) == -1) {
-            error_msg(dup2_fail_msg, true);
-
-            if (close(pipe_fds[i][WRITE_END])) {
-              error_msg(close_fail_msg, true);
-            }
-          }
-        }
-
-        /**
-         * We have already duplicated the pipe fds we need to stdin/stdout, so
-         * we can close them all in the child. It is especially important to
-         * close all of the write ends so that the reading process knows that
-         * we've finished writing.
+  /* One relay per stage whose output goes to several places */
+  unsigned int relays = 0;
+
+  for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
+    relays += stage_fans_out(current_ctx, i);
+  }
+
+  if (job_reserve_helpers(job, relays + subs->count) == -1) {
+    job_remove(job);
+    free(threads);
+    return -1;
+  }
+
+  /* Before any stage, which may be waiting for the subshell's output */
+  subst_launch(current_ctx, subs, job);
+
+  job->teardown = option_is_set(OPTION_TEARDOWN) && !subst_takes_output(subs);
+  job->teardown_kill_after_ms = teardown_kill_after_ms();
+
+  if (current_ctx->timeout_ms > 0) {
+    job_set_timeout(job, current_ctx->timeout_ms, current_ctx->timeout_signal,
+                    current_ctx->kill_after_ms);
+  }
+
+  const long pipe_size = pipe_size_for(current_ctx);
+
+  /* Relays only run while the shell waits, it doesn't for background jobs */
+  bool profiled = current_ctx->is_profiled && current_ctx->commands_count > 1;
+
+  if (profiled && job->background) {
+    error_msg("profile: background jobs can't be profiled", false);
+    profiled = false;
+  }
+
+  if (profiled && profile_start(job, current_ctx) == -1) {
+    profiled = false;
+  }
+
+  /* Lets on-change -c cancel the run, unless the relays need io_fd */
+  if (!job->background) {
+    watch_attach(job);
+  }
+
+  /* Only foreground jobs are sampled, the shell isn't around for the others */
+  if (pipe_size == PIPE_SIZE_ADAPTIVE && current_ctx->commands_count > 1) {
+    job->monitor = pipe_size_adapt;
+  }
+
+  /* Read end of the pipe coming from the previous stage */
+  int prev_read = -1;
+
+  const int in_process = in_process_stage(current_ctx, builtins, in_fds);
+  unsigned int in_process_slot = 0;
+  struct stage_spawn in_process_fds = {
+      .in_fd = -1, .out_fd = -1, .err_fd = -1};
+  int in_process_pipes[2] = {-1, -1};
+
+  for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
+    int pipe_fds[2] = {-1, -1};
+
+    /*
+     * Write to a new pipe unless this is the last command. If it can't be
+     * created, the stages launched so far see EOF and finish on their own.
+     */
+    if (i < current_ctx->commands_count - 1 &&
+        create_pipe(pipe_fds, pipe_size) == -1) {
+      break;
+    }
+
+    /* The next stage reads from the relay instead, which keeps our read end */
+    if (profiled && pipe_fds[READ_END] != -1 &&
+        profile_relay(job, i, &pipe_fds[READ_END], pipe_size) == -1) {
+      close_fd(pipe_fds[READ_END]);
+      close_fd(pipe_fds[WRITE_END]);
+      break;
+    }
+
+    /* The stage writes to its relay, which writes to the pipe and the files */
+    const bool fans_out = stage_fans_out(current_ctx, i);
+
+    if (fans_out && start_fanout(current_ctx, job, i, out_fds[i],
+                                 &pipe_fds[WRITE_END], pipe_size) == -1) {
+      close_fd(pipe_fds[READ_END]);
+      close_fd(pipe_fds[WRITE_END]);
+      break;
+    }
+
+    struct stage_spawn stage = {
+        .path = paths[i],
+        .argv = current_ctx->commands[i],
+        /* Read from the previous pipe unless this is the first command */
+        .in_fd = prev_read,
+        .out_fd = pipe_fds[WRITE_END],
+        .err_fd = -1,
+        /*
+         * Every stage joins the process group of the first one, which is
+         * separate from the shell's for background jobs and under job control.
+         * This prevents SIGINT from killing background jobs.
          */
-        for (unsigned int j = 0; j < current_ctx->commands_count - 1; j++) {
-          if (close(pipe_fds[j][READ_END]) == -1) {
-            error_msg(close_fail_msg, true);
-          }
-
-          if (close(pipe_fds[j][WRITE_END]) == -1) {
-            error_msg(close_fail_msg, true);
-          }
-        }
-      }
+        .pgid = job->own_pgroup ? job->pgid : -1,
+        .tty_fd = job_control && !job->background ? shell_terminal : -1,
+        .attrs = current_ctx->stage_attrs[i],
+    };
 
-      /*
-       * Handle I/O redirection. We assume we are redirecting to and from a file
-       * as the POSIX specification does, though many shells (starting with
-       * ksh93) allow for redirecting to and from sockets.
-       */
-      if (current_ctx->in_stream_name[i]) {
-        int in_fd = open(current_ctx->in_stream_name[i], O_RDONLY);
-        if (in_fd == -1) {
-          error_msg(open_fail_msg, true);
-          exit(EXIT_FAILURE);
-        }
-
-        /* Redirect stdin to the specified file. */
-        if (dup2(in_fd, STDIN_FILENO) == -1) {
-          error_msg(dup2_fail_msg, true);
-
-          if (close(in_fd)) {
-            error_msg(close_fail_msg, true);
-          }
-        }
-      }
+    /* The /dev/fd paths of its process substitutions have to stay valid */
+    stage.keep_fds = subst_stage_fds(subs, i, &stage.keep_fds_count);
 
-      if (current_ctx->out_stream_name[i]) {
-        /* The stream type is either write only (for >) or append (for >>) */
-        int out_fd =
-            open(current_ctx->out_stream_name[i],
-                 O_WRONLY | current_ctx->out_stream_type[i] | O_CREAT, 0644);
-        if (out_fd == -1) {
-          error_msg(open_fail_msg, true);
-          exit(EXIT_FAILURE);
-        }
-
-        if (dup2(out_fd, STDOUT_FILENO) == -1) {
-          error_msg(dup2_fail_msg, true);
-        }
-
-        if (close(out_fd)) {
-          error_msg(close_fail_msg, true);
-        }
-      }
+    /* Redirections take precedence over pipes */
+    if (in_fds[i] != -1) {
+      stage.in_fd = in_fds[i];
+    }
+
+    if (out_fds[i] != -1 && !fans_out) {
+      stage.out_fd = out_fds[i];
+    }
+
+    /* The shell keeps this stage's pipe ends until it has run the stage */
+    if ((int)i == in_process && job_add_process(job, 0) == 0) {
+      in_process_slot = job->procs_count - 1;
+      in_process_fds = stage;
+      in_process_pipes[0] = prev_read;
+      in_process_pipes[1] = pipe_fds[WRITE_END];
+      prev_read = pipe_fds[READ_END];
+      continue;
+    }
 
-      /**
-       * execvp() replaces the current process image with a new program. This
-       * will only return if the function fails.
+    /*
+     * A stage that fails to launch is reported and skipped, the rest of the
+     * pipeline still runs and sees EOF or EPIPE on its pipes.
+     */
+    pid_t pid = builtins[i] ? launch_builtin(current_ctx, job, i, builtins[i],
+                                             &stage, threads)
+                            : spawn_stage(&stage);
+
+    if (pid == -1 && !builtins[i]) {
+      /* The cached path may be stale, make the next lookup search again */
+      path_cache_forget(current_ctx->commands[i][0]);
+    } else if (pid <= 0) {
+      /* Failed builtin, or one running on a thread that is already tracked */
+    } else if (job_add_process(job, pid) == -1) {
+      error_msg("Failed to track process", false);
+    } else if (stage.tty_fd != -1 && job->pgid == pid) {
+      /*
+       * The child gives itself the terminal too, doing it from both sides
+       * means neither has to wait for the other.
        */
-      if (execvp(current_ctx->commands[i][0], current_ctx->commands[i]) == -1) {
-        error_msg("Failed to execute process", true);
-        exit(EXIT_FAILURE);
-      }
+      tcsetpgrp(shell_terminal, job->pgid);
     }
+
+    /*
+     * The child has its own copies now. Closing the write end here is what
+     * lets the next stage see EOF once this one exits.
+     */
+    close_fd(prev_read);
+    close_fd(pipe_fds[WRITE_END]);
+
+    prev_read = pipe_fds[READ_END];
   }
 
+  close_fd(prev_read);
+
   /*
-   * The parent process doesn't need the pipe file descriptors since the
-   * children have their own copies, so we close them all.
+   * Every other stage is running by now, so they consume what the stage
+   * writes and produce what it reads. Closing its pipe ends afterwards is what
+   * tells its neighbours it is done.
    */
-  if (pipe_fds) {
-    for (unsigned int i = 0; i < current_ctx->commands_count - 1; i++) {
-      if (close(pipe_fds[i][READ_END])) {
-        error_msg(close_fail_msg, true);
-      }
+  struct job *outer_stage_job =
+      job_stage_begin(job, in_process_fds.argv && !builtins[in_process]);
 
-      if (close(pipe_fds[i][WRITE_END])) {
-        error_msg(close_fail_msg, true);
-      }
-    }
+  if (in_process_fds.argv) {
+    run_in_process_stage(current_ctx, job, in_process_slot, in_process,
+                         builtins[in_process], in_process_fds.in_fd,
+                         in_process_fds.out_fd);
+    close_fd(in_process_pipes[0]);
+    close_fd(in_process_pipes[1]);
+  }
 
-    free(pipe_fds);
+  /* Their readers are running or done by now, so the threads finish */
+  join_builtin_threads(job, threads, current_ctx->commands_count);
+
+  job_stage_end(outer_stage_job);
+
+  /*
+   * Every stage has its own copy, or is done with the shell's. A subshell
+   * only sees EOF on a pipe opened as a redirection target once the shell's
+   * copy is closed too.
+   */
+  close_redirections(current_ctx, in_fds, out_fds);
+  subst_close(subs);
+
+  if (job->procs_count == 0) {
+    job_remove(job);
+    return -1;
+  }
+
+  /* Background jobs are reaped later, before a prompt or by wait */
+  if (job->background) {
+    printf("[%u] %d\n", job->id, job->pgid);
+    fflush(stdout);
+    return 0;
   }
 
   /**
-   * For foreground processes, we keep waiting until all child processes have
-   * exited normally or been terminated by SIGINT/SIGSTP before returning. If a
-   * process is stopped (Ctrl-Z), waitpid() returns but we do not exit the loop
-   * because a stopped process is not finished.
+   * For foreground jobs, we keep waiting until all child processes have exited
+   * or been killed, or until the job is stopped (Ctrl-Z), in which case it
+   * stays in the job table so fg and bg can resume it.
+   */
+  return job_wait(job);
+}
+
+/**
+ * run_pipeline - Run a builtin or launch the pipeline as a job
+ * @current_ctx: Shell context
+ *
+ * Per-stage data lives on the heap, so the pipeline length is only bounded by
+ * memory and the process limits.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int run_pipeline(struct repl_ctx *current_ctx) {
+  /* Overrides and exec decide for themselves, before anything is set up */
+  const int is_builtin = exec_builtin(current_ctx);
+
+  if (is_builtin == -1) {
+    return -1;
+  }
+
+  if (is_builtin) {
+    return 0;
+  }
+
+  const unsigned int count = current_ctx->commands_count;
+
+  const char **paths = malloc(count * sizeof(*paths));
+  const struct command_associations **builtins =
+      malloc(count * sizeof(*builtins));
+  int *redirect_fds = malloc(count * 2 * sizeof(*redirect_fds));
+  if (!paths || !builtins || !redirect_fds) {
+    error_msg(malloc_fail_msg, true);
+    free(paths);
+    free(builtins);
+    free(redirect_fds);
+    return -1;
+  }
+
+  int *in_fds = redirect_fds;
+  int *out_fds = redirect_fds + count;
+  struct substitutions subs = {.items = NULL, .count = 0, .stage_fds = NULL};
+  int result = -1;
+  int batched = -1;
+
+  if (find_stage_builtins(current_ctx, builtins) == 0) {
+    batched = check_arg_sizes(current_ctx, builtins);
+  }
+
+  /*
+   * Substitutions are /dev/fd paths by the time redirections are opened. Their
+   * subshells belong to a job, so a pipeline with any always runs as one.
    */
-  if (!current_ctx->is_background_process) {
-    for (unsigned int k = 0; k < current_ctx->commands_count; k++) {
-      do {
-        waitpid(pids[k], &status, WUNTRACED);
-      } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+  if (batched != -1 && resolve_programs(current_ctx, builtins, paths) == 0 &&
+      subst_prepare(current_ctx, &subs) == 0 &&
+      open_redirections(current_ctx, in_fds, out_fds) == 0) {
+    if (count == 1 && builtins[0] && !pipeline_fans_out(current_ctx) &&
+        subs.count == 0) {
+      /* On its own, a builtin runs in the shell with its redirections */
+      result = run_builtin_here(builtins[0], current_ctx, 0, in_fds[0],
+                                out_fds[0]) == -1
+                   ? -1
+                   : 0;
+    } else if (batched) {
+      result = run_batched(current_ctx, paths[0], in_fds[0], out_fds[0]);
+    } else if (subs.count == 0 && can_exec_in_place(current_ctx)) {
+      /* Only returns if the exec failed */
+      result = exec_in_place(paths[0], current_ctx->commands[0], in_fds[0],
+                             out_fds[0]);
+    } else {
+      result = launch_job(current_ctx, builtins, paths, in_fds, out_fds,
+                          &subs);
     }
+    close_redirections(current_ctx, in_fds, out_fds);
   }
 
-  return 0;
+  subst_finish(&subs);
+
+  free(paths);
+  free(builtins);
+  free(redirect_fds);
+
+  return result;
+}
+
+/**
+ * set_exit_status - Set $? and $PIPESTATUS for a command without a job
+ * @current_ctx: Shell context
+ * @code: Exit status
+ *
+ * For commands the shell handles on its own instead of running a pipeline,
+ * such as one it skipped or a keyword used the wrong way.
+ */
+void set_exit_status(struct repl_ctx *current_ctx, int code) {
+  char status[4];
+
+  snprintf(status, sizeof(status), "%d", code);
+
+  set_user_env(current_ctx, "?", status);
+  set_user_env(current_ctx, "PIPESTATUS", status);
+}
+
+/**
+ * set_status_vars - Update $? and $PIPESTATUS after a command
+ * @current_ctx: Shell context
+ * @run_result: Return value of run_pipeline()
+ * @result: Result of the job the command waited for, NULL if there was none
+ *
+ * PIPESTATUS holds the exit status of every stage, $? that of the last one
+ * (with pipefail, that of the last one that failed), or TIMEOUT_EXIT_CODE if
+ * the job ran out of time. Builtins and background
+ * jobs have no job result, so they set both from whether the command
+ * succeeded, with NOT_FOUND_EXIT_CODE for a program that wasn't found.
+ */
+void set_status_vars(struct repl_ctx *current_ctx, int run_result,
+                     const struct job_result *result) {
+  unsigned int count = result ? result->stages_count : 1;
+
+  /* Exit statuses are at most 3 digits, plus a separator each */
+  char *pipe_status = malloc(count * 4 + 1);
+  if (!pipe_status) {
+    error_msg(malloc_fail_msg, true);
+    return;
+  }
+
+  const bool not_found = path_cache_take_miss();
+  int last_code = run_result == -1 ? (not_found ? NOT_FOUND_EXIT_CODE : 1) : 0;
+  size_t len = 0;
+
+  pipe_status[0] = '\0';
+
+  const bool pipefail = option_is_set(OPTION_PIPEFAIL);
+
+  for (unsigned int i = 0; result && i < count; i++) {
+    int code = result->stages[i].exit_code;
+
+    if (!pipefail || code != 0 || i == 0) {
+      last_code = code;
+    }
+
+    len += sprintf(pipe_status + len, i > 0 ? " %d" : "%d", code);
+  }
+
+  if (!result) {
+    sprintf(pipe_status, "%d", last_code);
+  }
+
+  if (result && result->timed_out) {
+    last_code = TIMEOUT_EXIT_CODE;
+  }
+
+  char last_status[4];
+  snprintf(last_status, sizeof(last_status), "%d", last_code);
+
+  set_user_env(current_ctx, "?", last_status);
+  set_user_env(current_ctx, "PIPESTATUS", pipe_status);
+
+  free(pipe_status);
+}
+
+/**
+ * exec - Execute command pipeline
+ * @current_ctx: Shell context
+ *
+ * This does quite a bit:
+ * - Runs builtins in the shell, or as stages of the pipeline
+ * - Resolve programs and open redirection targets in the shell so typos and
+ *   bad paths fail early
+ * - Create the pipe to the next command as each one is launched
+ * - Spawn a child process for each command with posix_spawn, as one job
+ * - Close pipe file descriptors in parent as soon as they are handed over
+ * - Wait for the job in the foreground (unless background process)
+ * - Record exit statuses and, for the time keyword, report resource usage
+ *
+ * Return: 0 on success, -1 on error
+ */
+int exec(struct repl_ctx *current_ctx) {
+  return exec_measured(current_ctx, NULL, NULL);
+}
+
+/**
+ * exec_measured - Execute command pipeline and measure it
+ * @current_ctx: Shell context
+ * @real: Output parameter - wall time the pipeline took
+ * @usage: Output parameter - resource usage of every stage, as reported by
+ * wait4(), plus that of the shell while it ran
+ *
+ * Same as exec(), for the bench keyword.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int exec_measured(struct repl_ctx *current_ctx, struct timespec *real,
+                  struct rusage *usage) {
+  struct timing_mark mark;
+  const bool measured = real && usage;
+
+  if (current_ctx->is_timed || measured) {
+    timing_start(&mark);
+  }
+
+  int run_result = run_pipeline(current_ctx);
+
+  /* NULL unless a job was waited for, by us or by a builtin such as fg */
+  const struct job_result *result = job_take_result();
+
+  if (measured) {
+    timing_total(&mark, result, real, usage);
+  }
+
+  set_status_vars(current_ctx, run_result, result);
+
+  if (current_ctx->is_timed) {
+    timing_report(current_ctx, &mark, result);
+  }
+
+  return run_result;
 }
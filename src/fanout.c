@@ -0,0 +1,491 @@
+/**
+ * fanout.c
+ *
+ * Copying a stage's output to several files and to the next stage.
+ *
+ * OVERVIEW:
+ * "make > build.log >> all.log | grep error" sends make's output to both files
+ * and to grep, which otherwise takes a tee process and a second pipe. As in
+ * zsh, with "set -o multios" every ">" and ">>" of a stage gets the whole
+ * output, and so does the next stage if there is one. The option is off by
+ * default, since POSIX shells send the output to the last file only and give
+ * the next stage an empty pipe.
+ *
+ * THE RELAY:
+ * A stage that fans out writes to a pipe read by a relay, a forked copy of the
+ * shell that belongs to the job. For every destination but the last, tee(2)
+ * duplicates what is in the pipe into a private pipe without consuming it,
+ * then splice() moves the original to the last destination and each private
+ * pipe to its own. tee(2) only takes references to the pipe's pages and
+ * splice() hands them on, so the data is never copied into the relay's memory
+ * the way tee(1) copies it through a buffer.
+ *
+ * A private pipe has at least as many slots as the stage's pipe and is empty
+ * whenever tee(2) is called, so every destination gets exactly what the first
+ * one got.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "fanout.h"
+#include "options.h"
+#include "relay.h"
+
+/* Size of the buffer used for destinations splice() refuses */
+#define FANOUT_BUFFER_SIZE (64 * 1024)
+
+/**
+ * fanout_dest - One place the relay writes to
+ * @fd: Destination descriptor
+ * @pipe_fds: Private pipe tee(2) fills for this destination, -1 for the last
+ * one, which gets the original
+ * @alive: Whether the destination still accepts output
+ */
+struct fanout_dest {
+  int fd;
+  int pipe_fds[2];
+  bool alive;
+};
+
+/**
+ * fanout_add - Add an output file to a stage
+ * @fanout: Stage's fan-out, allocated on the first call
+ * @name: File name, copied
+ * @type: O_WRONLY for ">", O_APPEND for ">>"
+ *
+ * Return: 0 on success, -1 on error
+ */
+int fanout_add(struct out_fanout **fanout, const char *name, int type) {
+  if (!*fanout) {
+    *fanout = calloc(1, sizeof(**fanout));
+    if (!*fanout) {
+      error_msg(malloc_fail_msg, true);
+      return -1;
+    }
+  }
+
+  struct out_fanout *files = *fanout;
+  const unsigned int count = files->count + 1;
+
+  char **names = realloc(files->names, count * sizeof(*names));
+  if (names) {
+    files->names = names;
+  }
+
+  int *types = realloc(files->types, count * sizeof(*types));
+  if (types) {
+    files->types = types;
+  }
+
+  int *fds = realloc(files->fds, count * sizeof(*fds));
+  if (fds) {
+    files->fds = fds;
+  }
+
+  if (!names || !types || !fds) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  files->names[files->count] = strdup(name);
+  if (!files->names[files->count]) {
+    error_msg(strdup_fail_msg, true);
+    return -1;
+  }
+
+  files->types[files->count] = type;
+  files->fds[files->count] = -1;
+  files->count = count;
+
+  return 0;
+}
+
+/**
+ * fanout_free - Free a stage's fan-out
+ * @fanout: Fan-out to free, NULL to do nothing
+ */
+void fanout_free(struct out_fanout *fanout) {
+  if (!fanout) {
+    return;
+  }
+
+  for (unsigned int i = 0; i < fanout->count; i++) {
+    free(fanout->names[i]);
+  }
+
+  free(fanout->names);
+  free(fanout->types);
+  free(fanout->fds);
+  free(fanout);
+}
+
+/**
+ * stage_fans_out - Check whether a stage's output goes to several places
+ * @current_ctx: Shell context with parsed redirections
+ * @index: Stage of the pipeline
+ *
+ * With the multios option, a stage fans out if it has several output files,
+ * or an output file and a next stage: as in zsh, "A > FILE | B" then writes
+ * to both. Otherwise the last file takes the output and the next stage gets
+ * nothing, as in POSIX shells.
+ *
+ * Return: true if the stage needs a relay, false otherwise
+ */
+bool stage_fans_out(const struct repl_ctx *current_ctx, unsigned int index) {
+  if (!option_is_set(OPTION_MULTIOS)) {
+    return false;
+  }
+
+  return current_ctx->out_fanout[index] ||
+         (current_ctx->out_stream_name[index] &&
+          index < current_ctx->commands_count - 1);
+}
+
+/**
+ * pipeline_fans_out - Check whether any stage of the pipeline fans out
+ * @current_ctx: Shell context with parsed redirections
+ *
+ * Such a pipeline has to run as a job, which its relays belong to.
+ *
+ * Return: true if a stage needs a relay, false otherwise
+ */
+bool pipeline_fans_out(const struct repl_ctx *current_ctx) {
+  for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
+    if (stage_fans_out(current_ctx, i)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * buffer_move - Move bytes through a buffer, for destinations splice() refuses
+ * @from: Pipe to read from
+ * @to: Destination
+ * @len: Bytes to move
+ *
+ * Return: Bytes moved, -1 on error
+ */
+ssize_t buffer_move(int from, int to, size_t len) {
+  static char buffer[FANOUT_BUFFER_SIZE];
+
+  ssize_t got = read(from, buffer, len < sizeof(buffer) ? len : sizeof(buffer));
+  if (got <= 0) {
+    return got;
+  }
+
+  for (ssize_t written = 0; written < got;) {
+    ssize_t n = write(to, buffer + written, got - written);
+    if (n == -1) {
+      return -1;
+    }
+    written += n;
+  }
+
+  return got;
+}
+
+/**
+ * move_bytes - Move a given amount of data from a pipe to a destination
+ * @from: Pipe holding at least len bytes
+ * @dest: Destination, marked dead if it goes away
+ * @len: Bytes to move
+ * @discard: Descriptor of /dev/null, where the bytes go once dest is dead
+ *
+ * The bytes are always consumed from the pipe, so the relay stays in step
+ * with it whatever happens to the destination.
+ */
+void move_bytes(int from, struct fanout_dest *dest, size_t len, int discard) {
+  bool use_splice = true;
+
+  while (len > 0) {
+    const int to = dest->alive ? dest->fd : discard;
+    ssize_t moved = use_splice ? splice(from, NULL, to, NULL, len, 0)
+                               : buffer_move(from, to, len);
+
+    if (moved > 0) {
+      len -= moved;
+      continue;
+    }
+
+    /* Terminals and some special files can't be spliced into */
+    if (moved == -1 && errno == EINVAL && use_splice) {
+      use_splice = false;
+      continue;
+    }
+
+    if (moved == -1 && errno == EINTR) {
+      continue;
+    }
+
+    /* The reader went away or the file can't take more, keep the others */
+    if (dest->alive && moved == -1 && errno != EPIPE) {
+      error_msg("fan-out: write failed", true);
+    }
+
+    if (!dest->alive) {
+      return;
+    }
+
+    dest->alive = false;
+  }
+}
+
+/**
+ * match_pipe_size - Give private pipes as many slots as the stage's pipe
+ * @in_fd: Stage's pipe, which adaptive pipe sizing may have grown
+ * @dests: Destinations
+ * @count: Number of destinations
+ *
+ * Return: 0 on success, -1 if a private pipe can't hold what tee(2) copies
+ */
+int match_pipe_size(int in_fd, struct fanout_dest *dests, unsigned int count) {
+  const int size = fcntl(in_fd, F_GETPIPE_SZ);
+
+  for (unsigned int i = 0; size > 0 && i < count; i++) {
+    const int fd = dests[i].pipe_fds[1];
+
+    if (fd != -1 && fcntl(fd, F_GETPIPE_SZ) < size &&
+        fcntl(fd, F_SETPIPE_SZ, size) == -1) {
+      error_msg("fan-out: failed to resize pipe", true);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * run_fanout - Copy everything from in_fd to every destination
+ * @in_fd: Stage's pipe
+ * @dests: Destinations, the last one has no private pipe
+ * @count: Number of destinations
+ * @discard: Descriptor of /dev/null
+ *
+ * Return: 0 at EOF or once every destination is gone, -1 on error
+ */
+int run_fanout(int in_fd, struct fanout_dest *dests, unsigned int count,
+               int discard) {
+  struct fanout_dest *last = &dests[count - 1];
+
+  for (;;) {
+    if (match_pipe_size(in_fd, dests, count) == -1) {
+      return -1;
+    }
+
+    /* The first tee(2) waits for data, the others copy exactly as much */
+    ssize_t len = -1;
+    bool any_alive = last->alive;
+
+    for (unsigned int i = 0; i + 1 < count; i++) {
+      if (!dests[i].alive) {
+        continue;
+      }
+
+      any_alive = true;
+
+      ssize_t copied;
+      do {
+        copied = tee(in_fd, dests[i].pipe_fds[1],
+                     len == -1 ? RELAY_CHUNK : (size_t)len, 0);
+      } while (copied == -1 && errno == EINTR);
+
+      if (copied == -1 || (len != -1 && copied != len)) {
+        error_msg("fan-out: tee failed", copied == -1);
+        return -1;
+      }
+
+      len = copied;
+    }
+
+    if (!any_alive) {
+      return 0;
+    }
+
+    /* No private pipes left, the last destination takes whatever arrives */
+    if (len == -1) {
+      len = splice(in_fd, NULL, last->fd, NULL, RELAY_CHUNK, 0);
+
+      if (len == -1 && errno == EINTR) {
+        continue;
+      }
+
+      if (len == -1 && errno == EINVAL) {
+        len = buffer_move(in_fd, last->fd, RELAY_CHUNK);
+      }
+
+      if (len == -1) {
+        if (errno != EPIPE) {
+          error_msg("fan-out: write failed", true);
+        }
+        return 0;
+      }
+
+      if (len == 0) {
+        return 0;
+      }
+
+      continue;
+    }
+
+    if (len == 0) {
+      return 0;
+    }
+
+    move_bytes(in_fd, last, (size_t)len, discard);
+
+    for (unsigned int i = 0; i + 1 < count; i++) {
+      if (dests[i].alive) {
+        move_bytes(dests[i].pipe_fds[0], &dests[i], (size_t)len, discard);
+      }
+    }
+  }
+}
+
+/**
+ * keep_only - Close every descriptor above stderr but the relay's
+ * @in_fd: Stage's pipe
+ * @out_fds: Destinations
+ * @count: Number of destinations
+ *
+ * The relay holding other pipe ends of the pipeline would keep its stages from
+ * ever seeing EOF. The gaps between the descriptors it keeps are closed from
+ * the lowest one up.
+ */
+void keep_only(int in_fd, const int *out_fds, unsigned int count) {
+  unsigned int low = STDERR_FILENO + 1;
+
+  for (;;) {
+    /* Lowest kept descriptor at or above low */
+    unsigned int next = ~0U;
+
+    if ((unsigned int)in_fd >= low) {
+      next = (unsigned int)in_fd;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+      if ((unsigned int)out_fds[i] >= low && (unsigned int)out_fds[i] < next) {
+        next = (unsigned int)out_fds[i];
+      }
+    }
+
+    if (next > low && close_range(low, next - 1, 0) == -1) {
+      for (long fd = low; fd < sysconf(_SC_OPEN_MAX) && fd < (long)next;
+           fd++) {
+        close(fd);
+      }
+    }
+
+    if (next == ~0U) {
+      return;
+    }
+
+    low = next + 1;
+  }
+}
+
+/**
+ * fanout_child - Body of the relay process
+ * @in_fd: Stage's pipe
+ * @out_fds: Destinations
+ * @count: Number of destinations
+ *
+ * Return: Exit status of the relay
+ */
+int fanout_child(int in_fd, const int *out_fds, unsigned int count) {
+  struct fanout_dest *dests = calloc(count, sizeof(*dests));
+  int discard = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+  if (!dests || discard == -1) {
+    error_msg("fan-out: failed to start", true);
+    return EXIT_FAILURE;
+  }
+
+  for (unsigned int i = 0; i < count; i++) {
+    dests[i].fd = out_fds[i];
+    dests[i].pipe_fds[0] = -1;
+    dests[i].pipe_fds[1] = -1;
+    dests[i].alive = true;
+
+    /*
+     * splice() refuses files opened with O_APPEND. The relay is the only
+     * writer through this descriptor, so it seeks to the end itself.
+     */
+    const int flags = fcntl(out_fds[i], F_GETFL);
+    if (flags != -1 && (flags & O_APPEND) &&
+        lseek(out_fds[i], 0, SEEK_END) != -1) {
+      fcntl(out_fds[i], F_SETFL, flags & ~O_APPEND);
+    }
+
+    if (i + 1 < count && pipe2(dests[i].pipe_fds, O_CLOEXEC) == -1) {
+      error_msg("Failed to create pipe", true);
+      return EXIT_FAILURE;
+    }
+  }
+
+  return run_fanout(in_fd, dests, count, discard) == 0 ? EXIT_SUCCESS
+                                                       : EXIT_FAILURE;
+}
+
+/**
+ * fanout_spawn - Start the relay copying a stage's output everywhere
+ * @in_fd: Read end of the pipe the stage writes to
+ * @out_fds: Destinations, in the order the output is handed to them
+ * @count: Number of entries in out_fds
+ * @pgid: Process group to join, 0 for a new group, -1 to stay in the shell's
+ *
+ * The relay is a forked copy of the shell that keeps only in_fd and out_fds.
+ * It duplicates the pipe's contents with tee(2) and moves them with splice(),
+ * so the data stays in the kernel. A destination that goes away (EPIPE) is
+ * dropped and the others keep getting the output. The relay exits at EOF or
+ * once no destination is left.
+ *
+ * Return: PID of the relay, -1 on error
+ */
+pid_t fanout_spawn(int in_fd, const int *out_fds, unsigned int count,
+                   pid_t pgid) {
+  static const int reset_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN,
+                                      SIGTTOU};
+
+  fflush(stdout);
+  fflush(stderr);
+
+  pid_t pid = fork();
+
+  if (pid == -1) {
+    error_msg("Failed to fork", true);
+    return -1;
+  }
+
+  /* From both sides, so the stages can join a group the relay leads */
+  if (pgid != -1) {
+    setpgid(pid > 0 ? pid : 0, pgid);
+  }
+
+  if (pid > 0) {
+    return pid;
+  }
+
+  keep_only(in_fd, out_fds, count);
+
+  /* SIGPIPE stays ignored, EPIPE only drops one destination */
+  for (size_t i = 0; i < sizeof(reset_signals) / sizeof(*reset_signals); i++) {
+    signal(reset_signals[i], SIG_DFL);
+  }
+
+  sigset_t empty_mask;
+  sigemptyset(&empty_mask);
+  sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+
+  _exit(fanout_child(in_fd, out_fds, count));
+}
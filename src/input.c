@@ -16,10 +16,13 @@
 #include <readline/history.h>
 #include <readline/readline.h>
 
+#include "builtins.h"
 #include "config.h"
 #include "error.h"
+#include "fanout.h"
 #include "input.h"
 #include "parse.h"
+#include "subst.h"
 
 /**
  * take_input - Display prompt and read user input
@@ -36,6 +39,9 @@ int take_input(struct repl_ctx *current_ctx) {
     return -1;
   }
 
+  /* Wake up now and then to start deferred pipelines while idle */
+  rl_event_hook = queue_waiting() ? queue_event_hook : NULL;
+
   /* Display the prompt and take user input. */
   current_ctx->input = readline(prompt);
 
@@ -59,17 +65,23 @@ int take_input(struct repl_ctx *current_ctx) {
  * - Splits input on pipes to get individual commands
  * - Initialize arrays for command data
  * - Tokenize each command into arguments
- * - Parse special operators (&, <, >, >>)
- * - Expand environment variables and tilde (~)
+ * - Parse the time keyword and special operators (&, <, >, >>)
+ * - Parse the sched keyword of each stage
+ * - Expand environment variables and tilde (~), outside process substitutions
+ * - Give background jobs the attributes from BACKGROUND_SCHED
  *
  * Return: 0 on success, -1 on error
  */
 int process_input(struct repl_ctx *current_ctx) {
   current_ctx->commands_count = 0;
+  current_ctx->syntax_error = 0;
 
   /* Split input on ' | ' to get individual commands */
   current_ctx->unparsed_commands =
       split_on_pipes(current_ctx->input, &current_ctx->commands_count);
+  if (!current_ctx->unparsed_commands) {
+    return -1;
+  }
 
   /**
    * Allocate arrays fro command metadata now that we know how many commands we
@@ -88,22 +100,66 @@ int process_input(struct repl_ctx *current_ctx) {
       return -1;
     }
 
+    if (unclosed_substitution(current_ctx->commands[i])) {
+      error_msg("Syntax error: unclosed process substitution", false);
+      current_ctx->syntax_error = 1;
+    }
+
     /* Parse special operators and remove them from arguments */
+    if (i == 0 && determine_keywords(current_ctx) == -1) {
+      current_ctx->syntax_error = 1;
+    }
+
+    if (determine_stage_attrs(current_ctx, i) == -1) {
+      current_ctx->syntax_error = 1;
+    }
+
     determine_if_background(current_ctx, i);
 
     determine_in_stream(current_ctx, i);
 
     determine_out_stream(current_ctx, i);
 
-    /* Expand environment variables and tilde (~) */
+    /*
+     * Expand environment variables and tilde (~). A process substitution's
+     * command is expanded once it runs, like the rest of its parsing.
+     */
     for (unsigned int j = 0; j < current_ctx->args_count[i]; j++) {
+      if (is_substitution(current_ctx->commands[i][j])) {
+        continue;
+      }
+
       replace(&current_ctx->commands[i][j], "~", current_ctx->home_dir);
       parse_envs(&current_ctx->commands[i][j], current_ctx->user_envs,
                  current_ctx->user_envs_count);
     }
+
+    /* Redirection targets too, so "> /dev/fd/$COPROC[1]" works */
+    char **targets[] = {&current_ctx->in_stream_name[i],
+                        &current_ctx->out_stream_name[i]};
+
+    for (unsigned int j = 0; j < 2; j++) {
+      if (*targets[j] && !is_substitution(*targets[j])) {
+        replace(targets[j], "~", current_ctx->home_dir);
+        parse_envs(targets[j], current_ctx->user_envs,
+                   current_ctx->user_envs_count);
+      }
+    }
+
+    const struct out_fanout *fanout = current_ctx->out_fanout[i];
+
+    for (unsigned int j = 0; fanout && j < fanout->count; j++) {
+      if (is_substitution(fanout->names[j])) {
+        continue;
+      }
+
+      replace(&fanout->names[j], "~", current_ctx->home_dir);
+      parse_envs(&fanout->names[j], current_ctx->user_envs,
+                 current_ctx->user_envs_count);
+    }
   }
 
-  return 0;
+  return apply_background_attrs(current_ctx);
 }
 
 /**
@@ -181,6 +237,8 @@ char *construct_prompt(char *home_dir, char *user) {
  * - in_stream_name[i]: input file for command i (or NULL)
  * - out_stream_name[i]: output file for command i (or NULL)
  * - out_stream_type[i]: O_WRONLY or O_APPEND
+ * - stage_attrs[i]: attributes from the sched keyword (or NULL)
+ * - out_fanout[i]: output files after the first (or NULL)
  *
  * All arrays are sized by commands_count, which was set by split_on_pipes, so
  * that we only allocate as much memory as we need.
@@ -232,6 +290,22 @@ int init_repl_vars(struct repl_ctx *current_ctx) {
     return -1;
   }
 
+  /* Array of stage attributes, NULL for stages without any */
+  current_ctx->stage_attrs =
+      calloc(current_ctx->commands_count, sizeof(struct stage_attrs *));
+  if (!current_ctx->stage_attrs) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  /* Further output files, NULL for stages with at most one */
+  current_ctx->out_fanout =
+      calloc(current_ctx->commands_count, sizeof(struct out_fanout *));
+  if (!current_ctx->out_fanout) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
   /* Initialize stream names to NULL to indicate no redirection */
   for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
     current_ctx->in_stream_name[i] = NULL;
@@ -0,0 +1,1867 @@
+/**
+ * jobs.c
+ *
+ * Job table and job control.
+ *
+ * OVERVIEW:
+ * Every pipeline the shell launches becomes a job that stays in the table
+ * until all of its processes have been reaped. This is what makes it possible
+ * to recover exit statuses, stop and resume jobs (Ctrl-Z, fg, bg) and wait for
+ * background jobs.
+ *
+ * REAPING:
+ * The SIGCHLD handler only sets a flag. The actual wait4() calls happen at
+ * points where the shell is ready for them (before each prompt and while
+ * waiting for a job) and never block, each one returns a single child that
+ * changed status along with its resource usage, which is what the time
+ * keyword reports.
+ *
+ * WAITING:
+ * Every child also gets a pidfd, registered with an epoll instance. While the
+ * shell waits it sleeps in epoll_pwait(), which reports only the children
+ * that exited, so waking up costs the same with one job or thousands. The
+ * sleep can also be given a timeout, which is what deadlines (the timeout
+ * keyword and wait -t) build on. pidfds also make signalling race-free: a
+ * pidfd always refers to the same process, even once its PID is reused.
+ *
+ * SCALING:
+ * Jobs are stored in an array indexed by job number, and every live process
+ * is indexed by PID in an open-addressed hash table, so looking up the job of a
+ * reaped child costs the same whether there are two background jobs or
+ * thousands.
+ *
+ * TEARDOWN:
+ * Once the last stage of a pipeline exits, nothing reads what the others
+ * produce. They are sent SIGPIPE shortly after (and SIGKILL after a grace
+ * period, if configured) rather than left running until their next write.
+ *
+ * JOB CONTROL:
+ * In interactive sessions, each job gets its own process group and the shell
+ * moves the terminal's foreground process group back and forth with
+ * tcsetpgrp(). That way Ctrl+C and Ctrl-Z only reach the foreground job.
+ *
+ * STAGES IN THE SHELL:
+ * A builtin stage can run in the shell itself (see exec.c), which ignores
+ * Ctrl-Z and couldn't wait for the job while busy with the stage. Until the
+ * stage is done, a stop of the job is undone with SIGCONT and reported, as
+ * zsh does ("job can't be suspended"). Jobs the stage launches, such as the
+ * commands xargs runs, join the job's process group and leave it the
+ * terminal, so Ctrl+C and Ctrl-Z reach the whole pipeline.
+ *
+ * cat only moves data, so its stage is handed over instead. The shell forks
+ * where it is in the copy, the child joins the job, stops along with it and
+ * carries on from there once resumed. The shell goes back to wait for the job,
+ * which it then finds stopped like any other.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "input.h"
+#include "jobs.h"
+#include "signals.h"
+
+/* Initial number of slots in the PID index, must be a power of two */
+#define PID_INDEX_MIN 64
+
+/* Most children reaped per wakeup, the rest are picked up by the next one */
+#define WAIT_EVENTS_MAX 64
+
+bool job_control = false;
+
+int shell_terminal = -1;
+
+static pid_t shell_pgid;
+
+static struct termios shell_tmodes;
+
+static struct {
+  /* slots[id - 1] holds job number id, or NULL */
+  struct job **slots;
+  unsigned int slots_capacity;
+  unsigned int highest_id;
+  struct job *current;
+  /* Open-addressed PID -> process table with linear probing */
+  struct job_proc **pids;
+  unsigned int pids_capacity;
+  unsigned int pids_count;
+  /* Jobs with a deadline, reaping skips checking them when there are none */
+  unsigned int deadlines_count;
+} table;
+
+/* Every child's pidfd is registered here, see wait_event() */
+static int epoll_fd = -1;
+
+/* Foreground job whose io_fd is registered with epoll_fd, if any */
+static struct job *io_job;
+
+/* Result of the last foreground job, see job_take_result() */
+static struct job_result last_result;
+
+static bool last_result_taken = true;
+
+/* Foreground job the shell runs a stage of, see job_stage_begin() */
+static struct job *stage_job;
+
+/* Process group of stage_job, 0 if none. Read by the SIGCHLD handler */
+static volatile sig_atomic_t stage_pgid;
+
+/* Whether the current stage's stop was reported, it only is once */
+static volatile sig_atomic_t stage_stop_reported;
+
+/* Whether the current stage is handed to a child when the job stops */
+static volatile sig_atomic_t stage_hands_over;
+
+/* Where the shell goes on once a child took the stage over, NULL if it can't */
+static sigjmp_buf *volatile stage_detach_point;
+
+/* Descriptors the stage uses, the child closes every other one */
+static int stage_keep_fds[STAGE_KEEP_FDS_MAX];
+
+static volatile sig_atomic_t stage_keep_fds_count;
+
+/* In the shell, the child that took the stage over. -1 in that child */
+static volatile sig_atomic_t stage_taken_over;
+
+/* Printed when a stop is undone, with only async-signal-safe calls */
+#define STAGE_STOP_MSG                                                         \
+  RED "clowniSH: job can't be suspended while the shell runs one of its "      \
+      "stages " CYAN "\n"
+
+/**
+ * pid_home - Get the preferred slot for a PID in the index
+ * @pid: Process ID
+ *
+ * PIDs are handed out sequentially, so they are scrambled with a
+ * multiplicative hash to avoid long runs of occupied slots.
+ *
+ * Return: Slot index
+ */
+unsigned int pid_home(pid_t pid) {
+  return ((uint32_t)pid * 2654435761u) & (table.pids_capacity - 1);
+}
+
+/**
+ * pid_index_find - Look up a process by PID
+ * @pid: Process ID
+ *
+ * Return: Process if tracked, NULL otherwise
+ */
+struct job_proc *pid_index_find(pid_t pid) {
+  if (!table.pids) {
+    return NULL;
+  }
+
+  for (unsigned int i = pid_home(pid); table.pids[i];
+       i = (i + 1) & (table.pids_capacity - 1)) {
+    if (table.pids[i]->pid == pid) {
+      return table.pids[i];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * pid_index_grow - Double the size of the PID index
+ *
+ * The index is kept at most half full so that probe sequences stay short.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int pid_index_grow(void) {
+  unsigned int old_capacity = table.pids_capacity;
+  struct job_proc **old_pids = table.pids;
+  unsigned int new_capacity = old_capacity ? old_capacity * 2 : PID_INDEX_MIN;
+
+  struct job_proc **new_pids = calloc(new_capacity, sizeof(*new_pids));
+  if (!new_pids) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  table.pids = new_pids;
+  table.pids_capacity = new_capacity;
+
+  for (unsigned int i = 0; i < old_capacity; i++) {
+    if (!old_pids[i]) {
+      continue;
+    }
+
+    unsigned int j = pid_home(old_pids[i]->pid);
+    while (table.pids[j]) {
+      j = (j + 1) & (new_capacity - 1);
+    }
+    table.pids[j] = old_pids[i];
+  }
+
+  free(old_pids);
+
+  return 0;
+}
+
+/**
+ * pid_index_insert - Add a process to the PID index
+ * @proc: Process to add
+ *
+ * Return: 0 on success, -1 on error
+ */
+int pid_index_insert(struct job_proc *proc) {
+  if ((table.pids_count + 1) * 2 > table.pids_capacity &&
+      pid_index_grow() == -1) {
+    return -1;
+  }
+
+  unsigned int i = pid_home(proc->pid);
+  while (table.pids[i]) {
+    i = (i + 1) & (table.pids_capacity - 1);
+  }
+
+  table.pids[i] = proc;
+  table.pids_count++;
+
+  return 0;
+}
+
+/**
+ * pid_index_remove - Remove a process from the PID index
+ * @pid: Process ID
+ *
+ * Uses backward shift deletion: entries after the removed one are moved up if
+ * their preferred slot allows it, so lookups never need tombstones.
+ */
+void pid_index_remove(pid_t pid) {
+  if (!table.pids) {
+    return;
+  }
+
+  const unsigned int mask = table.pids_capacity - 1;
+  unsigned int i = pid_home(pid);
+
+  while (table.pids[i] && table.pids[i]->pid != pid) {
+    i = (i + 1) & mask;
+  }
+
+  if (!table.pids[i]) {
+    return;
+  }
+
+  for (unsigned int j = (i + 1) & mask; table.pids[j]; j = (j + 1) & mask) {
+    unsigned int home = pid_home(table.pids[j]->pid);
+
+    /* Leave the entry alone if its home slot lies cyclically in (i, j] */
+    bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+    if (stays) {
+      continue;
+    }
+
+    table.pids[i] = table.pids[j];
+    i = j;
+  }
+
+  table.pids[i] = NULL;
+  table.pids_count--;
+}
+
+/**
+ * watch_proc - Start watching a process through a pidfd
+ * @proc: Process that was just launched
+ *
+ * Kernels older than 5.3 don't have pidfd_open(), the process is then only
+ * noticed through SIGCHLD, which interrupts the wait just the same.
+ */
+void watch_proc(struct job_proc *proc) {
+  proc->pidfd = pidfd_open(proc->pid, 0);
+  if (proc->pidfd == -1) {
+    return;
+  }
+
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = proc};
+
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, proc->pidfd, &event) == -1) {
+    close(proc->pidfd);
+    proc->pidfd = -1;
+  }
+}
+
+/**
+ * unwatch_proc - Stop watching a process
+ * @proc: Process that was reaped or is no longer tracked
+ */
+void unwatch_proc(struct job_proc *proc) {
+  if (proc->pidfd == -1) {
+    return;
+  }
+
+  /* Closing the only reference also takes it out of the epoll set */
+  close(proc->pidfd);
+  proc->pidfd = -1;
+}
+
+/**
+ * deadline_in - Compute a deadline some time from now
+ * @deadline: Output parameter - deadline on the CLOCK_MONOTONIC clock
+ * @duration_ms: Time from now
+ */
+void deadline_in(struct timespec *deadline, long duration_ms) {
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+
+  deadline->tv_sec += duration_ms / 1000;
+  deadline->tv_nsec += (duration_ms % 1000) * 1000000L;
+
+  if (deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000L;
+  }
+}
+
+/**
+ * timespec_before - Compare two points in time
+ * @a: First time
+ * @b: Second time
+ *
+ * Return: true if a is earlier than b, false otherwise
+ */
+bool timespec_before(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec < b->tv_sec ||
+         (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/**
+ * has_deadline - Check whether a job has a deadline pending
+ * @job: Job to check
+ *
+ * Return: true if it has one, false otherwise
+ */
+bool has_deadline(const struct job *job) {
+  return job->deadline.tv_sec != 0 || job->deadline.tv_nsec != 0;
+}
+
+/**
+ * clear_deadline - Remove the pending deadline of a job, if any
+ * @job: Job to update
+ */
+void clear_deadline(struct job *job) {
+  if (!has_deadline(job)) {
+    return;
+  }
+
+  job->deadline.tv_sec = 0;
+  job->deadline.tv_nsec = 0;
+  table.deadlines_count--;
+}
+
+/**
+ * jobs_init - Set up job control at startup
+ * @interactive: Whether commands are read from the user rather than given
+ * with -c
+ *
+ * Creates the epoll instance children are watched with. If the session is
+ * interactive and stdin is a terminal, also puts the shell in its own process
+ * group, takes ownership of the terminal and ignores the job control signals
+ * that would otherwise stop the shell itself.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int jobs_init(bool interactive) {
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    error_msg("Failed to create epoll instance", true);
+    return -1;
+  }
+
+  if (!interactive || !isatty(STDIN_FILENO)) {
+    return 0;
+  }
+
+  /*
+   * If we were started in the background, wait until we are brought to the
+   * foreground before touching the terminal.
+   */
+  while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp())) {
+    kill(-shell_pgid, SIGTTIN);
+  }
+
+  /*
+   * The shell must not be stopped by Ctrl-Z or by writing to the terminal
+   * while a job owns it. These are reset to their defaults in every child.
+   */
+  signal(SIGQUIT, SIG_IGN);
+  signal(SIGTSTP, SIG_IGN);
+  signal(SIGTTIN, SIG_IGN);
+  signal(SIGTTOU, SIG_IGN);
+
+  /* Failing with EPERM means we already lead our own session, which is fine */
+  shell_pgid = getpid();
+  if (setpgid(shell_pgid, shell_pgid) == -1 && errno != EPERM) {
+    error_msg("Failed to create process group for the shell", true);
+    return -1;
+  }
+  shell_pgid = getpgrp();
+
+  /*
+   * Keep a close-on-exec copy of the terminal, stdin of a job may be
+   * redirected but the job still needs to be given the terminal.
+   */
+  shell_terminal = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+  if (shell_terminal == -1) {
+    error_msg(dup2_fail_msg, true);
+    return -1;
+  }
+
+  if (tcsetpgrp(shell_terminal, shell_pgid) == -1) {
+    error_msg("Failed to take control of the terminal", true);
+    return -1;
+  }
+
+  tcgetattr(shell_terminal, &shell_tmodes);
+
+  job_control = true;
+
+  return 0;
+}
+
+/**
+ * job_create - Add a new job to the table
+ * @command: Command line, for display
+ * @procs_capacity: Number of stages in the pipeline
+ * @background: Whether the job is launched in the background
+ *
+ * Background jobs always get their own process group so that Ctrl+C doesn't
+ * reach them. Foreground jobs only do when job control is enabled.
+ *
+ * Return: New job, NULL on error
+ */
+struct job *job_create(const char *command, unsigned int procs_capacity,
+                       bool background) {
+  unsigned int id = table.highest_id + 1;
+
+  if (id > table.slots_capacity) {
+    unsigned int new_capacity =
+        table.slots_capacity ? table.slots_capacity * 2 : 16;
+
+    struct job **new_slots =
+        realloc(table.slots, new_capacity * sizeof(*new_slots));
+    if (!new_slots) {
+      error_msg(malloc_fail_msg, true);
+      return NULL;
+    }
+
+    for (unsigned int i = table.slots_capacity; i < new_capacity; i++) {
+      new_slots[i] = NULL;
+    }
+
+    table.slots = new_slots;
+    table.slots_capacity = new_capacity;
+  }
+
+  struct job *job = calloc(1, sizeof(*job));
+  if (!job) {
+    error_msg(malloc_fail_msg, true);
+    return NULL;
+  }
+
+  job->procs = calloc(procs_capacity, sizeof(*job->procs));
+  job->command = strdup(command);
+  if (!job->procs || !job->command) {
+    error_msg(malloc_fail_msg, true);
+    free(job->procs);
+    free(job->command);
+    free(job);
+    return NULL;
+  }
+
+  /* The background operator is implied by the job's state when listed */
+  size_t len = strlen(job->command);
+  while (len > 0 && (job->command[len - 1] == ' ' ||
+                     job->command[len - 1] == '\t' ||
+                     job->command[len - 1] == '&')) {
+    job->command[--len] = '\0';
+  }
+
+  job->id = id;
+  job->io_fd = -1;
+  job->procs_capacity = procs_capacity;
+  job->background = background;
+  job->own_pgroup = background || job_control;
+
+  /*
+   * Launched by a stage the shell runs, so part of that stage's pipeline. The
+   * group is gone once its processes have been reaped, the job then gets one
+   * of its own.
+   */
+  if (!background && stage_job) {
+    job->launched_by_stage = true;
+
+    if (kill(-stage_pgid, 0) == 0) {
+      job->pgid = stage_pgid;
+    }
+  }
+
+  table.slots[id - 1] = job;
+  table.highest_id = id;
+  table.current = job;
+
+  return job;
+}
+
+/**
+ * init_proc - Start tracking a process launched for a job
+ * @job: Job the process belongs to
+ * @proc: Free entry of the job's procs or helpers
+ * @pid: Process ID, 0 for a stage that runs inside the shell
+ *
+ * Return: 0 on success, -1 on error
+ */
+int init_proc(struct job *job, struct job_proc *proc, pid_t pid) {
+  proc->pid = pid;
+  proc->pidfd = -1;
+  proc->status = 0;
+  proc->finished = false;
+  proc->stopped = false;
+  proc->job = job;
+  proc->full_samples = 0;
+  memset(&proc->usage, 0, sizeof(proc->usage));
+  clock_gettime(CLOCK_MONOTONIC, &proc->start_time);
+
+  /* Stages inside the shell are never reaped, so they aren't indexed */
+  if (pid > 0) {
+    if (pid_index_insert(proc) == -1) {
+      return -1;
+    }
+
+    watch_proc(proc);
+  }
+
+  if (job->own_pgroup && job->pgid == 0) {
+    job->pgid = pid;
+  }
+
+  job->running_count++;
+
+  return 0;
+}
+
+/**
+ * job_process_count - Count the processes of a job, helpers included
+ * @job: Job to count
+ *
+ * Return: Number of stages and helpers launched
+ */
+unsigned int job_process_count(const struct job *job) {
+  return job->procs_count + job->helpers_count;
+}
+
+/**
+ * job_proc_at - Get a process of a job by position, stages first
+ * @job: Job the process belongs to
+ * @index: Position, below job_process_count()
+ *
+ * Return: The process, helpers come after every stage
+ */
+struct job_proc *job_proc_at(struct job *job, unsigned int index) {
+  return index < job->procs_count ? &job->procs[index]
+                                  : &job->helpers[index - job->procs_count];
+}
+
+/**
+ * job_add_process - Record a stage that was launched for a job
+ * @job: Job the stage belongs to
+ * @pid: Process ID of the stage, 0 for a stage that runs inside the shell
+ *
+ * If the job has its own process group, the first launched stage's PID becomes
+ * the job's process group ID. A stage running inside the shell counts as
+ * running until it is completed with job_finish_process().
+ *
+ * Return: 0 on success, -1 on error
+ */
+int job_add_process(struct job *job, pid_t pid) {
+  if (job->procs_count == job->procs_capacity) {
+    return -1;
+  }
+
+  if (init_proc(job, &job->procs[job->procs_count], pid) == -1) {
+    return -1;
+  }
+
+  job->procs_count++;
+
+  return 0;
+}
+
+/**
+ * job_reserve_helpers - Make room for the helper processes of a job
+ * @job: Job, without any helpers yet
+ * @count: Number of helpers that may be added
+ *
+ * Helpers are stored apart from the stages, so they don't show up in the
+ * job's result, but are signalled, waited for and reaped with it: the job
+ * isn't done until its helpers are.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int job_reserve_helpers(struct job *job, unsigned int count) {
+  /* Never reallocated, the PID index points into the array */
+  job->helpers = calloc(count, sizeof(*job->helpers));
+  if (!job->helpers && count > 0) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  job->helpers_capacity = count;
+
+  return 0;
+}
+
+/**
+ * job_add_helper - Record a helper process launched for a job
+ * @job: Job the helper belongs to, with room reserved by
+ * job_reserve_helpers()
+ * @pid: Process ID of the helper
+ *
+ * Like a stage, a helper launched before any stage leads the job's process
+ * group.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int job_add_helper(struct job *job, pid_t pid) {
+  if (job->helpers_count == job->helpers_capacity) {
+    return -1;
+  }
+
+  if (init_proc(job, &job->helpers[job->helpers_count], pid) == -1) {
+    return -1;
+  }
+
+  job->helpers_count++;
+
+  return 0;
+}
+
+/**
+ * signal_proc - Send a signal to one process of a job
+ * @proc: Process to signal
+ * @signal_num: Signal to send
+ *
+ * Return: 0 on success or if the process already finished, -1 on error
+ */
+int signal_proc(const struct job_proc *proc, int signal_num) {
+  /* A PID of 0 is a stage inside the shell, kill() would signal our group */
+  if (proc->finished || proc->pid == 0) {
+    return 0;
+  }
+
+  if (proc->pidfd != -1) {
+    return pidfd_send_signal(proc->pidfd, signal_num, NULL, 0);
+  }
+
+  return kill(proc->pid, signal_num);
+}
+
+/**
+ * job_set_timeout - Give a job a time limit
+ * @job: Job to limit
+ * @timeout_ms: Time from now until the job is signalled
+ * @signal_num: Signal to send first
+ * @kill_after_ms: Grace period before SIGKILL follows, 0 to never send it
+ *
+ * Deadlines are enforced whenever the shell reaps children, and the shell
+ * wakes up for them while it waits for jobs. A background job that runs out of
+ * time while the shell sits at the prompt is signalled before the next one.
+ */
+void job_set_timeout(struct job *job, long timeout_ms, int signal_num,
+                     long kill_after_ms) {
+  if (!has_deadline(job)) {
+    table.deadlines_count++;
+  }
+
+  deadline_in(&job->deadline, timeout_ms);
+  job->deadline_signal = signal_num;
+  job->kill_after_ms = kill_after_ms;
+}
+
+/**
+ * enforce_deadline - jobs_for_each callback signalling jobs out of time
+ * @job: Job to check
+ * @arg: Pointer to the current CLOCK_MONOTONIC time
+ */
+void enforce_deadline(struct job *job, void *arg) {
+  const struct timespec *now = arg;
+
+  if (!has_deadline(job) || timespec_before(now, &job->deadline)) {
+    return;
+  }
+
+  clear_deadline(job);
+
+  if (job_is_done(job)) {
+    return;
+  }
+
+  /* Killing what is left after teardown isn't the job running out of time */
+  if (!job->tearing_down) {
+    job->timed_out = true;
+  }
+
+  signal_job(job, job->deadline_signal);
+
+  /* A stopped job would only act on the signal once continued */
+  if (job->running_count < job_process_count(job) - job->finished_count) {
+    signal_job(job, SIGCONT);
+  }
+
+  /* SIGKILL follows if the job is still around after the grace period */
+  if (job->kill_after_ms > 0) {
+    job_set_timeout(job, job->kill_after_ms, SIGKILL, 0);
+  }
+}
+
+/**
+ * start_teardown - Stop the stages left running after the last one exited
+ * @job: Job whose last stage just finished
+ *
+ * SIGPIPE is what the stages would get on their next write anyway, so a
+ * producer that handles it (to flush or clean up) gets to do so. It is sent
+ * through the job's deadline, TEARDOWN_DELAY_MS from now: in "false | true",
+ * true often exits first, and false should still get to exit with its own
+ * status.
+ */
+void start_teardown(struct job *job) {
+  job->tearing_down = true;
+
+  /* An earlier deadline from the timeout keyword is left in place */
+  struct timespec teardown_time;
+  deadline_in(&teardown_time, TEARDOWN_DELAY_MS);
+
+  if (!has_deadline(job) || timespec_before(&teardown_time, &job->deadline)) {
+    job_set_timeout(job, TEARDOWN_DELAY_MS, SIGPIPE,
+                    job->teardown_kill_after_ms);
+  }
+}
+
+/**
+ * next_deadline - Find the earliest pending job deadline
+ * @deadline: Output parameter - earliest deadline
+ *
+ * Return: true if any job has a deadline, false otherwise
+ */
+bool next_deadline(struct timespec *deadline) {
+  bool found = false;
+
+  for (unsigned int id = 1;
+       table.deadlines_count > 0 && id <= table.highest_id; id++) {
+    struct job *job = table.slots[id - 1];
+
+    if (job && has_deadline(job) &&
+        (!found || timespec_before(&job->deadline, deadline))) {
+      *deadline = job->deadline;
+      found = true;
+    }
+  }
+
+  return found;
+}
+
+/**
+ * job_remove - Remove a job from the table and free it
+ * @job: Job to remove
+ *
+ * Processes that are still running are not signalled, they simply stop being
+ * tracked (this is how disown works).
+ */
+void job_remove(struct job *job) {
+  for (unsigned int i = 0; i < job_process_count(job); i++) {
+    struct job_proc *proc = job_proc_at(job, i);
+
+    if (!proc->finished) {
+      pid_index_remove(proc->pid);
+      unwatch_proc(proc);
+    }
+  }
+
+  clear_deadline(job);
+
+  if (job->io_release) {
+    job->io_release(job);
+  }
+
+  table.slots[job->id - 1] = NULL;
+
+  /* Let job numbers be reused once the highest ones are gone */
+  while (table.highest_id > 0 && !table.slots[table.highest_id - 1]) {
+    table.highest_id--;
+  }
+
+  if (table.current == job) {
+    table.current = NULL;
+
+    for (unsigned int id = table.highest_id; id > 0; id--) {
+      if (table.slots[id - 1]) {
+        table.current = table.slots[id - 1];
+        break;
+      }
+    }
+  }
+
+  free(job->procs);
+  free(job->helpers);
+  free(job->command);
+  free(job);
+}
+
+/**
+ * job_is_done - Check whether every process of a job has finished
+ * @job: Job to check
+ *
+ * Return: true if done, false otherwise
+ */
+bool job_is_done(const struct job *job) {
+  return job->finished_count == job_process_count(job);
+}
+
+/**
+ * resume_stage_job - Undo a stop of the job whose stage the shell runs
+ *
+ * Only uses async-signal-safe calls, as the SIGCHLD handler calls it.
+ */
+void resume_stage_job(void) {
+  kill(-stage_pgid, SIGCONT);
+
+  if (!stage_stop_reported) {
+    stage_stop_reported = 1;
+    write(STDERR_FILENO, STAGE_STOP_MSG, sizeof(STAGE_STOP_MSG) - 1);
+  }
+}
+
+/**
+ * close_stage_others - Close the descriptors above stderr the stage doesn't use
+ *
+ * The shell's other pipe ends would keep the stage's neighbours from ever
+ * seeing EOF. The gaps between the kept descriptors are closed from the
+ * lowest one up.
+ */
+void close_stage_others(void) {
+  unsigned int low = STDERR_FILENO + 1;
+
+  for (;;) {
+    /* Lowest kept descriptor at or above low */
+    unsigned int next = ~0U;
+
+    for (int i = 0; i < stage_keep_fds_count; i++) {
+      const unsigned int fd = (unsigned int)stage_keep_fds[i];
+
+      if (stage_keep_fds[i] >= 0 && fd >= low && fd < next) {
+        next = fd;
+      }
+    }
+
+    if (next > low) {
+      close_range(low, next - 1, 0);
+    }
+
+    if (next == ~0U) {
+      return;
+    }
+
+    low = next + 1;
+  }
+}
+
+/**
+ * hand_over_stage - Fork a child that carries on with the stage the shell runs
+ *
+ * Called once the job stopped, with only async-signal-safe calls. The child
+ * returns to where the shell was in the stage, once the job is resumed. The
+ * shell jumps to stage_detach_point, or keeps the job running if there is no
+ * child.
+ */
+void hand_over_stage(void) {
+  static const int reset_signals[] = {SIGINT,  SIGQUIT, SIGTSTP,
+                                      SIGTTIN, SIGTTOU, SIGCHLD};
+  sigjmp_buf *point = stage_detach_point;
+  const pid_t pgid = stage_pgid;
+  const pid_t pid = _Fork();
+
+  if (pid == -1) {
+    resume_stage_job();
+    return;
+  }
+
+  if (pid == 0) {
+    struct sigaction default_action;
+
+    memset(&default_action, 0, sizeof(default_action));
+    default_action.sa_handler = SIG_DFL;
+
+    for (size_t i = 0; i < sizeof(reset_signals) / sizeof(*reset_signals);
+         i++) {
+      sigaction(reset_signals[i], &default_action, NULL);
+    }
+
+    stage_pgid = 0;
+    stage_detach_point = NULL;
+    stage_taken_over = -1;
+
+    close_stage_others();
+    setpgid(0, pgid);
+    raise(SIGSTOP);
+    return;
+  }
+
+  /* Done here, the job's stops are the job table's to report again */
+  setpgid(pid, pgid);
+  stage_pgid = 0;
+  stage_detach_point = NULL;
+  stage_taken_over = pid;
+
+  siglongjmp(*point, 1);
+}
+
+/**
+ * job_stage_check - Keep the job whose stage the shell runs from stopping
+ *
+ * Called by the SIGCHLD handler. The stop is only looked at (WNOWAIT), so the
+ * job table still reaps it, as a stop followed by a continue. A stage that is
+ * handed over instead waits for job_stage_detachable() if it is busy.
+ */
+void job_stage_check(void) {
+  const int saved_errno = errno;
+  siginfo_t info;
+
+  info.si_pid = 0;
+
+  if (stage_pgid > 0 &&
+      waitid(P_PGID, stage_pgid, &info, WSTOPPED | WNOHANG | WNOWAIT) == 0 &&
+      info.si_pid != 0) {
+    if (stage_detach_point) {
+      hand_over_stage();
+    } else if (!stage_hands_over) {
+      resume_stage_job();
+    }
+  }
+
+  errno = saved_errno;
+}
+
+/**
+ * job_stage_detachable - Let a stop of the job hand the stage to a child
+ * @point: Where the shell goes on once a child took the stage over, NULL while
+ * the stage runs code that isn't async-signal-safe
+ * @fds: Descriptors the stage uses, the child closes every other one
+ * @count: Number of entries in fds, at most STAGE_KEEP_FDS_MAX
+ *
+ * Only for a stage job_stage_begin() was told can be handed over. A stop that
+ * came while the stage was busy is acted on right away.
+ */
+void job_stage_detachable(sigjmp_buf *point, const int *fds,
+                          unsigned int count) {
+  stage_detach_point = NULL;
+
+  if (!point || !stage_hands_over) {
+    return;
+  }
+
+  if (count > STAGE_KEEP_FDS_MAX) {
+    count = STAGE_KEEP_FDS_MAX;
+  }
+
+  for (unsigned int i = 0; i < count; i++) {
+    stage_keep_fds[i] = fds[i];
+  }
+  stage_keep_fds_count = (sig_atomic_t)count;
+
+  stage_detach_point = point;
+  job_stage_check();
+}
+
+/**
+ * job_stage_taken_over - Get the child that took over the stage the shell ran
+ *
+ * Return: PID of the child in the shell, -1 in the child itself, 0 if the
+ * stage wasn't handed over
+ */
+pid_t job_stage_taken_over(void) { return stage_taken_over; }
+
+/**
+ * job_adopt_process - Track the child that took over a stage of the shell
+ * @job: Job the stage belongs to
+ * @index: Position of the stage in the job's procs
+ * @pid: Child, from job_stage_taken_over()
+ *
+ * Return: 0 on success, -1 on error
+ */
+int job_adopt_process(struct job *job, unsigned int index, pid_t pid) {
+  struct job_proc *proc = &job->procs[index];
+
+  proc->pid = pid;
+
+  if (pid_index_insert(proc) == -1) {
+    proc->pid = 0;
+    return -1;
+  }
+
+  watch_proc(proc);
+
+  return 0;
+}
+
+/**
+ * job_stage_begin - Note that the shell is about to run stages of a job
+ * @job: Job whose stage runs in the shell or on its threads
+ * @hands_over: Whether the stage the shell runs can be handed to a child, see
+ * job_stage_detachable()
+ *
+ * Under job control, the shell can't be stopped along with the job by Ctrl-Z,
+ * and wouldn't wait for the job while busy with its stage. Until
+ * job_stage_end(), a stop of the job is undone with SIGCONT and reported,
+ * unless the stage is handed over. Jobs launched in the meantime join the
+ * job's process group and leave it the terminal, so Ctrl+C and Ctrl-Z reach
+ * them along with the pipeline.
+ *
+ * Return: Job the shell ran a stage of before, for job_stage_end()
+ */
+struct job *job_stage_begin(struct job *job, bool hands_over) {
+  struct job *previous = stage_job;
+
+  stage_taken_over = 0;
+
+  if (!job_control || job->background || job->pgid <= 0) {
+    return previous;
+  }
+
+  stage_job = job;
+  stage_stop_reported = 0;
+  stage_hands_over = hands_over;
+  stage_detach_point = NULL;
+  stage_pgid = job->pgid;
+
+  /* Ctrl-Z may have come before there was anything to undo it */
+  job_stage_check();
+
+  return previous;
+}
+
+/**
+ * job_stage_end - Note that the shell is done running stages of a job
+ * @previous: Return value of the matching job_stage_begin()
+ */
+void job_stage_end(struct job *previous) {
+  stage_pgid = previous ? previous->pgid : 0;
+  stage_hands_over = false;
+  stage_detach_point = NULL;
+  stage_job = previous;
+}
+
+/**
+ * update_proc - Apply a status change reported by wait4()
+ * @proc: Process that changed status
+ * @status: Status from wait4()
+ * @usage: Resource usage from wait4(), only meaningful once finished
+ */
+void update_proc(struct job_proc *proc, int status,
+                 const struct rusage *usage) {
+  struct job *job = proc->job;
+
+  if (proc->finished) {
+    return;
+  }
+
+  proc->status = status;
+
+  if (WIFSTOPPED(status)) {
+    /* Reaped before the SIGCHLD handler could undo it */
+    if (stage_pgid > 0 && job->pgid == stage_pgid && !stage_hands_over) {
+      resume_stage_job();
+      return;
+    }
+
+    if (stage_pgid > 0 && job->launched_by_stage) {
+      signal_job(job, SIGCONT);
+      return;
+    }
+
+    if (!proc->stopped) {
+      proc->stopped = true;
+      job->running_count--;
+    }
+    return;
+  }
+
+  if (WIFCONTINUED(status)) {
+    if (proc->stopped) {
+      proc->stopped = false;
+      job->running_count++;
+    }
+    return;
+  }
+
+  /* Exited or killed by a signal */
+  if (!proc->stopped) {
+    job->running_count--;
+  }
+
+  proc->stopped = false;
+  proc->finished = true;
+  proc->usage = *usage;
+  clock_gettime(CLOCK_MONOTONIC, &proc->end_time);
+  job->finished_count++;
+
+  /* The PID may be reused from now on, so it must leave the index */
+  pid_index_remove(proc->pid);
+  unwatch_proc(proc);
+
+  if (job->teardown && !job->tearing_down &&
+      proc == &job->procs[job->procs_count - 1] && !job_is_done(job)) {
+    start_teardown(job);
+  }
+}
+
+/**
+ * job_finish_process - Record the outcome of a stage that ran inside the shell
+ * @job: Job the stage belongs to
+ * @index: Position of the stage in the job's procs
+ * @exit_code: Exit status of the stage
+ * @usage: Resources the shell used running the stage
+ */
+void job_finish_process(struct job *job, unsigned int index, int exit_code,
+                        const struct rusage *usage) {
+  /* Encoded the way wait4() would report a normal exit */
+  update_proc(&job->procs[index], (exit_code & 0xff) << 8, usage);
+}
+
+/**
+ * jobs_reap - Collect status changes of child processes without blocking
+ *
+ * Only does any work if SIGCHLD was received since the last call, or if a
+ * job's deadline has passed.
+ */
+void jobs_reap(void) {
+  if (table.deadlines_count > 0) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    jobs_for_each(enforce_deadline, &now);
+  }
+
+  if (!child_status_changed) {
+    return;
+  }
+
+  /*
+   * Clear the flag before reaping, a child that changes status while we loop
+   * sets it again and is picked up by the next call.
+   */
+  child_status_changed = 0;
+
+  pid_t pid;
+  int status;
+  struct rusage usage;
+
+  /*
+   * wait4() is waitpid() that also returns the child's resource usage, which
+   * would otherwise be folded into RUSAGE_CHILDREN and lost per stage.
+   */
+  while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED,
+                      &usage)) > 0) {
+    struct job_proc *proc = pid_index_find(pid);
+
+    /* Disowned jobs are still our children, they are reaped but not tracked */
+    if (proc) {
+      update_proc(proc, status, &usage);
+    }
+  }
+}
+
+/**
+ * job_state - Describe the state of a job for display
+ * @job: Job to describe
+ * @buffer: Output buffer
+ * @size: Size of buffer
+ */
+void job_state(const struct job *job, char *buffer, size_t size) {
+  if (job->running_count > 0) {
+    snprintf(buffer, size, "Running");
+    return;
+  }
+
+  if (!job_is_done(job)) {
+    snprintf(buffer, size, "Stopped");
+    return;
+  }
+
+  /* Like other shells, report the status of the last stage */
+  int status = job->procs[job->procs_count - 1].status;
+
+  if (WIFSIGNALED(status)) {
+    snprintf(buffer, size, "%s", strsignal(WTERMSIG(status)));
+  } else if (WEXITSTATUS(status) != 0) {
+    snprintf(buffer, size, "Exit %d", WEXITSTATUS(status));
+  } else {
+    snprintf(buffer, size, "Done");
+  }
+}
+
+/**
+ * job_print - Print a job in the format used by the jobs builtin
+ * @job: Job to print
+ * @show_pids: Whether to list the PID of every stage
+ */
+void job_print(const struct job *job, bool show_pids) {
+  char state[64];
+
+  job_state(job, state, sizeof(state));
+
+  printf("[%u]%c  ", job->id, job == table.current ? '+' : ' ');
+
+  if (show_pids) {
+    for (unsigned int i = 0; i < job->procs_count; i++) {
+      printf("%d ", job->procs[i].pid);
+    }
+  }
+
+  printf("%-24s%s%s\n", state, job->command,
+         job->running_count > 0 && job->background ? " &" : "");
+}
+
+/**
+ * jobs_for_each - Call a function for every job in job number order
+ * @fn: Function to call
+ * @arg: Passed through to fn
+ */
+void jobs_for_each(void (*fn)(struct job *, void *), void *arg) {
+  /* fn is allowed to remove the job it is given */
+  for (unsigned int id = 1; id <= table.highest_id; id++) {
+    if (table.slots[id - 1]) {
+      fn(table.slots[id - 1], arg);
+    }
+  }
+}
+
+/**
+ * notify_job - Report a background job that finished or stopped
+ * @job: Job to check
+ * @arg: Unused
+ */
+void notify_job(struct job *job, void *arg) {
+  (void)arg;
+
+  if (!job->background || job->running_count > 0) {
+    return;
+  }
+
+  if (job_is_done(job)) {
+    job_print(job, false);
+    job_remove(job);
+    return;
+  }
+
+  if (!job->notified) {
+    job_print(job, false);
+    job->notified = true;
+  }
+}
+
+/**
+ * jobs_notify - Report and remove background jobs that have finished
+ *
+ * Called before each prompt, so finished jobs are reported at a point where the
+ * output doesn't garble what the user is typing.
+ */
+void jobs_notify(void) {
+  jobs_reap();
+  jobs_for_each(notify_job, NULL);
+}
+
+/**
+ * signal_job - Send a signal to every process of a job
+ * @job: Job to signal
+ * @signal_num: Signal to send
+ *
+ * Return: 0 on success, -1 on error
+ */
+int signal_job(struct job *job, int signal_num) {
+  /* A job launched by a stage in the shell may share the stage's group */
+  if (job->own_pgroup && job->pgid > 0 &&
+      (job == stage_job || job->pgid != stage_pgid)) {
+    return kill(-job->pgid, signal_num);
+  }
+
+  for (unsigned int i = 0; i < job_process_count(job); i++) {
+    if (signal_proc(job_proc_at(job, i), signal_num) == -1) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * exit_code_of - Convert a wait status to a shell exit status
+ * @status: Status from waitpid() or wait4()
+ *
+ * Return: Exit status, or 128 + signal number for killed or stopped processes
+ */
+int exit_code_of(int status) {
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+
+  if (WIFSIGNALED(status)) {
+    return 128 + WTERMSIG(status);
+  }
+
+  if (WIFSTOPPED(status)) {
+    return 128 + WSTOPSIG(status);
+  }
+
+  return 0;
+}
+
+/**
+ * save_result - Record the outcome of a foreground job for job_take_result()
+ * @job: Job that finished or stopped
+ */
+void save_result(const struct job *job) {
+  struct stage_result *stages =
+      realloc(last_result.stages, job->procs_count * sizeof(*stages));
+  if (!stages && job->procs_count > 0) {
+    error_msg(malloc_fail_msg, true);
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (unsigned int i = 0; i < job->procs_count; i++) {
+    const struct job_proc *proc = &job->procs[i];
+    const struct timespec *end = proc->finished ? &proc->end_time : &now;
+
+    stages[i].exit_code = exit_code_of(proc->status);
+    stages[i].stopped = !proc->finished;
+    stages[i].in_shell = proc->pid == 0;
+    stages[i].usage = proc->usage;
+    stages[i].elapsed.tv_sec = end->tv_sec - proc->start_time.tv_sec;
+    stages[i].elapsed.tv_nsec = end->tv_nsec - proc->start_time.tv_nsec;
+
+    if (stages[i].elapsed.tv_nsec < 0) {
+      stages[i].elapsed.tv_sec--;
+      stages[i].elapsed.tv_nsec += 1000000000L;
+    }
+  }
+
+  last_result.stages = stages;
+  last_result.stages_count = job->procs_count;
+  last_result.timed_out = job->timed_out;
+  last_result_taken = false;
+}
+
+/**
+ * job_take_result - Get the result saved by the last job_wait()
+ *
+ * Each result is only handed out once, so callers can tell whether a command
+ * (e.g. fg) waited for a job at all.
+ *
+ * Return: Result, valid until the next job_wait(), NULL if there is none
+ */
+const struct job_result *job_take_result(void) {
+  if (last_result_taken) {
+    return NULL;
+  }
+
+  last_result_taken = true;
+
+  return &last_result;
+}
+
+/**
+ * job_peek_result - Look at the result saved by the last job_wait()
+ *
+ * Unlike job_take_result(), the result is left for the next caller, so a
+ * builtin can act on the status of a job it waited for and still leave it
+ * for $?.
+ *
+ * Return: Result, valid until the next job_wait(), NULL if there is none
+ */
+const struct job_result *job_peek_result(void) {
+  return last_result_taken ? NULL : &last_result;
+}
+
+/**
+ * wait_timeout - Work out how long a wait may sleep
+ * @limit: The caller's own deadline, NULL for none
+ * @timeout: Output parameter - time left until the earliest deadline
+ *
+ * The earliest deadline is either limit or that of any job, so jobs run out of
+ * time even while the shell is waiting for something else.
+ *
+ * Return: true if there is a deadline, false to sleep indefinitely
+ */
+bool wait_timeout(const struct timespec *limit, struct timespec *timeout) {
+  struct timespec deadline;
+  bool found = next_deadline(&deadline);
+
+  if (limit && (!found || timespec_before(limit, &deadline))) {
+    deadline = *limit;
+    found = true;
+  }
+
+  if (!found) {
+    return false;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  timeout->tv_sec = 0;
+  timeout->tv_nsec = 0;
+
+  if (timespec_before(&now, &deadline)) {
+    timeout->tv_sec = deadline.tv_sec - now.tv_sec;
+    timeout->tv_nsec = deadline.tv_nsec - now.tv_nsec;
+
+    if (timeout->tv_nsec < 0) {
+      timeout->tv_sec--;
+      timeout->tv_nsec += 1000000000L;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * wait_event - Sleep until a child exits, a signal arrives or a timeout passes
+ * @timeout: Longest time to sleep, NULL for no limit
+ * @wait_mask: Signal mask to sleep with, must leave SIGCHLD unblocked
+ *
+ * epoll only reports the pidfds of children that exited and those are reaped
+ * straight away, so a wakeup costs the same no matter how many children are
+ * still running. Stops and continues don't make a pidfd readable, the SIGCHLD
+ * they raise interrupts the sleep instead.
+ *
+ * The io_fd of the job waited for in the foreground is registered too, with
+ * a NULL pointer, and handed to the job's io_ready when it is ready.
+ *
+ * Return: 1 if children were reaped or I/O was handled, 0 if the timeout
+ * passed, -1 otherwise
+ */
+int wait_event(const struct timespec *timeout, const sigset_t *wait_mask) {
+  struct epoll_event events[WAIT_EVENTS_MAX];
+  int timeout_ms = -1;
+
+  if (timeout) {
+    /* Round up, waking up early would just mean going back to sleep */
+    long ms = timeout->tv_sec > INT_MAX / 1000
+                  ? INT_MAX
+                  : timeout->tv_sec * 1000 +
+                        (timeout->tv_nsec + 999999) / 1000000;
+    timeout_ms = ms > INT_MAX ? INT_MAX : (int)ms;
+  }
+
+  int ready =
+      epoll_pwait(epoll_fd, events, WAIT_EVENTS_MAX, timeout_ms, wait_mask);
+  if (ready <= 0) {
+    return ready;
+  }
+
+  int result = -1;
+
+  for (int i = 0; i < ready; i++) {
+    struct job_proc *proc = events[i].data.ptr;
+    int status;
+    struct rusage usage;
+
+    if (!proc) {
+      io_job->io_ready(io_job);
+      result = 1;
+      continue;
+    }
+
+    /* Already reaped through SIGCHLD earlier in this batch */
+    if (proc->pidfd == -1) {
+      continue;
+    }
+
+    if (wait4(proc->pid, &status, WNOHANG, &usage) == proc->pid) {
+      update_proc(proc, status, &usage);
+      result = 1;
+    }
+  }
+
+  return result;
+}
+
+/**
+ * job_wait - Wait for a job in the foreground
+ * @job: Job to wait for
+ *
+ * Hands the terminal to the job when job control is enabled, and takes it back
+ * once every process has finished or the job was stopped (Ctrl-Z). Finished
+ * jobs are removed from the table, stopped ones are kept and reported.
+ *
+ * The exit status and resource usage of every stage are saved for
+ * job_take_result().
+ *
+ * Return: 0 on success, -1 on error
+ */
+int job_wait(struct job *job) {
+  job->background = false;
+
+  /* A job that only ran inside the shell has no process group */
+  if (job_control && job->own_pgroup && job->pgid > 0) {
+    tcsetpgrp(shell_terminal, job->pgid);
+  }
+
+  /*
+   * SIGCHLD is blocked while we check the job, and epoll_pwait() atomically
+   * unblocks it while sleeping, so a child stopping between the check and the
+   * sleep can't be missed.
+   */
+  sigset_t block_mask;
+  sigset_t old_mask;
+
+  sigemptyset(&block_mask);
+  sigaddset(&block_mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &block_mask, &old_mask);
+
+  sigset_t wait_mask = old_mask;
+  sigdelset(&wait_mask, SIGCHLD);
+
+  /* The job's I/O is only handled while the shell waits for it */
+  struct epoll_event io_event = {.events = EPOLLIN, .data.ptr = NULL};
+
+  if (job->io_fd != -1 &&
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, job->io_fd, &io_event) == 0) {
+    io_job = job;
+  }
+
+  for (;;) {
+    jobs_reap();
+
+    if (job->running_count == 0) {
+      break;
+    }
+
+    /* With a monitor, also wake up on our own to run it */
+    struct timespec monitor_time;
+    struct timespec timeout;
+
+    if (job->monitor) {
+      deadline_in(&monitor_time, JOB_MONITOR_INTERVAL_MS);
+    }
+
+    bool limited = wait_timeout(job->monitor ? &monitor_time : NULL, &timeout);
+
+    if (wait_event(limited ? &timeout : NULL, &wait_mask) == 0 &&
+        job->monitor) {
+      job->monitor(job);
+    }
+  }
+
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+  if (io_job) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, job->io_fd, NULL);
+    io_job = NULL;
+  }
+
+  if (job_control) {
+    /* A stopped job keeps its terminal modes until it is continued */
+    if (!job_is_done(job)) {
+      job->has_tmodes = tcgetattr(shell_terminal, &job->tmodes) == 0;
+    }
+
+    /* A job launched by a stage the shell runs gives it back to the stage's */
+    if (stage_pgid <= 0 || tcsetpgrp(shell_terminal, stage_pgid) == -1) {
+      tcsetpgrp(shell_terminal, shell_pgid);
+      tcsetattr(shell_terminal, TCSADRAIN, &shell_tmodes);
+    }
+  }
+
+  save_result(job);
+
+  if (job_is_done(job)) {
+    job_remove(job);
+    return 0;
+  }
+
+  /* Stopped (Ctrl-Z), the job keeps running in the background once resumed */
+  job->background = true;
+  job->notified = true;
+  table.current = job;
+
+  printf("\n");
+  job_print(job, false);
+
+  return 0;
+}
+
+/**
+ * job_continue - Resume a job with SIGCONT
+ * @job: Job to resume
+ * @foreground: Whether to wait for it in the foreground (fg) or not (bg)
+ *
+ * Return: 0 on success, -1 on error
+ */
+int job_continue(struct job *job, bool foreground) {
+  for (unsigned int i = 0; i < job_process_count(job); i++) {
+    struct job_proc *proc = job_proc_at(job, i);
+
+    if (proc->stopped) {
+      proc->stopped = false;
+      job->running_count++;
+    }
+  }
+
+  job->notified = false;
+  table.current = job;
+
+  if (foreground && job_control && job->own_pgroup) {
+    tcsetpgrp(shell_terminal, job->pgid);
+
+    if (job->has_tmodes) {
+      tcsetattr(shell_terminal, TCSADRAIN, &job->tmodes);
+    }
+  }
+
+  if (signal_job(job, SIGCONT) == -1) {
+    error_msg("Failed to continue job", true);
+    return -1;
+  }
+
+  if (foreground) {
+    return job_wait(job);
+  }
+
+  job->background = true;
+
+  return 0;
+}
+
+/**
+ * job_current - Get the job that fg and bg act on without arguments
+ *
+ * Return: Most recently launched or stopped job, NULL if there are no jobs
+ */
+struct job *job_current(void) { return table.current; }
+
+/**
+ * job_find - Look up a job from a job spec
+ * @spec: "%n" for job n, "%%" or "%+" for the current job, or a PID
+ *
+ * Return: Matching job, NULL if there is none
+ */
+struct job *job_find(const char *spec) {
+  char *end;
+
+  if (spec[0] != '%') {
+    long pid = strtol(spec, &end, 10);
+    if (*end != '\0' || pid <= 0) {
+      return NULL;
+    }
+
+    struct job_proc *proc = pid_index_find((pid_t)pid);
+    return proc ? proc->job : NULL;
+  }
+
+  if (strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 ||
+      strcmp(spec, "%") == 0) {
+    return table.current;
+  }
+
+  long id = strtol(spec + 1, &end, 10);
+  if (*end == '\0' && id > 0 && (unsigned long)id <= table.highest_id) {
+    return table.slots[id - 1];
+  }
+
+  /* %name refers to the most recent job whose command starts with name */
+  for (unsigned int i = table.highest_id; i > 0; i--) {
+    struct job *job = table.slots[i - 1];
+
+    if (job && strncmp(job->command, spec + 1, strlen(spec + 1)) == 0) {
+      return job;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * jobs_wait_any - Block until a child process changes status
+ * @deadline: When to give up (CLOCK_MONOTONIC), NULL to wait indefinitely
+ *
+ * Return: 0 when a status change was collected or a job deadline was
+ * enforced, 1 if the deadline passed, -1 if interrupted by SIGINT
+ */
+int jobs_wait_any(const struct timespec *deadline) {
+  sigset_t block_mask;
+  sigset_t old_mask;
+
+  sigemptyset(&block_mask);
+  sigaddset(&block_mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &block_mask, &old_mask);
+
+  sigset_t wait_mask = old_mask;
+  sigdelset(&wait_mask, SIGCHLD);
+
+  while (!child_status_changed && !sigint_received) {
+    struct timespec timeout;
+    bool limited = wait_timeout(deadline, &timeout);
+
+    /* Children were reaped or a deadline (ours or a job's) has passed */
+    if (wait_event(limited ? &timeout : NULL, &wait_mask) != -1) {
+      break;
+    }
+  }
+
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+  jobs_reap();
+
+  if (sigint_received) {
+    return -1;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return deadline && !timespec_before(&now, deadline) ? 1 : 0;
+}
+
+/**
+ * hangup_job - Make sure a stopped job doesn't outlive the shell stopped
+ * @job: Job to release
+ * @arg: Unused
+ */
+void hangup_job(struct job *job, void *arg) {
+  (void)arg;
+
+  if (job->running_count < job_process_count(job) - job->finished_count) {
+    signal_job(job, SIGHUP);
+    signal_job(job, SIGCONT);
+  }
+
+  job_remove(job);
+}
+
+/**
+ * detach_job - Drop a job from a forked child's table, see jobs_detach()
+ * @job: Job to drop
+ * @arg: Unused
+ */
+void detach_job(struct job *job, void *arg) {
+  (void)arg;
+
+  /* Already closed, and the numbers may be reused by now */
+  for (unsigned int i = 0; i < job_process_count(job); i++) {
+    job_proc_at(job, i)->pidfd = -1;
+  }
+
+  /* Relays and their reports belong to the shell */
+  job->io_release = NULL;
+
+  job_remove(job);
+}
+
+/**
+ * jobs_detach - Give a forked child of the shell a job table of its own
+ *
+ * For a forked child whose descriptors above stderr were closed. The jobs
+ * belong to the shell, and the epoll instance was shared with the shell: a
+ * pidfd the child added to it would wake up the shell. The child starts over
+ * with an empty table, a new epoll instance and no job control, as a subshell
+ * would.
+ */
+void jobs_detach(void) {
+  io_job = NULL;
+  stage_job = NULL;
+  stage_pgid = 0;
+  shell_terminal = -1;
+  job_control = false;
+
+  jobs_for_each(detach_job, NULL);
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+}
+
+/**
+ * snapshot_job - Keep a job in a forked child's table, see jobs_snapshot()
+ * @job: Job to keep
+ * @arg: Job the child belongs to, which is dropped instead
+ */
+void snapshot_job(struct job *job, void *arg) {
+  if (job == arg) {
+    detach_job(job, NULL);
+    return;
+  }
+
+  for (unsigned int i = 0; i < job_process_count(job); i++) {
+    job_proc_at(job, i)->pidfd = -1;
+  }
+
+  job->io_release = NULL;
+  clear_deadline(job);
+}
+
+/**
+ * jobs_snapshot - Give a forked child of the shell a copy of the job table
+ * @own_job: Job the child belongs to, which is left out
+ *
+ * Like jobs_detach(), except that the shell's other jobs stay in the table,
+ * for builtins that use it without changing it. The child doesn't reap the
+ * jobs or enforce their deadlines, that is still up to the shell.
+ */
+void jobs_snapshot(struct job *own_job) {
+  io_job = NULL;
+  stage_job = NULL;
+  stage_pgid = 0;
+  shell_terminal = -1;
+  job_control = false;
+  child_status_changed = 0;
+
+  jobs_for_each(snapshot_job, own_job);
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+}
+
+/**
+ * jobs_close - Release every job at shell exit
+ *
+ * Stopped jobs would otherwise stay stopped forever, so they are sent SIGHUP
+ * followed by SIGCONT before the table is freed.
+ */
+void jobs_close(void) {
+  jobs_reap();
+  jobs_for_each(hangup_job, NULL);
+
+  free(table.slots);
+  free(table.pids);
+  memset(&table, 0, sizeof(table));
+
+  free(last_result.stages);
+  last_result.stages = NULL;
+  last_result.stages_count = 0;
+  last_result_taken = true;
+
+  if (shell_terminal != -1) {
+    close(shell_terminal);
+    shell_terminal = -1;
+  }
+
+  if (epoll_fd != -1) {
+    close(epoll_fd);
+    epoll_fd = -1;
+  }
+}
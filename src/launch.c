@@ -0,0 +1,363 @@
+/**
+ * launch.c
+ *
+ * Process launching for pipeline stages.
+ *
+ * OVERVIEW:
+ * A plain fork() copies the page tables of the whole shell, and that cost grows
+ * with readline history, config and everything else the shell keeps in memory.
+ * posix_spawn() avoids that: glibc runs the child on the parent's memory with
+ * clone(CLONE_VM | CLONE_VFORK) and the parent is suspended only until the
+ * child calls exec.
+ *
+ * Since no shell code runs in the child, everything the old fork-based child
+ * did by hand is described up front:
+ * - File actions: dup2 pipe ends and redirection targets onto stdin/stdout
+ *   (and stderr for builtins that capture it). Every descriptor the shell
+ *   opens is close-on-exec, so nothing else has to be closed and the setup of
+ *   a stage costs the same in any pipeline length. The pipes of process
+ *   substitutions are dup2'd onto themselves, which keeps them past exec
+ * - Attributes: process group of the job, default signal dispositions and an
+ *   empty signal mask
+ *
+ * CPU affinity, nice level, I/O priority and resource limits (the sched
+ * keyword) have no spawn attribute. For stages with any of those, the shell
+ * does what glibc does inside posix_spawn() itself: vfork(), which shares
+ * memory just the same, and a few system calls in the child before exec.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "launch.h"
+#include "signals.h"
+#include "stage_attrs.h"
+#include "zygote.h"
+
+extern char **environ;
+
+/**
+ * launch_init - Make inherited descriptors close-on-exec
+ *
+ * Descriptors the shell opens itself are close-on-exec, but whatever started
+ * the shell may have left others open. Marking everything above stderr once at
+ * startup keeps them out of every stage without per-stage close actions.
+ */
+void launch_init(void) {
+  /* Not supported before Linux 5.11, stages then inherit those descriptors */
+  if (close_range(STDERR_FILENO + 1, ~0U, CLOSE_RANGE_CLOEXEC) == -1 &&
+      errno != ENOSYS && errno != EINVAL) {
+    error_msg("Failed to mark inherited descriptors close-on-exec", true);
+  }
+}
+
+/**
+ * build_file_actions - Describe descriptor setup for a stage
+ * @actions: File actions object to fill (already initialized)
+ * @stage: Stage being launched
+ *
+ * The actions are applied in the child in the order they are added. A dup2 onto
+ * the same descriptor still clears close-on-exec, so it is never skipped, and
+ * is how the descriptors in keep_fds survive the exec.
+ *
+ * Return: 0 on success, error number on failure
+ */
+int build_file_actions(posix_spawn_file_actions_t *actions,
+                       const struct stage_spawn *stage) {
+  int err;
+
+#if defined(__GLIBC__) &&                                                      \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+  /*
+   * Giving the child the terminal from inside the child as well as from the
+   * shell closes the window where it could read from the terminal before the
+   * shell got around to calling tcsetpgrp().
+   */
+  if (stage->tty_fd != -1) {
+    err = posix_spawn_file_actions_addtcsetpgrp_np(actions, stage->tty_fd);
+    if (err) {
+      return err;
+    }
+  }
+#endif
+
+  if (stage->in_fd != -1) {
+    err = posix_spawn_file_actions_adddup2(actions, stage->in_fd, STDIN_FILENO);
+    if (err) {
+      return err;
+    }
+  }
+
+  if (stage->out_fd != -1) {
+    err = posix_spawn_file_actions_adddup2(actions, stage->out_fd,
+                                           STDOUT_FILENO);
+    if (err) {
+      return err;
+    }
+  }
+
+  if (stage->err_fd != -1) {
+    err = posix_spawn_file_actions_adddup2(actions, stage->err_fd,
+                                           STDERR_FILENO);
+    if (err) {
+      return err;
+    }
+  }
+
+  for (unsigned int i = 0; i < stage->keep_fds_count; i++) {
+    err = posix_spawn_file_actions_adddup2(actions, stage->keep_fds[i],
+                                           stage->keep_fds[i]);
+    if (err) {
+      return err;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * build_attributes - Describe process attributes for a stage
+ * @attr: Attributes object to fill (already initialized)
+ * @stage: Stage being launched
+ *
+ * The job control signals are ignored by an interactive shell, and so is
+ * SIGPIPE. Ignored dispositions survive exec, so they have to be reset
+ * explicitly. Caught signals (SIGINT, SIGCHLD) are reset by exec anyway.
+ *
+ * Return: 0 on success, error number on failure
+ */
+int build_attributes(posix_spawnattr_t *attr, const struct stage_spawn *stage) {
+  short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+  sigset_t default_signals;
+  sigset_t empty_mask;
+  int err;
+
+  sigemptyset(&default_signals);
+  sigaddset(&default_signals, SIGPIPE);
+  sigaddset(&default_signals, SIGQUIT);
+  sigaddset(&default_signals, SIGTSTP);
+  sigaddset(&default_signals, SIGTTIN);
+  sigaddset(&default_signals, SIGTTOU);
+  sigemptyset(&empty_mask);
+
+  err = posix_spawnattr_setsigdefault(attr, &default_signals);
+  if (err) {
+    return err;
+  }
+
+  err = posix_spawnattr_setsigmask(attr, &empty_mask);
+  if (err) {
+    return err;
+  }
+
+  /*
+   * A separate process group keeps SIGINT from the terminal (Ctrl+C) away from
+   * background jobs, and lets job control stop and resume a job as a whole.
+   * This is the spawn equivalent of setpgid(0, pgid).
+   */
+  if (stage->pgid != -1) {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    err = posix_spawnattr_setpgroup(attr, stage->pgid);
+    if (err) {
+      return err;
+    }
+  }
+
+  return posix_spawnattr_setflags(attr, flags);
+}
+
+/**
+ * keep_stage_fds - Let the descriptors in keep_fds survive exec
+ * @stage: Stage being launched
+ *
+ * For children that set themselves up, the equivalent of the dup2 file actions
+ * build_file_actions() adds for them.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int keep_stage_fds(const struct stage_spawn *stage) {
+  for (unsigned int i = 0; i < stage->keep_fds_count; i++) {
+    if (fcntl(stage->keep_fds[i], F_SETFD, 0) == -1) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * spawn_with_attrs - Launch a stage that has scheduling or resource attributes
+ * @stage: Description of the stage to launch, attrs is set
+ *
+ * The child shares the shell's memory and stack until it execs, so it only
+ * makes system calls and reports failure through variables of this frame,
+ * which the shell reads once vfork() returns. Signals are blocked around
+ * vfork(), as a handler of the shell running in the child would corrupt the
+ * shell's state. The child resets them to the defaults before unblocking.
+ *
+ * Return: PID of the child on success, -1 on error
+ */
+pid_t spawn_with_attrs(const struct stage_spawn *stage) {
+  volatile const char *failed_step = NULL;
+  volatile const char *failed_attr = NULL;
+  volatile int failed_errno = 0;
+  sigset_t all_signals;
+  sigset_t old_mask;
+
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+  pid_t pid = vfork();
+
+  if (pid == 0) {
+    struct saved_signals saved;
+
+    if (stage->pgid != -1 && setpgid(0, stage->pgid) == -1) {
+      failed_step = "join the process group";
+    } else if (stage->tty_fd != -1 &&
+               tcsetpgrp(stage->tty_fd, getpgrp()) == -1) {
+      /* Done while SIGTTOU is still blocked, the child isn't in front yet */
+      failed_step = "take the terminal";
+    } else if ((stage->in_fd != -1 &&
+                dup2(stage->in_fd, STDIN_FILENO) == -1) ||
+               (stage->out_fd != -1 &&
+                dup2(stage->out_fd, STDOUT_FILENO) == -1) ||
+               (stage->err_fd != -1 &&
+                dup2(stage->err_fd, STDERR_FILENO) == -1)) {
+      failed_step = "redirect";
+    } else if (keep_stage_fds(stage) == -1) {
+      failed_step = "keep descriptors";
+    } else {
+      failed_attr = apply_stage_attrs(stage->attrs);
+    }
+
+    if (!failed_step && !failed_attr) {
+      /* Also unblocks every signal, as posix_spawn() does */
+      restore_default_signals(&saved);
+
+      if (stage->path) {
+        execve(stage->path, stage->argv, environ);
+      } else {
+        execvpe(stage->argv[0], stage->argv, environ);
+      }
+
+      failed_step = "execute";
+    }
+
+    failed_errno = errno;
+    _exit(127);
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+  if (pid == -1) {
+    error_msg("Failed to fork", true);
+    return -1;
+  }
+
+  if (failed_step || failed_attr) {
+    /* Never tracked by the job table, so nothing else reaps it */
+    waitpid(pid, NULL, 0);
+
+    char msg[ERR_MSG_MAX];
+    if (failed_attr) {
+      snprintf(msg, ERR_MSG_MAX, "%s: Failed to set %s", stage->argv[0],
+               (const char *)failed_attr);
+    } else {
+      snprintf(msg, ERR_MSG_MAX, "%s: Failed to %s", stage->argv[0],
+               (const char *)failed_step);
+    }
+    errno = failed_errno;
+    error_msg(msg, true);
+    return -1;
+  }
+
+  return pid;
+}
+
+/**
+ * spawn_stage - Launch a single pipeline stage
+ * @stage: Description of the stage to launch
+ *
+ * Uses posix_spawn(), which glibc implements with clone(CLONE_VM |
+ * CLONE_VFORK). The child shares the shell's memory until it calls exec, so no
+ * page tables are copied no matter how large the shell grows. All descriptor
+ * setup is expressed as spawn file actions instead of code running in a forked
+ * child. A stage with attributes, which posix_spawn() can't express, is
+ * launched with vfork() instead. With -z, the zygote launches the others,
+ * unless they keep descriptors the zygote doesn't have.
+ *
+ * Return: PID of the child on success, -1 on error
+ */
+pid_t spawn_stage(const struct stage_spawn *stage) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  pid_t pid = -1;
+  int err;
+
+  if (stage->attrs) {
+    return spawn_with_attrs(stage);
+  }
+
+  if (zygote_active() && stage->keep_fds_count == 0) {
+    pid = zygote_spawn(stage);
+    if (pid != ZYGOTE_FALLBACK) {
+      return pid;
+    }
+    pid = -1;
+  }
+
+  err = posix_spawn_file_actions_init(&actions);
+  if (err) {
+    errno = err;
+    error_msg("Failed to initialize spawn file actions", true);
+    return -1;
+  }
+
+  err = posix_spawnattr_init(&attr);
+  if (err) {
+    posix_spawn_file_actions_destroy(&actions);
+    errno = err;
+    error_msg("Failed to initialize spawn attributes", true);
+    return -1;
+  }
+
+  err = build_file_actions(&actions, stage);
+  if (!err) {
+    err = build_attributes(&attr, stage);
+  }
+
+  /*
+   * Unlike execvp() in a forked child, exec failures (such as a missing
+   * program) are reported back to the parent through the return value. When
+   * the shell already resolved the program, the child execs it directly
+   * instead of searching $PATH again.
+   */
+  if (!err && stage->path) {
+    err = posix_spawn(&pid, stage->path, &actions, &attr, stage->argv,
+                      environ);
+  } else if (!err) {
+    err = posix_spawnp(&pid, stage->argv[0], &actions, &attr, stage->argv,
+                       environ);
+  }
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (err) {
+    errno = err;
+    error_msg("Failed to execute process", true);
+    return -1;
+  }
+
+  return pid;
+}
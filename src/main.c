@@ -20,18 +20,31 @@
  * The root user cannot run this shell, as it is designed to be unpredictable.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "bench.h"
+#include "builtins.h"
 #include "config.h"
 #include "error.h"
 #include "exec.h"
 #include "history.h"
 #include "input.h"
+#include "jobs.h"
+#include "launch.h"
+#include "options.h"
+#include "parse.h"
+#include "path_cache.h"
 #include "signals.h"
+#include "stage_attrs.h"
 #include "tease.h"
+#include "watch.h"
+#include "zygote.h"
 
 /**
  * process_args - Parse CLI options
@@ -39,28 +52,38 @@
  * @argv: Argument array from main
  *
  * FLAGS:
+ * -c: Run the given commands instead of reading input
  * -d: Debug mode (disables color overrides and dynamically generated prompt)
  * -h: Display program usage and exit
  * -p: Polite mode (disables all teasing functionality)
  * -v: Display version and exit
+ * -z: Launch commands through a zygote forked at startup
 
  * Uses getopt() to handle startup options, this is the standard POSIX method to
  * do so.
+ *
+ * Return: Commands given with -c, NULL to read input
  */
-void process_args(int argc, char *argv[]) {
+char *process_args(int argc, char *argv[]) {
+  char *commands = NULL;
   int c;
-  while ((c = getopt(argc, argv, "dhpv")) != -1) {
+  while ((c = getopt(argc, argv, "c:dhpvz")) != -1) {
     switch (c) {
+    case 'c':
+      commands = optarg;
+      break;
     case 'd':
       debug_mode = true;
       break;
     case 'h':
       printf("Usage: clownish [options]\n");
       printf("Options:\n");
+      printf("  -c COMMANDS      Run COMMANDS (one per line) and exit\n");
       printf("  -d               enable debug mode\n");
       printf("  -h               Show this help message\n");
       printf("  -p               Enable polite mode\n");
       printf("  -v               Show version info\n");
+      printf("  -z               Launch commands through a zygote\n");
       exit(EXIT_SUCCESS);
     case 'p':
       teasing_enabled = false;
@@ -68,12 +91,17 @@ void process_args(int argc, char *argv[]) {
     case 'v':
       printf("clowniSH 0.231969420: Malevolent Marlin\n");
       exit(EXIT_SUCCESS);
+    case 'z':
+      use_zygote = true;
+      break;
     case '?':
       fprintf(stderr, "Unknown option '-%c'. Run with -h for options.\n",
               optopt);
       exit(EXIT_FAILURE);
     }
   }
+
+  return commands;
 }
 
 /**
@@ -81,11 +109,16 @@ void process_args(int argc, char *argv[]) {
  * @current_ctx: Shell context containing parsed commands
  *
  * Sometimes ClowniSH needs to protect the user from themselves and refuse to
- * run unscrupulous software, do not resist.
+ * run unscrupulous software, do not resist. Commands with a syntax error that
+ * was already reported are skipped as well.
  *
- * Return: true if command blacklisted, false otherwise
+ * Return: true if command blacklisted or malformed, false otherwise
  */
 bool skip_execution(struct repl_ctx *current_ctx) {
+  if (current_ctx->syntax_error) {
+    return true;
+  }
+
   for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
     if (program_is_blacklisted(current_ctx->commands[i][0])) {
       return true;
@@ -94,6 +127,106 @@ bool skip_execution(struct repl_ctx *current_ctx) {
   return false;
 }
 
+/**
+ * eval_input - Evaluate the command in current_ctx->input
+ * @current_ctx: Shell context, input is freed along with the rest
+ * @hist_file: Path to history file for saving on exit
+ *
+ * - Parses it into commands and arguments
+ * - Queues it instead if it starts with the defer keyword, or benchmarks it
+ *   with the bench keyword
+ * - Rewrites the pipeline to leave out stages that only pass data on
+ * - Executes if not blacklisted, or sets $? to SKIPPED_EXIT_CODE
+ * - Randomly teases the user about their software choices
+ * - Cleans up allocated memory
+ */
+void eval_input(struct repl_ctx *current_ctx, char *hist_file) {
+  /* Empty input does not need processing */
+  if (current_ctx->input[0] == '\0') {
+    cleanup_ctx(current_ctx);
+    return;
+  }
+
+  if (process_input(current_ctx) == -1) {
+    cleanup_ctx(current_ctx);
+    close_history(hist_file);
+    exit(EXIT_FAILURE);
+  }
+
+  if (skip_execution(current_ctx)) {
+    set_exit_status(current_ctx, SKIPPED_EXIT_CODE);
+    cleanup_ctx(current_ctx);
+    return;
+  }
+
+  if (current_ctx->is_benched) {
+    bench_run(current_ctx);
+    cleanup_ctx(current_ctx);
+    return;
+  }
+
+  if (current_ctx->is_deferred) {
+    queue_add(current_ctx);
+    cleanup_ctx(current_ctx);
+    return;
+  }
+
+  rewrite_pipeline(current_ctx);
+
+  const int result = current_ctx->watch_paths ? watch_run(current_ctx)
+                                              : exec(current_ctx);
+  if (result == -1) {
+    cleanup_ctx(current_ctx);
+    return;
+  }
+
+  handle_teasing(current_ctx);
+
+  cleanup_ctx(current_ctx);
+}
+
+/**
+ * run_queue - Start the deferred pipelines the machine has headroom for
+ * @current_ctx: Shell context, without a command being evaluated
+ * @hist_file: Path to history file for saving on exit
+ *
+ * Each one is evaluated like typed input, as a background job.
+ */
+void run_queue(struct repl_ctx *current_ctx, char *hist_file) {
+  unsigned int id;
+
+  while ((current_ctx->input = queue_next(current_ctx, &id))) {
+    const struct job *previous = job_current();
+
+    /* The shell has to outlive the job to start the rest of the queue */
+    current_ctx->is_last_command = 0;
+    eval_input(current_ctx, hist_file);
+
+    struct job *job = job_current();
+    queue_started(id, job != previous ? job : NULL);
+  }
+}
+
+/**
+ * drain_queue - Start and wait for the deferred pipelines, for wait
+ * @current_ctx: Shell context, without a command being evaluated
+ * @hist_file: Path to history file for saving on exit
+ *
+ * wait can't start queued pipelines itself, as they are evaluated like typed
+ * input and wait is in the middle of a command. Once it returns, they are
+ * started here as headroom allows, then waited for. Ctrl+C stops draining,
+ * the pipelines that didn't start stay queued.
+ */
+void drain_queue(struct repl_ctx *current_ctx, char *hist_file) {
+  while (queue_draining()) {
+    run_queue(current_ctx, hist_file);
+
+    if (queue_drain_wait() == -1) {
+      break;
+    }
+  }
+}
+
 /**
  * repl - Read-Eval-Print Loop
  * @current_ctx: Shell context
@@ -102,45 +235,71 @@ bool skip_execution(struct repl_ctx *current_ctx) {
  * This is the core of the shell, it loops until the user enters the "exit"
  * command or presses Ctrl+D.
  * - Reads user input
- * - Parses it into commands and arguments
- * - Executes if not blacklisted
- * - Randomly teases the user about their software choices
- * - Cleans up allocated memory
+ * - Evaluates it with eval_input()
  */
 void repl(struct repl_ctx *current_ctx, char *hist_file) {
   while (current_ctx->receiving) {
+    /* Report background jobs that finished while the last command ran */
+    jobs_notify();
+
+    run_queue(current_ctx, hist_file);
+
     if (take_input(current_ctx) == -1) {
       cleanup_ctx(current_ctx);
       close_history(hist_file);
       exit(EXIT_FAILURE);
     }
 
-    /* Empty input does not need processing */
-    if (current_ctx->input[0] == '\0') {
-      cleanup_ctx(current_ctx);
-      continue;
+    /* Ctrl+D, or the end of a script piped into the shell */
+    if (!current_ctx->input) {
+      current_ctx->receiving = 0;
+      break;
     }
 
-    if (process_input(current_ctx) == -1) {
-      cleanup_ctx(current_ctx);
-      close_history(hist_file);
-      exit(EXIT_FAILURE);
-    }
+    eval_input(current_ctx, hist_file);
 
-    if (skip_execution(current_ctx)) {
-      cleanup_ctx(current_ctx);
-      continue;
-    }
+    drain_queue(current_ctx, hist_file);
+  }
+}
 
-    if (exec(current_ctx) == -1) {
-      cleanup_ctx(current_ctx);
-      continue;
+/**
+ * run_commands - Run the commands given with -c
+ * @current_ctx: Shell context
+ * @commands: Commands, one per line
+ * @hist_file: Path to history file for saving on exit
+ *
+ * Unlike in the REPL, the shell knows which command is the last one, so that
+ * one may replace the shell rather than run in a child the shell waits for.
+ *
+ * Return: Exit status of the last command
+ */
+int run_commands(struct repl_ctx *current_ctx, const char *commands,
+                 char *hist_file) {
+  const char *line = commands;
+
+  while (current_ctx->receiving && *line) {
+    const char *end = strchrnul(line, '\n');
+
+    current_ctx->input = strndup(line, end - line);
+    if (!current_ctx->input) {
+      error_msg(strdup_fail_msg, true);
+      return EXIT_FAILURE;
     }
 
-    handle_teasing(current_ctx);
+    line = *end ? end + 1 : end;
+    current_ctx->is_last_command = *line == '\0';
 
-    cleanup_ctx(current_ctx);
+    eval_input(current_ctx, hist_file);
+
+    drain_queue(current_ctx, hist_file);
+
+    run_queue(current_ctx, hist_file);
   }
+
+  char *status =
+      get_user_env("?", current_ctx->user_envs, current_ctx->user_envs_count);
+
+  return status ? atoi(status) : EXIT_SUCCESS;
 }
 
 /**
@@ -164,7 +323,12 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
-  process_args(argc, argv);
+  char *commands = process_args(argc, argv);
+
+  /* Before anything else is loaded, so the zygote is as small as can be */
+  if (use_zygote) {
+    zygote_start();
+  }
 
   struct repl_ctx current_ctx;
 
@@ -180,6 +344,19 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
+  launch_init();
+
+  if (jobs_init(commands == NULL) == -1) {
+    exit(EXIT_FAILURE);
+  }
+
+  /* The shell still works without the command cache, so failure is non-fatal */
+  path_cache_init(&current_ctx);
+
+  options_init(&current_ctx);
+
+  stage_attrs_init(&current_ctx);
+
   /*
    * Seed the random number generator with the current time to ensure variety
    * between each run. RNG is used in this shell to decide when to tease the
@@ -190,9 +367,24 @@ int main(int argc, char *argv[]) {
   current_ctx.receiving = 1;
   current_ctx.input = NULL;
 
-  repl(&current_ctx, hist_file);
+  int status = EXIT_SUCCESS;
+
+  if (commands) {
+    status = run_commands(&current_ctx, commands, hist_file);
+  } else {
+    repl(&current_ctx, hist_file);
+  }
+
+  /* exit already did this, but not Ctrl+D or the end of a script */
+  coproc_close_all();
+
+  queue_drop_all();
+
+  path_cache_close();
+
+  jobs_close();
 
   close_history(hist_file);
 
-  exit(EXIT_SUCCESS);
+  exit(status);
 }
@@ -0,0 +1,107 @@
+/**
+ * options.c
+ *
+ * Shell options.
+ *
+ * OVERVIEW:
+ * Options are named switches, listed with "set -o", enabled with
+ * "set -o NAME" and disabled with "set +o NAME". They last for the session.
+ *
+ * - pipefail (off): a pipeline fails if any of its stages fails. $? is the
+ *   status of the rightmost stage that failed, or 0 if every stage succeeded.
+ * - teardown (off): when the last stage of a pipeline exits, the stages still
+ *   running can't be producing anything useful anymore. Left alone, a
+ *   producer only finds out once it writes to the pipe and gets SIGPIPE, which
+ *   a stage that computes for a long time between writes may not do for a
+ *   while. The shell sends them SIGPIPE right away instead, followed by
+ *   SIGKILL after TEARDOWN_KILL_AFTER from ~/.clownrc if that is set. This
+ *   also kills stages that would never have written again and exited cleanly
+ *   ("sleep 1 | true" then fails with pipefail), hence off.
+ * - autobatch (off): a command with more arguments than exec accepts is run
+ *   once per batch of arguments that fits instead of failing with E2BIG. The
+ *   program and its leading options are repeated in every batch. This changes
+ *   what the command does if it isn't fine with being split, hence off.
+ * - rewrite (on): "cat FILE | CMD" runs as "CMD < FILE", and other cat stages
+ *   that only pass data on are left out (see parse_rewrite.c). Debug mode
+ *   prints every rewrite.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "error.h"
+#include "options.h"
+#include "parse.h"
+
+static struct {
+  const char *name;
+  bool value;
+} options[OPTIONS_COUNT] = {
+    [OPTION_PIPEFAIL] = {"pipefail", false},
+    [OPTION_TEARDOWN] = {"teardown", false},
+    [OPTION_AUTOBATCH] = {"autobatch", false},
+    [OPTION_REWRITE] = {"rewrite", true},
+    [OPTION_MULTIOS] = {"multios", false},
+};
+
+static long kill_after_ms = 0;
+
+/**
+ * options_init - Load option settings from the configuration file
+ * @current_ctx: Shell context (for configuration)
+ *
+ * TEARDOWN_KILL_AFTER=DURATION in ~/.clownrc makes the teardown option follow
+ * SIGPIPE with SIGKILL for stages still around after DURATION.
+ */
+void options_init(struct repl_ctx *current_ctx) {
+  const char *spec = get_user_env("TEARDOWN_KILL_AFTER", current_ctx->user_envs,
+                                  current_ctx->user_envs_count);
+
+  if (spec && parse_duration(spec, &kill_after_ms) == -1) {
+    error_msg("Invalid TEARDOWN_KILL_AFTER in configuration file", false);
+    kill_after_ms = 0;
+  }
+}
+
+/**
+ * option_is_set - Check whether an option is enabled
+ * @option: Option to check
+ *
+ * Return: true if enabled, false otherwise
+ */
+bool option_is_set(enum shell_option option) { return options[option].value; }
+
+/**
+ * option_set - Enable or disable an option by name
+ * @name: Option name, as listed by "set -o"
+ * @value: Whether to enable it
+ *
+ * Return: 0 on success, -1 if there is no such option
+ */
+int option_set(const char *name, bool value) {
+  for (unsigned int i = 0; i < OPTIONS_COUNT; i++) {
+    if (strcmp(options[i].name, name) == 0) {
+      options[i].value = value;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * options_print - List every option and whether it is enabled
+ */
+void options_print(void) {
+  for (unsigned int i = 0; i < OPTIONS_COUNT; i++) {
+    printf("%-16s%s\n", options[i].name, options[i].value ? "on" : "off");
+  }
+}
+
+/**
+ * teardown_kill_after_ms - Get the grace period before teardown sends SIGKILL
+ *
+ * Return: Grace period in milliseconds, 0 if teardown never sends SIGKILL
+ */
+long teardown_kill_after_ms(void) { return kill_after_ms; }
@@ -16,6 +16,34 @@
 #include "error.h"
 #include "parse.h"
 
+/**
+ * select_element - Pick one element of an array variable
+ * @value: Variable value, elements separated by spaces
+ * @index: Element to pick, starting at 0
+ * @length: Output parameter - length of the element
+ *
+ * Shell arrays such as PIPESTATUS are stored as space-separated words, so
+ * $NAME[n] expands to the nth word.
+ *
+ * Return: Start of the element, pointer to "" if index is out of range
+ */
+const char *select_element(const char *value, unsigned long index,
+                           size_t *length) {
+  const char *element = value;
+
+  for (;;) {
+    element += strspn(element, " ");
+    *length = strcspn(element, " ");
+
+    if (*element == '\0' || index == 0) {
+      return element;
+    }
+
+    element += *length;
+    index--;
+  }
+}
+
 /**
  * parse_envs - Expand environment variables in argument
  * @arg: Pointer to argument string (will be modified)
@@ -24,14 +52,13 @@
  *
  * Searches for "$VARNAME" pattern in the argument and replaces it with the
  * variable's value. The replacement is done in-place by modifying what arg
- * points to.
+ * points to. "$?" expands to the exit status of the last command and
+ * "$VARNAME[n]" to the nth element of an array variable such as PIPESTATUS.
  */
 void parse_envs(char **arg, struct user_env *user_envs,
                 unsigned int user_envs_count) {
-  char *start = *arg;
-
   /* Search for '$' to find start of variable */
-  char *env_position = strstr(start, "$");
+  char *env_position = strchr(*arg, '$');
 
   if (!env_position) {
     return;
@@ -47,39 +74,62 @@ void parse_envs(char **arg, struct user_env *user_envs,
   unsigned int i = 0;
 
   /* Move past '$' */
-  start++;
+  char *start = env_position + 1;
 
-  while (*start && (isalnum(*start) || *start == '_')) {
+  if (*start == '?') {
     var_name[i++] = *start++;
+  } else {
+    while (*start && (isalnum(*start) || *start == '_') && i < ENV_MAX - 1) {
+      var_name[i++] = *start++;
+    }
   }
 
   /* Ensure null termination */
   var_name[i] = '\0';
 
-  char *env_value;
+  /* A lone '$' is left as is */
+  if (i == 0) {
+    return;
+  }
 
-  /* Check user-defined variables first */
-  if (user_envs_count > 0) {
-    env_value = get_user_env(var_name, user_envs, user_envs_count);
-    if (env_value) {
-      *arg = env_value;
-      return;
-    }
+  /* Check user-defined variables first, then system environment variables */
+  const char *env_value = get_user_env(var_name, user_envs, user_envs_count);
+  if (!env_value) {
+    env_value = getenv(var_name);
   }
 
-  /* Check system environment variables */
-  env_value = getenv(var_name);
   if (!env_value) {
     error_msg(env_fail_msg, false);
-    env_value = "";
     return;
   }
 
-  /* TODO: Use replace() here instead, this leaks memory ya dumb beaver */
-  *arg = strdup(env_value);
-  if (!*arg) {
-    error_msg(strdup_fail_msg, true);
+  size_t value_len = strlen(env_value);
+
+  /* $NAME[n] selects a single element */
+  if (*start == '[' && isdigit(start[1])) {
+    char *end;
+    unsigned long index = strtoul(start + 1, &end, 10);
+
+    if (*end == ']') {
+      env_value = select_element(env_value, index, &value_len);
+      start = end + 1;
+    }
+  }
+
+  /* Text before and after the variable is kept */
+  size_t prefix_len = env_position - *arg;
+  size_t suffix_len = strlen(start);
+
+  char *expanded = malloc(prefix_len + value_len + suffix_len + 1);
+  if (!expanded) {
+    error_msg(malloc_fail_msg, true);
+    return;
   }
 
-  return;
+  memcpy(expanded, *arg, prefix_len);
+  memcpy(expanded + prefix_len, env_value, value_len);
+  memcpy(expanded + prefix_len + value_len, start, suffix_len + 1);
+
+  free(*arg);
+  *arg = expanded;
 }
@@ -1,7 +1,7 @@
 /**
  * parse_flags.c
  *
- * Parser for background process operator (&).
+ * Parser for the background process operator (&) and pipeline keywords.
  *
  * OVERVIEW:
  * Responsible for detecting and parsing the background operator. POSIX
@@ -9,12 +9,28 @@
  * asynchronously without blocking the shell. Only the LAST command in a
  * pipeline can be backgrounded because all commands in a pipeline must run
  * together.
+ *
+ * Keywords such as time, pipesize, timeout, profile, on-change, defer and bench
+ * apply to the whole pipeline, so they can only appear at the start of the
+ * first command. The sched keyword applies to a single stage, and can prefix
+ * any of them.
  */
 
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "error.h"
+#include "exec.h"
+#include "jobs.h"
 #include "parse.h"
+#include "pipe_size.h"
+#include "signals.h"
+#include "stage_attrs.h"
+#include "watch.h"
 
 /**
  * determine_if_background - Check for background operator
@@ -25,9 +41,9 @@
  * is the last in the pipeline, removes & from arguments since it is not a
  * program argument and sets is_background_process to true.
  *
- * When exec.c sees that is_background_process is true, it calls setpgid(0, 0)
- * to create a new process group. This prevents SIGINT (Ctrl+C) from killing the
- * background job.
+ * When exec.c sees that is_background_process is true, it launches the
+ * pipeline as a background job in its own process group. This prevents SIGINT
+ * (Ctrl+C) from killing the background job.
  */
 void determine_if_background(struct repl_ctx *current_ctx,
                              unsigned int command_index) {
@@ -36,7 +52,7 @@ void determine_if_background(struct repl_ctx *current_ctx,
   if (strcmp(current_ctx->commands[command_index]
                                   [current_ctx->args_count[command_index] - 1],
              "&") == 0) {
-    if (command_index - 1 != current_ctx->commands_count) {
+    if (command_index != current_ctx->commands_count - 1) {
       error_msg("Background operator can only be specified for the last "
                 "command in the pipeline.",
                 false);
@@ -51,3 +67,374 @@ void determine_if_background(struct repl_ctx *current_ctx,
                current_ctx->args_count[command_index] - 1);
   }
 }
+
+/**
+ * remove_keyword - Remove the first word of a command
+ * @current_ctx: Shell context with parsed commands
+ * @command_index: Which command in pipeline to modify
+ *
+ * remove_arg() refuses to remove the program name, but a keyword in front of
+ * the program isn't one.
+ */
+void remove_keyword(struct repl_ctx *current_ctx, unsigned int command_index) {
+  char **args = current_ctx->commands[command_index];
+
+  free(args[0]);
+
+  /* Shift everything down, including the terminating NULL */
+  memmove(args, args + 1,
+          current_ctx->args_count[command_index] * sizeof(char *));
+  current_ctx->args_count[command_index]--;
+}
+
+/**
+ * determine_timeout - Parse the timeout keyword and its options
+ * @current_ctx: Shell context with "timeout" as the first word
+ *
+ * Usage: timeout [-s SIGNAL] [-k DURATION] DURATION COMMAND...
+ *
+ * Return: 0 on success, -1 on a malformed keyword
+ */
+int determine_timeout(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+  unsigned int i = 1;
+
+  current_ctx->timeout_signal = SIGTERM;
+  current_ctx->kill_after_ms = TIMEOUT_KILL_AFTER_MS;
+
+  for (; args[i] && args[i + 1] && args[i][0] == '-'; i += 2) {
+    if (strcmp(args[i], "-s") == 0) {
+      current_ctx->timeout_signal = parse_signal(args[i + 1]);
+      if (current_ctx->timeout_signal == -1) {
+        return -1;
+      }
+    } else if (strcmp(args[i], "-k") == 0) {
+      if (parse_duration(args[i + 1], &current_ctx->kill_after_ms) == -1) {
+        return -1;
+      }
+    } else {
+      return -1;
+    }
+  }
+
+  /* The duration has to be followed by a command */
+  if (!args[i] || !args[i + 1] ||
+      parse_duration(args[i], &current_ctx->timeout_ms) == -1) {
+    return -1;
+  }
+
+  for (unsigned int words = i + 1; words > 0; words--) {
+    remove_keyword(current_ctx, 0);
+  }
+
+  return 0;
+}
+
+/**
+ * determine_profile - Parse the profile keyword and its options
+ * @current_ctx: Shell context with "profile" as the first word
+ *
+ * Usage: profile [-j] [-o FILE] COMMAND...
+ *
+ * Return: 0 on success, -1 on a malformed keyword
+ */
+int determine_profile(struct repl_ctx *current_ctx) {
+  current_ctx->is_profiled = 1;
+  remove_keyword(current_ctx, 0);
+
+  while (current_ctx->args_count[0] > 1) {
+    char **args = current_ctx->commands[0];
+
+    if (strcmp(args[0], "-j") == 0) {
+      current_ctx->profile_json = 1;
+      remove_keyword(current_ctx, 0);
+      continue;
+    }
+
+    if (strcmp(args[0], "-o") != 0) {
+      return 0;
+    }
+
+    /* The file name has to be followed by a command */
+    if (current_ctx->args_count[0] < 3) {
+      return -1;
+    }
+
+    free(current_ctx->profile_output);
+    current_ctx->profile_output = strdup(args[1]);
+    if (!current_ctx->profile_output) {
+      error_msg(malloc_fail_msg, true);
+      return -1;
+    }
+
+    remove_keyword(current_ctx, 0);
+    remove_keyword(current_ctx, 0);
+  }
+
+  /* Only options were left, there is no command to profile */
+  const char *last = current_ctx->commands[0][0];
+  return strcmp(last, "-j") == 0 || strcmp(last, "-o") == 0 ? -1 : 0;
+}
+
+/**
+ * determine_on_change - Parse the on-change keyword, its options and paths
+ * @current_ctx: Shell context with "on-change" as the first word
+ *
+ * Usage: on-change [-d DELAY] [-c] PATH... -- COMMAND...
+ *
+ * The paths go through the same ~ and variable expansion as arguments.
+ *
+ * Return: 0 on success, -1 on a malformed keyword
+ */
+int determine_on_change(struct repl_ctx *current_ctx) {
+  char **args = current_ctx->commands[0];
+  unsigned int i = 1;
+
+  /* Only one set of paths per pipeline */
+  if (current_ctx->watch_paths) {
+    return -1;
+  }
+
+  for (; args[i] && args[i][0] == '-' && strcmp(args[i], "--") != 0; i++) {
+    if (strcmp(args[i], "-c") == 0) {
+      current_ctx->watch_cancel = 1;
+    } else if (strcmp(args[i], "-d") == 0 && args[i + 1] &&
+               parse_duration(args[i + 1], &current_ctx->watch_debounce_ms) !=
+                   -1) {
+      i++;
+    } else {
+      return -1;
+    }
+  }
+
+  unsigned int paths_start = i;
+  while (args[i] && strcmp(args[i], "--") != 0) {
+    i++;
+  }
+
+  /* At least one path, then "--" and a command */
+  const unsigned int paths_count = i - paths_start;
+  if (paths_count == 0 || !args[i] || !args[i + 1]) {
+    return -1;
+  }
+
+  current_ctx->watch_paths = calloc(paths_count + 1, sizeof(char *));
+  if (!current_ctx->watch_paths) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  for (unsigned int j = 0; j < paths_count; j++) {
+    current_ctx->watch_paths[j] = strdup(args[paths_start + j]);
+    if (!current_ctx->watch_paths[j]) {
+      error_msg(strdup_fail_msg, true);
+      return -1;
+    }
+
+    replace(&current_ctx->watch_paths[j], "~", current_ctx->home_dir);
+    parse_envs(&current_ctx->watch_paths[j], current_ctx->user_envs,
+               current_ctx->user_envs_count);
+  }
+
+  for (unsigned int words = i + 1; words > 0; words--) {
+    remove_keyword(current_ctx, 0);
+  }
+
+  return 0;
+}
+
+/**
+ * determine_keywords - Check for pipeline keywords
+ * @current_ctx: Shell context with the first command parsed
+ *
+ * Removes the keywords at the start of the first command's arguments and
+ * records their effect on the whole pipeline:
+ * - time: exec reports the resource usage of every stage once it finishes
+ * - pipesize SIZE: pipes between stages get SIZE bytes of capacity (K, M and G
+ *   suffixes are accepted) or grow as needed with "adaptive"
+ * - timeout DURATION: the job is sent SIGTERM (or the signal given with -s)
+ *   once DURATION has passed, and SIGKILL if it is still around after the
+ *   grace period given with -k
+ * - profile: pipes between stages go through relays in the shell, which count
+ *   the bytes moved and how long each side waited, reported once the pipeline
+ *   finishes (as JSON with -j, appended to FILE with -o FILE)
+ * - on-change PATH... --: the pipeline reruns every time one of the PATHs
+ *   changes, once no further change came for DELAY (set with -d), and a
+ *   change during a run cancels it with -c
+ * - defer: the pipeline is queued, and starts in the background once the
+ *   machine has headroom (see builtins_queue.c)
+ * - bench: the pipeline is run repeatedly and its timing summarized, or
+ *   several pipelines separated by --vs are compared (see bench.c)
+ *
+ * Return: 0 on success, -1 on a malformed keyword
+ */
+int determine_keywords(struct repl_ctx *current_ctx) {
+  current_ctx->is_timed = 0;
+  current_ctx->pipe_size = PIPE_SIZE_DEFAULT;
+  current_ctx->timeout_ms = 0;
+  current_ctx->is_profiled = 0;
+  current_ctx->profile_json = 0;
+  current_ctx->watch_debounce_ms = WATCH_DEBOUNCE_MS;
+  current_ctx->watch_cancel = 0;
+  current_ctx->is_deferred = 0;
+  current_ctx->is_benched = 0;
+
+  /* A keyword on its own is just a command name */
+  while (current_ctx->args_count[0] > 1) {
+    const char *keyword = current_ctx->commands[0][0];
+
+    if (strcmp(keyword, "time") == 0) {
+      current_ctx->is_timed = 1;
+      remove_keyword(current_ctx, 0);
+      continue;
+    }
+
+    if (strcmp(keyword, "defer") == 0) {
+      current_ctx->is_deferred = 1;
+      remove_keyword(current_ctx, 0);
+      continue;
+    }
+
+    /* Its options and pipelines are parsed from the text, see bench.c */
+    if (strcmp(keyword, "bench") == 0) {
+      current_ctx->is_benched = 1;
+      break;
+    }
+
+    if (strcmp(keyword, "timeout") == 0) {
+      if (determine_timeout(current_ctx) == -1) {
+        error_msg("timeout: usage: timeout [-s SIGNAL] [-k DURATION] DURATION "
+                  "COMMAND...",
+                  false);
+        return -1;
+      }
+      continue;
+    }
+
+    if (strcmp(keyword, "profile") == 0) {
+      if (determine_profile(current_ctx) == -1) {
+        error_msg("profile: usage: profile [-j] [-o FILE] COMMAND...", false);
+        return -1;
+      }
+      continue;
+    }
+
+    if (strcmp(keyword, "on-change") == 0) {
+      if (determine_on_change(current_ctx) == -1) {
+        error_msg("on-change: usage: on-change [-d DELAY] [-c] PATH... -- "
+                  "COMMAND...",
+                  false);
+        return -1;
+      }
+      continue;
+    }
+
+    if (strcmp(keyword, "pipesize") != 0) {
+      break;
+    }
+
+    if (current_ctx->args_count[0] < 3 ||
+        parse_pipe_size(current_ctx->commands[0][1],
+                        &current_ctx->pipe_size) == -1) {
+      error_msg("pipesize: usage: pipesize SIZE[K|M|G]|adaptive COMMAND...",
+                false);
+      return -1;
+    }
+
+    remove_keyword(current_ctx, 0);
+    remove_keyword(current_ctx, 0);
+  }
+
+  return 0;
+}
+
+/**
+ * determine_stage_attrs - Parse the sched keyword of a stage
+ * @current_ctx: Shell context with the stage parsed
+ * @command_index: Which command in the pipeline to check
+ *
+ * Usage: sched [-a CPUS] [-n NICE] [-i CLASS[:LEVEL]] [-p POLICY]
+ * [-l RESOURCE=SOFT[:HARD]]... COMMAND...
+ *
+ * The attributes are applied by the stage's child before it execs, so
+ * builtins, which don't get a child of their own, can't have any.
+ *
+ * Return: 0 on success, -1 on a malformed keyword
+ */
+int determine_stage_attrs(struct repl_ctx *current_ctx,
+                          unsigned int command_index) {
+  char **args = current_ctx->commands[command_index];
+
+  /* A keyword on its own is just a command name */
+  if (current_ctx->args_count[command_index] < 2 ||
+      strcmp(args[0], "sched") != 0) {
+    return 0;
+  }
+
+  struct stage_attrs *attrs = malloc(sizeof(*attrs));
+  if (!attrs) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  int used = parse_stage_attrs(args + 1, attrs);
+
+  /* The options have to be followed by a command */
+  if (used == -1 || !args[used + 1]) {
+    error_msg("sched: usage: sched [-a CPUS] [-n NICE] [-i CLASS[:LEVEL]] "
+              "[-p POLICY] [-l RESOURCE=SOFT[:HARD]]... COMMAND...",
+              false);
+    free(attrs);
+    return -1;
+  }
+
+  const struct command_associations *builtin = find_builtin(args[used + 1]);
+
+  if (builtin && builtin->kind != BUILTIN_OVERRIDE) {
+    char msg[ERR_MSG_MAX];
+    snprintf(msg, ERR_MSG_MAX, "sched: %s is a shell builtin", args[used + 1]);
+    error_msg(msg, false);
+    free(attrs);
+    return -1;
+  }
+
+  for (int words = used + 1; words > 0; words--) {
+    remove_keyword(current_ctx, command_index);
+  }
+
+  free(current_ctx->stage_attrs[command_index]);
+  current_ctx->stage_attrs[command_index] = attrs;
+
+  return 0;
+}
+
+/**
+ * apply_background_attrs - Give the stages of a background job the
+ * attributes from BACKGROUND_SCHED
+ * @current_ctx: Shell context with every stage parsed
+ *
+ * Attributes a stage sets with the sched keyword take precedence.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int apply_background_attrs(struct repl_ctx *current_ctx) {
+  const struct stage_attrs *defaults = background_stage_attrs();
+
+  if (!current_ctx->is_background_process || !defaults) {
+    return 0;
+  }
+
+  for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
+    if (!current_ctx->stage_attrs[i]) {
+      current_ctx->stage_attrs[i] = calloc(1, sizeof(struct stage_attrs));
+      if (!current_ctx->stage_attrs[i]) {
+        error_msg(malloc_fail_msg, true);
+        return -1;
+      }
+    }
+
+    merge_stage_attrs(current_ctx->stage_attrs[i], defaults);
+  }
+
+  return 0;
+}
@@ -9,22 +9,128 @@
  *
  * We split on pipes before lexing because we need to know how many commands
  * there are before we allocate arrays for their arguments and I/O redirections.
+ *
+ * A process substitution, "<(...)" or ">(...)", is one word however many
+ * spaces and pipes it holds: its command is only parsed once it runs.
  */
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "error.h"
 #include "parse.h"
 
+/**
+ * substitution_end - Find the end of a process substitution
+ * @start: Start of a word
+ *
+ * Parentheses nest, so "<(diff <(a) <(b))" ends at the last one.
+ *
+ * Return: Character after the closing parenthesis, NULL if the word doesn't
+ * start a process substitution or it is never closed
+ */
+const char *substitution_end(const char *start) {
+  if ((start[0] != '<' && start[0] != '>') || start[1] != '(') {
+    return NULL;
+  }
+
+  unsigned int depth = 0;
+
+  for (const char *c = start + 1; *c; c++) {
+    if (*c == '(') {
+      depth++;
+    } else if (*c == ')' && --depth == 0) {
+      return c + 1;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * unclosed_substitution - Check a command for an unclosed process substitution
+ * @args: NULL-terminated arguments of the command
+ *
+ * next_token() splits an unclosed "<(" like any other word, which is reported
+ * rather than taken for a file name.
+ *
+ * Return: true if an argument opens a substitution it never closes
+ */
+bool unclosed_substitution(char **args) {
+  for (unsigned int i = 0; args[i]; i++) {
+    if ((args[i][0] == '<' || args[i][0] == '>') && args[i][1] == '(' &&
+        !substitution_end(args[i])) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * find_pipe - Find the next pipe operator between commands
+ * @line: Command string to search
+ *
+ * We search for " | " rather than just "|" in case a file has the pipe symbol
+ * in its name. Pipes inside a process substitution belong to its command.
+ *
+ * Return: Start of the " | " separator, NULL if there is none
+ */
+const char *find_pipe(const char *line) {
+  for (const char *c = line; *c; c++) {
+    if (strncmp(c, " | ", 3) == 0) {
+      return c;
+    }
+
+    const bool word_start = c == line || strchr(" \t\r\n\a", c[-1]);
+    const char *end = word_start ? substitution_end(c) : NULL;
+
+    if (end) {
+      c = end - 1;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * next_token - Split the next word off a command
+ * @cursor: Position in the command, advanced past the word
+ * @delim: Characters that separate words
+ *
+ * Works like strtok(), except that a process substitution stays one word.
+ *
+ * Return: Null-terminated word inside the command, NULL if none is left
+ */
+char *next_token(char **cursor, const char *delim) {
+  char *start = *cursor + strspn(*cursor, delim);
+
+  if (*start == '\0') {
+    *cursor = start;
+    return NULL;
+  }
+
+  /* An unclosed substitution is left for the parser to report */
+  const char *end = substitution_end(start);
+  char *word_end = end ? (char *)end : start;
+
+  word_end += strcspn(word_end, delim);
+
+  *cursor = *word_end ? word_end + 1 : word_end;
+  *word_end = '\0';
+
+  return start;
+}
+
 /**
  * lex_input - Tokenize a single command into arguments
- * @line: Command string to tokenize (modified by strtok)
+ * @line: Command string to tokenize (modified by next_token)
  * @args_count: Output parameter - number of arguments found
  *
- * Uses strtok() to split on whitespace (spaces, tabs, newlines). Each token is
- * duplicated with strdup so it persists after strtok modifies the original
- * string.
+ * Uses next_token() to split on whitespace (spaces, tabs, newlines). Each token
+ * is duplicated with strdup so it persists after next_token modifies the
+ * original string.
  *
  * Return: Array of strings (NULL-terminated), NULL on error
  */
@@ -32,7 +138,7 @@ char **lex_input(char *line, unsigned int *args_count) {
   /* Delimiters: space, tab, carriage return, newline, bell */
   static const char *delim = " \t\r\n\a";
 
-  int buffer_size = TOKENS_MAX;
+  size_t buffer_size = TOKENS_MAX;
 
   char **tokens = malloc(buffer_size * sizeof(char *));
   if (!tokens) {
@@ -40,18 +146,16 @@ char **lex_input(char *line, unsigned int *args_count) {
     return NULL;
   }
 
-  char *token;
+  char *cursor = line;
   /**
-   * strtok() breaks a string into tokens.
-   * The first call to it (strtok(string, delims)) returns first token.
-   * Subsequent calls (strok(NULL, delims)) returns the next token.
-   * Returns NULL when no more tokens are found.
+   * next_token() breaks a string into tokens like strtok(), keeping its place
+   * in cursor. Returns NULL when no more tokens are found.
    */
-  token = strtok(line, delim);
+  char *token = next_token(&cursor, delim);
 
   while (token) {
     /**
-     * We duplicate the string with strdup because strtok's tokens are just
+     * We duplicate the string with strdup because the tokens are just
      * pointers into the original string, which we'll free soon.
      */
     tokens[*args_count] = strdup(token);
@@ -66,19 +170,27 @@ char **lex_input(char *line, unsigned int *args_count) {
 
     (*args_count)++;
 
-    /* Grow the buffer if we're running out of space */
-    if (*args_count >= (unsigned int)buffer_size) {
-      buffer_size += TOKENS_MAX;
-
-      tokens = realloc(tokens, buffer_size * sizeof(char *));
-
-      if (!tokens) {
+    /*
+     * Grow the buffer if we're running out of space. Doubling keeps the number
+     * of reallocations (and the copying they do) logarithmic in the number of
+     * arguments, which matters for very long argument lists.
+     */
+    if (*args_count >= buffer_size) {
+      char **new_tokens = realloc(tokens, buffer_size * 2 * sizeof(char *));
+      if (!new_tokens) {
         error_msg("Failed to reallocate memory", true);
+        for (unsigned int i = 0; i < *args_count; i++) {
+          free(tokens[i]);
+        }
+        free(tokens);
         return NULL;
       }
+
+      tokens = new_tokens;
+      buffer_size *= 2;
     }
 
-    token = strtok(NULL, delim);
+    token = next_token(&cursor, delim);
   }
 
   /* Null-terminate the array (required by execvp) */
@@ -88,47 +200,24 @@ char **lex_input(char *line, unsigned int *args_count) {
 }
 
 /**
- * pipes_exceeded - Check if command has too many pipes
+ * count_commands - Count the commands of a pipeline
  * @line: Full command string
- * @commands_count: Ouput parameter - number of commands found
  *
- * Pipes consume file descriptors and memory, so we limit the number of pipes to
- * PIPES_MAX (64).
+ * There is no fixed limit on the number of commands: exec only holds two
+ * pipes open at a time, so long pipelines are bounded by the process limits
+ * rather than by the shell.
  *
- * Return: true if exceeded, false otherwise
+ * Return: Number of commands
  */
-bool pipes_exceeded(const char *line, unsigned int *commands_count) {
-  int pipe_count = 0;
-
-  char *temp = strdup(line);
-  if (!temp) {
-    error_msg(strdup_fail_msg, true);
-    return true;
-  }
-
-  char *temp_start = temp;
+unsigned int count_commands(const char *line) {
+  unsigned int pipe_count = 0;
 
-  /**
-   * We search for " | " rather than just "|" in case a file has the pipe symbol
-   * in its name.
-   */
-  while ((temp = strstr(temp, " | "))) {
+  for (const char *temp = line; (temp = find_pipe(temp)); temp += 3) {
     pipe_count++;
-    /* Move past " | " */
-    temp += 3;
-  }
-
-  free(temp_start);
-
-  if (pipe_count >= PIPES_MAX) {
-    error_msg("Number of commands exceeded", false);
-    return true;
   }
 
   /* The last command won't have a pipe after it */
-  *commands_count = pipe_count + 1;
-
-  return false;
+  return pipe_count + 1;
 }
 
 /**
@@ -139,12 +228,11 @@ bool pipes_exceeded(const char *line, unsigned int *commands_count) {
  * Returns: Array of command strings, NULL on error
  */
 char **split_on_pipes(const char *line, unsigned int *commands_count) {
-  if (pipes_exceeded(line, commands_count)) {
-    return NULL;
-  }
+  *commands_count = count_commands(line);
 
   char **unparsed_commands = malloc(*commands_count * sizeof(char *));
   if (!unparsed_commands) {
+    error_msg(malloc_fail_msg, true);
     return NULL;
   }
 
@@ -152,6 +240,7 @@ char **split_on_pipes(const char *line, unsigned int *commands_count) {
   char *input = strdup(line);
   if (!input) {
     error_msg(strdup_fail_msg, true);
+    free(unparsed_commands);
     return NULL;
   }
 
@@ -163,7 +252,7 @@ char **split_on_pipes(const char *line, unsigned int *commands_count) {
    * Find each " | " seperator and replace it with null terminator to split the
    * string. Duplicate the command substring and save it.
    */
-  while ((position = strstr(start, " | ")) && index < PIPES_MAX) {
+  while ((position = (char *)find_pipe(start))) {
     *position = '\0';
 
     unparsed_commands[index] = strdup(start);
@@ -183,12 +272,6 @@ char **split_on_pipes(const char *line, unsigned int *commands_count) {
     index++;
   }
 
-  /* This is overly cautious as pipes_exceeded checks this */
-  if (index == PIPES_MAX) {
-    free(input);
-    return NULL;
-  }
-
   /* Save the last command separately since it doesn't end with a pipe */
   unparsed_commands[index++] = strdup(start);
   if (!unparsed_commands[index - 1]) {
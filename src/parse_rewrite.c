@@ -0,0 +1,231 @@
+/**
+ * parse_rewrite.c
+ *
+ * Rewrites of parsed pipelines that leave out stages doing nothing useful.
+ *
+ * OVERVIEW:
+ * "cat FILE | sort" costs a process and a copy of every byte through a pipe,
+ * when sort could read FILE itself. Between parsing and execution, the shell
+ * rewrites such pipelines into equivalent ones with fewer stages:
+ * - "cat FILE | CMD" becomes "CMD < FILE"
+ * - "cat < FILE | CMD" becomes "CMD < FILE"
+ * - "A | cat | B" becomes "A | B"
+ * - "A | cat > FILE" (or >>) becomes "A > FILE"
+ *
+ * Only rewrites whose result can't be told apart are made: cat has no
+ * options or sched attributes, the stages involved have no redirections that
+ * would conflict, and cat never ends up dropped in front of the terminal,
+ * where programs behave differently than in front of a pipe. A FILE that cat
+ * would fail to read is left to cat, so the error is the same. What does
+ * change is the number of stages, and so $PIPESTATUS.
+ *
+ * Each rewrite is printed in debug mode. "set +o rewrite" turns them off.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "exec.h"
+#include "options.h"
+#include "parse.h"
+
+/**
+ * plain_cat - Check whether a stage is cat without options
+ * @args: Arguments of the stage
+ * @operands: Number of operands cat must have
+ *
+ * Return: true if args is cat with exactly that many operands, none of them
+ * an option or "-", false otherwise
+ */
+bool plain_cat(char **args, unsigned int operands) {
+  if (strcmp(args[0], "cat") != 0) {
+    return false;
+  }
+
+  for (unsigned int i = 1; i <= operands; i++) {
+    if (!args[i] || args[i][0] == '-') {
+      return false;
+    }
+  }
+
+  return !args[operands + 1];
+}
+
+/**
+ * readable_file - Check whether cat would read a file without error
+ * @path: File to check
+ *
+ * Return: true if path is a regular file the shell can read, false otherwise
+ */
+bool readable_file(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+         access(path, R_OK) == 0;
+}
+
+/**
+ * single_stage_allowed - Check whether a stage may end up on its own
+ * @args: Arguments of the stage
+ *
+ * On its own, a stage named like an override or exec runs that builtin rather
+ * than the program it runs as inside a pipeline.
+ *
+ * Return: true if the stage runs the same either way, false otherwise
+ */
+bool single_stage_allowed(char **args) {
+  const struct command_associations *builtin = find_builtin(args[0]);
+  return !builtin ||
+         (builtin->kind != BUILTIN_OVERRIDE && builtin->kind != BUILTIN_ALONE);
+}
+
+/**
+ * remove_stage - Drop a stage from the pipeline
+ * @current_ctx: Shell context with parsed commands
+ * @index: Stage to drop, its redirections must already be moved or freed
+ */
+void remove_stage(struct repl_ctx *current_ctx, unsigned int index) {
+  for (unsigned int j = 0; j < current_ctx->args_count[index]; j++) {
+    free(current_ctx->commands[index][j]);
+  }
+
+  free(current_ctx->commands[index]);
+  free(current_ctx->unparsed_commands[index]);
+  free(current_ctx->stage_attrs[index]);
+
+  for (unsigned int i = index; i + 1 < current_ctx->commands_count; i++) {
+    current_ctx->commands[i] = current_ctx->commands[i + 1];
+    current_ctx->unparsed_commands[i] = current_ctx->unparsed_commands[i + 1];
+    current_ctx->args_count[i] = current_ctx->args_count[i + 1];
+    current_ctx->in_stream_name[i] = current_ctx->in_stream_name[i + 1];
+    current_ctx->out_stream_name[i] = current_ctx->out_stream_name[i + 1];
+    current_ctx->out_stream_type[i] = current_ctx->out_stream_type[i + 1];
+    current_ctx->out_fanout[i] = current_ctx->out_fanout[i + 1];
+    current_ctx->stage_attrs[i] = current_ctx->stage_attrs[i + 1];
+  }
+
+  current_ctx->commands_count--;
+}
+
+/**
+ * fold_leading_cat - Turn "cat FILE | CMD" or "cat < FILE | CMD" into
+ * "CMD < FILE"
+ * @current_ctx: Shell context with parsed commands
+ *
+ * Return: true if the pipeline was rewritten, false otherwise
+ */
+bool fold_leading_cat(struct repl_ctx *current_ctx) {
+  char **cat = current_ctx->commands[0];
+  char **next = current_ctx->commands[1];
+  const bool from_operand = cat[1] != NULL;
+  char *file;
+
+  if (current_ctx->out_stream_name[0] || current_ctx->in_stream_name[1] ||
+      current_ctx->stage_attrs[0] ||
+      (current_ctx->commands_count == 2 && !single_stage_allowed(next))) {
+    return false;
+  }
+
+  if (plain_cat(cat, 1) && !current_ctx->in_stream_name[0] &&
+      readable_file(cat[1])) {
+    /* Taken over by the next stage, remove_stage() mustn't free it */
+    file = cat[1];
+    cat[1] = NULL;
+  } else if (plain_cat(cat, 0) && current_ctx->in_stream_name[0]) {
+    file = current_ctx->in_stream_name[0];
+  } else {
+    return false;
+  }
+
+  if (debug_mode) {
+    fprintf(stderr, "rewrite: cat %s%s | %s -> %s < %s\n",
+            from_operand ? "" : "< ", file, next[0], next[0], file);
+  }
+
+  current_ctx->in_stream_name[1] = file;
+  current_ctx->in_stream_name[0] = NULL;
+  remove_stage(current_ctx, 0);
+
+  return true;
+}
+
+/**
+ * drop_passthrough_cat - Turn "A | cat | B" into "A | B", or "A | cat > FILE"
+ * into "A > FILE"
+ * @current_ctx: Shell context with parsed commands
+ * @index: Stage to check, not the first
+ *
+ * A cat at the end of the pipeline is only dropped if it writes to a file,
+ * otherwise A would find itself writing to the terminal.
+ *
+ * Return: true if the pipeline was rewritten, false otherwise
+ */
+bool drop_passthrough_cat(struct repl_ctx *current_ctx, unsigned int index) {
+  const bool is_last = index == current_ctx->commands_count - 1;
+  char **prev = current_ctx->commands[index - 1];
+
+  if (!plain_cat(current_ctx->commands[index], 0) ||
+      current_ctx->in_stream_name[index] || current_ctx->stage_attrs[index] ||
+      current_ctx->out_stream_name[index - 1] ||
+      (is_last && !current_ctx->out_stream_name[index]) ||
+      current_ctx->out_fanout[index] ||
+      (current_ctx->commands_count == 2 && !single_stage_allowed(prev))) {
+    return false;
+  }
+
+  if (debug_mode) {
+    const char *file = current_ctx->out_stream_name[index];
+    const char *op =
+        current_ctx->out_stream_type[index] == O_APPEND ? ">>" : ">";
+
+    if (is_last) {
+      fprintf(stderr, "rewrite: %s | cat %s %s -> %s %s %s\n", prev[0], op,
+              file, prev[0], op, file);
+    } else {
+      const char *next = current_ctx->commands[index + 1][0];
+      fprintf(stderr, "rewrite: %s | cat | %s -> %s | %s\n", prev[0], next,
+              prev[0], next);
+    }
+  }
+
+  current_ctx->out_stream_name[index - 1] = current_ctx->out_stream_name[index];
+  current_ctx->out_stream_type[index - 1] = current_ctx->out_stream_type[index];
+  current_ctx->out_stream_name[index] = NULL;
+  remove_stage(current_ctx, index);
+
+  return true;
+}
+
+/**
+ * rewrite_pipeline - Leave out stages of the pipeline that only pass data on
+ * @current_ctx: Shell context with parsed commands
+ *
+ * Rewrites are applied until none applies anymore, so "cat FILE | cat | wc"
+ * ends up as "wc < FILE".
+ */
+void rewrite_pipeline(struct repl_ctx *current_ctx) {
+  if (!option_is_set(OPTION_REWRITE)) {
+    return;
+  }
+
+  bool rewritten = true;
+
+  while (rewritten && current_ctx->commands_count > 1) {
+    rewritten = false;
+
+    for (unsigned int i = current_ctx->commands_count - 1; i > 0; i--) {
+      if (drop_passthrough_cat(current_ctx, i)) {
+        rewritten = true;
+        break;
+      }
+    }
+
+    if (!rewritten && current_ctx->commands_count > 1) {
+      rewritten = fold_leading_cat(current_ctx);
+    }
+  }
+}
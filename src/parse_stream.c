@@ -9,6 +9,9 @@
  * Output redirection: > filename
  * Append redirection: >> filename
  *
+ * A command can have several output redirections, its output then goes to
+ * every one of them (see fanout.c).
+ *
  * It is important that we remove the operators and their arguments as the
  * programs themselves don't understand shell syntax.
  */
@@ -17,6 +20,7 @@
 #include <string.h>
 
 #include "error.h"
+#include "fanout.h"
 #include "parse.h"
 
 /**
@@ -56,70 +60,58 @@ void determine_in_stream(struct repl_ctx *current_ctx,
 }
 
 /**
- * determine_out_stream - Parse input redirection operator
+ * determine_out_stream - Parse output redirection operators
  * @current_ctx: Shell context
  * @command_index: Which command in the pipeline to check
  *
- * Searches for the '>' and ">>" operators in the command's arguments. If found:
+ * Searches for the '>' and ">>" operators in the command's arguments. For
+ * each one:
  * - Extracts the filename that follows it
- * - Stores filename in in_stream_name[command_index]
+ * - Stores the first filename in out_stream_name[command_index], later ones
+ *   in out_fanout[command_index], as the output goes to every one of them
  * - Removes operator and filename from arguments
  */
 void determine_out_stream(struct repl_ctx *current_ctx,
                           unsigned int command_index) {
-  for (unsigned int i = 0; i < current_ctx->args_count[command_index]; i++) {
-    /* Check for '>': write mode */
-    if (strcmp(current_ctx->commands[command_index][i], ">") == 0) {
-      if (!current_ctx->commands[command_index][i + 1]) {
-        error_msg(redirection_missing_filename_msg, false);
-        return;
-      }
-
-      /* write mode (O_WRONLY) overwrites the files contents */
-      current_ctx->out_stream_type[command_index] = O_WRONLY;
+  char **args = current_ctx->commands[command_index];
+  unsigned int i = 0;
 
-      current_ctx->out_stream_name[command_index] =
-          strdup(current_ctx->commands[command_index][i + 1]);
-      if (!current_ctx->out_stream_name[command_index]) {
-        error_msg(strdup_fail_msg, true);
-        return;
-      }
+  while (i < current_ctx->args_count[command_index]) {
+    /*
+     * write mode (O_WRONLY) overwrites the files contents, O_APPEND mode
+     * positions writes at the end of the file, preserving existing content.
+     */
+    int type;
 
-      /* Remove ">" and filename from arguments */
-      remove_arg(current_ctx->commands[command_index],
-                 &current_ctx->args_count[command_index], i);
-      remove_arg(current_ctx->commands[command_index],
-                 &current_ctx->args_count[command_index], i);
+    if (strcmp(args[i], ">") == 0) {
+      type = O_WRONLY;
+    } else if (strcmp(args[i], ">>") == 0) {
+      type = O_APPEND;
+    } else {
+      i++;
+      continue;
+    }
 
+    if (!args[i + 1]) {
+      error_msg(redirection_missing_filename_msg, false);
       return;
     }
 
-    /* Check for '>>': append mode*/
-    if (strcmp(current_ctx->commands[command_index][i], ">>") == 0) {
-      if (!current_ctx->commands[command_index][i + 1]) {
-        error_msg(redirection_missing_filename_msg, false);
-        return;
-      }
-
-      /* 
-       * O_APPEND mode positions writes at the end of the file, preserving
-       * existing content.
-       */
-      current_ctx->out_stream_type[command_index] = O_APPEND;
-
-      current_ctx->out_stream_name[command_index] =
-          strdup(current_ctx->commands[command_index][i + 1]);
+    if (!current_ctx->out_stream_name[command_index]) {
+      current_ctx->out_stream_type[command_index] = type;
+      current_ctx->out_stream_name[command_index] = strdup(args[i + 1]);
       if (!current_ctx->out_stream_name[command_index]) {
         error_msg(strdup_fail_msg, true);
         return;
       }
-
-      remove_arg(current_ctx->commands[command_index],
-                 &current_ctx->args_count[command_index], i);
-      remove_arg(current_ctx->commands[command_index],
-                 &current_ctx->args_count[command_index], i);
-
+    } else if (fanout_add(&current_ctx->out_fanout[command_index],
+                          args[i + 1], type) == -1) {
+      current_ctx->syntax_error = 1;
       return;
     }
+
+    /* Remove the operator and filename from arguments */
+    remove_arg(args, &current_ctx->args_count[command_index], i);
+    remove_arg(args, &current_ctx->args_count[command_index], i);
   }
 }
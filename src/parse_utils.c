@@ -7,6 +7,7 @@
  * Responsible for helper functions used throughout parsing stages.
  */
 
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -103,3 +104,97 @@ void replace(char **original_str, const char *original_substr,
 
   free(new_str);
 }
+
+/**
+ * parse_duration - Parse a duration such as "30", "1.5s", "2m", "1h" or "1d"
+ * @spec: Number of seconds, fractions allowed, with an optional s, m, h or d
+ * suffix
+ * @duration_ms: Output parameter - duration in milliseconds
+ *
+ * Return: 0 on success, -1 if spec isn't a valid duration
+ */
+int parse_duration(const char *spec, long *duration_ms) {
+  char *end;
+  double seconds = strtod(spec, &end);
+
+  /* The negated comparison also rejects NaN */
+  if (end == spec || !(seconds >= 0)) {
+    return -1;
+  }
+
+  switch (*end) {
+  case '\0':
+  case 's':
+    break;
+  case 'm':
+    seconds *= 60;
+    break;
+  case 'h':
+    seconds *= 60 * 60;
+    break;
+  case 'd':
+    seconds *= 60 * 60 * 24;
+    break;
+  default:
+    return -1;
+  }
+
+  if (*end != '\0' && end[1] != '\0') {
+    return -1;
+  }
+
+  /* Anything longer than a few centuries is as good as no limit */
+  if (seconds > 1e10) {
+    return -1;
+  }
+
+  /* Round up, so a tiny duration doesn't turn into no limit at all */
+  *duration_ms = (long)(seconds * 1000);
+  if (*duration_ms < seconds * 1000) {
+    (*duration_ms)++;
+  }
+
+  return 0;
+}
+
+/**
+ * parse_size - Parse a size such as "4096", "512K", "64M" or "2G"
+ * @spec: Number of bytes with an optional K, M or G suffix (powers of 1024)
+ * @bytes: Output parameter - size in bytes
+ *
+ * Return: 0 on success, -1 if spec isn't a valid size
+ */
+int parse_size(const char *spec, long long *bytes) {
+  char *end;
+  long long size = strtoll(spec, &end, 10);
+
+  if (end == spec || size < 0) {
+    return -1;
+  }
+
+  int shift = 0;
+
+  switch (*end) {
+  case 'G':
+  case 'g':
+    shift += 10;
+    /* fall through */
+  case 'M':
+  case 'm':
+    shift += 10;
+    /* fall through */
+  case 'K':
+  case 'k':
+    shift += 10;
+    end++;
+    break;
+  }
+
+  if (*end != '\0' || size > (LLONG_MAX >> shift)) {
+    return -1;
+  }
+
+  *bytes = size << shift;
+
+  return 0;
+}
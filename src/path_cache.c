@@ -0,0 +1,807 @@
+/**
+ * path_cache.c
+ *
+ * Executable lookup cache (the shell's equivalent of bash's "hash" table).
+ *
+ * OVERVIEW:
+ * execvp() searches every $PATH directory each time a command is launched, and
+ * when it fails, it fails after the child has already been created. Instead,
+ * the shell resolves each command name once, remembers the result and launches
+ * the program by its full path.
+ *
+ * INVALIDATION:
+ * A cached path becomes wrong when a program with the same name is added to,
+ * removed from or renamed in any $PATH directory. The directories are watched
+ * with inotify and every event drops the entry for the name it concerns. If
+ * inotify is unavailable, the modification time of each directory is checked
+ * instead, which tells us something changed but not what, so the whole cache is
+ * dropped. Changing $PATH itself also drops the whole cache.
+ *
+ * PERSISTENCE:
+ * With HASH_PERSIST=1 in ~/.clownrc, the cache is written to a file in
+ * $XDG_RUNTIME_DIR (a tmpfs) at exit and mmapped back in by the next session.
+ * The file records $PATH and the modification times of its directories, and is
+ * ignored if either no longer matches.
+ */
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "error.h"
+#include "path_cache.h"
+
+/* Used when $PATH is unset, matching what execvp() would search */
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+#define PATH_CACHE_BUCKETS_MIN 64
+
+#define PATH_CACHE_MAGIC "CLOWNHSH"
+
+#define PATH_CACHE_VERSION 1
+
+/* Events in a $PATH directory that can change what a name resolves to */
+#define PATH_CACHE_WATCH_MASK                                                  \
+  (IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM |        \
+   IN_MOVED_TO | IN_MOVE_SELF | IN_ONLYDIR)
+
+/**
+ * cache_entry - A resolved command
+ *
+ * Entries are chained per bucket, so they never move once allocated.
+ */
+struct cache_entry {
+  char *name;
+  char *path;
+  unsigned int hits;
+  struct cache_entry *next;
+};
+
+/**
+ * cache_file_header - Layout of the persisted cache
+ *
+ * The header is followed by entries_count cache_file_entry records and then
+ * strings_size bytes of null-terminated strings that the records point into.
+ */
+struct cache_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t entries_count;
+  uint64_t path_hash;
+  uint64_t dirs_stamp;
+  uint64_t strings_size;
+};
+
+struct cache_file_entry {
+  uint32_t name_offset;
+  uint32_t path_offset;
+  uint32_t hits;
+};
+
+static struct {
+  struct cache_entry **buckets;
+  unsigned int buckets_count;
+  unsigned int entries_count;
+  /* The $PATH the entries were resolved against */
+  char *path_env;
+  int inotify_fd;
+  /* Fallback when inotify is unavailable */
+  uint64_t dirs_stamp;
+  bool persist;
+} cache = {.inotify_fd = -1};
+
+/* Whether a name was reported as not found, see path_cache_take_miss() */
+static bool miss_reported;
+
+/**
+ * fnv1a - Hash a buffer
+ * @data: Bytes to hash
+ * @len: Number of bytes
+ * @hash: Starting value, chain calls by passing the previous result
+ *
+ * FNV-1a is tiny and good enough for short keys like command names.
+ *
+ * Return: 64-bit hash
+ */
+uint64_t fnv1a(const void *data, size_t len, uint64_t hash) {
+  const unsigned char *bytes = data;
+
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+/**
+ * current_path_env - Get the $PATH that lookups should use
+ *
+ * Return: Value of $PATH, or DEFAULT_PATH if unset
+ */
+const char *current_path_env(void) {
+  const char *path_env = getenv("PATH");
+  return path_env ? path_env : DEFAULT_PATH;
+}
+
+/**
+ * next_path_dir - Extract the next directory from a $PATH string
+ * @cursor: Position in the $PATH string, advanced past the directory
+ * @dir: Output buffer of PATH_MAX bytes
+ *
+ * An empty component means the current directory, as in execvp().
+ *
+ * Return: true if a directory was extracted, false at the end of the string
+ */
+bool next_path_dir(const char **cursor, char *dir) {
+  if (!*cursor) {
+    return false;
+  }
+
+  const char *colon = strchr(*cursor, ':');
+  size_t len = colon ? (size_t)(colon - *cursor) : strlen(*cursor);
+
+  if (len == 0) {
+    snprintf(dir, PATH_MAX, ".");
+  } else {
+    snprintf(dir, PATH_MAX, "%.*s", (int)len, *cursor);
+  }
+
+  *cursor = colon ? colon + 1 : NULL;
+
+  return true;
+}
+
+/**
+ * compute_dirs_stamp - Summarize the modification times of $PATH directories
+ * @path_env: $PATH string
+ *
+ * Any program being added, removed or renamed changes the modification time of
+ * the directory it is in, and therefore the stamp.
+ *
+ * Return: Hash of every directory's modification time
+ */
+uint64_t compute_dirs_stamp(const char *path_env) {
+  uint64_t stamp = FNV1A_SEED;
+  char dir[PATH_MAX];
+  struct stat dir_stat;
+
+  while (next_path_dir(&path_env, dir)) {
+    struct timespec mtime = {0, 0};
+
+    if (stat(dir, &dir_stat) == 0) {
+      mtime = dir_stat.st_mtim;
+    }
+
+    stamp = fnv1a(&mtime.tv_sec, sizeof(mtime.tv_sec), stamp);
+    stamp = fnv1a(&mtime.tv_nsec, sizeof(mtime.tv_nsec), stamp);
+  }
+
+  return stamp;
+}
+
+/**
+ * find_entry - Find the entry for a command name
+ * @name: Command name
+ *
+ * Return: Entry if cached, NULL otherwise
+ */
+struct cache_entry *find_entry(const char *name) {
+  if (!cache.buckets) {
+    return NULL;
+  }
+
+  uint64_t hash = fnv1a(name, strlen(name), FNV1A_SEED);
+  struct cache_entry *entry = cache.buckets[hash % cache.buckets_count];
+
+  while (entry && strcmp(entry->name, name) != 0) {
+    entry = entry->next;
+  }
+
+  return entry;
+}
+
+/**
+ * grow_buckets - Double the number of buckets
+ *
+ * Keeps chains short as the number of cached commands grows.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int grow_buckets(void) {
+  unsigned int new_count =
+      cache.buckets_count ? cache.buckets_count * 2 : PATH_CACHE_BUCKETS_MIN;
+
+  struct cache_entry **new_buckets = calloc(new_count, sizeof(*new_buckets));
+  if (!new_buckets) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  for (unsigned int i = 0; i < cache.buckets_count; i++) {
+    struct cache_entry *entry = cache.buckets[i];
+
+    while (entry) {
+      struct cache_entry *next = entry->next;
+      uint64_t hash = fnv1a(entry->name, strlen(entry->name), FNV1A_SEED);
+
+      entry->next = new_buckets[hash % new_count];
+      new_buckets[hash % new_count] = entry;
+      entry = next;
+    }
+  }
+
+  free(cache.buckets);
+  cache.buckets = new_buckets;
+  cache.buckets_count = new_count;
+
+  return 0;
+}
+
+/**
+ * insert_entry - Add a resolved command to the cache
+ * @name: Command name
+ * @path: Full path of the executable
+ * @hits: Initial hit count
+ *
+ * Return: New entry, NULL on error
+ */
+struct cache_entry *insert_entry(const char *name, const char *path,
+                                 unsigned int hits) {
+  if (cache.entries_count >= cache.buckets_count && grow_buckets() == -1) {
+    return NULL;
+  }
+
+  struct cache_entry *entry = malloc(sizeof(*entry));
+  if (!entry) {
+    error_msg(malloc_fail_msg, true);
+    return NULL;
+  }
+
+  entry->name = strdup(name);
+  entry->path = strdup(path);
+  if (!entry->name || !entry->path) {
+    error_msg(strdup_fail_msg, true);
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+    return NULL;
+  }
+
+  uint64_t hash = fnv1a(name, strlen(name), FNV1A_SEED);
+
+  entry->hits = hits;
+  entry->next = cache.buckets[hash % cache.buckets_count];
+  cache.buckets[hash % cache.buckets_count] = entry;
+  cache.entries_count++;
+
+  return entry;
+}
+
+/**
+ * path_cache_forget - Remove a single entry
+ * @name: Command name to forget
+ *
+ * Used when a cached path turns out to be stale, so the next lookup searches
+ * $PATH again.
+ */
+void path_cache_forget(const char *name) {
+  if (!cache.buckets) {
+    return;
+  }
+
+  uint64_t hash = fnv1a(name, strlen(name), FNV1A_SEED);
+  struct cache_entry **link = &cache.buckets[hash % cache.buckets_count];
+
+  while (*link) {
+    struct cache_entry *entry = *link;
+
+    if (strcmp(entry->name, name) == 0) {
+      *link = entry->next;
+      free(entry->name);
+      free(entry->path);
+      free(entry);
+      cache.entries_count--;
+      return;
+    }
+
+    link = &entry->next;
+  }
+}
+
+/**
+ * path_cache_reset - Remove every entry
+ */
+void path_cache_reset(void) {
+  for (unsigned int i = 0; i < cache.buckets_count; i++) {
+    struct cache_entry *entry = cache.buckets[i];
+
+    while (entry) {
+      struct cache_entry *next = entry->next;
+      free(entry->name);
+      free(entry->path);
+      free(entry);
+      entry = next;
+    }
+
+    cache.buckets[i] = NULL;
+  }
+
+  cache.entries_count = 0;
+}
+
+/**
+ * watch_path_dirs - Start watching the directories of the current $PATH
+ *
+ * Replaces any previous watches. If inotify can't be used, records the
+ * directory modification times for the fallback check instead.
+ */
+void watch_path_dirs(void) {
+  if (cache.inotify_fd != -1) {
+    close(cache.inotify_fd);
+  }
+
+  cache.dirs_stamp = compute_dirs_stamp(cache.path_env);
+
+  cache.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (cache.inotify_fd == -1) {
+    return;
+  }
+
+  const char *cursor = cache.path_env;
+  char dir[PATH_MAX];
+
+  /* Directories that don't exist can't contain programs, so skip them */
+  while (next_path_dir(&cursor, dir)) {
+    inotify_add_watch(cache.inotify_fd, dir, PATH_CACHE_WATCH_MASK);
+  }
+}
+
+/**
+ * drain_events - Apply pending inotify events
+ *
+ * Each event names the file that changed, so only that entry is dropped. If
+ * events were lost or a whole directory went away, everything is dropped.
+ */
+void drain_events(void) {
+  /* Aligned as required by the inotify man page */
+  char buffer[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  while ((len = read(cache.inotify_fd, buffer, sizeof(buffer))) > 0) {
+    for (char *ptr = buffer; ptr < buffer + len;) {
+      const struct inotify_event *event = (const struct inotify_event *)ptr;
+
+      if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        path_cache_reset();
+      } else if (event->len > 0) {
+        path_cache_forget(event->name);
+      }
+
+      ptr += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+/**
+ * path_cache_sync - Drop entries invalidated since the last sync
+ *
+ * Processes pending change notifications for the $PATH directories. Pointers
+ * returned by path_cache_lookup() stay valid until the next call to this
+ * function or to path_cache_reset().
+ */
+void path_cache_sync(void) {
+  const char *path_env = current_path_env();
+
+  if (!cache.path_env || strcmp(cache.path_env, path_env) != 0) {
+    char *new_path_env = strdup(path_env);
+    if (!new_path_env) {
+      error_msg(strdup_fail_msg, true);
+      return;
+    }
+
+    free(cache.path_env);
+    cache.path_env = new_path_env;
+    path_cache_reset();
+    watch_path_dirs();
+    return;
+  }
+
+  if (cache.inotify_fd != -1) {
+    drain_events();
+    return;
+  }
+
+  uint64_t stamp = compute_dirs_stamp(cache.path_env);
+
+  if (stamp != cache.dirs_stamp) {
+    path_cache_reset();
+    cache.dirs_stamp = stamp;
+  }
+}
+
+/**
+ * search_path - Search the $PATH directories for a program
+ * @name: Command name
+ * @result: Output buffer of PATH_MAX bytes
+ *
+ * Return: true if an executable regular file was found, false otherwise
+ */
+bool search_path(const char *name, char *result) {
+  const char *cursor = cache.path_env;
+  char dir[PATH_MAX];
+  struct stat file_stat;
+
+  while (next_path_dir(&cursor, dir)) {
+    if (snprintf(result, PATH_MAX, "%s/%s", dir, name) >= PATH_MAX) {
+      continue;
+    }
+
+    if (stat(result, &file_stat) == 0 && S_ISREG(file_stat.st_mode) &&
+        access(result, X_OK) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * path_cache_lookup - Resolve a command name to an executable path
+ * @name: Command name as typed by the user
+ *
+ * Names containing a slash are returned unchanged, as the shell doesn't search
+ * $PATH for them.
+ *
+ * Return: Path to the executable, NULL if it wasn't found
+ */
+const char *path_cache_lookup(const char *name) {
+  if (strchr(name, '/')) {
+    return name;
+  }
+
+  if (!cache.path_env) {
+    path_cache_sync();
+  }
+
+  struct cache_entry *entry = find_entry(name);
+  if (entry) {
+    entry->hits++;
+    return entry->path;
+  }
+
+  char path[PATH_MAX];
+
+  if (name[0] == '\0' || !search_path(name, path)) {
+    return NULL;
+  }
+
+  entry = insert_entry(name, path, 1);
+
+  /* Still usable even if it couldn't be cached */
+  return entry ? entry->path : name;
+}
+
+/**
+ * path_cache_not_found - Report a command name that couldn't be resolved
+ * @name: Command name as typed by the user
+ *
+ * The command that failed because of it exits with NOT_FOUND_EXIT_CODE rather
+ * than 1, see path_cache_take_miss().
+ */
+void path_cache_not_found(const char *name) {
+  char msg[ERR_MSG_MAX];
+
+  snprintf(msg, ERR_MSG_MAX, "Command not found: %s", name);
+  error_msg(msg, false);
+
+  miss_reported = true;
+}
+
+/**
+ * path_cache_take_miss - Check whether a command name wasn't found
+ *
+ * The report is cleared, so it only counts for the command that made it.
+ *
+ * Return: true if path_cache_not_found() was called since the last check
+ */
+bool path_cache_take_miss(void) {
+  const bool missed = miss_reported;
+
+  miss_reported = false;
+
+  return missed;
+}
+
+/**
+ * path_cache_print - Print every entry with its hit count
+ *
+ * Return: Number of entries printed
+ */
+unsigned int path_cache_print(void) {
+  if (cache.entries_count == 0) {
+    return 0;
+  }
+
+  printf("hits\tcommand\n");
+
+  for (unsigned int i = 0; i < cache.buckets_count; i++) {
+    for (struct cache_entry *entry = cache.buckets[i]; entry;
+         entry = entry->next) {
+      printf("%4u\t%s\n", entry->hits, entry->path);
+    }
+  }
+
+  return cache.entries_count;
+}
+
+/**
+ * construct_cache_file_path - Build the path of the persisted cache
+ * @path: Output buffer of PATH_MAX bytes
+ *
+ * $XDG_RUNTIME_DIR is private to the user and cleared at logout, which is
+ * exactly the lifetime we want for this cache.
+ *
+ * Return: 0 on success, -1 if $XDG_RUNTIME_DIR isn't set
+ */
+int construct_cache_file_path(char *path) {
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (!runtime_dir) {
+    return -1;
+  }
+
+  snprintf(path, PATH_MAX, "%s/%s", runtime_dir, PATH_CACHE_FILE);
+
+  return 0;
+}
+
+/**
+ * load_cache_file - Load entries persisted by a previous session
+ *
+ * The file is mmapped rather than read so that it is consumed directly from the
+ * page cache. Anything that doesn't look exactly right is silently ignored, the
+ * cache will simply start cold.
+ */
+void load_cache_file(void) {
+  char file_path[PATH_MAX];
+
+  if (construct_cache_file_path(file_path) == -1) {
+    return;
+  }
+
+  int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+
+  struct stat file_stat;
+
+  if (fstat(fd, &file_stat) == -1 ||
+      (size_t)file_stat.st_size < sizeof(struct cache_file_header)) {
+    close(fd);
+    return;
+  }
+
+  size_t size = (size_t)file_stat.st_size;
+  char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    return;
+  }
+
+  const struct cache_file_header *header = (const void *)map;
+  const char *path_env = cache.path_env;
+
+  if (memcmp(header->magic, PATH_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != PATH_CACHE_VERSION ||
+      header->path_hash != fnv1a(path_env, strlen(path_env), FNV1A_SEED) ||
+      header->dirs_stamp != compute_dirs_stamp(path_env) ||
+      size != sizeof(*header) +
+                  header->entries_count * sizeof(struct cache_file_entry) +
+                  header->strings_size ||
+      header->strings_size == 0) {
+    munmap(map, size);
+    return;
+  }
+
+  const struct cache_file_entry *entries = (const void *)(header + 1);
+  const char *strings = (const char *)(entries + header->entries_count);
+
+  /* Make sure every string is terminated inside the mapping */
+  if (strings[header->strings_size - 1] != '\0') {
+    munmap(map, size);
+    return;
+  }
+
+  for (uint32_t i = 0; i < header->entries_count; i++) {
+    if (entries[i].name_offset >= header->strings_size ||
+        entries[i].path_offset >= header->strings_size) {
+      break;
+    }
+
+    const char *name = strings + entries[i].name_offset;
+
+    if (!find_entry(name) &&
+        !insert_entry(name, strings + entries[i].path_offset,
+                      entries[i].hits)) {
+      break;
+    }
+  }
+
+  munmap(map, size);
+}
+
+/**
+ * save_cache_file - Persist the cache for the next session
+ *
+ * The file is written under a temporary name and renamed into place, so a
+ * concurrently starting session never maps a half-written file.
+ */
+void save_cache_file(void) {
+  char file_path[PATH_MAX];
+  char temp_path[PATH_MAX];
+
+  if (cache.entries_count == 0 || !cache.path_env ||
+      construct_cache_file_path(file_path) == -1) {
+    return;
+  }
+
+  if (snprintf(temp_path, PATH_MAX, "%s.%d", file_path, getpid()) >=
+      PATH_MAX) {
+    return;
+  }
+
+  size_t strings_size = 0;
+
+  for (unsigned int i = 0; i < cache.buckets_count; i++) {
+    for (struct cache_entry *entry = cache.buckets[i]; entry;
+         entry = entry->next) {
+      strings_size += strlen(entry->name) + strlen(entry->path) + 2;
+    }
+  }
+
+  size_t size = sizeof(struct cache_file_header) +
+                cache.entries_count * sizeof(struct cache_file_entry) +
+                strings_size;
+
+  int fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    error_msg(open_fail_msg, true);
+    return;
+  }
+
+  if (ftruncate(fd, size) == -1) {
+    error_msg("Failed to size command cache file", true);
+    close(fd);
+    unlink(temp_path);
+    return;
+  }
+
+  char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    error_msg("Failed to map command cache file", true);
+    unlink(temp_path);
+    return;
+  }
+
+  struct cache_file_header *header = (void *)map;
+  struct cache_file_entry *entries = (void *)(header + 1);
+  char *strings = (char *)(entries + cache.entries_count);
+  uint32_t offset = 0;
+  uint32_t index = 0;
+
+  memcpy(header->magic, PATH_CACHE_MAGIC, sizeof(header->magic));
+  header->version = PATH_CACHE_VERSION;
+  header->entries_count = cache.entries_count;
+  header->path_hash =
+      fnv1a(cache.path_env, strlen(cache.path_env), FNV1A_SEED);
+  header->dirs_stamp = compute_dirs_stamp(cache.path_env);
+  header->strings_size = strings_size;
+
+  for (unsigned int i = 0; i < cache.buckets_count; i++) {
+    for (struct cache_entry *entry = cache.buckets[i]; entry;
+         entry = entry->next) {
+      entries[index].hits = entry->hits;
+
+      entries[index].name_offset = offset;
+      strcpy(strings + offset, entry->name);
+      offset += strlen(entry->name) + 1;
+
+      entries[index].path_offset = offset;
+      strcpy(strings + offset, entry->path);
+      offset += strlen(entry->path) + 1;
+
+      index++;
+    }
+  }
+
+  munmap(map, size);
+
+  if (rename(temp_path, file_path) == -1) {
+    error_msg("Failed to save command cache", true);
+    unlink(temp_path);
+  }
+}
+
+/**
+ * path_cache_init - Set up the cache at startup
+ * @current_ctx: Shell context (for configuration)
+ *
+ * Watches the $PATH directories for changes and, if HASH_PERSIST=1 is set in
+ * ~/.clownrc, loads the entries saved by a previous session so that the first
+ * commands of a new session don't have to search $PATH.
+ *
+ * Failing to set up the cache is non-fatal, lookups still work without it.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int path_cache_init(struct repl_ctx *current_ctx) {
+  const char *persist = get_user_env("HASH_PERSIST", current_ctx->user_envs,
+                                     current_ctx->user_envs_count);
+
+  cache.persist = persist && strcmp(persist, "1") == 0;
+
+  path_cache_sync();
+
+  if (!cache.path_env) {
+    return -1;
+  }
+
+  if (cache.persist) {
+    load_cache_file();
+  }
+
+  return 0;
+}
+
+/**
+ * path_cache_detach - Stop sharing the inotify instance with the shell
+ *
+ * For a forked child of the shell whose descriptors above stderr were closed.
+ * Reading the shell's inotify instance would take events the shell needs, so
+ * the child checks the modification times of the $PATH directories instead.
+ */
+void path_cache_detach(void) {
+  cache.inotify_fd = -1;
+
+  /* Nothing was tracked while inotify was, so the next sync starts over */
+  cache.dirs_stamp = 0;
+}
+
+/**
+ * path_cache_close - Persist (if enabled) and free the cache at shell exit
+ */
+void path_cache_close(void) {
+  if (cache.persist) {
+    save_cache_file();
+  }
+
+  path_cache_reset();
+
+  free(cache.buckets);
+  cache.buckets = NULL;
+  cache.buckets_count = 0;
+
+  free(cache.path_env);
+  cache.path_env = NULL;
+
+  if (cache.inotify_fd != -1) {
+    close(cache.inotify_fd);
+    cache.inotify_fd = -1;
+  }
+}
@@ -0,0 +1,239 @@
+/**
+ * pipe_size.c
+ *
+ * Pipe capacity tuning.
+ *
+ * OVERVIEW:
+ * A pipe holds 64 KiB by default. When a producer outpaces its consumer, the
+ * producer blocks every time those 64 KiB fill up and both processes end up
+ * context switching constantly. Larger pipes let each side do more work per
+ * wakeup, which matters for pipelines that move gigabytes.
+ *
+ * The capacity comes from PIPE_SIZE in ~/.clownrc, or from the pipesize
+ * keyword for a single pipeline:
+ *   pipesize 1M zcat huge.log.gz | grep ERROR | sort
+ *
+ * ADAPTIVE MODE:
+ * With "adaptive", pipes start at the default capacity and the shell samples
+ * them while it waits for the job. A pipe that is full in several samples in a
+ * row is doubled, up to /proc/sys/fs/pipe-max-size. The shell doesn't keep
+ * its own ends of the pipes (that would break EOF and EPIPE), so it reaches
+ * them through /proc/<pid>/fd/1 of the writing stage.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "error.h"
+#include "pipe_size.h"
+
+/* Used when /proc/sys/fs/pipe-max-size can't be read, the kernel's default */
+#define PIPE_MAX_SIZE_FALLBACK (1024 * 1024)
+
+/**
+ * parse_pipe_size - Parse a pipe capacity setting
+ * @spec: Size in bytes with an optional K, M or G suffix, or "adaptive"
+ * @pipe_size: Output parameter - size in bytes or PIPE_SIZE_ADAPTIVE
+ *
+ * Return: 0 on success, -1 if spec is invalid
+ */
+int parse_pipe_size(const char *spec, long *pipe_size) {
+  if (strcmp(spec, "adaptive") == 0) {
+    *pipe_size = PIPE_SIZE_ADAPTIVE;
+    return 0;
+  }
+
+  char *end;
+  long size = strtol(spec, &end, 10);
+
+  if (end == spec || size <= 0) {
+    return -1;
+  }
+
+  long multiplier = 1;
+
+  switch (*end) {
+  case 'G':
+  case 'g':
+    multiplier *= 1024;
+    /* fall through */
+  case 'M':
+  case 'm':
+    multiplier *= 1024;
+    /* fall through */
+  case 'K':
+  case 'k':
+    multiplier *= 1024;
+    end++;
+    break;
+  }
+
+  /* Checked before multiplying, which could overflow */
+  if (*end != '\0' || size > INT_MAX / multiplier) {
+    return -1;
+  }
+
+  *pipe_size = size * multiplier;
+
+  return 0;
+}
+
+/**
+ * pipe_size_for - Get the pipe capacity a pipeline should use
+ * @current_ctx: Shell context
+ *
+ * The pipesize keyword takes precedence over PIPE_SIZE from ~/.clownrc.
+ *
+ * Return: Size in bytes, PIPE_SIZE_DEFAULT or PIPE_SIZE_ADAPTIVE
+ */
+long pipe_size_for(struct repl_ctx *current_ctx) {
+  static bool config_parsed = false;
+  static long config_size = PIPE_SIZE_DEFAULT;
+
+  if (current_ctx->pipe_size != PIPE_SIZE_DEFAULT) {
+    return current_ctx->pipe_size;
+  }
+
+  /* The config doesn't change during a session, so only complain once */
+  if (!config_parsed) {
+    config_parsed = true;
+
+    const char *spec = get_user_env("PIPE_SIZE", current_ctx->user_envs,
+                                    current_ctx->user_envs_count);
+    if (spec && parse_pipe_size(spec, &config_size) == -1) {
+      error_msg("Invalid PIPE_SIZE in configuration file", false);
+      config_size = PIPE_SIZE_DEFAULT;
+    }
+  }
+
+  return config_size;
+}
+
+/**
+ * pipe_max_size - Get the largest capacity an unprivileged pipe can have
+ *
+ * Return: Size in bytes
+ */
+long pipe_max_size(void) {
+  static long max_size = 0;
+
+  if (max_size > 0) {
+    return max_size;
+  }
+
+  max_size = PIPE_MAX_SIZE_FALLBACK;
+
+  FILE *file = fopen("/proc/sys/fs/pipe-max-size", "re");
+  if (file) {
+    long value;
+    if (fscanf(file, "%ld", &value) == 1 && value > 0) {
+      max_size = value;
+    }
+    fclose(file);
+  }
+
+  return max_size;
+}
+
+/**
+ * pipe_size_apply - Set the capacity of a pipe
+ * @fd: Either end of the pipe
+ * @pipe_size: Requested size in bytes
+ *
+ * The size is clamped to /proc/sys/fs/pipe-max-size, which is as far as an
+ * unprivileged process may go. The kernel rounds it up to a power of two
+ * number of pages.
+ *
+ * Return: New capacity on success, -1 on error
+ */
+int pipe_size_apply(int fd, long pipe_size) {
+  static bool reported = false;
+
+  if (pipe_size > pipe_max_size()) {
+    pipe_size = pipe_max_size();
+  }
+
+  int capacity = fcntl(fd, F_SETPIPE_SZ, (int)pipe_size);
+
+  /*
+   * EPERM means the user is over their total pipe buffer allowance, which
+   * would repeat for every pipe of the pipeline.
+   */
+  if (capacity == -1 && !reported) {
+    error_msg("Failed to resize pipe", true);
+    reported = true;
+  }
+
+  return capacity;
+}
+
+/**
+ * sample_stage - Check whether a stage is writing into a full pipe
+ * @proc: Stage to check, its full_samples count is updated
+ */
+void sample_stage(struct job_proc *proc) {
+  char fd_path[64];
+  snprintf(fd_path, sizeof(fd_path), "/proc/%d/fd/1", proc->pid);
+
+  struct stat st;
+  if (stat(fd_path, &st) == -1 || !S_ISFIFO(st.st_mode)) {
+    proc->full_samples = 0;
+    return;
+  }
+
+  /*
+   * Opening the pipe for reading adds a reader for a moment, but without
+   * reading anything nothing changes for the stages using it.
+   */
+  int fd = open(fd_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+
+  int capacity = fcntl(fd, F_GETPIPE_SZ);
+  int queued = 0;
+
+  /* Within PIPE_BUF of full, a write of any size may block */
+  if (capacity > 0 && ioctl(fd, FIONREAD, &queued) == 0 &&
+      queued >= capacity - PIPE_BUF) {
+    proc->full_samples++;
+  } else {
+    proc->full_samples = 0;
+  }
+
+  if (proc->full_samples >= PIPE_SIZE_FULL_SAMPLES &&
+      capacity < pipe_max_size()) {
+    pipe_size_apply(fd, (long)capacity * 2);
+    proc->full_samples = 0;
+  }
+
+  close(fd);
+}
+
+/**
+ * pipe_size_adapt - Job monitor that grows pipes which keep filling up
+ * @job: Foreground job being waited for
+ *
+ * Called periodically while the job runs. Every stage whose stdout is a pipe
+ * that is found full PIPE_SIZE_FULL_SAMPLES times in a row, meaning the stage
+ * keeps blocking on its consumer, gets that pipe doubled.
+ */
+void pipe_size_adapt(struct job *job) {
+  /* The last stage writes to the shell's stdout, which isn't ours to resize */
+  for (unsigned int i = 0; i + 1 < job->procs_count; i++) {
+    struct job_proc *proc = &job->procs[i];
+
+    if (!proc->finished && !proc->stopped) {
+      sample_stage(proc);
+    }
+  }
+}
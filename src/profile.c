@@ -0,0 +1,675 @@
+/**
+ * profile.c
+ *
+ * Per-stage byte and throughput accounting for the profile keyword.
+ *
+ * OVERVIEW:
+ * A profiled pipeline doesn't connect its stages directly. Each stage writes
+ * to a pipe the shell reads, and the shell splice()s what arrives into a
+ * second pipe the next stage reads. splice() moves pages between the two
+ * pipes without copying them, so the relay costs little more than the system
+ * calls, and every byte that crosses a stage boundary passes in front of the
+ * shell.
+ *
+ * WAITING:
+ * A relay is always waiting on one side. Either the upstream pipe is empty,
+ * so the downstream stage is starved for input, or the downstream pipe is
+ * full, so the upstream stage is about to block on its writes. The time spent
+ * in each state is charged to the stage it holds up. A stage that makes its
+ * neighbours wait while rarely waiting itself is the bottleneck.
+ *
+ * Relays only run while the shell waits for the job in the foreground, which
+ * is why background pipelines aren't profiled and a stopped one stalls until
+ * it is brought back with fg.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "pipe_size.h"
+#include "profile.h"
+#include "relay.h"
+#include "timing.h"
+
+/* Most splice() calls per wakeup, so one busy relay can't starve the others */
+#define PUMP_CALLS_MAX 64
+
+/* Most relays handled per wakeup, the rest are picked up by the next one */
+#define PROFILE_EVENTS_MAX 16
+
+enum { READ_END, WRITE_END };
+
+/**
+ * relay - Mover between a stage and the next one
+ * @from: Read end of the upstream stage's pipe
+ * @to: Write end of the downstream stage's pipe
+ * @registered: Descriptor currently watched with epoll, -1 if none
+ * @blocked: Whether waiting on a full downstream pipe rather than an empty
+ * upstream one
+ * @done: Whether either side went away and both ends were closed
+ * @since: When the current wait started
+ * @bytes: Bytes moved so far
+ * @starved_time: Time the upstream pipe was empty
+ * @blocked_time: Time the downstream pipe was full
+ */
+struct relay {
+  int from;
+  int to;
+  int registered;
+  bool blocked;
+  bool done;
+  struct timespec since;
+  unsigned long long bytes;
+  struct timespec starved_time;
+  struct timespec blocked_time;
+};
+
+/**
+ * profile - Profiling state of a job
+ * @epoll_fd: Watches one side of every relay, the job's io_fd
+ * @stages_count: Number of stages in the pipeline
+ * @names: Command name of every stage
+ * @relays: relays[i] sits between stage i and stage i + 1
+ * @json: Whether the report is JSON rather than a table
+ * @output: File the report is appended to, NULL for stderr
+ */
+struct profile {
+  int epoll_fd;
+  unsigned int stages_count;
+  char **names;
+  struct relay *relays;
+  bool json;
+  char *output;
+};
+
+/**
+ * add_elapsed - Add the time since a point to a total
+ * @total: Total to add to
+ * @since: Start of the interval
+ * @now: End of the interval
+ */
+void add_elapsed(struct timespec *total, const struct timespec *since,
+                 const struct timespec *now) {
+  total->tv_sec += now->tv_sec - since->tv_sec;
+  total->tv_nsec += now->tv_nsec - since->tv_nsec;
+
+  if (total->tv_nsec < 0) {
+    total->tv_sec--;
+    total->tv_nsec += 1000000000L;
+  } else if (total->tv_nsec >= 1000000000L) {
+    total->tv_sec++;
+    total->tv_nsec -= 1000000000L;
+  }
+}
+
+/**
+ * charge_wait - Charge the time since the current wait started
+ * @relay: Relay that stops waiting
+ * @now: Current time
+ */
+void charge_wait(struct relay *relay, const struct timespec *now) {
+  add_elapsed(relay->blocked ? &relay->blocked_time : &relay->starved_time,
+              &relay->since, now);
+  relay->since = *now;
+}
+
+/**
+ * relay_wait - Wait for the side of a relay that holds it up
+ * @profile: Profile the relay belongs to
+ * @relay: Relay to update
+ * @blocked: true to wait for room downstream, false for data upstream
+ *
+ * Only one side is watched at a time: a pipe whose other end was closed is
+ * always ready, and watching it while waiting on the other side would spin.
+ */
+void relay_wait(struct profile *profile, struct relay *relay, bool blocked) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  charge_wait(relay, &now);
+  relay->blocked = blocked;
+
+  int fd = blocked ? relay->to : relay->from;
+  if (fd == relay->registered) {
+    return;
+  }
+
+  if (relay->registered != -1) {
+    epoll_ctl(profile->epoll_fd, EPOLL_CTL_DEL, relay->registered, NULL);
+  }
+
+  struct epoll_event event = {.events = blocked ? EPOLLOUT : EPOLLIN,
+                              .data.ptr = relay};
+
+  relay->registered = epoll_ctl(profile->epoll_fd, EPOLL_CTL_ADD, fd, &event)
+                          ? -1
+                          : fd;
+}
+
+/**
+ * relay_finish - Close both ends of a relay
+ * @relay: Relay whose upstream stage finished or downstream stage went away
+ *
+ * Closing the downstream pipe is what gives the next stage EOF, closing the
+ * upstream one gives the previous stage EPIPE. Closing also takes the watched
+ * descriptor out of the epoll set.
+ */
+void relay_finish(struct relay *relay) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  charge_wait(relay, &now);
+
+  close(relay->from);
+  close(relay->to);
+  relay->registered = -1;
+  relay->done = true;
+}
+
+/**
+ * pump - Move whatever a relay can move without blocking
+ * @profile: Profile the relay belongs to
+ * @relay: Relay that is ready
+ */
+void pump(struct profile *profile, struct relay *relay) {
+  if (relay->done) {
+    return;
+  }
+
+  for (unsigned int i = 0; i < PUMP_CALLS_MAX; i++) {
+    ssize_t moved = splice(relay->from, NULL, relay->to, NULL, RELAY_CHUNK,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    if (moved > 0) {
+      relay->bytes += moved;
+      continue;
+    }
+
+    if (moved == -1 && errno == EINTR) {
+      continue;
+    }
+
+    /* EAGAIN doesn't say which side it came from, the upstream pipe does */
+    if (moved == -1 && errno == EAGAIN) {
+      int pending = 0;
+      ioctl(relay->from, FIONREAD, &pending);
+      relay_wait(profile, relay, pending > 0);
+      return;
+    }
+
+    /* EOF upstream, or EPIPE because the downstream stage exited */
+    relay_finish(relay);
+    return;
+  }
+
+  /* Still moving, watch the upstream side so we come straight back */
+  relay_wait(profile, relay, false);
+}
+
+/**
+ * profile_ready - io_ready hook, runs the relays that can make progress
+ * @job: Job being profiled
+ */
+void profile_ready(struct job *job) {
+  struct profile *profile = job->io_data;
+  struct epoll_event events[PROFILE_EVENTS_MAX];
+
+  int ready = epoll_wait(profile->epoll_fd, events, PROFILE_EVENTS_MAX, 0);
+
+  for (int i = 0; i < ready; i++) {
+    pump(profile, events[i].data.ptr);
+  }
+}
+
+/**
+ * format_bytes - Format a byte count for the report table
+ * @buffer: Output buffer
+ * @size: Size of buffer
+ * @bytes: Byte count
+ */
+void format_bytes(char *buffer, size_t size, double bytes) {
+  static const char units[] = "BKMGT";
+  unsigned int unit = 0;
+
+  while (bytes >= 1024 && unit < sizeof(units) - 2) {
+    bytes /= 1024;
+    unit++;
+  }
+
+  snprintf(buffer, size, unit ? "%.1f%c" : "%.0f%c", bytes, units[unit]);
+}
+
+/**
+ * stage_stats - Figures reported for one stage
+ * @has_in: Whether the stage reads from a relay
+ * @has_out: Whether the stage writes to a relay
+ * @bytes_in: Bytes the stage read
+ * @bytes_out: Bytes the stage wrote
+ * @in_wait: Seconds the stage's input was empty
+ * @out_wait: Seconds the stage's output was full
+ * @elapsed: Seconds the stage ran, negative if it isn't known
+ * @busy: Fraction of elapsed the stage wasn't waiting on a neighbour
+ */
+struct stage_stats {
+  bool has_in;
+  bool has_out;
+  unsigned long long bytes_in;
+  unsigned long long bytes_out;
+  double in_wait;
+  double out_wait;
+  double elapsed;
+  double busy;
+};
+
+/**
+ * collect_stats - Work out the figures of one stage
+ * @job: Job being profiled
+ * @profile: Its profile
+ * @stage: Position of the stage in the pipeline
+ * @stats: Output parameter - figures
+ */
+void collect_stats(const struct job *job, const struct profile *profile,
+                   unsigned int stage, struct stage_stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+
+  if (stage > 0) {
+    const struct relay *in = &profile->relays[stage - 1];
+    stats->has_in = true;
+    stats->bytes_in = in->bytes;
+    stats->in_wait = timespec_seconds(&in->starved_time);
+  }
+
+  if (stage < profile->stages_count - 1) {
+    const struct relay *out = &profile->relays[stage];
+    stats->has_out = true;
+    stats->bytes_out = out->bytes;
+    stats->out_wait = timespec_seconds(&out->blocked_time);
+  }
+
+  stats->elapsed = -1;
+  stats->busy = -1;
+
+  /* Stages that failed to launch are missing, so procs may not line up */
+  if (job->procs_count != profile->stages_count) {
+    return;
+  }
+
+  const struct job_proc *proc = &job->procs[stage];
+  struct timespec elapsed = {0, 0};
+
+  add_elapsed(&elapsed, &proc->start_time, &proc->end_time);
+  stats->elapsed = timespec_seconds(&elapsed);
+
+  if (stats->elapsed > 0) {
+    stats->busy = 1 - (stats->in_wait + stats->out_wait) / stats->elapsed;
+    stats->busy = stats->busy < 0 ? 0 : stats->busy;
+  }
+}
+
+/**
+ * find_bottleneck - Pick the stage that kept the others waiting
+ * @job: Job being profiled
+ * @profile: Its profile
+ *
+ * Return: Position of the busiest stage, -1 if it can't be told
+ */
+int find_bottleneck(const struct job *job, const struct profile *profile) {
+  int bottleneck = -1;
+  double busiest = -1;
+
+  for (unsigned int i = 0;
+       profile->stages_count > 1 && i < profile->stages_count; i++) {
+    struct stage_stats stats;
+    collect_stats(job, profile, i, &stats);
+
+    if (stats.busy > busiest) {
+      busiest = stats.busy;
+      bottleneck = (int)i;
+    }
+  }
+
+  return bottleneck;
+}
+
+/**
+ * print_json_string - Print a string as a JSON string literal
+ * @stream: Stream to print to
+ * @str: String to print
+ */
+void print_json_string(FILE *stream, const char *str) {
+  fputc('"', stream);
+
+  for (; *str; str++) {
+    unsigned char c = *str;
+
+    if (c == '"' || c == '\\') {
+      fprintf(stream, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(stream, "\\u%04x", c);
+    } else {
+      fputc(c, stream);
+    }
+  }
+
+  fputc('"', stream);
+}
+
+/**
+ * report_json - Print the report as a single line of JSON
+ * @stream: Stream to print to
+ * @job: Job being profiled
+ * @profile: Its profile
+ *
+ * Byte counts are null for the ends of the pipeline, which don't go through a
+ * relay, and times are in seconds.
+ */
+void report_json(FILE *stream, const struct job *job,
+                 const struct profile *profile) {
+  fprintf(stream, "{\"command\":");
+  print_json_string(stream, job->command);
+  fprintf(stream, ",\"stages\":[");
+
+  for (unsigned int i = 0; i < profile->stages_count; i++) {
+    struct stage_stats stats;
+    collect_stats(job, profile, i, &stats);
+
+    fprintf(stream, "%s{\"stage\":%u,\"command\":", i ? "," : "", i + 1);
+    print_json_string(stream, profile->names[i]);
+
+    if (stats.has_in) {
+      fprintf(stream, ",\"bytes_in\":%llu,\"in_wait\":%.6f", stats.bytes_in,
+              stats.in_wait);
+    } else {
+      fprintf(stream, ",\"bytes_in\":null,\"in_wait\":null");
+    }
+
+    if (stats.has_out) {
+      fprintf(stream, ",\"bytes_out\":%llu,\"out_wait\":%.6f", stats.bytes_out,
+              stats.out_wait);
+    } else {
+      fprintf(stream, ",\"bytes_out\":null,\"out_wait\":null");
+    }
+
+    if (stats.elapsed >= 0) {
+      fprintf(stream, ",\"elapsed\":%.6f,\"busy\":%.4f,\"exit\":%d",
+              stats.elapsed, stats.busy < 0 ? 0 : stats.busy,
+              exit_code_of(job->procs[i].status));
+    }
+
+    fprintf(stream, "}");
+  }
+
+  int bottleneck = find_bottleneck(job, profile);
+
+  if (bottleneck >= 0) {
+    fprintf(stream, "],\"bottleneck\":%d}\n", bottleneck + 1);
+  } else {
+    fprintf(stream, "],\"bottleneck\":null}\n");
+  }
+}
+
+/**
+ * report_table - Print the report as a table
+ * @stream: Stream to print to
+ * @job: Job being profiled
+ * @profile: Its profile
+ *
+ * The rate is what went through the stage per second it ran, measured on its
+ * output, or its input for the last stage.
+ */
+void report_table(FILE *stream, const struct job *job,
+                  const struct profile *profile) {
+  fprintf(stream, "%-6s %10s %10s %10s %10s %10s %5s  %s\n", "stage", "in",
+          "out", "rate", "in wait", "out wait", "busy", "command");
+
+  for (unsigned int i = 0; i < profile->stages_count; i++) {
+    struct stage_stats stats;
+    char in[16] = "-";
+    char out[16] = "-";
+    char rate[24] = "-";
+    char in_wait[16] = "-";
+    char out_wait[16] = "-";
+    char busy[8] = "-";
+
+    collect_stats(job, profile, i, &stats);
+
+    if (stats.has_in) {
+      format_bytes(in, sizeof(in), stats.bytes_in);
+      snprintf(in_wait, sizeof(in_wait), "%.3fs", stats.in_wait);
+    }
+
+    if (stats.has_out) {
+      format_bytes(out, sizeof(out), stats.bytes_out);
+      snprintf(out_wait, sizeof(out_wait), "%.3fs", stats.out_wait);
+    }
+
+    if (stats.elapsed > 0) {
+      unsigned long long moved =
+          stats.has_out ? stats.bytes_out : stats.bytes_in;
+
+      format_bytes(rate, sizeof(rate) - 2, moved / stats.elapsed);
+      strcat(rate, "/s");
+      snprintf(busy, sizeof(busy), "%.0f%%", stats.busy * 100);
+    }
+
+    fprintf(stream, "%-6u %10s %10s %10s %10s %10s %5s  %s\n", i + 1, in, out,
+            rate, in_wait, out_wait, busy, profile->names[i]);
+  }
+
+  int bottleneck = find_bottleneck(job, profile);
+
+  if (bottleneck >= 0) {
+    fprintf(stream, "bottleneck: stage %d (%s)\n", bottleneck + 1,
+            profile->names[bottleneck]);
+  }
+}
+
+/**
+ * profile_report - Print the report where the profile keyword asked for it
+ * @job: Job that finished
+ * @profile: Its profile
+ */
+void profile_report(const struct job *job, const struct profile *profile) {
+  FILE *stream = stderr;
+
+  if (profile->output) {
+    stream = fopen(profile->output, "ae");
+    if (!stream) {
+      error_msg(open_fail_msg, true);
+      return;
+    }
+  }
+
+  if (profile->json) {
+    report_json(stream, job, profile);
+  } else {
+    report_table(stream, job, profile);
+  }
+
+  if (stream != stderr) {
+    fclose(stream);
+  }
+}
+
+/**
+ * close_relays - Close the relays that are still open
+ * @profile: Profile whose relays to close
+ */
+void close_relays(struct profile *profile) {
+  for (unsigned int i = 0; profile->relays && i < profile->stages_count; i++) {
+    if (!profile->relays[i].done) {
+      relay_finish(&profile->relays[i]);
+    }
+  }
+}
+
+/**
+ * free_profile - Close every relay and free a profile
+ * @profile: Profile to free
+ */
+void free_profile(struct profile *profile) {
+  close_relays(profile);
+
+  for (unsigned int i = 0; profile->names && i < profile->stages_count; i++) {
+    free(profile->names[i]);
+  }
+
+  if (profile->epoll_fd != -1) {
+    close(profile->epoll_fd);
+  }
+
+  free(profile->names);
+  free(profile->relays);
+  free(profile->output);
+  free(profile);
+}
+
+/**
+ * profile_release - io_release hook, reports on a finished job
+ * @job: Job being removed
+ *
+ * Jobs that are removed before they are done (disown, exit) aren't reported,
+ * their figures would be incomplete.
+ */
+void profile_release(struct job *job) {
+  struct profile *profile = job->io_data;
+
+  /* Wait times run until the relays close, which is now for any still open */
+  close_relays(profile);
+
+  if (job_is_done(job)) {
+    profile_report(job, profile);
+  }
+
+  free_profile(profile);
+
+  job->io_data = NULL;
+  job->io_fd = -1;
+}
+
+/**
+ * profile_start - Prepare a job for profiling
+ * @job: Foreground job about to be launched
+ * @current_ctx: Shell context with the pipeline's commands and report options
+ *
+ * The job's I/O hooks are pointed at the profile, so relays run while the
+ * shell waits for the job and the report is printed once the job is removed.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int profile_start(struct job *job, struct repl_ctx *current_ctx) {
+  const unsigned int count = current_ctx->commands_count;
+
+  struct profile *profile = calloc(1, sizeof(*profile));
+  if (!profile) {
+    error_msg(malloc_fail_msg, true);
+    return -1;
+  }
+
+  profile->epoll_fd = -1;
+  profile->stages_count = count;
+  profile->json = current_ctx->profile_json;
+  profile->names = calloc(count, sizeof(*profile->names));
+  profile->relays = calloc(count, sizeof(*profile->relays));
+  if (!profile->names || !profile->relays) {
+    error_msg(malloc_fail_msg, true);
+    free_profile(profile);
+    return -1;
+  }
+
+  /* Relays that never get created hold no descriptors */
+  for (unsigned int i = 0; i < count; i++) {
+    profile->relays[i].from = -1;
+    profile->relays[i].to = -1;
+    profile->relays[i].registered = -1;
+    profile->relays[i].done = true;
+
+    profile->names[i] = strdup(current_ctx->commands[i][0]);
+    if (!profile->names[i]) {
+      error_msg(malloc_fail_msg, true);
+      free_profile(profile);
+      return -1;
+    }
+  }
+
+  if (current_ctx->profile_output) {
+    profile->output = strdup(current_ctx->profile_output);
+    if (!profile->output) {
+      error_msg(malloc_fail_msg, true);
+      free_profile(profile);
+      return -1;
+    }
+  }
+
+  profile->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (profile->epoll_fd == -1) {
+    error_msg("Failed to create epoll instance", true);
+    free_profile(profile);
+    return -1;
+  }
+
+  job->io_fd = profile->epoll_fd;
+  job->io_ready = profile_ready;
+  job->io_release = profile_release;
+  job->io_data = profile;
+
+  return 0;
+}
+
+/**
+ * profile_relay - Put a relay between a stage and the next one
+ * @job: Job being profiled
+ * @stage: Position of the upstream stage in the pipeline
+ * @read_end: Read end of the upstream stage's pipe, replaced with the read end
+ * the downstream stage should use
+ * @pipe_size: Capacity for the new pipe, as for the upstream one
+ *
+ * The shell keeps the original read end and a second pipe's write end, and
+ * moves data from one to the other with splice().
+ *
+ * Return: 0 on success, -1 on error (read_end is left alone)
+ */
+int profile_relay(struct job *job, unsigned int stage, int *read_end,
+                  long pipe_size) {
+  struct profile *profile = job->io_data;
+  struct relay *relay = &profile->relays[stage];
+  int pipe_fds[2];
+
+  if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+    error_msg("Failed to create pipe", true);
+    return -1;
+  }
+
+  if (pipe_size > 0) {
+    pipe_size_apply(pipe_fds[WRITE_END], pipe_size);
+  }
+
+  /*
+   * Only the shell holds these two ends, the stages get the other ones, so
+   * making them non-blocking doesn't affect the stages.
+   */
+  fcntl(*read_end, F_SETFL, O_NONBLOCK);
+  fcntl(pipe_fds[WRITE_END], F_SETFL, O_NONBLOCK);
+
+  relay->from = *read_end;
+  relay->to = pipe_fds[WRITE_END];
+  relay->done = false;
+  relay->blocked = false;
+  clock_gettime(CLOCK_MONOTONIC, &relay->since);
+
+  /* Nothing has been written yet, so the relay starts out starved */
+  relay_wait(profile, relay, false);
+
+  *read_end = pipe_fds[READ_END];
+
+  return 0;
+}
@@ -0,0 +1,278 @@
+/**
+ * relay.c
+ *
+ * Moving data between descriptors inside the kernel.
+ *
+ * OVERVIEW:
+ * A read()/write() loop copies every byte into a userspace buffer and back
+ * out again. Linux has several system calls that skip that round trip, but
+ * each only works for some kinds of descriptors:
+ * - copy_file_range(): regular file to regular file
+ * - splice(): at least one side must be a pipe
+ * - sendfile(): the source must support mmap-like access (regular files)
+ *
+ * relay_fd() starts with the best candidate for the descriptor types and falls
+ * back to the next one when the kernel refuses (EINVAL, EXDEV, ENOSYS...),
+ * ending with a plain buffer copy which always works.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "relay.h"
+#include "signals.h"
+
+/* Size of the buffer used when no zero-copy mechanism applies */
+#define RELAY_BUFFER_SIZE (128 * 1024)
+
+enum relay_method { RELAY_COPY_FILE_RANGE, RELAY_SPLICE, RELAY_SENDFILE,
+                    RELAY_BUFFER };
+
+/**
+ * first_method - Choose the first mechanism to try for a pair of descriptors
+ * @in_fd: Source
+ * @out_fd: Destination
+ *
+ * Return: Mechanism to start with
+ */
+enum relay_method first_method(int in_fd, int out_fd) {
+  struct stat in_st;
+  struct stat out_st;
+
+  if (fstat(in_fd, &in_st) == -1 || fstat(out_fd, &out_st) == -1) {
+    return RELAY_BUFFER;
+  }
+
+  /* copy_file_range() refuses files opened with O_APPEND */
+  if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode) &&
+      !(fcntl(out_fd, F_GETFL) & O_APPEND)) {
+    return RELAY_COPY_FILE_RANGE;
+  }
+
+  if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode)) {
+    return RELAY_SPLICE;
+  }
+
+  if (S_ISREG(in_st.st_mode) || S_ISBLK(in_st.st_mode)) {
+    return RELAY_SENDFILE;
+  }
+
+  return RELAY_BUFFER;
+}
+
+/**
+ * buffer_copy - Move one chunk through a userspace buffer
+ * @in_fd: Source
+ * @out_fd: Destination
+ * @failed_side: Output parameter - side that failed on error
+ *
+ * Return: Bytes moved, 0 at EOF, -1 on error
+ */
+ssize_t buffer_copy(int in_fd, int out_fd, enum relay_side *failed_side) {
+  static char buffer[RELAY_BUFFER_SIZE];
+
+  ssize_t bytes_read = read(in_fd, buffer, sizeof(buffer));
+  if (bytes_read <= 0) {
+    *failed_side = RELAY_READ;
+    return bytes_read;
+  }
+
+  for (ssize_t written = 0; written < bytes_read;) {
+    ssize_t n = write(out_fd, buffer + written, bytes_read - written);
+    if (n == -1) {
+      if (errno == EINTR && !sigint_received) {
+        continue;
+      }
+      *failed_side = RELAY_WRITE;
+      return -1;
+    }
+    written += n;
+  }
+
+  return bytes_read;
+}
+
+/**
+ * move_chunk - Move one chunk with the given mechanism
+ * @method: Mechanism to use
+ * @in_fd: Source
+ * @out_fd: Destination
+ * @failed_side: Output parameter - side that failed on error, only set by the
+ * buffer copy
+ *
+ * Return: Bytes moved, 0 at EOF, -1 on error
+ */
+ssize_t move_chunk(enum relay_method method, int in_fd, int out_fd,
+                   enum relay_side *failed_side) {
+  switch (method) {
+  case RELAY_COPY_FILE_RANGE:
+    return copy_file_range(in_fd, NULL, out_fd, NULL, RELAY_CHUNK, 0);
+  case RELAY_SPLICE:
+    return splice(in_fd, NULL, out_fd, NULL, RELAY_CHUNK,
+                  SPLICE_F_MOVE | SPLICE_F_MORE);
+  case RELAY_SENDFILE:
+    return sendfile(out_fd, in_fd, NULL, RELAY_CHUNK);
+  case RELAY_BUFFER:
+  default:
+    return buffer_copy(in_fd, out_fd, failed_side);
+  }
+}
+
+/**
+ * method_unsupported - Check whether an error means "try the next mechanism"
+ * @err: errno after a failed call
+ *
+ * Return: true if a fallback may work, false for real errors
+ */
+bool method_unsupported(int err) {
+  return err == EINVAL || err == EXDEV || err == ENOSYS ||
+         err == EOPNOTSUPP || err == EBADF;
+}
+
+/**
+ * relay_fd - Copy everything from one descriptor to another
+ * @in_fd: Descriptor to read from until EOF
+ * @out_fd: Descriptor to write to
+ * @failed_side: Output parameter - side that failed on error, may be NULL
+ *
+ * Picks the cheapest mechanism the pair of descriptors supports:
+ * - copy_file_range() between regular files, which may share extents or be
+ *   done by the storage without passing through memory
+ * - splice() when either side is a pipe
+ * - sendfile() from a regular file to anything else (sockets, terminals)
+ * - read()/write() through a buffer when none of the above apply
+ *
+ * Stops early without an error if the reader of out_fd went away (EPIPE), and
+ * with an error if SIGINT was received. The in-kernel calls don't tell which
+ * descriptor an error came from, so a failed chunk is retried through the
+ * buffer, which does.
+ *
+ * Return: Number of bytes copied, -1 on error
+ */
+ssize_t relay_fd(int in_fd, int out_fd, enum relay_side *failed_side) {
+  enum relay_method method = first_method(in_fd, out_fd);
+  enum relay_side side = RELAY_READ;
+  ssize_t total = 0;
+
+  for (;;) {
+    if (sigint_received) {
+      return -1;
+    }
+
+    ssize_t moved = move_chunk(method, in_fd, out_fd, &side);
+
+    if (moved > 0) {
+      total += moved;
+      continue;
+    }
+
+    if (moved == 0) {
+      return total;
+    }
+
+    if (errno == EINTR && !sigint_received) {
+      continue;
+    }
+
+    /* Downstream closed the pipe, there is nobody left to copy for */
+    if (errno == EPIPE) {
+      return total;
+    }
+
+    /*
+     * A refused call hasn't consumed anything, so the next mechanism can pick
+     * up where this one stopped. The chain always ends with the buffer copy.
+     */
+    if (method != RELAY_BUFFER && method_unsupported(errno)) {
+      method = method == RELAY_COPY_FILE_RANGE ? RELAY_SENDFILE : RELAY_BUFFER;
+      continue;
+    }
+
+    /* A failed call moved nothing, the buffer copy tells which side failed */
+    if (method != RELAY_BUFFER && errno != EINTR) {
+      method = RELAY_BUFFER;
+      continue;
+    }
+
+    if (failed_side) {
+      *failed_side = side;
+    }
+
+    return -1;
+  }
+}
+
+/**
+ * relay_range - Copy part of a regular file to a descriptor
+ * @in_fd: Regular file (or memfd) to read from, its offset is left alone
+ * @offset: Where the part starts in in_fd
+ * @length: Size of the part in bytes
+ * @out_fd: Descriptor to write to
+ *
+ * Uses sendfile() with an explicit offset, which works for any destination,
+ * and falls back to pread()/write() through a buffer if the kernel refuses.
+ *
+ * Return: Number of bytes copied, -1 on error
+ */
+ssize_t relay_range(int in_fd, off_t offset, size_t length, int out_fd) {
+  static char buffer[RELAY_BUFFER_SIZE];
+  bool use_sendfile = true;
+  size_t total = 0;
+
+  while (total < length) {
+    size_t chunk = length - total < RELAY_CHUNK ? length - total : RELAY_CHUNK;
+    ssize_t moved;
+
+    if (use_sendfile) {
+      moved = sendfile(out_fd, in_fd, &offset, chunk);
+    } else {
+      moved = pread(in_fd, buffer,
+                    chunk < sizeof(buffer) ? chunk : sizeof(buffer), offset);
+      for (ssize_t written = 0; moved > 0 && written < moved;) {
+        ssize_t n = write(out_fd, buffer + written, moved - written);
+        if (n == -1) {
+          moved = -1;
+          break;
+        }
+        written += n;
+      }
+      if (moved > 0) {
+        offset += moved;
+      }
+    }
+
+    if (moved > 0) {
+      total += moved;
+      continue;
+    }
+
+    /* The file is shorter than expected, there is nothing more to copy */
+    if (moved == 0) {
+      break;
+    }
+
+    if (errno == EINTR) {
+      continue;
+    }
+
+    if (errno == EPIPE) {
+      break;
+    }
+
+    if (use_sendfile && method_unsupported(errno)) {
+      use_sendfile = false;
+      continue;
+    }
+
+    return -1;
+  }
+
+  return total;
+}
@@ -6,16 +6,30 @@
  * OVERVIEW:
  * Configures how the shell responds to Unix signals:
  * - SIGINT (Ctrl+C): Cancels current line
- * - SIGCHLD: Child process status change - Ignored
+ * - SIGCHLD: Child process status change - Recorded for the job table to reap
+ * - SIGPIPE: Ignored, builtins writing into a pipe whose reader exited get
+ *   EPIPE instead of killing the shell
+ *
+ * The job control signals (SIGTSTP, SIGTTIN, SIGTTOU) are configured by the
+ * job table, as they are only ignored when the shell owns a terminal.
  */
 
+#define _GNU_SOURCE
+
 #include <signal.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 #include "error.h"
+#include "jobs.h"
 #include "signals.h"
 
+volatile sig_atomic_t child_status_changed = 0;
+
+volatile sig_atomic_t sigint_received = 0;
+
 /**
  * handler - SIGINT (Ctrl+C) signal handler
  * @signal_num: Signal number (unused, but required by API)
@@ -31,6 +45,21 @@ void handler(int signal_num) {
    * at any time during execution.
    */
   write(STDOUT_FILENO, "\n", 1);
+  sigint_received = 1;
+}
+
+/**
+ * child_handler - SIGCHLD signal handler
+ * @signal_num: Signal number (unused, but required by API)
+ *
+ * Only records that a child changed status, the reaping is done outside of the
+ * handler by the job table. A stop of a job whose stage the shell runs is
+ * undone right away (see job_stage_check()).
+ */
+void child_handler(int signal_num) {
+  (void)signal_num;
+  child_status_changed = 1;
+  job_stage_check();
 }
 
 /**
@@ -39,12 +68,6 @@ void handler(int signal_num) {
  * Return: 0 on success, -1 on error
  */
 int init_sig_handler(void) {
-  /*
-   * SIG_IGN tells kernel to ignore SIGCHLD. This makes it so that the kernel
-   * automatically reaps child processes for us.
-   */
-  signal(SIGCHLD, SIG_IGN);
-
   struct sigaction sa;
 
   /*
@@ -61,5 +84,91 @@ int init_sig_handler(void) {
     return -1;
   }
 
+  /*
+   * We used to ignore SIGCHLD so that the kernel reaped children for us, but
+   * that throws away their exit statuses. Now the handler only takes note and
+   * the job table reaps. SA_RESTART keeps readline's reads from failing when a
+   * background job finishes while the user is typing.
+   */
+  sa.sa_handler = child_handler;
+  sa.sa_flags = SA_RESTART;
+
+  if (sigaction(SIGCHLD, &sa, NULL) == -1) {
+    error_msg("Failed to configure signal handling", true);
+    return -1;
+  }
+
+  /* Restored to the default in every child by launch.c */
+  signal(SIGPIPE, SIG_IGN);
+
   return 0;
 }
+
+/* Signals the shell handles or ignores, in the order they are saved in */
+static const int shell_signals[SHELL_SIGNALS_COUNT] = {
+    SIGINT, SIGCHLD, SIGPIPE, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU};
+
+/**
+ * restore_default_signals - Undo the shell's signal setup before exec
+ * @saved: Output parameter - the shell's setup, for reinstate_signals()
+ *
+ * Ignored signals stay ignored across exec and the signal mask is inherited,
+ * so a program that replaces the shell would otherwise start with the shell's
+ * dispositions instead of the defaults.
+ */
+void restore_default_signals(struct saved_signals *saved) {
+  struct sigaction default_action;
+  sigset_t empty_mask;
+
+  memset(&default_action, 0, sizeof(default_action));
+  default_action.sa_handler = SIG_DFL;
+  sigemptyset(&default_action.sa_mask);
+
+  for (int i = 0; i < SHELL_SIGNALS_COUNT; i++) {
+    sigaction(shell_signals[i], &default_action, &saved->actions[i]);
+  }
+
+  sigemptyset(&empty_mask);
+  sigprocmask(SIG_SETMASK, &empty_mask, &saved->mask);
+}
+
+/**
+ * reinstate_signals - Put back the setup restore_default_signals() undid
+ * @saved: Setup saved by restore_default_signals()
+ */
+void reinstate_signals(const struct saved_signals *saved) {
+  for (int i = 0; i < SHELL_SIGNALS_COUNT; i++) {
+    sigaction(shell_signals[i], &saved->actions[i], NULL);
+  }
+
+  sigprocmask(SIG_SETMASK, &saved->mask, NULL);
+}
+
+/**
+ * parse_signal - Convert a signal name or number to a signal number
+ * @name: "9", "KILL" or "SIGKILL" (case insensitive)
+ *
+ * Return: Signal number, -1 if unknown
+ */
+int parse_signal(const char *name) {
+  char *end;
+  long number = strtol(name, &end, 10);
+
+  if (*end == '\0') {
+    return number > 0 && number < NSIG ? (int)number : -1;
+  }
+
+  if (strncasecmp(name, "SIG", 3) == 0) {
+    name += 3;
+  }
+
+  for (int signal_num = 1; signal_num < NSIG; signal_num++) {
+    const char *abbrev = sigabbrev_np(signal_num);
+
+    if (abbrev && strcasecmp(abbrev, name) == 0) {
+      return signal_num;
+    }
+  }
+
+  return -1;
+}
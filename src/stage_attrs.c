@@ -0,0 +1,470 @@
+/**
+ * stage_attrs.c
+ *
+ * Scheduling and resource attributes of pipeline stages.
+ *
+ * OVERVIEW:
+ * "taskset -c 2 make", "nice -n 10 make" and "ionice -c idle make" each put a
+ * wrapper process in front of the program that does one system call and
+ * execs it. The sched keyword does the same from the child the shell already
+ * creates for the stage, between fork and exec:
+ *
+ *   sched -a 2-3 -n 10 -i idle -p batch -l nofile=4096 make | tee log
+ *
+ * Every one of these attributes is inherited across exec, and only applies to
+ * the stage it prefixes. BACKGROUND_SCHED in ~/.clownrc gives defaults for the
+ * stages of background jobs, such as "-n 10 -i idle" to keep them out of the
+ * way of interactive work.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "error.h"
+#include "parse.h"
+#include "stage_attrs.h"
+
+/* From linux/ioprio.h, which not every libc ships */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_LEVEL_DEFAULT 4
+#define IOPRIO_LEVELS 8
+
+static const struct {
+  const char *name;
+  int value;
+} io_classes[] = {
+    {"realtime", 1}, {"rt", 1}, {"best-effort", 2}, {"be", 2}, {"idle", 3},
+};
+
+static const struct {
+  const char *name;
+  int value;
+} policies[] = {
+    {"other", SCHED_OTHER},
+    {"batch", SCHED_BATCH},
+    {"idle", SCHED_IDLE},
+};
+
+static const struct {
+  const char *name;
+  int resource;
+} resources[] = {
+    {"as", RLIMIT_AS},
+    {"core", RLIMIT_CORE},
+    {"cpu", RLIMIT_CPU},
+    {"data", RLIMIT_DATA},
+    {"fsize", RLIMIT_FSIZE},
+    {"locks", RLIMIT_LOCKS},
+    {"memlock", RLIMIT_MEMLOCK},
+    {"msgqueue", RLIMIT_MSGQUEUE},
+    {"nice", RLIMIT_NICE},
+    {"nofile", RLIMIT_NOFILE},
+    {"nproc", RLIMIT_NPROC},
+    {"rss", RLIMIT_RSS},
+    {"rtprio", RLIMIT_RTPRIO},
+    {"sigpending", RLIMIT_SIGPENDING},
+    {"stack", RLIMIT_STACK},
+};
+
+#define TABLE_SIZE(table) (sizeof(table) / sizeof(*(table)))
+
+static struct stage_attrs background_attrs;
+static bool background_attrs_set = false;
+
+/**
+ * parse_cpu_list - Parse a list of CPUs such as "0-3,6"
+ * @spec: List of CPU numbers and ranges, separated by commas
+ * @cpus: Output parameter - the CPUs
+ *
+ * Return: 0 on success, -1 if malformed or empty
+ */
+int parse_cpu_list(const char *spec, cpu_set_t *cpus) {
+  CPU_ZERO(cpus);
+
+  while (*spec) {
+    char *end;
+    long first = strtol(spec, &end, 10);
+    long last = first;
+
+    if (end == spec || first < 0) {
+      return -1;
+    }
+
+    if (*end == '-') {
+      spec = end + 1;
+      last = strtol(spec, &end, 10);
+      if (end == spec || last < first) {
+        return -1;
+      }
+    }
+
+    if (last >= CPU_SETSIZE) {
+      return -1;
+    }
+
+    for (long cpu = first; cpu <= last; cpu++) {
+      CPU_SET(cpu, cpus);
+    }
+
+    if (*end == ',') {
+      end++;
+    } else if (*end != '\0') {
+      return -1;
+    }
+
+    spec = end;
+  }
+
+  return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+/**
+ * parse_io_priority - Parse an I/O priority such as "best-effort:2"
+ * @spec: CLASS or CLASS:LEVEL
+ * @ioprio: Output parameter - value for ioprio_set()
+ *
+ * Return: 0 on success, -1 if malformed
+ */
+int parse_io_priority(const char *spec, int *ioprio) {
+  const char *colon = strchr(spec, ':');
+  size_t class_len = colon ? (size_t)(colon - spec) : strlen(spec);
+  int class = -1;
+
+  for (size_t i = 0; i < TABLE_SIZE(io_classes); i++) {
+    if (strlen(io_classes[i].name) == class_len &&
+        strncmp(io_classes[i].name, spec, class_len) == 0) {
+      class = io_classes[i].value;
+    }
+  }
+
+  if (class == -1) {
+    return -1;
+  }
+
+  long level = IOPRIO_LEVEL_DEFAULT;
+
+  if (colon) {
+    char *end;
+    level = strtol(colon + 1, &end, 10);
+    if (end == colon + 1 || *end != '\0' || level < 0 ||
+        level >= IOPRIO_LEVELS) {
+      return -1;
+    }
+  }
+
+  *ioprio = (class << IOPRIO_CLASS_SHIFT) | (int)level;
+  return 0;
+}
+
+/**
+ * parse_limit_value - Parse a resource limit such as "64M" or "unlimited"
+ * @spec: Value to parse
+ * @end: Output parameter - first character after the value
+ * @value: Output parameter - the limit
+ *
+ * Return: 0 on success, -1 if malformed
+ */
+int parse_limit_value(const char *spec, const char **end, rlim_t *value) {
+  if (strncmp(spec, "unlimited", 9) == 0) {
+    *value = RLIM_INFINITY;
+    *end = spec + 9;
+    return 0;
+  }
+
+  char *number_end;
+  unsigned long long number = strtoull(spec, &number_end, 10);
+
+  if (number_end == spec || spec[0] == '-') {
+    return -1;
+  }
+
+  switch (*number_end) {
+  case 'G':
+  case 'g':
+    number *= 1024;
+    /* fall through */
+  case 'M':
+  case 'm':
+    number *= 1024;
+    /* fall through */
+  case 'K':
+  case 'k':
+    number *= 1024;
+    number_end++;
+    break;
+  }
+
+  *value = (rlim_t)number;
+  *end = number_end;
+  return 0;
+}
+
+/**
+ * parse_limit - Parse a resource limit option such as "nofile=1024:4096"
+ * @spec: RESOURCE=SOFT or RESOURCE=SOFT:HARD
+ * @limit: Output parameter - the limit
+ *
+ * Return: 0 on success, -1 if malformed
+ */
+int parse_limit(const char *spec, struct stage_limit *limit) {
+  const char *equal_sign = strchr(spec, '=');
+  if (!equal_sign) {
+    return -1;
+  }
+
+  size_t name_len = equal_sign - spec;
+  limit->resource = -1;
+
+  for (size_t i = 0; i < TABLE_SIZE(resources); i++) {
+    if (strlen(resources[i].name) == name_len &&
+        strncmp(resources[i].name, spec, name_len) == 0) {
+      limit->resource = resources[i].resource;
+    }
+  }
+
+  const char *end;
+
+  if (limit->resource == -1 ||
+      parse_limit_value(equal_sign + 1, &end, &limit->limit.rlim_cur) == -1) {
+    return -1;
+  }
+
+  limit->set_hard = *end == ':';
+
+  if (limit->set_hard &&
+      parse_limit_value(end + 1, &end, &limit->limit.rlim_max) == -1) {
+    return -1;
+  }
+
+  return *end == '\0' ? 0 : -1;
+}
+
+/**
+ * parse_stage_attrs - Parse the options of the sched keyword
+ * @args: Words following the keyword, NULL-terminated
+ * @attrs: Output parameter - attributes, cleared first
+ *
+ * Options:
+ * -a CPUS: run on the listed CPUs only ("0-3,6")
+ * -n NICE: nice level
+ * -i CLASS[:LEVEL]: I/O priority class (realtime, best-effort or idle) and
+ *  level within the class (0 to 7, 4 by default)
+ * -p POLICY: scheduling policy (other, batch or idle)
+ * -l RESOURCE=SOFT[:HARD]: resource limit, RESOURCE as in prlimit(1) without
+ *  the RLIMIT_ prefix, values with K, M or G suffixes or "unlimited"
+ *
+ * Parsing stops at the first word that isn't an option.
+ *
+ * Return: Number of words used, -1 on a malformed option
+ */
+int parse_stage_attrs(char **args, struct stage_attrs *attrs) {
+  memset(attrs, 0, sizeof(*attrs));
+
+  int i = 0;
+
+  for (; args[i] && args[i][0] == '-'; i += 2) {
+    const char *value = args[i + 1];
+
+    if (!value || strlen(args[i]) != 2) {
+      return -1;
+    }
+
+    switch (args[i][1]) {
+    case 'a':
+      if (parse_cpu_list(value, &attrs->affinity) == -1) {
+        return -1;
+      }
+      attrs->has_affinity = true;
+      break;
+    case 'n': {
+      char *end;
+      long nice = strtol(value, &end, 10);
+      if (end == value || *end != '\0' || nice < -20 || nice > 19) {
+        return -1;
+      }
+      attrs->nice = (int)nice;
+      attrs->has_nice = true;
+      break;
+    }
+    case 'i':
+      if (parse_io_priority(value, &attrs->ioprio) == -1) {
+        return -1;
+      }
+      attrs->has_ioprio = true;
+      break;
+    case 'p':
+      attrs->has_policy = false;
+      for (size_t j = 0; j < TABLE_SIZE(policies); j++) {
+        if (strcmp(policies[j].name, value) == 0) {
+          attrs->policy = policies[j].value;
+          attrs->has_policy = true;
+        }
+      }
+      if (!attrs->has_policy) {
+        return -1;
+      }
+      break;
+    case 'l':
+      if (attrs->limits_count == STAGE_LIMITS_MAX ||
+          parse_limit(value, &attrs->limits[attrs->limits_count]) == -1) {
+        return -1;
+      }
+      attrs->limits_count++;
+      break;
+    default:
+      return -1;
+    }
+  }
+
+  return i;
+}
+
+/**
+ * merge_stage_attrs - Fill in attributes a stage doesn't set itself
+ * @attrs: Attributes of the stage, updated
+ * @defaults: Attributes to take the missing ones from
+ */
+void merge_stage_attrs(struct stage_attrs *attrs,
+                       const struct stage_attrs *defaults) {
+  if (!attrs->has_affinity && defaults->has_affinity) {
+    attrs->affinity = defaults->affinity;
+    attrs->has_affinity = true;
+  }
+
+  if (!attrs->has_nice && defaults->has_nice) {
+    attrs->nice = defaults->nice;
+    attrs->has_nice = true;
+  }
+
+  if (!attrs->has_ioprio && defaults->has_ioprio) {
+    attrs->ioprio = defaults->ioprio;
+    attrs->has_ioprio = true;
+  }
+
+  if (!attrs->has_policy && defaults->has_policy) {
+    attrs->policy = defaults->policy;
+    attrs->has_policy = true;
+  }
+
+  for (unsigned int i = 0; i < defaults->limits_count; i++) {
+    bool overridden = false;
+
+    for (unsigned int j = 0; j < attrs->limits_count; j++) {
+      if (attrs->limits[j].resource == defaults->limits[i].resource) {
+        overridden = true;
+      }
+    }
+
+    if (!overridden && attrs->limits_count < STAGE_LIMITS_MAX) {
+      attrs->limits[attrs->limits_count++] = defaults->limits[i];
+    }
+  }
+}
+
+/**
+ * apply_stage_attrs - Apply attributes to the calling process
+ * @attrs: Attributes to apply
+ *
+ * Meant for a child between fork (or vfork) and exec: only system calls are
+ * made, nothing is allocated or printed.
+ *
+ * Return: NULL on success, name of the attribute that failed otherwise (errno
+ * tells why)
+ */
+const char *apply_stage_attrs(const struct stage_attrs *attrs) {
+  /* Before the nice level, which SCHED_IDLE ignores but others keep */
+  if (attrs->has_policy) {
+    struct sched_param param = {.sched_priority = 0};
+    if (sched_setscheduler(0, attrs->policy, &param) == -1) {
+      return "scheduling policy";
+    }
+  }
+
+  if (attrs->has_nice && setpriority(PRIO_PROCESS, 0, attrs->nice) == -1) {
+    return "nice level";
+  }
+
+  if (attrs->has_ioprio && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                                   attrs->ioprio) == -1) {
+    return "I/O priority";
+  }
+
+  if (attrs->has_affinity &&
+      sched_setaffinity(0, sizeof(attrs->affinity), &attrs->affinity) == -1) {
+    return "CPU affinity";
+  }
+
+  /* Last, so limits such as RLIMIT_NICE don't get in the way of the above */
+  for (unsigned int i = 0; i < attrs->limits_count; i++) {
+    const struct stage_limit *limit = &attrs->limits[i];
+    struct rlimit value = limit->limit;
+
+    if (!limit->set_hard && getrlimit(limit->resource, &value) == 0) {
+      value.rlim_cur = limit->limit.rlim_cur;
+    }
+
+    if (setrlimit(limit->resource, &value) == -1) {
+      return "resource limit";
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * stage_attrs_init - Load the attributes of background jobs
+ * @current_ctx: Shell context (for configuration)
+ *
+ * BACKGROUND_SCHED in ~/.clownrc takes the same options as the sched keyword
+ * and applies them to every stage of a background job that doesn't set them.
+ */
+void stage_attrs_init(struct repl_ctx *current_ctx) {
+  const char *spec = get_user_env("BACKGROUND_SCHED", current_ctx->user_envs,
+                                  current_ctx->user_envs_count);
+  if (!spec) {
+    return;
+  }
+
+  /* lex_input() splits the string in place */
+  char *copy = strdup(spec);
+  if (!copy) {
+    error_msg(strdup_fail_msg, true);
+    return;
+  }
+
+  unsigned int words_count = 0;
+  char **words = lex_input(copy, &words_count);
+  free(copy);
+
+  if (!words) {
+    return;
+  }
+
+  int used = parse_stage_attrs(words, &background_attrs);
+
+  if (used == -1 || (unsigned int)used != words_count) {
+    error_msg("Invalid BACKGROUND_SCHED in configuration file", false);
+  } else {
+    background_attrs_set = true;
+  }
+
+  for (unsigned int i = 0; i < words_count; i++) {
+    free(words[i]);
+  }
+  free(words);
+}
+
+/**
+ * background_stage_attrs - Get the attributes of background jobs
+ *
+ * Return: Attributes from BACKGROUND_SCHED, NULL if it isn't set
+ */
+const struct stage_attrs *background_stage_attrs(void) {
+  return background_attrs_set ? &background_attrs : NULL;
+}
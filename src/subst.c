@@ -0,0 +1,424 @@
+/**
+ * subst.c
+ *
+ * Process substitution.
+ *
+ * OVERVIEW:
+ * "<(COMMAND)" stands for a file that COMMAND's output can be read from, and
+ * ">(COMMAND)" for one that is written to COMMAND's input. Comparing the
+ * output of two commands then takes no temporary files:
+ *
+ *   diff <(sort a) <(sort b)
+ *
+ * Each substitution is a pipe. A subshell running COMMAND holds one end, and
+ * the word is replaced by /dev/fd/N, where N is the other end. Stages that
+ * get the path as an argument inherit N under the same number, redirection
+ * targets are opened by the shell like any other file. The subshells are
+ * helpers of the pipeline's job, so they are waited for, interrupted and
+ * stopped along with it, and none outlives it.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "error.h"
+#include "exec.h"
+#include "fanout.h"
+#include "input.h"
+#include "jobs.h"
+#include "parse.h"
+#include "path_cache.h"
+#include "subst.h"
+#include "zygote.h"
+
+/* Longest path naming a descriptor */
+#define DEV_FD_PATH_MAX sizeof("/dev/fd/-2147483648")
+
+/**
+ * is_substitution - Check whether a word is a process substitution
+ * @word: Argument or redirection target
+ *
+ * Return: true for "<(COMMAND)" and ">(COMMAND)", false otherwise
+ */
+bool is_substitution(const char *word) {
+  const char *end = substitution_end(word);
+
+  return end && *end == '\0';
+}
+
+/**
+ * find_substitutions - Visit every substitution word of the pipeline
+ * @current_ctx: Shell context with parsed commands and redirections
+ * @subs: Entries to fill in, NULL to only count them
+ *
+ * Arguments come first in each stage, then redirection targets.
+ *
+ * Return: Number of substitutions
+ */
+unsigned int find_substitutions(const struct repl_ctx *current_ctx,
+                                struct substitution *subs) {
+  unsigned int count = 0;
+
+  for (unsigned int i = 0; i < current_ctx->commands_count; i++) {
+    const struct out_fanout *fanout = current_ctx->out_fanout[i];
+    const unsigned int files = fanout ? fanout->count : 0;
+    char **args = current_ctx->commands[i];
+
+    for (unsigned int j = 0; args[j]; j++) {
+      if (is_substitution(args[j]) && subs) {
+        subs[count] = (struct substitution){
+            .word = &args[j], .stage = i, .in_argv = true};
+      }
+      count += is_substitution(args[j]);
+    }
+
+    char **targets[] = {&current_ctx->in_stream_name[i],
+                        &current_ctx->out_stream_name[i]};
+
+    for (unsigned int j = 0; j < 2 + files; j++) {
+      char **target = j < 2 ? targets[j] : &fanout->names[j - 2];
+
+      if (!*target || !is_substitution(*target)) {
+        continue;
+      }
+
+      if (subs) {
+        subs[count] = (struct substitution){.word = target, .stage = i};
+      }
+      count++;
+    }
+  }
+
+  return count;
+}
+
+/**
+ * pipeline_substitutes - Check whether the pipeline has process substitutions
+ * @current_ctx: Shell context with parsed commands and redirections
+ *
+ * Such a pipeline has to run as a job, which its subshells belong to.
+ *
+ * Return: true if any argument or redirection target is a substitution
+ */
+bool pipeline_substitutes(const struct repl_ctx *current_ctx) {
+  return find_substitutions(current_ctx, NULL) > 0;
+}
+
+/**
+ * subst_prepare - Give every process substitution of the pipeline its pipe
+ * @current_ctx: Shell context with parsed commands and redirections
+ * @subs: Output parameter - the substitutions found
+ *
+ * Each word is replaced by the /dev/fd path of the shell's end of its pipe,
+ * so the redirections can be opened and the stages launched as usual. Nothing
+ * runs yet, subst_launch() starts the subshells once there is a job.
+ *
+ * Return: 0 on success, -1 on error (the words are left as typed)
+ */
+int subst_prepare(struct repl_ctx *current_ctx, struct substitutions *subs) {
+  subs->count = find_substitutions(current_ctx, NULL);
+  subs->items = NULL;
+  subs->stage_fds = NULL;
+
+  if (subs->count == 0) {
+    return 0;
+  }
+
+  subs->items = calloc(subs->count, sizeof(*subs->items));
+  subs->stage_fds = malloc(subs->count * sizeof(*subs->stage_fds));
+  if (!subs->items || !subs->stage_fds) {
+    error_msg(malloc_fail_msg, true);
+    subs->count = 0;
+    subst_finish(subs);
+    return -1;
+  }
+
+  find_substitutions(current_ctx, subs->items);
+
+  for (unsigned int i = 0; i < subs->count; i++) {
+    struct substitution *sub = &subs->items[i];
+    const bool reads_output = (*sub->word)[0] == '<';
+    char path[DEV_FD_PATH_MAX];
+    int pipe_fds[2];
+
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+      error_msg("Failed to create pipe", true);
+      subs->count = i;
+      subst_finish(subs);
+      return -1;
+    }
+
+    /* The command reads what the subshell writes, or the other way around */
+    sub->fd = pipe_fds[reads_output ? 0 : 1];
+    sub->inner_fd = pipe_fds[reads_output ? 1 : 0];
+
+    snprintf(path, sizeof(path), "/dev/fd/%d", sub->fd);
+
+    char *replacement = strdup(path);
+    if (!replacement) {
+      error_msg(strdup_fail_msg, true);
+      close(pipe_fds[0]);
+      close(pipe_fds[1]);
+      subs->count = i;
+      subst_finish(subs);
+      return -1;
+    }
+
+    sub->original = *sub->word;
+    *sub->word = replacement;
+  }
+
+  return 0;
+}
+
+/**
+ * run_substitution - Run a substitution's command in the subshell
+ * @current_ctx: Subshell's copy of the shell context
+ * @command: Word as typed, "<(COMMAND)" or ">(COMMAND)"
+ *
+ * The command is parsed like typed input and run as the last command of -c,
+ * so a simple command replaces the subshell.
+ *
+ * Return: Exit status of the command
+ */
+int run_substitution(struct repl_ctx *current_ctx, const char *command) {
+  /* Without the "<(" and ")" around it */
+  char *input = strndup(command + 2, strlen(command) - 3);
+  if (!input) {
+    error_msg(strdup_fail_msg, true);
+    return EXIT_FAILURE;
+  }
+
+  /* The subshell's copy of the pipeline, nothing of it is used anymore */
+  cleanup_ctx(current_ctx);
+  current_ctx->input = input;
+
+  if (process_input(current_ctx) == -1 || current_ctx->syntax_error) {
+    return EXIT_FAILURE;
+  }
+
+  if (current_ctx->is_deferred || current_ctx->is_benched ||
+      current_ctx->watch_paths) {
+    error_msg("Process substitutions can't be deferred, benchmarked or "
+              "watched",
+              false);
+    return EXIT_FAILURE;
+  }
+
+  rewrite_pipeline(current_ctx);
+  current_ctx->is_last_command = 1;
+
+  exec(current_ctx);
+
+  char *status =
+      get_user_env("?", current_ctx->user_envs, current_ctx->user_envs_count);
+
+  return status ? atoi(status) : EXIT_SUCCESS;
+}
+
+/**
+ * fork_substitution - Start the subshell of one substitution
+ * @current_ctx: Shell context
+ * @sub: Substitution to start
+ * @pgid: Process group to join, 0 for a new group, -1 to stay in the shell's
+ * @tty_fd: Terminal to make the group the foreground of, -1 to leave it alone
+ *
+ * Return: PID of the subshell, -1 on error
+ */
+pid_t fork_substitution(struct repl_ctx *current_ctx,
+                        const struct substitution *sub, pid_t pgid,
+                        int tty_fd) {
+  static const int reset_signals[] = {SIGINT,  SIGPIPE, SIGQUIT,
+                                      SIGTSTP, SIGTTIN, SIGTTOU};
+  const int target = sub->original[0] == '<' ? STDOUT_FILENO : STDIN_FILENO;
+
+  fflush(stdout);
+  fflush(stderr);
+
+  pid_t pid = fork();
+
+  if (pid == -1) {
+    error_msg("Failed to fork", true);
+    return -1;
+  }
+
+  /* From both sides, so the stages can join a group the subshell leads */
+  if (pgid != -1) {
+    setpgid(pid > 0 ? pid : 0, pgid);
+  }
+
+  if (pid > 0) {
+    return pid;
+  }
+
+  /* Before SIGTTOU is reset, as the subshell isn't in the foreground yet */
+  if (tty_fd != -1) {
+    tcsetpgrp(tty_fd, getpgrp());
+  }
+
+  if (dup2(sub->inner_fd, target) == -1) {
+    error_msg(dup2_fail_msg, true);
+    _exit(EXIT_FAILURE);
+  }
+
+  __fpurge(stdin);
+
+  /* The shell's ends of this and the other pipes belong to the command */
+  if (close_range(STDERR_FILENO + 1, ~0U, 0) == -1) {
+    for (long fd = STDERR_FILENO + 1; fd < sysconf(_SC_OPEN_MAX); fd++) {
+      close(fd);
+    }
+  }
+
+  path_cache_detach();
+  jobs_detach();
+  zygote_detach();
+
+  /* SIGCHLD stays handled, the subshell waits for its own job */
+  for (size_t i = 0; i < sizeof(reset_signals) / sizeof(*reset_signals); i++) {
+    signal(reset_signals[i], SIG_DFL);
+  }
+
+  sigset_t empty_mask;
+  sigemptyset(&empty_mask);
+  sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+
+  int result = run_substitution(current_ctx, sub->original);
+
+  fflush(stdout);
+  fflush(stderr);
+
+  /* Skips atexit handlers and stdio buffers that belong to the shell */
+  _exit(result);
+}
+
+/**
+ * subst_launch - Start the subshell of every process substitution
+ * @current_ctx: Shell context
+ * @subs: Substitutions from subst_prepare()
+ * @job: Job the subshells belong to, before any stage has started
+ *
+ * Each subshell is a forked copy of the shell that parses and runs the
+ * substitution's command with its end of the pipe as stdout ("<(...)") or
+ * stdin (">(...)"). The subshells join the job's process group and are
+ * waited for with it, so Ctrl+C, job control and the exit of the job reach
+ * them too. A subshell that can't be started is reported, the command then
+ * sees an empty pipe.
+ */
+void subst_launch(struct repl_ctx *current_ctx, struct substitutions *subs,
+                  struct job *job) {
+  for (unsigned int i = 0; i < subs->count; i++) {
+    struct substitution *sub = &subs->items[i];
+
+    const int tty_fd = job_control && !job->background ? shell_terminal : -1;
+    pid_t pid = fork_substitution(current_ctx, sub,
+                                  job->own_pgroup ? job->pgid : -1, tty_fd);
+
+    if (pid == -1) {
+      /* Nothing to do, the command sees EOF or EPIPE */
+    } else if (job_add_helper(job, pid) == -1) {
+      error_msg("Failed to track process", false);
+    } else if (tty_fd != -1 && job->pgid == pid) {
+      /* From both sides, as for the first stage of a job */
+      tcsetpgrp(tty_fd, job->pgid);
+    }
+
+    /* The subshell has its own copy, the command sees EOF once it exits */
+    close(sub->inner_fd);
+    sub->inner_fd = -1;
+  }
+}
+
+/**
+ * subst_stage_fds - Collect the descriptors a stage's arguments name
+ * @subs: Substitutions from subst_prepare()
+ * @stage: Stage of the pipeline
+ * @count: Output parameter - number of descriptors
+ *
+ * Return: The descriptors, valid until the next call
+ */
+const int *subst_stage_fds(struct substitutions *subs, unsigned int stage,
+                           unsigned int *count) {
+  *count = 0;
+
+  for (unsigned int i = 0; i < subs->count; i++) {
+    if (subs->items[i].stage == stage && subs->items[i].in_argv &&
+        subs->items[i].fd != -1) {
+      subs->stage_fds[(*count)++] = subs->items[i].fd;
+    }
+  }
+
+  return subs->stage_fds;
+}
+
+/**
+ * subst_takes_output - Check whether a subshell reads what the pipeline writes
+ * @subs: Substitutions from subst_prepare()
+ *
+ * Such a subshell is still busy with the output when the last stage exits, so
+ * the job mustn't be torn down then.
+ *
+ * Return: true if any substitution is ">(...)", false otherwise
+ */
+bool subst_takes_output(const struct substitutions *subs) {
+  for (unsigned int i = 0; i < subs->count; i++) {
+    if (subs->items[i].original[0] == '>') {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * subst_close - Close the shell's ends of the pipes
+ * @subs: Substitutions from subst_prepare()
+ *
+ * Once every stage holds its own copy, the shell's would keep a subshell
+ * from seeing EOF, or from getting SIGPIPE when the command stops reading.
+ */
+void subst_close(struct substitutions *subs) {
+  for (unsigned int i = 0; i < subs->count; i++) {
+    struct substitution *sub = &subs->items[i];
+
+    if (sub->fd != -1) {
+      close(sub->fd);
+      sub->fd = -1;
+    }
+
+    if (sub->inner_fd != -1) {
+      close(sub->inner_fd);
+      sub->inner_fd = -1;
+    }
+  }
+}
+
+/**
+ * subst_finish - Release the substitutions and put the words back
+ * @subs: Substitutions from subst_prepare(), emptied
+ *
+ * The words are restored as typed, so a pipeline run again (by on-change)
+ * starts new subshells.
+ */
+void subst_finish(struct substitutions *subs) {
+  subst_close(subs);
+
+  for (unsigned int i = 0; i < subs->count; i++) {
+    free(*subs->items[i].word);
+    *subs->items[i].word = subs->items[i].original;
+  }
+
+  free(subs->items);
+  free(subs->stage_fds);
+  subs->items = NULL;
+  subs->stage_fds = NULL;
+  subs->count = 0;
+}
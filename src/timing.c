@@ -0,0 +1,171 @@
+/**
+ * timing.c
+ *
+ * Resource usage report for the time keyword.
+ *
+ * OVERVIEW:
+ * The time keyword measures a whole pipeline, and unlike time(1) it doesn't
+ * lump every stage together: each stage is reaped with wait4(), which returns
+ * that process's own resource usage. This makes it easy to tell which stage of
+ * a slow pipeline burns the CPU or the memory.
+ *
+ * The report goes to stderr so that it doesn't end up in the pipeline's output
+ * when that is redirected.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "timing.h"
+
+/**
+ * timing_start - Take the snapshot a timed pipeline is measured against
+ * @mark: Output parameter - snapshot
+ */
+void timing_start(struct timing_mark *mark) {
+  getrusage(RUSAGE_SELF, &mark->self);
+  clock_gettime(CLOCK_MONOTONIC, &mark->wall);
+}
+
+/**
+ * timeval_seconds - Convert a timeval to seconds
+ * @tv: Time to convert
+ *
+ * Return: Seconds
+ */
+double timeval_seconds(const struct timeval *tv) {
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/**
+ * timespec_seconds - Convert a timespec to seconds
+ * @ts: Time to convert
+ *
+ * Return: Seconds
+ */
+double timespec_seconds(const struct timespec *ts) {
+  return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+/**
+ * print_usage_line - Print one line of the report
+ * @label: Stage number or "total"
+ * @real: Wall time in seconds
+ * @usage: Resource usage to print
+ * @exit_code: Exit status, or a negative value to leave the column empty
+ * @command: Command name, can be NULL
+ */
+void print_usage_line(const char *label, double real,
+                      const struct rusage *usage, int exit_code,
+                      const char *command) {
+  char exit_column[16] = "";
+
+  if (exit_code >= 0) {
+    snprintf(exit_column, sizeof(exit_column), "%d", exit_code);
+  }
+
+  /* ru_maxrss is in kilobytes on Linux */
+  fprintf(stderr, "%-6s %9.3fs %9.3fs %9.3fs %9ldK %7ld %7ld %5s  %s\n",
+          label, real, timeval_seconds(&usage->ru_utime),
+          timeval_seconds(&usage->ru_stime), usage->ru_maxrss, usage->ru_nvcsw,
+          usage->ru_nivcsw, exit_column, command ? command : "");
+}
+
+/**
+ * timing_total - Work out the wall time and resource usage of a pipeline
+ * @mark: Snapshot taken by timing_start()
+ * @result: Result of the pipeline's job, NULL if only a builtin ran
+ * @real: Output parameter - wall time since the snapshot
+ * @total: Output parameter - the shell's own usage since the snapshot plus
+ * that of every stage, with the largest peak resident set size of any of them
+ */
+void timing_total(const struct timing_mark *mark,
+                  const struct job_result *result, struct timespec *real,
+                  struct rusage *total) {
+  struct timespec now;
+  struct rusage self;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  getrusage(RUSAGE_SELF, &self);
+
+  /* The shell's own share, which is where builtins run */
+  memset(total, 0, sizeof(*total));
+
+  timersub(&self.ru_utime, &mark->self.ru_utime, &total->ru_utime);
+  timersub(&self.ru_stime, &mark->self.ru_stime, &total->ru_stime);
+  total->ru_nvcsw = self.ru_nvcsw - mark->self.ru_nvcsw;
+  total->ru_nivcsw = self.ru_nivcsw - mark->self.ru_nivcsw;
+
+  unsigned int stages_count = result ? result->stages_count : 0;
+
+  for (unsigned int i = 0; i < stages_count; i++) {
+    const struct stage_result *stage = &result->stages[i];
+
+    /* Stages inside the shell are already part of the shell's share */
+    if (!stage->in_shell) {
+      timeradd(&total->ru_utime, &stage->usage.ru_utime, &total->ru_utime);
+      timeradd(&total->ru_stime, &stage->usage.ru_stime, &total->ru_stime);
+      total->ru_nvcsw += stage->usage.ru_nvcsw;
+      total->ru_nivcsw += stage->usage.ru_nivcsw;
+    }
+
+    /* Stages run side by side, so the peak is the largest one, not the sum */
+    if (stage->usage.ru_maxrss > total->ru_maxrss) {
+      total->ru_maxrss = stage->usage.ru_maxrss;
+    }
+  }
+
+  real->tv_sec = now.tv_sec - mark->wall.tv_sec;
+  real->tv_nsec = now.tv_nsec - mark->wall.tv_nsec;
+
+  /* Callers print and add up tv_nsec as is, so it has to be in range */
+  if (real->tv_nsec < 0) {
+    real->tv_sec--;
+    real->tv_nsec += 1000000000L;
+  } else if (real->tv_nsec >= 1000000000L) {
+    real->tv_sec++;
+    real->tv_nsec -= 1000000000L;
+  }
+}
+
+/**
+ * timing_report - Print the resource usage of a timed pipeline to stderr
+ * @current_ctx: Shell context with the pipeline's commands
+ * @mark: Snapshot taken by timing_start()
+ * @result: Result of the pipeline's job, NULL if only a builtin ran
+ *
+ * Prints one line per stage with its wall, user and system time, peak resident
+ * set size, voluntary and involuntary context switches and exit status,
+ * followed by a total line. Time the shell spent running builtins counts
+ * towards the total.
+ */
+void timing_report(struct repl_ctx *current_ctx, const struct timing_mark *mark,
+                   const struct job_result *result) {
+  struct timespec real;
+  struct rusage total;
+
+  timing_total(mark, result, &real, &total);
+
+  fprintf(stderr, "%-6s %10s %10s %10s %10s %7s %7s %5s  %s\n", "stage",
+          "real", "user", "sys", "maxrss", "vcsw", "ivcsw", "exit", "command");
+
+  unsigned int stages_count = result ? result->stages_count : 0;
+
+  for (unsigned int i = 0; i < stages_count; i++) {
+    const struct stage_result *stage = &result->stages[i];
+    char label[16];
+
+    snprintf(label, sizeof(label), "%u", i + 1);
+
+    /* Stages that failed to launch are missing, so names may not line up */
+    const char *command = stages_count == current_ctx->commands_count
+                              ? current_ctx->commands[i][0]
+                              : NULL;
+
+    print_usage_line(label, timespec_seconds(&stage->elapsed), &stage->usage,
+                     stage->exit_code, command);
+  }
+
+  print_usage_line("total", timespec_seconds(&real), &total, -1, NULL);
+}
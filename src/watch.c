@@ -0,0 +1,372 @@
+/**
+ * watch.c
+ *
+ * Rerunning a pipeline when files change, for the on-change keyword.
+ *
+ * OVERVIEW:
+ * "on-change [-d DELAY] [-c] PATH... -- COMMAND..." runs the pipeline, then
+ * sleeps on an inotify descriptor until one of the PATHs changes and runs it
+ * again, like entr, instead of a "while true; do make; sleep 1; done" loop
+ * that wakes up every second whether anything changed or not.
+ *
+ * WHAT IS WATCHED:
+ * A file is watched through its directory, filtered on its name, so editors
+ * that save by writing a new file and renaming it over the old one are still
+ * noticed. A directory is watched for changes to its entries, not to
+ * subdirectories: a build usually writes somewhere below the sources, and
+ * watching that would rerun it forever. Writes only count once the file is
+ * closed, so a run doesn't start on a half-written file.
+ *
+ * DEBOUNCING:
+ * After a change, the pipeline reruns only once no event arrived for DELAY
+ * (WATCH_DEBOUNCE_MS by default), so a burst of events triggers a single run.
+ * Changes made while the pipeline runs trigger one more run after it, or with
+ * -c cancel the run with SIGTERM so the next one starts sooner.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "error.h"
+#include "exec.h"
+#include "signals.h"
+#include "watch.h"
+
+/* Events that mean a watched entry changed */
+#define WATCH_EVENTS                                                           \
+  (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |      \
+   IN_ATTRIB)
+
+/**
+ * watch_target - A path given to on-change
+ * @wd: Watch descriptor of the directory the path is watched through
+ * @name: File name within that directory, NULL to accept any entry
+ */
+struct watch_target {
+  int wd;
+  char *name;
+};
+
+/**
+ * watch - State of the running on-change loop
+ * @inotify_fd: Descriptor the events are read from, non-blocking
+ * @targets: Watched paths
+ * @targets_count: Number of entries in targets
+ * @cancel: Whether a change cancels the run in progress (-c)
+ * @changed: Whether a change arrived since the last run started
+ */
+struct watch {
+  int inotify_fd;
+  struct watch_target *targets;
+  unsigned int targets_count;
+  bool cancel;
+  bool changed;
+};
+
+/* Loop in progress, for watch_attach(), NULL outside of watch_run() */
+static struct watch *active_watch = NULL;
+
+/**
+ * add_target - Start watching a path
+ * @watch: Loop state, with its inotify descriptor open
+ * @path: File or directory to watch
+ *
+ * Return: 0 on success, -1 on error (reported)
+ */
+int add_target(struct watch *watch, const char *path) {
+  struct watch_target *target = &watch->targets[watch->targets_count];
+  char *copy = strdup(path);
+
+  if (!copy) {
+    error_msg(strdup_fail_msg, true);
+    return -1;
+  }
+
+  /* A directory is watched itself, a file through its directory */
+  target->name = NULL;
+  target->wd = inotify_add_watch(watch->inotify_fd, path,
+                                 WATCH_EVENTS | IN_ONLYDIR);
+
+  if (target->wd == -1 && errno == ENOTDIR) {
+    target->name = strdup(basename(copy));
+    target->wd = target->name ? inotify_add_watch(watch->inotify_fd,
+                                                  dirname(copy), WATCH_EVENTS)
+                              : -1;
+  }
+
+  free(copy);
+
+  if (target->wd == -1) {
+    char msg[ERR_MSG_MAX];
+    snprintf(msg, ERR_MSG_MAX, "on-change: %s", path);
+    error_msg(msg, true);
+    free(target->name);
+    return -1;
+  }
+
+  watch->targets_count++;
+
+  return 0;
+}
+
+/**
+ * event_matches - Check whether an event concerns a watched path
+ * @watch: Loop state
+ * @event: Event read from the inotify descriptor
+ *
+ * Return: true if the event is about a watched path, false otherwise
+ */
+bool event_matches(const struct watch *watch,
+                   const struct inotify_event *event) {
+  /* Events were lost, any of them could have been ours */
+  if (event->mask & IN_Q_OVERFLOW) {
+    return true;
+  }
+
+  for (unsigned int i = 0; i < watch->targets_count; i++) {
+    const struct watch_target *target = &watch->targets[i];
+
+    if (target->wd == event->wd &&
+        (!target->name ||
+         (event->len > 0 && strcmp(target->name, event->name) == 0))) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * drain_changes - Read every pending event
+ * @watch: Loop state
+ *
+ * Return: true if any event concerned a watched path, false otherwise
+ */
+bool drain_changes(struct watch *watch) {
+  /* Aligned as required by the inotify man page */
+  char buffer[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  bool changed = false;
+
+  while ((len = read(watch->inotify_fd, buffer, sizeof(buffer))) > 0) {
+    for (char *ptr = buffer; ptr < buffer + len;) {
+      const struct inotify_event *event = (const struct inotify_event *)ptr;
+
+      if (event_matches(watch, event)) {
+        changed = true;
+      }
+
+      ptr += sizeof(struct inotify_event) + event->len;
+    }
+  }
+
+  return changed;
+}
+
+/**
+ * wait_readable - Sleep until the inotify descriptor has events
+ * @watch: Loop state
+ * @timeout_ms: Longest time to sleep, -1 for no limit
+ *
+ * SIGINT is blocked outside of ppoll(), so a Ctrl+C arriving just before the
+ * sleep still interrupts it.
+ *
+ * Return: 1 if there are events, 0 on timeout, -1 if interrupted by SIGINT
+ */
+int wait_readable(struct watch *watch, long timeout_ms) {
+  struct pollfd pfd = {.fd = watch->inotify_fd, .events = POLLIN};
+  struct timespec timeout = {.tv_sec = timeout_ms / 1000,
+                             .tv_nsec = (timeout_ms % 1000) * 1000000};
+  sigset_t block_mask;
+  sigset_t old_mask;
+  int result;
+
+  sigemptyset(&block_mask);
+  sigaddset(&block_mask, SIGINT);
+  sigprocmask(SIG_BLOCK, &block_mask, &old_mask);
+
+  do {
+    result = sigint_received
+                 ? -1
+                 : ppoll(&pfd, 1, timeout_ms < 0 ? NULL : &timeout, &old_mask);
+  } while (result == -1 && errno == EINTR && !sigint_received);
+
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+  if (sigint_received) {
+    return -1;
+  }
+
+  return result > 0 ? 1 : 0;
+}
+
+/**
+ * wait_for_change - Sleep until a watched path changes and things settle
+ * @watch: Loop state
+ * @debounce_ms: Quiet period required after the last event
+ *
+ * Return: 0 once it is time to rerun, -1 if interrupted by SIGINT
+ */
+int wait_for_change(struct watch *watch, long debounce_ms) {
+  while (!watch->changed) {
+    if (wait_readable(watch, -1) == -1) {
+      return -1;
+    }
+    watch->changed = drain_changes(watch);
+  }
+
+  /* Every further event restarts the quiet period */
+  for (;;) {
+    int result = wait_readable(watch, debounce_ms);
+
+    if (result != 1) {
+      return result;
+    }
+
+    drain_changes(watch);
+  }
+}
+
+/**
+ * watch_io_ready - io_ready hook, cancels the job on a change
+ * @job: Job launched by the current run
+ */
+void watch_io_ready(struct job *job) {
+  struct watch *watch = job->io_data;
+
+  if (drain_changes(watch) && !watch->changed) {
+    watch->changed = true;
+
+    if (debug_mode) {
+      fprintf(stderr, "on-change: change during the run, cancelling it\n");
+    }
+
+    signal_job(job, SIGTERM);
+  }
+}
+
+/**
+ * watch_attach - Let a change cancel a job launched by watch_run()
+ * @job: Foreground job just created by exec
+ *
+ * Does nothing unless on-change runs with -c and the job has no other use for
+ * its io_fd. Otherwise, a change while the job runs sends it SIGTERM, and the
+ * pipeline reruns once the job is gone.
+ */
+void watch_attach(struct job *job) {
+  if (!active_watch || !active_watch->cancel || job->io_fd != -1) {
+    return;
+  }
+
+  job->io_fd = active_watch->inotify_fd;
+  job->io_ready = watch_io_ready;
+  job->io_data = active_watch;
+}
+
+/**
+ * watch_close - Stop watching and free the loop state
+ * @watch: Loop state
+ */
+void watch_close(struct watch *watch) {
+  for (unsigned int i = 0; i < watch->targets_count; i++) {
+    free(watch->targets[i].name);
+  }
+
+  free(watch->targets);
+
+  if (watch->inotify_fd != -1) {
+    close(watch->inotify_fd);
+  }
+
+  active_watch = NULL;
+}
+
+/**
+ * watch_run - Run a pipeline, then again every time a watched path changes
+ * @current_ctx: Shell context with the pipeline and the on-change settings
+ *
+ * Every run goes through exec(), so it is an ordinary foreground job with
+ * $? and $PIPESTATUS set. Between runs, the shell sleeps on an inotify
+ * descriptor, nothing is polled. Ctrl+C stops watching.
+ *
+ * Return: Result of the last exec(), 0 on success, -1 on error
+ */
+int watch_run(struct repl_ctx *current_ctx) {
+  unsigned int count = 0;
+
+  /* The loop lives in the shell, which doesn't wait for background jobs */
+  if (current_ctx->is_background_process) {
+    error_msg("on-change: can't run in the background", false);
+    return -1;
+  }
+
+  while (current_ctx->watch_paths[count]) {
+    count++;
+  }
+
+  struct watch watch = {
+      .inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC),
+      .targets = calloc(count, sizeof(struct watch_target)),
+      .targets_count = 0,
+      .cancel = current_ctx->watch_cancel,
+      .changed = false,
+  };
+
+  if (watch.inotify_fd == -1 || !watch.targets) {
+    error_msg("on-change: failed to set up inotify", true);
+    watch_close(&watch);
+    return -1;
+  }
+
+  for (unsigned int i = 0; i < count; i++) {
+    if (add_target(&watch, current_ctx->watch_paths[i]) == -1) {
+      watch_close(&watch);
+      return -1;
+    }
+  }
+
+  active_watch = &watch;
+
+  /* The shell has to stay around for the next run */
+  current_ctx->is_last_command = 0;
+  sigint_received = 0;
+
+  int result;
+
+  for (;;) {
+    watch.changed = false;
+    result = exec(current_ctx);
+
+    /* A run stopped with Ctrl+C stops watching too */
+    const char *status = get_user_env("?", current_ctx->user_envs,
+                                      current_ctx->user_envs_count);
+    if (sigint_received ||
+        (!watch.changed && status && atoi(status) == 128 + SIGINT)) {
+      break;
+    }
+
+    if (wait_for_change(&watch, current_ctx->watch_debounce_ms) == -1) {
+      break;
+    }
+
+    if (debug_mode) {
+      fprintf(stderr, "on-change: rerunning\n");
+    }
+  }
+
+  watch_close(&watch);
+
+  return result;
+}
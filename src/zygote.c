@@ -0,0 +1,528 @@
+/**
+ * zygote.c
+ *
+ * Zygote process for launching pipeline stages.
+ *
+ * OVERVIEW:
+ * With -z, the shell forks a helper right at startup, before history, config
+ * and caches are loaded, while the shell is about as small as it will ever
+ * be. From then on the shell sends every stage it would have spawned to the
+ * helper over a socketpair: path, argv and environment in one message, and
+ * stdin, stdout, stderr, the working directory and the terminal as
+ * descriptors (SCM_RIGHTS). The helper forks the stage from its own small
+ * address space, so the cost of creating a child stays the same no matter how
+ * large the interactive shell grows.
+ *
+ * KEY CONCEPTS:
+ * - CLONE_PARENT: The helper creates the child as a sibling rather than its
+ *   own child, so the shell is the parent. Job control works unchanged: the
+ *   shell gets SIGCHLD, reaps the child with wait4() and opens its pidfd.
+ * - Exec errors: The child reports a failed exec through a close-on-exec pipe,
+ *   which the helper reads before replying. EOF means the exec went through,
+ *   so failures are reported like posix_spawn() reports them.
+ * - Fallback: Requests too large for a message, stages with sched attributes
+ *   and everything after the helper died are launched by the shell directly.
+ *
+ * The helper exits once the shell closes its end of the socket, which also
+ * happens when the shell execs another program in its place.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "zygote.h"
+
+extern char **environ;
+
+/**
+ * zygote_request - Header of a spawn request, followed by the path (unless
+ * search_path is set), argv and envp as consecutive strings
+ * @pgid: Process group to join, 0 for a new group led by the child
+ * @has_tty: Whether a terminal was sent to give the child's group
+ * @search_path: Whether argv[0] is searched in $PATH instead of given a path
+ * @argc: Number of arguments
+ * @envc: Number of environment entries
+ */
+struct zygote_request {
+  pid_t pgid;
+  int has_tty;
+  int search_path;
+  unsigned int argc;
+  unsigned int envc;
+};
+
+/**
+ * zygote_reply - Outcome of a spawn request
+ * @pid: PID of the child, -1 if it couldn't be created
+ * @err: 0 if the child is running the program, errno of the failure otherwise
+ * (if pid is set, the child exited and still has to be reaped)
+ */
+struct zygote_reply {
+  pid_t pid;
+  int err;
+};
+
+/* Descriptors sent along with a request, in this order */
+enum zygote_fd { SENT_IN, SENT_OUT, SENT_ERR, SENT_CWD, SENT_TTY, SENT_MAX };
+
+bool use_zygote = false;
+
+/* Shell's end of the socket, -1 without a zygote */
+static int zygote_fd = -1;
+
+/**
+ * pack_strings - Copy strings one after another, each with its terminator
+ * @dest: Buffer to copy to, NULL to only measure
+ * @strings: NULL-terminated array
+ * @count: Output parameter - number of strings
+ *
+ * Return: Number of bytes used
+ */
+size_t pack_strings(char *dest, char **strings, unsigned int *count) {
+  size_t used = 0;
+
+  for (*count = 0; strings[*count]; (*count)++) {
+    size_t len = strlen(strings[*count]) + 1;
+    if (dest) {
+      memcpy(dest + used, strings[*count], len);
+    }
+    used += len;
+  }
+
+  return used;
+}
+
+/**
+ * unpack_strings - Build a NULL-terminated array over packed strings
+ * @cursor: Position in the message, advanced past the strings
+ * @end: End of the message
+ * @count: Number of strings
+ *
+ * Return: Allocated array (the strings stay in the message), NULL if the
+ * message is malformed or on allocation failure
+ */
+char **unpack_strings(const char **cursor, const char *end,
+                      unsigned int count) {
+  char **strings = malloc((count + 1) * sizeof(*strings));
+  if (!strings) {
+    return NULL;
+  }
+
+  for (unsigned int i = 0; i < count; i++) {
+    const char *terminator = memchr(*cursor, '\0', end - *cursor);
+    if (!terminator) {
+      free(strings);
+      return NULL;
+    }
+    strings[i] = (char *)*cursor;
+    *cursor = terminator + 1;
+  }
+
+  strings[count] = NULL;
+  return strings;
+}
+
+/**
+ * zygote_child - Set up a new stage and exec it
+ * @req: Request being served
+ * @fds: Descriptors sent with the request
+ * @path: Program to run, or the name to search $PATH for
+ * @argv: Arguments
+ * @envp: Environment
+ * @err_pipe: Write end of the pipe the exec error is reported through
+ *
+ * Same setup as spawn_stage() describes with file actions and attributes.
+ * Every signal is still blocked here, as in the zygote, so taking the terminal
+ * while in the background doesn't raise SIGTTOU.
+ */
+void zygote_child(const struct zygote_request *req, const int *fds,
+                  const char *path, char **argv, char **envp, int err_pipe) {
+  setpgid(0, req->pgid);
+
+  if (req->has_tty) {
+    tcsetpgrp(fds[SENT_TTY], getpgrp());
+  }
+
+  if (dup2(fds[SENT_IN], STDIN_FILENO) != -1 &&
+      dup2(fds[SENT_OUT], STDOUT_FILENO) != -1 &&
+      dup2(fds[SENT_ERR], STDERR_FILENO) != -1 &&
+      fchdir(fds[SENT_CWD]) != -1) {
+    /* Only stdin, stdout and stderr survive into the program */
+    close_range(STDERR_FILENO + 1, ~0U, CLOSE_RANGE_CLOEXEC);
+
+    for (int sig = 1; sig < NSIG; sig++) {
+      signal(sig, SIG_DFL);
+    }
+
+    sigset_t empty_mask;
+    sigemptyset(&empty_mask);
+    sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+
+    if (req->search_path) {
+      execvpe(path, argv, envp);
+    } else {
+      execve(path, argv, envp);
+    }
+  }
+
+  int err = errno;
+  if (write(err_pipe, &err, sizeof(err)) == -1) {
+    /* The zygote then sees EOF and takes the exec as successful */
+  }
+  _exit(127);
+}
+
+/**
+ * zygote_serve_one - Launch the stage described by a request
+ * @msg: Request
+ * @len: Length of the request
+ * @fds: Descriptors sent with it
+ *
+ * Return: Outcome to send back
+ */
+struct zygote_reply zygote_serve_one(const char *msg, size_t len,
+                                     const int *fds) {
+  struct zygote_reply reply = {.pid = -1, .err = EINVAL};
+  struct zygote_request req;
+
+  if (len < sizeof(req)) {
+    return reply;
+  }
+
+  memcpy(&req, msg, sizeof(req));
+
+  const char *cursor = msg + sizeof(req);
+  const char *end = msg + len;
+  const char *path = NULL;
+
+  if (!req.search_path) {
+    char **path_only = unpack_strings(&cursor, end, 1);
+    if (!path_only) {
+      return reply;
+    }
+    path = path_only[0];
+    free(path_only);
+  }
+
+  char **argv = unpack_strings(&cursor, end, req.argc);
+  char **envp = argv ? unpack_strings(&cursor, end, req.envc) : NULL;
+
+  if (!envp || !argv[0]) {
+    free(argv);
+    free(envp);
+    return reply;
+  }
+
+  if (req.search_path) {
+    path = argv[0];
+  }
+
+  int err_pipe[2];
+
+  if (pipe2(err_pipe, O_CLOEXEC) == -1) {
+    reply.err = errno;
+    free(argv);
+    free(envp);
+    return reply;
+  }
+
+  /* Like fork(), except the child's parent is the shell */
+  reply.pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, 0);
+
+  if (reply.pid == 0) {
+    close(err_pipe[0]);
+    zygote_child(&req, fds, path, argv, envp, err_pipe[1]);
+  }
+
+  reply.err = reply.pid == -1 ? errno : 0;
+  close(err_pipe[1]);
+
+  /* Blocks until the child execs (EOF) or reports why it couldn't */
+  if (reply.pid != -1) {
+    ssize_t got;
+    while ((got = read(err_pipe[0], &reply.err, sizeof(reply.err))) == -1 &&
+           errno == EINTR) {
+    }
+    if (got != sizeof(reply.err)) {
+      reply.err = 0;
+    }
+  }
+
+  close(err_pipe[0]);
+  free(argv);
+  free(envp);
+
+  return reply;
+}
+
+/**
+ * zygote_serve - Main loop of the zygote
+ * @sock: Zygote's end of the socket
+ *
+ * Never returns, the zygote exits once the shell closes its end.
+ */
+void zygote_serve(int sock) {
+  static char msg[ZYGOTE_MSG_MAX];
+  union {
+    char buf[CMSG_SPACE(SENT_MAX * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+
+  for (;;) {
+    struct iovec iov = {.iov_base = msg, .iov_len = sizeof(msg)};
+    struct msghdr hdr = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t len = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+
+    if (len == -1 && errno == EINTR) {
+      continue;
+    }
+
+    if (len <= 0) {
+      _exit(EXIT_SUCCESS);
+    }
+
+    int fds[SENT_MAX] = {-1, -1, -1, -1, -1};
+    unsigned int fds_count = 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS) {
+      fds_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(cmsg), fds_count * sizeof(int));
+    }
+
+    struct zygote_reply reply = {.pid = -1, .err = EINVAL};
+
+    if (!(hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) && fds_count >= SENT_TTY) {
+      reply = zygote_serve_one(msg, len, fds);
+    }
+
+    for (unsigned int i = 0; i < fds_count; i++) {
+      close(fds[i]);
+    }
+
+    if (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) == -1) {
+      _exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/**
+ * zygote_start - Fork the zygote
+ *
+ * Meant to be called first thing at startup, while the shell is still as small
+ * as it gets. If it fails, the shell launches everything itself.
+ *
+ * Return: 0 on success, -1 on error
+ */
+int zygote_start(void) {
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+    error_msg("zygote: failed to create socket", true);
+    return -1;
+  }
+
+  pid_t pid = fork();
+
+  if (pid == -1) {
+    error_msg("zygote: failed to fork", true);
+    close(sv[0]);
+    close(sv[1]);
+    return -1;
+  }
+
+  if (pid > 0) {
+    close(sv[1]);
+    zygote_fd = sv[0];
+    return 0;
+  }
+
+  /*
+   * Out of the shell's process group, so Ctrl+C at the prompt doesn't reach
+   * it, and with every signal blocked, which its children start out with too.
+   */
+  setpgid(0, 0);
+
+  sigset_t all_signals;
+  sigfillset(&all_signals);
+  sigprocmask(SIG_SETMASK, &all_signals, NULL);
+
+  /* Stages get their stdin, stdout and stderr with each request */
+  int null_fd = open("/dev/null", O_RDWR);
+  if (null_fd != -1) {
+    dup2(null_fd, STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+  }
+
+  /* The socket is the only descriptor the zygote keeps */
+  for (int fd = STDERR_FILENO + 1; fd < sv[1]; fd++) {
+    close(fd);
+  }
+  close_range(sv[1] + 1, ~0U, 0);
+
+  zygote_serve(sv[1]);
+  _exit(EXIT_SUCCESS);
+}
+
+/**
+ * zygote_active - Check whether stages are launched through the zygote
+ *
+ * Return: true if the zygote is running, false otherwise
+ */
+bool zygote_active(void) { return zygote_fd != -1; }
+
+/**
+ * zygote_gone - Stop using a zygote that no longer answers
+ */
+void zygote_gone(void) {
+  error_msg("zygote: helper exited, launching commands directly", false);
+  close(zygote_fd);
+  zygote_fd = -1;
+}
+
+/**
+ * zygote_spawn - Launch a pipeline stage through the zygote
+ * @stage: Description of the stage to launch
+ *
+ * The child is created with CLONE_PARENT, so it is the shell's child like any
+ * other stage: the shell gets its SIGCHLD, waits for it and opens its pidfd.
+ *
+ * Return: PID of the child on success, -1 on error, ZYGOTE_FALLBACK if the
+ * request doesn't fit in a message or the zygote is gone
+ */
+pid_t zygote_spawn(const struct stage_spawn *stage) {
+  struct zygote_request req = {
+      /* Staying in the shell's group has to be spelled out to the zygote */
+      .pgid = stage->pgid == -1 ? getpgrp() : stage->pgid,
+      .has_tty = stage->tty_fd != -1,
+      .search_path = stage->path == NULL,
+  };
+
+  size_t path_len = stage->path ? strlen(stage->path) + 1 : 0;
+  size_t len = sizeof(req) + path_len +
+               pack_strings(NULL, stage->argv, &req.argc) +
+               pack_strings(NULL, environ, &req.envc);
+
+  if (zygote_fd == -1 || len > ZYGOTE_MSG_MAX) {
+    return ZYGOTE_FALLBACK;
+  }
+
+  char *msg = malloc(len);
+  int cwd_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+  if (!msg || cwd_fd == -1) {
+    free(msg);
+    if (cwd_fd != -1) {
+      close(cwd_fd);
+    }
+    return ZYGOTE_FALLBACK;
+  }
+
+  char *cursor = msg;
+  unsigned int count;
+
+  memcpy(cursor, &req, sizeof(req));
+  cursor += sizeof(req);
+  if (stage->path) {
+    memcpy(cursor, stage->path, path_len);
+    cursor += path_len;
+  }
+  cursor += pack_strings(cursor, stage->argv, &count);
+  pack_strings(cursor, environ, &count);
+
+  const int fds[SENT_MAX] = {
+      stage->in_fd != -1 ? stage->in_fd : STDIN_FILENO,
+      stage->out_fd != -1 ? stage->out_fd : STDOUT_FILENO,
+      stage->err_fd != -1 ? stage->err_fd : STDERR_FILENO,
+      cwd_fd,
+      stage->tty_fd,
+  };
+  const unsigned int fds_count = req.has_tty ? SENT_MAX : SENT_TTY;
+
+  union {
+    char buf[CMSG_SPACE(SENT_MAX * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct iovec iov = {.iov_base = msg, .iov_len = len};
+  struct msghdr hdr = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control.buf,
+      .msg_controllen = CMSG_SPACE(fds_count * sizeof(int)),
+  };
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(fds_count * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, fds_count * sizeof(int));
+
+  ssize_t sent;
+  while ((sent = sendmsg(zygote_fd, &hdr, MSG_NOSIGNAL)) == -1 &&
+         errno == EINTR) {
+  }
+
+  free(msg);
+  close(cwd_fd);
+
+  /* Bigger than the socket buffer allows, this one goes the direct way */
+  if (sent == -1 && errno == EMSGSIZE) {
+    return ZYGOTE_FALLBACK;
+  }
+
+  struct zygote_reply reply;
+  ssize_t got = -1;
+
+  if (sent != -1) {
+    while ((got = recv(zygote_fd, &reply, sizeof(reply), 0)) == -1 &&
+           errno == EINTR) {
+    }
+  }
+
+  if (got != sizeof(reply)) {
+    zygote_gone();
+    return ZYGOTE_FALLBACK;
+  }
+
+  if (reply.err) {
+    /* The child exited without exec, and is ours to reap */
+    if (reply.pid > 0) {
+      waitpid(reply.pid, NULL, 0);
+    }
+
+    errno = reply.err;
+    error_msg("Failed to execute process", true);
+    return -1;
+  }
+
+  return reply.pid;
+}
+
+/**
+ * zygote_detach - Stop using the zygote in a forked copy of the shell
+ *
+ * Children the zygote creates belong to the shell, not to the copy, which
+ * couldn't wait for them. The copy launches its stages itself instead.
+ */
+void zygote_detach(void) { zygote_fd = -1; }
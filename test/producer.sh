@@ -0,0 +1,9 @@
+#!/bin/sh
+# Prints one line, then computes for a long time before printing the next.
+# Used to check that producers are stopped once their consumer exits.
+echo first
+i=0
+while [ $i -lt 1000000 ]; do
+  i=$((i + 1))
+done
+echo second